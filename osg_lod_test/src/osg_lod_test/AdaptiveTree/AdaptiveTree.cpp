@@ -0,0 +1,423 @@
+#include <cstring>
+#include <algorithm>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/MatrixTransform>
+#include <osg/NodeVisitor>
+#include <osg/PrimitiveSet>
+#include <osg/TriangleIndexFunctor>
+
+#include <OpenThreads/ScopedLock>
+
+#include "AdaptiveTree.h"
+#include "DrawableMerger.h"
+
+typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+namespace
+{
+    typedef DrawableMerger::SlotArray SlotArray;
+
+    struct TriangleCounter
+    {
+        TriangleCounter() : count(0) {}
+
+        unsigned long long count;
+
+        void operator() ( unsigned int, unsigned int, unsigned int )
+        {
+            ++count;
+        }
+    };
+
+    // the state sets along a node path merged in order, the deeper ones
+    // winning unless overridden, 0 if no node sets any
+    osg::ref_ptr<osg::StateSet> path_stateset( const osg::NodePath &path )
+    {
+        osg::ref_ptr<osg::StateSet> merged;
+        bool copied = false;
+        for (size_t i = 0; i < path.size(); ++i)
+        {
+            osg::StateSet *stateset = path[i]->getStateSet();
+            if (!stateset)
+                continue;
+            if (!merged.valid())
+            {
+                merged = stateset;
+                continue;
+            }
+            if (!copied)
+            {
+                merged = new osg::StateSet(*merged, osg::CopyOp::SHALLOW_COPY);
+                copied = true;
+            }
+            merged->merge(*stateset);
+        }
+        return merged;
+    }
+
+    struct CollectedGeometry
+    {
+        osg::Geometry *geometry;
+        osg::Matrix matrix;
+        osg::ref_ptr<osg::StateSet> stateset;
+    };
+
+    // the geometries below a node with the matrix to world coordinates and
+    // the state their geode inherits
+    class GeometryCollector : public osg::NodeVisitor
+    {
+        public :
+            GeometryCollector() :
+                osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+            {
+            }
+
+            virtual void apply( osg::Geode &geode )
+            {
+                CollectedGeometry collected;
+                collected.matrix = osg::computeLocalToWorld(getNodePath());
+                collected.stateset = path_stateset(getNodePath());
+                for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+                {
+                    osg::Geometry *geometry = geode.getDrawable(i)->asGeometry();
+                    if (geometry && geometry->getVertexArray() && geometry->getVertexArray()->getNumElements() > 0)
+                    {
+                        collected.geometry = geometry;
+                        geometries.push_back(collected);
+                    }
+                }
+                traverse(geode);
+            }
+
+            std::vector<CollectedGeometry> geometries;
+    };
+
+    typedef std::vector< osg::ref_ptr<osg::Geode> > GeodeList;
+
+    // the geode of a part for the geometries with the given inherited state
+    osg::Geode* part_geode( GeodeList &geodes, osg::StateSet *stateset )
+    {
+        for (size_t i = 0; i < geodes.size(); ++i)
+        {
+            if (geodes[i]->getStateSet() == stateset)
+                return geodes[i].get();
+        }
+        osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+        geode->setStateSet(stateset);
+        geodes.push_back(geode);
+        return geode.get();
+    }
+
+    // the arrays of a geometry that is cut by triangle, false if it can't be:
+    // positions that are not a Vec3Array, lines or points, arrays bound per
+    // primitive set or shorter than the vertices
+    bool collect_arrays( const osg::Geometry &geometry, std::vector<SlotArray> &arrays )
+    {
+        if (!dynamic_cast<const osg::Vec3Array*>(geometry.getVertexArray()) || geometry.containsDeprecatedData())
+            return false;
+        for (unsigned int i = 0; i < geometry.getNumPrimitiveSets(); ++i)
+        {
+            const osg::PrimitiveSet *primitives = geometry.getPrimitiveSet(i);
+            if (!DrawableMerger::triangleMode(primitives->getMode()) || primitives->getNumInstances() > 0)
+                return false;
+        }
+        return DrawableMerger::collectArrays(geometry, arrays);
+    }
+
+    // positions and normals in world coordinates, the other arrays as they are
+    osg::ref_ptr<osg::Array> cut_array( const SlotArray &source, const std::vector<unsigned int> &vertices,
+                                        const osg::Matrix &matrix, const osg::Matrix &inverse )
+    {
+        osg::ref_ptr<osg::Array> array;
+        if (source.per_vertex)
+        {
+            array = dynamic_cast<osg::Array*>(source.array->cloneType());
+            if (!array.valid())
+                return 0;
+            array->resizeArray(static_cast<unsigned int>(vertices.size()));
+            array->setBinding(osg::Array::BIND_PER_VERTEX);
+            array->setNormalize(source.array->getNormalize());
+
+            unsigned char *data = static_cast<unsigned char*>(const_cast<void*>(array->getDataPointer()));
+            const unsigned char *from = static_cast<const unsigned char*>(source.array->getDataPointer());
+            const size_t size = source.array->getElementSize();
+            for (size_t i = 0; i < vertices.size(); ++i)
+                memcpy(data + i * size, from + vertices[i] * size, size);
+        }
+        else
+        {
+            array = dynamic_cast<osg::Array*>(source.array->clone(osg::CopyOp::DEEP_COPY_ALL));
+            if (!array.valid())
+                return 0;
+        }
+
+        if (matrix.isIdentity())
+            return array;
+        osg::Vec3Array *vec3s = dynamic_cast<osg::Vec3Array*>(array.get());
+        if (source.slot == 0)
+        {
+            for (size_t i = 0; i < vec3s->size(); ++i)
+                (*vec3s)[i] = (*vec3s)[i] * matrix;
+        }
+        else if (source.slot == 1 && vec3s)
+        {
+            // normals go by the inverse transpose
+            for (size_t i = 0; i < vec3s->size(); ++i)
+            {
+                (*vec3s)[i] = osg::Matrix::transform3x3(inverse, (*vec3s)[i]);
+                (*vec3s)[i].normalize();
+            }
+        }
+        return array;
+    }
+
+    // the triangles of geometry in indices as one geometry of their own
+    osg::ref_ptr<osg::Geometry> cut_geometry( const osg::Geometry &geometry, const std::vector<SlotArray> &arrays,
+                                              const osg::Matrix &matrix, const osg::Matrix &inverse,
+                                              const std::vector<unsigned int> &indices )
+    {
+        // the vertices the triangles use, numbered in order of first use
+        std::vector<unsigned int> vertices;
+        std::vector<int> remap(geometry.getVertexArray()->getNumElements(), -1);
+        std::vector<unsigned int> part_indices(indices.size());
+        for (size_t i = 0; i < indices.size(); ++i)
+        {
+            int &index = remap[indices[i]];
+            if (index < 0)
+            {
+                index = static_cast<int>(vertices.size());
+                vertices.push_back(indices[i]);
+            }
+            part_indices[i] = static_cast<unsigned int>(index);
+        }
+
+        osg::ref_ptr<osg::Geometry> part = new osg::Geometry;
+        part->setName(geometry.getName());
+        part->setDataVariance(geometry.getDataVariance());
+        part->setStateSet(const_cast<osg::StateSet*>(geometry.getStateSet()));
+        part->setUseDisplayList(geometry.getUseDisplayList());
+        part->setUseVertexBufferObjects(geometry.getUseVertexBufferObjects());
+
+        for (size_t i_a = 0; i_a < arrays.size(); ++i_a)
+        {
+            osg::ref_ptr<osg::Array> array = cut_array(arrays[i_a], vertices, matrix, inverse);
+            if (!array.valid())
+                return 0;
+
+            int slot = arrays[i_a].slot;
+            if (slot == 0)
+                part->setVertexArray(array.get());
+            else if (slot == 1)
+                part->setNormalArray(array.get(), array->getBinding());
+            else if (slot == 2)
+                part->setColorArray(array.get(), array->getBinding());
+            else if (slot == 3)
+                part->setSecondaryColorArray(array.get(), array->getBinding());
+            else if (slot == 4)
+                part->setFogCoordArray(array.get(), array->getBinding());
+            else if (slot < DrawableMerger::ATTRIB_SLOT)
+                part->setTexCoordArray(slot - DrawableMerger::TEXCOORD_SLOT, array.get(), array->getBinding());
+            else
+                part->setVertexAttribArray(slot - DrawableMerger::ATTRIB_SLOT, array.get(), array->getBinding());
+        }
+
+        if (vertices.size() <= 65536)
+            part->addPrimitiveSet(new osg::DrawElementsUShort(osg::PrimitiveSet::TRIANGLES, part_indices.begin(), part_indices.end()));
+        else
+            part->addPrimitiveSet(new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES, part_indices.begin(), part_indices.end()));
+        return part;
+    }
+
+    unsigned int part_of( const osg::Vec3 &point, const osg::Vec3 &center, unsigned int num_parts )
+    {
+        unsigned int part = (point.x() >= center.x() ? 1 : 0) + (point.y() >= center.y() ? 2 : 0);
+        if (num_parts == 8 && point.z() >= center.z())
+            part += 4;
+        return part;
+    }
+}
+
+
+AdaptiveTree::Stats::Stats( void ) :
+    num_nodes(0),
+    num_leaves(0),
+    num_split(0),
+    num_collapsed(0)
+{
+}
+
+AdaptiveTree::Stats& AdaptiveTree::Stats::operator += (const Stats &rhs)
+{
+    num_nodes += rhs.num_nodes;
+    num_leaves += rhs.num_leaves;
+    num_split += rhs.num_split;
+    num_collapsed += rhs.num_collapsed;
+    return *this;
+}
+
+AdaptiveTree::AdaptiveTree( unsigned int max_triangles, bool octree, unsigned int max_split_depth, float tall_ratio ) :
+    _max_triangles(max_triangles),
+    _octree(octree),
+    _max_split_depth(max_split_depth),
+    _tall_ratio(tall_ratio)
+{
+}
+
+bool AdaptiveTree::splits( unsigned long long triangles, unsigned int depth ) const
+{
+    return triangles > _max_triangles && depth < _max_split_depth;
+}
+
+bool AdaptiveTree::collapses( unsigned long long triangles ) const
+{
+    return triangles <= _max_triangles;
+}
+
+unsigned int AdaptiveTree::numParts( const osg::BoundingBox &bound ) const
+{
+    if (!_octree || !bound.valid())
+        return 4;
+    float width = std::max(bound.xMax() - bound.xMin(), bound.yMax() - bound.yMin());
+    float height = bound.zMax() - bound.zMin();
+    return height > 0.f && height >= width * _tall_ratio ? 8 : 4;
+}
+
+void AdaptiveTree::split( const osg::Node &node, std::vector< osg::ref_ptr<osg::Node> > &parts ) const
+{
+    GeometryCollector collector;
+    const_cast<osg::Node&>(node).accept(collector);
+
+    // the triangles of the geometries that can be cut, and the bound of
+    // the triangle centroids and of the centers of the others
+    const size_t num_geometries = collector.geometries.size();
+    std::vector< std::vector<SlotArray> > arrays(num_geometries);
+    std::vector< std::vector<unsigned int> > triangles(num_geometries);
+    std::vector<bool> cut(num_geometries, false);
+    osg::BoundingBox bound;
+    for (size_t i_g = 0; i_g < num_geometries; ++i_g)
+    {
+        const osg::Geometry &geometry = *collector.geometries[i_g].geometry;
+        const osg::Matrix &matrix = collector.geometries[i_g].matrix;
+        cut[i_g] = collect_arrays(geometry, arrays[i_g]);
+        if (!cut[i_g])
+        {
+            bound.expandBy(geometry.getBound().center() * matrix);
+            continue;
+        }
+
+        const osg::Vec3Array &vertices = *static_cast<const osg::Vec3Array*>(geometry.getVertexArray());
+        osg::TriangleIndexFunctor<DrawableMerger::TriangleIndices> functor;
+        geometry.accept(functor);
+        std::vector<unsigned int> &indices = triangles[i_g];
+        for (size_t i_t = 0; i_t + 2 < functor.indices.size(); i_t += 3)
+        {
+            const unsigned int *t = &functor.indices[i_t];
+            if (t[0] >= vertices.size() || t[1] >= vertices.size() || t[2] >= vertices.size())
+                continue;
+            indices.insert(indices.end(), t, t + 3);
+            bound.expandBy((vertices[t[0]] + vertices[t[1]] + vertices[t[2]]) / 3.f * matrix);
+        }
+    }
+
+    const unsigned int num_parts = numParts(bound);
+    const osg::Vec3 center = bound.center();
+    std::vector<GeodeList> geodes(num_parts);
+    std::vector< osg::ref_ptr<osg::Group> > groups(num_parts);
+    for (size_t i_g = 0; i_g < num_geometries; ++i_g)
+    {
+        osg::Geometry *geometry = collector.geometries[i_g].geometry;
+        const osg::Matrix &matrix = collector.geometries[i_g].matrix;
+        osg::StateSet *stateset = collector.geometries[i_g].stateset.get();
+        if (!cut[i_g])
+        {
+            unsigned int part = part_of(geometry->getBound().center() * matrix, center, num_parts);
+            if (!groups[part].valid())
+                groups[part] = new osg::Group;
+            // a copy, the input keeps its geometries to itself
+            osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+            geode->setStateSet(stateset);
+            geode->addDrawable(osg::clone(geometry, osg::CopyOp::SHALLOW_COPY));
+            if (matrix.isIdentity())
+                groups[part]->addChild(geode.get());
+            else
+            {
+                osg::ref_ptr<osg::MatrixTransform> transform = new osg::MatrixTransform(matrix);
+                transform->addChild(geode.get());
+                groups[part]->addChild(transform.get());
+            }
+            continue;
+        }
+
+        // the triangles of each part, in their order in the geometry
+        const osg::Vec3Array &vertices = *static_cast<const osg::Vec3Array*>(geometry->getVertexArray());
+        const std::vector<unsigned int> &indices = triangles[i_g];
+        std::vector< std::vector<unsigned int> > part_indices(num_parts);
+        for (size_t i_t = 0; i_t < indices.size(); i_t += 3)
+        {
+            const unsigned int *t = &indices[i_t];
+            osg::Vec3 centroid = (vertices[t[0]] + vertices[t[1]] + vertices[t[2]]) / 3.f * matrix;
+            std::vector<unsigned int> &to = part_indices[part_of(centroid, center, num_parts)];
+            to.insert(to.end(), t, t + 3);
+        }
+
+        osg::Matrix inverse = osg::Matrix::inverse(matrix);
+        for (unsigned int part = 0; part < num_parts; ++part)
+        {
+            if (part_indices[part].empty())
+                continue;
+            osg::ref_ptr<osg::Geometry> piece = cut_geometry(*geometry, arrays[i_g], matrix, inverse, part_indices[part]);
+            if (!piece.valid())
+                continue;
+            part_geode(geodes[part], stateset)->addDrawable(piece.get());
+        }
+    }
+
+    parts.assign(num_parts, 0);
+    for (unsigned int part = 0; part < num_parts; ++part)
+    {
+        if (!groups[part].valid() && geodes[part].size() <= 1)
+        {
+            if (!geodes[part].empty())
+                parts[part] = geodes[part].front();
+            continue;
+        }
+        if (!groups[part].valid())
+            groups[part] = new osg::Group;
+        for (size_t i = 0; i < geodes[part].size(); ++i)
+            groups[part]->addChild(geodes[part][i].get());
+        parts[part] = groups[part];
+    }
+}
+
+unsigned long long AdaptiveTree::countTriangles( const osg::Node &node )
+{
+    GeometryCollector collector;
+    const_cast<osg::Node&>(node).accept(collector);
+    unsigned long long count = 0;
+    for (size_t i_g = 0; i_g < collector.geometries.size(); ++i_g)
+    {
+        osg::TriangleIndexFunctor<TriangleCounter> functor;
+        collector.geometries[i_g].geometry->accept(functor);
+        count += functor.count;
+    }
+    return count;
+}
+
+std::string AdaptiveTree::nodeName( const std::string &path )
+{
+    return path.empty() ? "tree.ive" : "tree_" + path + ".ive";
+}
+
+void AdaptiveTree::addStats( const Stats &stats )
+{
+    ScopedLock lock(_mutex);
+    _total += stats;
+}
+
+AdaptiveTree::Stats AdaptiveTree::getTotal( void ) const
+{
+    ScopedLock lock(_mutex);
+    return _total;
+}
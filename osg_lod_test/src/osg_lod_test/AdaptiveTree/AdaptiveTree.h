@@ -0,0 +1,84 @@
+#ifndef _ADAPTIVE_TREE_H
+#define _ADAPTIVE_TREE_H
+
+#include <string>
+#include <vector>
+
+#include <osg/Node>
+#include <osg/BoundingBox>
+
+#include <OpenThreads/Mutex>
+
+/** the shape of a tile tree that follows the density of the data instead of
+  * a full grid. a tile holds up to max_triangles: a denser tile is split into
+  * the quadrants of its bound, or into its octants when the octree is on and
+  * the bound is tall, and a subtree of fewer triangles is collapsed into one
+  * tile. a split cuts by triangle centroid, so no triangle is clipped or
+  * duplicated and the parts still meet without cracks.*/
+class AdaptiveTree {
+    public :
+        struct Stats
+        {
+            Stats(void);
+
+            /** tree_<path> files written.*/
+            unsigned int num_nodes;
+            unsigned int num_leaves;
+            /** tiles of the leaf grid split into parts.*/
+            unsigned int num_split;
+            /** grid cells whose leaves were joined into one tile.*/
+            unsigned int num_collapsed;
+
+            Stats& operator += (const Stats &rhs);
+        };
+
+        /** a bound whose height is at least tall_ratio of its width is split
+          * into octants when the octree is on.*/
+        AdaptiveTree( unsigned int max_triangles = 65536, bool octree = false,
+                      unsigned int max_split_depth = 8, float tall_ratio = 0.5f );
+
+        unsigned int getMaxTriangles(void) const { return _max_triangles; }
+        bool getOctree(void) const { return _octree; }
+        unsigned int getMaxSplitDepth(void) const { return _max_split_depth; }
+
+        /** a tile of more than max_triangles is split, unless depth splits
+          * are above it already.*/
+        bool splits( unsigned long long triangles, unsigned int depth ) const;
+
+        /** whether the leaves below a cell holding this many triangles are
+          * one tile.*/
+        bool collapses( unsigned long long triangles ) const;
+
+        /** 8 for a tall bound with the octree on, 4 otherwise.*/
+        unsigned int numParts( const osg::BoundingBox &bound ) const;
+
+        /** the parts of node by the half of the bound of its triangle centroids
+          * they fall in, x + 2 y + 4 z, null for an empty part. the cut
+          * geometries are in world coordinates like the simplified tiles,
+          * geometries that can't be cut go whole to the part of their
+          * center. node is not touched, thread safe.*/
+        void split( const osg::Node &node, std::vector< osg::ref_ptr<osg::Node> > &parts ) const;
+
+        static unsigned long long countTriangles( const osg::Node &node );
+
+        /** file name of the node at path, one digit per level for the child
+          * index below its parent.*/
+        static std::string nodeName( const std::string &path );
+
+        /** sum up the statistics of a built subtree, thread safe.*/
+        void addStats( const Stats &stats );
+        Stats getTotal(void) const;
+
+    private :
+        AdaptiveTree( const AdaptiveTree& ) {}
+        AdaptiveTree& operator = (const AdaptiveTree& ) { return *this; }
+
+        unsigned int _max_triangles;
+        bool _octree;
+        unsigned int _max_split_depth;
+        float _tall_ratio;
+
+        Stats _total;
+        mutable OpenThreads::Mutex _mutex;
+};
+#endif
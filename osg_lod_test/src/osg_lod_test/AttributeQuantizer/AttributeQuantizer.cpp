@@ -0,0 +1,425 @@
+#include <cmath>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/MatrixTransform>
+#include <osg/NodeVisitor>
+#include <osg/Shader>
+#include <osg/StateSet>
+#include <osg/TexMat>
+
+#include <OpenThreads/ScopedLock>
+
+#include "AttributeQuantizer.h"
+
+typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+namespace
+{
+    // generic attribute of the octahedral normals, clear of the slots some
+    // drivers alias with the fixed function arrays
+    const unsigned int normal_attribute = 6;
+
+    // state inherited along the path to a geometry that the quantized
+    // form can't honour
+    struct PathState
+    {
+        PathState( void ) : lighting_off(false), texture_transform(false) {}
+
+        bool lighting_off;
+        bool texture_transform;
+    };
+
+    void inherit_state( PathState &state, const osg::StateSet *stateset )
+    {
+        if (!stateset)
+            return;
+        osg::StateAttribute::GLModeValue lighting = stateset->getMode(GL_LIGHTING);
+        if (lighting != osg::StateAttribute::INHERIT)
+            state.lighting_off = (lighting & osg::StateAttribute::ON) == 0;
+        if (stateset->getTextureAttribute(0, osg::StateAttribute::TEXMAT) ||
+            stateset->getTextureAttribute(0, osg::StateAttribute::TEXGEN))
+            state.texture_transform = true;
+    }
+
+    class CollectVisitor : public osg::NodeVisitor
+    {
+        public :
+            CollectVisitor() :
+                osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+                has_transform(false),
+                has_other_drawables(false)
+            {
+            }
+
+            virtual void apply( osg::Transform &transform )
+            {
+                has_transform = true;
+                traverse(transform);
+            }
+
+            virtual void apply( osg::Node &node )
+            {
+                PathState parent = _state;
+                inherit_state(_state, node.getStateSet());
+                traverse(node);
+                _state = parent;
+            }
+
+            virtual void apply( osg::Geode &geode )
+            {
+                PathState parent = _state;
+                inherit_state(_state, geode.getStateSet());
+                for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+                {
+                    osg::Geometry *geometry = geode.getDrawable(i)->asGeometry();
+                    if (geometry)
+                    {
+                        PathState state = _state;
+                        inherit_state(state, geometry->getStateSet());
+                        geometries.push_back(geometry);
+                        states.push_back(state);
+                    }
+                    else
+                        has_other_drawables = true;
+                }
+                _state = parent;
+            }
+
+            std::vector<osg::Geometry*> geometries;
+            std::vector<PathState> states;
+            bool has_transform;
+            bool has_other_drawables;
+
+        private :
+            PathState _state;
+    };
+
+    bool quantizable( const osg::Geometry &geometry, const PathState &state )
+    {
+        const osg::Vec3Array *vertices = dynamic_cast<const osg::Vec3Array*>(geometry.getVertexArray());
+        if (!vertices)
+            return false;
+
+        const osg::Array *normals = geometry.getNormalArray();
+        if (normals && (!dynamic_cast<const osg::Vec3Array*>(normals) ||
+                        normals->getBinding() != osg::Array::BIND_PER_VERTEX ||
+                        normals->getNumElements() != vertices->size()))
+            return false;
+
+        // the normals would need a shader of their own
+        const osg::StateSet *stateset = geometry.getStateSet();
+        if (normals && stateset && stateset->getAttribute(osg::StateAttribute::PROGRAM))
+            return false;
+
+        // the shader lights with light 0, ignores the colors and passes on
+        // texture unit 0 only
+        if (normals)
+        {
+            if (state.lighting_off)
+                return false;
+            const osg::Array *colors = geometry.getColorArray();
+            if (colors && colors->getBinding() != osg::Array::BIND_OVERALL &&
+                colors->getBinding() != osg::Array::BIND_OFF)
+                return false;
+            for (unsigned int unit = 1; unit < geometry.getNumTexCoordArrays(); ++unit)
+            {
+                if (geometry.getTexCoordArray(unit))
+                    return false;
+            }
+        }
+
+        // the decoding texmat replaces unit 0's, and the shader skips texgen
+        const bool has_texcoords = geometry.getNumTexCoordArrays() > 0 && geometry.getTexCoordArray(0);
+        if (state.texture_transform && (normals || has_texcoords))
+            return false;
+        return true;
+    }
+
+    std::string vertex_shader_source( unsigned int normal_bits )
+    {
+        std::ostringstream sstr;
+        sstr.precision(9);
+        sstr << "#version 110\n"
+                "attribute vec2 oct_normal;\n"
+                "\n"
+                "vec3 decode_normal(vec2 e)\n"
+                "{\n"
+                "    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+                "    if (n.z < 0.0)\n"
+                "        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);\n"
+                "    return normalize(n);\n"
+                "}\n"
+                "\n"
+                "void main()\n"
+                "{\n"
+                "    vec3 normal = normalize(gl_NormalMatrix * decode_normal(oct_normal * "
+             << 1.0 / double((1 << (normal_bits - 1)) - 1) << "));\n"
+                "    vec4 eye = gl_ModelViewMatrix * gl_Vertex;\n"
+                "    vec3 light = normalize(gl_LightSource[0].position.xyz - eye.xyz * gl_LightSource[0].position.w);\n"
+                "    vec3 half_vector = normalize(light - normalize(eye.xyz));\n"
+                "    float diffuse = max(dot(normal, light), 0.0);\n"
+                "    float specular = diffuse > 0.0 ? pow(max(dot(normal, half_vector), 0.0), gl_FrontMaterial.shininess) : 0.0;\n"
+                "    vec4 color = gl_FrontLightModelProduct.sceneColor + gl_FrontLightProduct[0].ambient +\n"
+                "                 gl_FrontLightProduct[0].diffuse * diffuse + gl_FrontLightProduct[0].specular * specular;\n"
+                "    color.a = gl_FrontMaterial.diffuse.a;\n"
+                "    gl_FrontColor = color;\n"
+                "    gl_BackColor = color;\n"
+                "    gl_TexCoord[0] = gl_TextureMatrix[0] * gl_MultiTexCoord0;\n"
+                "    gl_Position = ftransform();\n"
+                "}\n";
+        return sstr.str();
+    }
+
+    // unit octahedron folded onto the square [-1,1]^2
+    void oct_encode( const osg::Vec3 &n, float &u, float &v )
+    {
+        float l1 = fabs(n.x()) + fabs(n.y()) + fabs(n.z());
+        if (l1 <= 0.f)
+        {
+            u = v = 0.f;
+            return;
+        }
+        u = n.x() / l1;
+        v = n.y() / l1;
+        if (n.z() < 0.f)
+        {
+            float fu = (1.f - fabs(v)) * (u >= 0.f ? 1.f : -1.f);
+            float fv = (1.f - fabs(u)) * (v >= 0.f ? 1.f : -1.f);
+            u = fu;
+            v = fv;
+        }
+    }
+
+    template<class ArrayType>
+    osg::ref_ptr<osg::Array> encode_normals( const osg::Vec3Array &normals, const osg::Vec3d &scale, unsigned int bits )
+    {
+        typedef typename ArrayType::ElementDataType Element;
+        typedef typename Element::value_type Value;
+        const float max_value = float((1 << (bits - 1)) - 1);
+
+        osg::ref_ptr<ArrayType> encoded = new ArrayType(normals.size());
+        for (size_t i = 0; i < normals.size(); ++i)
+        {
+            // normals of the quantized space, the decoding transform scales them back
+            osg::Vec3 n(normals[i].x() * scale.x(), normals[i].y() * scale.y(), normals[i].z() * scale.z());
+            float u, v;
+            oct_encode(n, u, v);
+            (*encoded)[i] = Element(static_cast<Value>(floorf(u * max_value + 0.5f)),
+                                    static_cast<Value>(floorf(v * max_value + 0.5f)));
+        }
+        return encoded;
+    }
+
+    osg::StateSet* own_stateset( osg::Geometry &geometry, bool &copied )
+    {
+        // statesets are shared between geometries, each gets its own texmat
+        if (!copied)
+        {
+            const osg::StateSet *shared = geometry.getStateSet();
+            geometry.setStateSet(shared ? new osg::StateSet(*shared, osg::CopyOp::SHALLOW_COPY) : new osg::StateSet);
+            copied = true;
+        }
+        return geometry.getStateSet();
+    }
+}
+
+AttributeQuantizer::Stats::Stats( void ) :
+    num_tiles(0),
+    num_kept(0),
+    bytes_before(0),
+    bytes_after(0),
+    max_position_error(0.)
+{
+}
+
+AttributeQuantizer::Stats& AttributeQuantizer::Stats::operator += (const Stats &rhs)
+{
+    num_tiles += rhs.num_tiles;
+    num_kept += rhs.num_kept;
+    bytes_before += rhs.bytes_before;
+    bytes_after += rhs.bytes_after;
+    max_position_error = std::max(max_position_error, rhs.max_position_error);
+    return *this;
+}
+
+AttributeQuantizer::AttributeQuantizer( double position_error, unsigned int normal_bits, unsigned int texcoord_bits ) :
+    _position_error(position_error > 0. ? position_error : 0.),
+    _normal_bits(std::min(std::max(normal_bits, 2u), 16u)),
+    _texcoord_bits(std::min(std::max(texcoord_bits, 1u), 16u))
+{
+    _program = new osg::Program;
+    _program->setName("quantized_normals");
+    _program->addShader(new osg::Shader(osg::Shader::VERTEX, vertex_shader_source(_normal_bits)));
+    _program->addBindAttribLocation("oct_normal", normal_attribute);
+}
+
+osg::ref_ptr<osg::Node> AttributeQuantizer::quantize( const osg::Node &node, Stats *stats ) const
+{
+    osg::ref_ptr<osg::Node> copy = dynamic_cast<osg::Node*>(
+        node.clone(osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES));
+    if (!copy.valid())
+        return 0;
+
+    Stats tile_stats;
+    tile_stats.num_tiles = 1;
+
+    CollectVisitor collect;
+    copy->accept(collect);
+    bool keep = collect.has_transform || collect.has_other_drawables || collect.geometries.empty();
+
+    osg::BoundingBoxd box;
+    for (size_t i = 0; i < collect.geometries.size() && !keep; ++i)
+    {
+        if (!quantizable(*collect.geometries[i], collect.states[i]))
+        {
+            keep = true;
+            break;
+        }
+        const osg::Vec3Array &vertices = *static_cast<const osg::Vec3Array*>(collect.geometries[i]->getVertexArray());
+        for (size_t i_v = 0; i_v < vertices.size(); ++i_v)
+            box.expandBy(osg::Vec3d(vertices[i_v]));
+    }
+    if (!keep && !box.valid())
+        keep = true;
+
+    // the fewest bits that keep every axis within the error
+    osg::Vec3d extent = box._max - box._min;
+    double largest = std::max(extent.x(), std::max(extent.y(), extent.z()));
+    unsigned int bits = 16;
+    if (!keep && _position_error > 0.)
+    {
+        for (bits = 1; bits <= 16; ++bits)
+        {
+            if (largest / double((1 << bits) - 1) * 0.5 <= _position_error)
+                break;
+        }
+        keep = bits > 16;
+    }
+
+    if (keep)
+    {
+        tile_stats.num_kept = 1;
+        if (stats)
+            *stats += tile_stats;
+        return copy;
+    }
+
+    const int levels = (1 << bits) - 1;
+    const int bias = 1 << (bits - 1);
+    osg::Vec3d step;
+    for (int a = 0; a < 3; ++a)
+    {
+        step[a] = extent[a] > 0. ? extent[a] / levels : 1.;
+        if (extent[a] > 0.)
+            tile_stats.max_position_error = std::max(tile_stats.max_position_error, step[a] * 0.5);
+    }
+    osg::Vec3d offset(box._min.x() + step.x() * bias, box._min.y() + step.y() * bias, box._min.z() + step.z() * bias);
+
+    const unsigned int normal_size = _normal_bits <= 8 ? 1 : 2;
+    for (size_t i = 0; i < collect.geometries.size(); ++i)
+    {
+        osg::Geometry &geometry = *collect.geometries[i];
+        bool own_state = false;
+
+        const osg::Vec3Array &vertices = *static_cast<const osg::Vec3Array*>(geometry.getVertexArray());
+        const size_t num_vertices = vertices.size();
+        osg::ref_ptr<osg::Vec3sArray> positions = new osg::Vec3sArray(num_vertices);
+        osg::BoundingBox quantized_box;
+        for (size_t i_v = 0; i_v < num_vertices; ++i_v)
+        {
+            short q[3];
+            for (int a = 0; a < 3; ++a)
+            {
+                int k = static_cast<int>(floor((vertices[i_v][a] - box._min[a]) / step[a] + 0.5));
+                q[a] = static_cast<short>(std::min(std::max(k, 0), levels) - bias);
+            }
+            (*positions)[i_v] = osg::Vec3s(q[0], q[1], q[2]);
+            quantized_box.expandBy(osg::Vec3(q[0], q[1], q[2]));
+        }
+        geometry.setVertexArray(positions.get());
+        tile_stats.bytes_before += num_vertices * sizeof(osg::Vec3);
+        tile_stats.bytes_after += num_vertices * sizeof(osg::Vec3s);
+
+        const osg::Vec3Array *normals = static_cast<const osg::Vec3Array*>(geometry.getNormalArray());
+        if (normals)
+        {
+            osg::ref_ptr<osg::Array> encoded = normal_size == 1 ?
+                encode_normals<osg::Vec2bArray>(*normals, step, _normal_bits) :
+                encode_normals<osg::Vec2sArray>(*normals, step, _normal_bits);
+            geometry.setNormalArray(0);
+            geometry.setVertexAttribArray(normal_attribute, encoded.get(), osg::Array::BIND_PER_VERTEX);
+            own_stateset(geometry, own_state)->setAttributeAndModes(_program.get(), osg::StateAttribute::ON);
+            tile_stats.bytes_before += num_vertices * sizeof(osg::Vec3);
+            tile_stats.bytes_after += num_vertices * 2 * normal_size;
+        }
+
+        const osg::Vec2Array *texcoords = dynamic_cast<const osg::Vec2Array*>(
+            geometry.getNumTexCoordArrays() > 0 ? geometry.getTexCoordArray(0) : 0);
+        if (texcoords && texcoords->size() == num_vertices && num_vertices > 0)
+        {
+            osg::Vec2d t_min((*texcoords)[0]), t_max((*texcoords)[0]);
+            for (size_t i_v = 1; i_v < num_vertices; ++i_v)
+            {
+                for (int a = 0; a < 2; ++a)
+                {
+                    t_min[a] = std::min(t_min[a], double((*texcoords)[i_v][a]));
+                    t_max[a] = std::max(t_max[a], double((*texcoords)[i_v][a]));
+                }
+            }
+
+            const int t_levels = (1 << _texcoord_bits) - 1;
+            const int t_bias = 1 << (_texcoord_bits - 1);
+            osg::Vec2d t_step;
+            for (int a = 0; a < 2; ++a)
+                t_step[a] = t_max[a] > t_min[a] ? (t_max[a] - t_min[a]) / t_levels : 1.;
+
+            osg::ref_ptr<osg::Vec2sArray> quantized = new osg::Vec2sArray(num_vertices);
+            for (size_t i_v = 0; i_v < num_vertices; ++i_v)
+            {
+                short q[2];
+                for (int a = 0; a < 2; ++a)
+                {
+                    int k = static_cast<int>(floor(((*texcoords)[i_v][a] - t_min[a]) / t_step[a] + 0.5));
+                    q[a] = static_cast<short>(std::min(std::max(k, 0), t_levels) - t_bias);
+                }
+                (*quantized)[i_v] = osg::Vec2s(q[0], q[1]);
+            }
+            geometry.setTexCoordArray(0, quantized.get(), osg::Array::BIND_PER_VERTEX);
+
+            osg::Matrix decode = osg::Matrix::scale(t_step.x(), t_step.y(), 1.) *
+                osg::Matrix::translate(t_min.x() + t_step.x() * t_bias, t_min.y() + t_step.y() * t_bias, 0.);
+            own_stateset(geometry, own_state)->setTextureAttribute(0, new osg::TexMat(decode));
+            tile_stats.bytes_before += num_vertices * sizeof(osg::Vec2);
+            tile_stats.bytes_after += num_vertices * sizeof(osg::Vec2s);
+        }
+
+        // osg can't compute the bound of short vertices itself
+        geometry.setInitialBound(quantized_box);
+        geometry.dirtyBound();
+        geometry.dirtyDisplayList();
+    }
+
+    osg::ref_ptr<osg::MatrixTransform> transform = new osg::MatrixTransform(
+        osg::Matrix::scale(step) * osg::Matrix::translate(offset));
+    transform->addChild(copy.get());
+
+    if (stats)
+        *stats += tile_stats;
+    return transform;
+}
+
+void AttributeQuantizer::addStats( const Stats &stats )
+{
+    ScopedLock lock(_mutex);
+    _total += stats;
+}
+
+AttributeQuantizer::Stats AttributeQuantizer::getTotal( void ) const
+{
+    ScopedLock lock(_mutex);
+    return _total;
+}
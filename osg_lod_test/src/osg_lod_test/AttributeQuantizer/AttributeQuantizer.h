@@ -0,0 +1,65 @@
+#ifndef _ATTRIBUTE_QUANTIZER_H
+#define _ATTRIBUTE_QUANTIZER_H
+
+#include <osg/Node>
+#include <osg/Program>
+
+#include <OpenThreads/Mutex>
+
+/** stores the vertex attributes of a tile in fewer bits before it is
+  * written. positions become 16 bit (or fewer) integers over the bounding
+  * box of the tile, decoded by a MatrixTransform above it; texcoords of
+  * unit 0 become 16 bit integers over the range of their geometry, decoded
+  * by a TexMat; normals are octahedral encoded into two bytes (or shorts)
+  * and decoded by a small vertex shader that also does the fixed function
+  * lighting of light 0, since the fixed pipeline has no way to take them.
+  *
+  * the normals are encoded in the quantized space, so the transform above
+  * the tile scales them back. a tile with transforms or vertex arrays of
+  * other types is left in floats.*/
+class AttributeQuantizer {
+    public :
+        struct Stats
+        {
+            Stats(void);
+
+            unsigned int num_tiles;
+            unsigned int num_kept;
+            unsigned long long bytes_before;
+            unsigned long long bytes_after;
+            double max_position_error;
+
+            Stats& operator += (const Stats &rhs);
+        };
+
+        /** position_error is the largest error allowed along an axis, in
+          * model units, the fewest bits that meet it are used. 0 always
+          * uses 16 bits. a tile that needs more than 16 bits stays in floats.
+          * normal_bits (2-16) per octahedral component, texcoord_bits (1-16).*/
+        AttributeQuantizer( double position_error = 0., unsigned int normal_bits = 8, unsigned int texcoord_bits = 16 );
+
+        double getPositionError(void) const { return _position_error; }
+        unsigned int getNormalBits(void) const { return _normal_bits; }
+        unsigned int getTexCoordBits(void) const { return _texcoord_bits; }
+
+        /** a quantized copy of node under its decoding transform. node is
+          * not touched, the nodes and geometries are copied.*/
+        osg::ref_ptr<osg::Node> quantize( const osg::Node &node, Stats *stats = 0 ) const;
+
+        /** sum up the statistics of a written tile, thread safe.*/
+        void addStats( const Stats &stats );
+        Stats getTotal(void) const;
+
+    private :
+        AttributeQuantizer( const AttributeQuantizer& ) {}
+        AttributeQuantizer& operator = (const AttributeQuantizer& ) { return *this; }
+
+        double _position_error;
+        unsigned int _normal_bits;
+        unsigned int _texcoord_bits;
+        osg::ref_ptr<osg::Program> _program;
+
+        Stats _total;
+        mutable OpenThreads::Mutex _mutex;
+};
+#endif
@@ -0,0 +1,137 @@
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#include <osg/Version>
+
+#include "Benchmark.h"
+#include "Utility.h"
+
+namespace
+{
+    std::string json_number( double value )
+    {
+        std::ostringstream out;
+        out.precision(9);
+        out << value;
+        return out.str();
+    }
+}
+
+double Benchmark::Stage::best( void ) const
+{
+    return seconds.empty() ? 0. : *std::min_element(seconds.begin(), seconds.end());
+}
+
+double Benchmark::Stage::mean( void ) const
+{
+    double sum = 0.;
+    for (size_t i = 0; i < seconds.size(); ++i)
+        sum += seconds[i];
+    return seconds.empty() ? 0. : sum / seconds.size();
+}
+
+double Benchmark::Stage::worst( void ) const
+{
+    return seconds.empty() ? 0. : *std::max_element(seconds.begin(), seconds.end());
+}
+
+Benchmark::Benchmark( const std::string &name ) :
+    _name(name)
+{
+}
+
+void Benchmark::setParameter( const std::string &key, const std::string &value )
+{
+    _parameters.push_back(std::make_pair(key, Utility::jsonString(value)));
+}
+
+void Benchmark::setParameter( const std::string &key, double value )
+{
+    _parameters.push_back(std::make_pair(key, json_number(value)));
+}
+
+void Benchmark::addRun( const std::string &stage, double seconds, unsigned long long items, unsigned long long bytes )
+{
+    std::vector<Stage>::iterator itr = _stages.begin();
+    while (itr != _stages.end() && itr->name != stage)
+        ++itr;
+    if (itr == _stages.end())
+    {
+        Stage added;
+        added.name = stage;
+        added.items = 0;
+        added.bytes = 0;
+        itr = _stages.insert(_stages.end(), added);
+    }
+    itr->seconds.push_back(seconds);
+    itr->items = items;
+    itr->bytes = bytes;
+}
+
+void Benchmark::writeJson( std::ostream &out ) const
+{
+    out << "{\n"
+        << "  \"benchmark\": " << Utility::jsonString(_name) << ",\n"
+        << "  \"format_version\": 1,\n"
+        << "  \"time\": " << Utility::jsonString(Utility::utcTime()) << ",\n"
+        << "  \"osg_version\": " << Utility::jsonString(osgGetVersion()) << ",\n"
+#ifdef NDEBUG
+        << "  \"build\": \"release\",\n"
+#else
+        << "  \"build\": \"debug\",\n"
+#endif
+        << "  \"parameters\": {";
+    for (size_t i = 0; i < _parameters.size(); ++i)
+        out << (i ? ",\n" : "\n") << "    " << Utility::jsonString(_parameters[i].first) << ": " << _parameters[i].second;
+    out << (_parameters.empty() ? "},\n" : "\n  },\n");
+
+    // the best run is the least disturbed by the rest of the machine
+    out << "  \"stages\": [";
+    for (size_t i = 0; i < _stages.size(); ++i)
+    {
+        const Stage &stage = _stages[i];
+        double best = stage.best();
+        out << (i ? ",\n" : "\n") << "    {\n"
+            << "      \"name\": " << Utility::jsonString(stage.name) << ",\n"
+            << "      \"runs\": " << stage.seconds.size() << ",\n"
+            << "      \"seconds\": [";
+        for (size_t i_r = 0; i_r < stage.seconds.size(); ++i_r)
+            out << (i_r ? ", " : "") << json_number(stage.seconds[i_r]);
+        out << "],\n"
+            << "      \"best_seconds\": " << json_number(best) << ",\n"
+            << "      \"mean_seconds\": " << json_number(stage.mean()) << ",\n"
+            << "      \"worst_seconds\": " << json_number(stage.worst()) << ",\n"
+            << "      \"items\": " << stage.items << ",\n"
+            << "      \"bytes\": " << stage.bytes << ",\n"
+            << "      \"items_per_second\": " << json_number(best > 0. ? stage.items / best : 0.) << ",\n"
+            << "      \"bytes_per_second\": " << json_number(best > 0. ? stage.bytes / best : 0.) << "\n"
+            << "    }";
+    }
+    out << (_stages.empty() ? "]\n" : "\n  ]\n") << "}\n";
+}
+
+bool Benchmark::writeJson( const std::string &filename ) const
+{
+    std::ofstream file(filename.c_str());
+    writeJson(file);
+    return file.good();
+}
+
+void Benchmark::writeSummary( std::ostream &out ) const
+{
+    for (size_t i = 0; i < _stages.size(); ++i)
+    {
+        const Stage &stage = _stages[i];
+        out << std::left << std::setw(24) << stage.name << std::right
+            << " best " << std::fixed << std::setprecision(4) << stage.best() << " s"
+            << ", mean " << stage.mean() << " s";
+        if (stage.items > 0 && stage.best() > 0.)
+            out << ", " << std::setprecision(1) << stage.items / stage.best() << " items/s";
+        if (stage.bytes > 0 && stage.best() > 0.)
+            out << ", " << std::setprecision(1) << stage.bytes / stage.best() / (1024. * 1024.) << " MB/s";
+        out.unsetf(std::ios::floatfield);
+        out << std::setprecision(6) << std::endl;
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef _BENCHMARK_H
+#define _BENCHMARK_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include <osg/Timer>
+
+/** timings of the stages of a benchmark run. every stage is run a few
+  * times, the report keeps each time with the items and bytes a run
+  * handled, and is written as json so runs of different releases can be
+  * compared by a script.*/
+class Benchmark {
+    public :
+        struct Stage
+        {
+            std::string name;
+            std::vector<double> seconds;
+            unsigned long long items;
+            unsigned long long bytes;
+
+            double best(void) const;
+            double mean(void) const;
+            double worst(void) const;
+        };
+
+        /** seconds since construction or the last restart.*/
+        class Timer
+        {
+            public :
+                Timer(void) : _start(osg::Timer::instance()->tick()) {}
+
+                void restart(void) { _start = osg::Timer::instance()->tick(); }
+                double seconds(void) const { return osg::Timer::instance()->delta_s(_start, osg::Timer::instance()->tick()); }
+
+            private :
+                osg::Timer_t _start;
+        };
+
+        Benchmark( const std::string &name );
+
+        /** settings of the run, written next to the stages.*/
+        void setParameter( const std::string &key, const std::string &value );
+        void setParameter( const std::string &key, double value );
+
+        /** one run of stage, items and bytes are what that run handled.*/
+        void addRun( const std::string &stage, double seconds, unsigned long long items = 0,
+                     unsigned long long bytes = 0 );
+
+        const std::vector<Stage>& getStages(void) const { return _stages; }
+
+        void writeJson( std::ostream &out ) const;
+        bool writeJson( const std::string &filename ) const;
+
+        /** one line per stage for the console.*/
+        void writeSummary( std::ostream &out ) const;
+
+    private :
+        Benchmark( const Benchmark& ) {}
+        Benchmark& operator = (const Benchmark& ) { return *this; }
+
+        std::string _name;
+        std::vector< std::pair<std::string, std::string> > _parameters;
+        std::vector<Stage> _stages;
+};
+#endif
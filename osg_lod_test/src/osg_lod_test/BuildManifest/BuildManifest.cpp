@@ -0,0 +1,189 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <osgDB/FileUtils>
+
+#include <OpenThreads/ScopedLock>
+
+#include "BuildManifest.h"
+#include "Utility.h"
+
+typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+namespace
+{
+    const char *manifest_header = "osg_lod_test_build_manifest 1";
+
+    // 64 bit fnv-1a
+    const BuildManifest::Hash fnv_offset = 14695981039346656037ULL;
+    const BuildManifest::Hash fnv_prime = 1099511628211ULL;
+
+    BuildManifest::Hash fnv1a( BuildManifest::Hash hash, const unsigned char *data, size_t size )
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= data[i];
+            hash *= fnv_prime;
+        }
+        return hash;
+    }
+}
+
+BuildManifest::BuildManifest( const std::string &filename ) :
+    _filename(filename)
+{
+}
+
+BuildManifest::Hash BuildManifest::hashString( const std::string &str )
+{
+    return fnv1a(fnv_offset, reinterpret_cast<const unsigned char*>(str.data()), str.size());
+}
+
+BuildManifest::Hash BuildManifest::hashData( const void *data, size_t size, Hash seed )
+{
+    return fnv1a(seed ? seed : fnv_offset, static_cast<const unsigned char*>(data), size);
+}
+
+BuildManifest::Hash BuildManifest::hashCombine( Hash seed, Hash value )
+{
+    unsigned char bytes[8];
+    for (int i = 0; i < 8; ++i)
+        bytes[i] = static_cast<unsigned char>(value >> (i * 8));
+    return fnv1a(seed ? seed : fnv_offset, bytes, 8);
+}
+
+BuildManifest::Hash BuildManifest::hashFile( const std::string &filename )
+{
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!file.good())
+        return 0;
+
+    Hash hash = fnv_offset;
+    std::vector<char> buffer(1 << 20);
+    while (file.good())
+    {
+        file.read(&buffer[0], buffer.size());
+        std::streamsize num_read = file.gcount();
+        if (num_read <= 0)
+            break;
+        hash = fnv1a(hash, reinterpret_cast<const unsigned char*>(&buffer[0]), static_cast<size_t>(num_read));
+    }
+    return hash;
+}
+
+bool BuildManifest::load( void )
+{
+    std::ifstream file(_filename.c_str());
+    if (!file.good())
+        return false;
+
+    std::string line;
+    std::getline(file, line);
+    if (line != manifest_header)
+        return false;
+
+    ScopedLock lock(_mutex);
+    while (std::getline(file, line))
+    {
+        std::istringstream sstr(line);
+        std::string type, path;
+        sstr >> type;
+        if (type == "input")
+        {
+            InputRecord record;
+            sstr >> record.size >> record.mtime >> std::hex >> record.hash;
+            sstr.get();
+            std::getline(sstr, path);
+            if (!path.empty())
+                _inputs[path] = record;
+        }
+        else if (type == "output")
+        {
+            Hash key = 0;
+            sstr >> std::hex >> key;
+            sstr.get();
+            std::getline(sstr, path);
+            if (!path.empty())
+                _outputs[path] = key;
+        }
+    }
+    return true;
+}
+
+bool BuildManifest::save( void ) const
+{
+    // written aside and renamed, an interrupted build keeps the old manifest.
+    std::string tmp_filename = _filename + ".tmp";
+    {
+        std::ofstream file(tmp_filename.c_str(), std::ios::out | std::ios::trunc);
+        if (!file.good())
+            return false;
+
+        ScopedLock lock(_mutex);
+        file << manifest_header << std::endl;
+        for (std::map<std::string, InputRecord>::const_iterator itr = _inputs.begin();
+            itr != _inputs.end(); ++itr)
+        {
+            file << "input " << std::dec << itr->second.size << " " << itr->second.mtime << " "
+                 << std::hex << itr->second.hash << " " << itr->first << std::endl;
+        }
+        for (std::map<std::string, Hash>::const_iterator itr = _outputs.begin();
+            itr != _outputs.end(); ++itr)
+        {
+            file << "output " << std::hex << itr->second << " " << itr->first << std::endl;
+        }
+        if (file.fail())
+            return false;
+    }
+
+    std::remove(_filename.c_str());
+    return std::rename(tmp_filename.c_str(), _filename.c_str()) == 0;
+}
+
+void BuildManifest::clear( void )
+{
+    ScopedLock lock(_mutex);
+    _inputs.clear();
+    _outputs.clear();
+}
+
+BuildManifest::Hash BuildManifest::inputHash( const std::string &filename )
+{
+    InputRecord record;
+    if (filename.empty() || !Utility::fileStatus(filename, record.size, record.mtime))
+        return 0;
+
+    {
+        ScopedLock lock(_mutex);
+        std::map<std::string, InputRecord>::const_iterator itr = _inputs.find(filename);
+        if (itr != _inputs.end() && itr->second.size == record.size && itr->second.mtime == record.mtime)
+            return itr->second.hash;
+    }
+
+    // new or touched since the last build, hash the content. a touched
+    // file with the same content still gives the same key.
+    record.hash = hashFile(filename);
+
+    ScopedLock lock(_mutex);
+    _inputs[filename] = record;
+    return record.hash;
+}
+
+bool BuildManifest::isUpToDate( const std::string &output, Hash key ) const
+{
+    {
+        ScopedLock lock(_mutex);
+        std::map<std::string, Hash>::const_iterator itr = _outputs.find(output);
+        if (itr == _outputs.end() || itr->second != key)
+            return false;
+    }
+    return osgDB::fileExists(output);
+}
+
+void BuildManifest::setOutput( const std::string &output, Hash key )
+{
+    ScopedLock lock(_mutex);
+    _outputs[output] = key;
+}
@@ -0,0 +1,61 @@
+#ifndef _BUILD_MANIFEST_H
+#define _BUILD_MANIFEST_H
+
+#include <string>
+#include <map>
+
+#include <OpenThreads/Mutex>
+
+/** persistent record of an lod database build, kept in the output
+  * directory. every input is stored with its size, modification time and
+  * content hash, every generated tile with the key it was built from. a
+  * tile's key combines the build parameters, the hashes of its inputs and
+  * the keys of the tiles it references, so a changed leaf invalidates its
+  * own tile and the chain of ancestors up to the root and nothing else.*/
+class BuildManifest {
+    public :
+        typedef unsigned long long Hash;
+
+        BuildManifest( const std::string &filename );
+
+        /** read the manifest of the previous build, false if there is none.*/
+        bool load(void);
+        bool save(void) const;
+
+        /** forget the previous build, every tile is out of date.*/
+        void clear(void);
+
+        /** content hash of an input file, 0 if it does not exist. when size
+          * and modification time match the previous build the recorded hash
+          * is reused and the file is not read.*/
+        Hash inputHash( const std::string &filename );
+
+        /** true if output was generated from key by the previous build and is still on disk.*/
+        bool isUpToDate( const std::string &output, Hash key ) const;
+
+        /** remember that output has been generated from key.*/
+        void setOutput( const std::string &output, Hash key );
+
+        static Hash hashString( const std::string &str );
+        static Hash hashData( const void *data, size_t size, Hash seed = 0 );
+        static Hash hashCombine( Hash seed, Hash value );
+        static Hash hashFile( const std::string &filename );
+
+    private :
+        BuildManifest( const BuildManifest& ) {}
+        BuildManifest& operator = (const BuildManifest& ) { return *this; }
+
+        struct InputRecord
+        {
+            InputRecord() : size(0), mtime(0), hash(0) {}
+            unsigned long long size;
+            long long mtime;
+            Hash hash;
+        };
+
+        std::string _filename;
+        std::map<std::string, InputRecord> _inputs;
+        std::map<std::string, Hash> _outputs;
+        mutable OpenThreads::Mutex _mutex;
+};
+#endif
@@ -0,0 +1,549 @@
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Texture>
+#include <osg/PagedLOD>
+#include <osg/NodeVisitor>
+#include <osg/Timer>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+
+#include <OpenThreads/ScopedLock>
+
+#include "DatabaseInspector.h"
+#include "TileScheduler.h"
+#include "Trace.h"
+#include "Utility.h"
+
+typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+namespace
+{
+    unsigned long long num_triangles( GLenum mode, unsigned long long num_indices )
+    {
+        switch (mode)
+        {
+            case osg::PrimitiveSet::TRIANGLES: return num_indices / 3;
+            case osg::PrimitiveSet::QUADS: return num_indices / 4 * 2;
+            case osg::PrimitiveSet::TRIANGLE_STRIP:
+            case osg::PrimitiveSet::TRIANGLE_FAN:
+            case osg::PrimitiveSet::POLYGON: return num_indices >= 3 ? num_indices - 2 : 0;
+            case osg::PrimitiveSet::QUAD_STRIP: return num_indices >= 4 ? (num_indices - 2) / 2 * 2 : 0;
+            default: return 0;
+        }
+    }
+
+    unsigned long long num_triangles( const osg::PrimitiveSet &primitives )
+    {
+        // every length is a strip or polygon of its own
+        const osg::DrawArrayLengths *lengths = dynamic_cast<const osg::DrawArrayLengths*>(&primitives);
+        if (!lengths)
+            return num_triangles(primitives.getMode(), primitives.getNumIndices());
+        unsigned long long triangles = 0;
+        for (osg::DrawArrayLengths::const_iterator itr = lengths->begin(); itr != lengths->end(); ++itr)
+            triangles += num_triangles(primitives.getMode(), *itr);
+        return triangles;
+    }
+
+    // counts of one tile, the LODs are range checked and the PagedLODs
+    // followed by the caller
+    class TileStatsVisitor : public osg::NodeVisitor
+    {
+        public :
+            TileStatsVisitor() :
+                osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+                vertices(0),
+                triangles(0),
+                texture_bytes(0)
+            {
+            }
+
+            virtual void apply( osg::Node &node )
+            {
+                addStateSet(node.getStateSet());
+                traverse(node);
+            }
+
+            virtual void apply( osg::LOD &lod )
+            {
+                lods.push_back(&lod);
+                addStateSet(lod.getStateSet());
+                traverse(lod);
+            }
+
+            virtual void apply( osg::PagedLOD &plod )
+            {
+                pagedlods.push_back(&plod);
+                apply(static_cast<osg::LOD&>(plod));
+            }
+
+            virtual void apply( osg::Geode &geode )
+            {
+                addStateSet(geode.getStateSet());
+                for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+                {
+                    addStateSet(geode.getDrawable(i)->getStateSet());
+                    const osg::Geometry *geometry = geode.getDrawable(i)->asGeometry();
+                    if (!geometry)
+                        continue;
+                    if (geometry->getVertexArray())
+                        vertices += geometry->getVertexArray()->getNumElements();
+                    for (unsigned int i_p = 0; i_p < geometry->getNumPrimitiveSets(); ++i_p)
+                        triangles += num_triangles(*geometry->getPrimitiveSet(i_p));
+                }
+            }
+
+            std::vector<const osg::LOD*> lods;
+            std::vector<const osg::PagedLOD*> pagedlods;
+            unsigned long long vertices;
+            unsigned long long triangles;
+            unsigned long long texture_bytes;
+
+        private :
+            // an image shared by several textures of the tile counts once
+            void addStateSet( const osg::StateSet *stateset )
+            {
+                if (!stateset || !_statesets.insert(stateset).second)
+                    return;
+                for (unsigned int unit = 0; unit < stateset->getTextureAttributeList().size(); ++unit)
+                {
+                    const osg::Texture *texture = dynamic_cast<const osg::Texture*>(
+                        stateset->getTextureAttribute(unit, osg::StateAttribute::TEXTURE));
+                    if (!texture)
+                        continue;
+                    for (unsigned int i = 0; i < texture->getNumImages(); ++i)
+                    {
+                        const osg::Image *image = texture->getImage(i);
+                        if (image && _images.insert(image).second)
+                            texture_bytes += image->getTotalSizeInBytesIncludingMipmaps();
+                    }
+                }
+            }
+
+            std::set<const osg::StateSet*> _statesets;
+            std::set<const osg::Image*> _images;
+    };
+
+    // the children of a LOD are drawn over ranges that should tile the
+    // whole scale without holes, a hole shows nothing at that distance or
+    // pixel size, an overlap draws both levels
+    void check_ranges( const osg::LOD &lod, std::vector< std::pair<std::string, std::string> > &issues )
+    {
+        const osg::PagedLOD *plod = dynamic_cast<const osg::PagedLOD*>(&lod);
+        unsigned int num_entries = lod.getNumChildren();
+        if (plod)
+            num_entries = std::max(num_entries, plod->getNumFileNames());
+
+        std::string name = std::string(lod.className()) + (lod.getName().empty() ? "" : " " + lod.getName());
+        std::vector< std::pair<float, float> > ranges;
+        for (unsigned int i = 0; i < num_entries; ++i)
+        {
+            bool paged = plod && i < plod->getNumFileNames() && !plod->getFileName(i).empty();
+            if (!paged && i >= lod.getNumChildren())
+                continue;
+            std::ostringstream detail;
+            detail << name << " child " << i;
+            if (i >= lod.getNumRanges())
+            {
+                issues.push_back(std::make_pair(std::string("missing_range"), detail.str() + " has no range"));
+                continue;
+            }
+            float min_range = lod.getMinRange(i), max_range = lod.getMaxRange(i);
+            detail << " range " << min_range << " " << max_range;
+            if (min_range < 0.f || max_range < min_range)
+                issues.push_back(std::make_pair(std::string("invalid_range"), detail.str()));
+            else if (min_range == max_range)
+                issues.push_back(std::make_pair(std::string("empty_range"), detail.str() + ", never drawn"));
+            else
+                ranges.push_back(std::make_pair(min_range, max_range));
+        }
+
+        std::sort(ranges.begin(), ranges.end());
+        for (size_t i = 1; i < ranges.size(); ++i)
+        {
+            float covered = ranges[i - 1].second;
+            float tolerance = 1e-5f * std::max(1.f, covered);
+            std::ostringstream detail;
+            if (ranges[i].first > covered + tolerance)
+            {
+                detail << name << " draws nothing between " << covered << " and " << ranges[i].first;
+                issues.push_back(std::make_pair(std::string("range_gap"), detail.str()));
+            }
+            else if (ranges[i].first < covered - tolerance)
+            {
+                detail << name << " draws two children between " << ranges[i].first << " and "
+                    << std::min(covered, ranges[i].second);
+                issues.push_back(std::make_pair(std::string("range_overlap"), detail.str()));
+            }
+            ranges[i].second = std::max(ranges[i].second, covered);
+        }
+    }
+
+    void write_histogram( std::ostream &out, const char *name, const DatabaseInspector::Histogram &histogram, bool last )
+    {
+        out << "        " << Utility::jsonString(name) << ": [";
+        for (size_t i = 0; i < histogram.counts.size(); ++i)
+            out << (i ? ", " : "") << histogram.counts[i];
+        out << (last ? "]\n" : "],\n");
+    }
+}
+
+
+void DatabaseInspector::Histogram::add( unsigned long long value )
+{
+    size_t bucket = 0;
+    while (value)
+    {
+        ++bucket;
+        value >>= 1;
+    }
+    if (counts.size() <= bucket)
+        counts.resize(bucket + 1, 0);
+    ++counts[bucket];
+}
+
+DatabaseInspector::Level::Level( void ) :
+    num_files(0),
+    num_pagedlods(0),
+    bytes(0),
+    vertices(0),
+    triangles(0),
+    texture_bytes(0),
+    max_bytes(0),
+    max_triangles(0)
+{
+}
+
+
+class DatabaseInspector::FileTask : public TileTask
+{
+    public :
+        FileTask( DatabaseInspector &inspector, const std::string &filename, unsigned int level, const Parent &parent ) :
+            _inspector(inspector),
+            _filename(filename),
+            _level(level),
+            _parent(parent)
+        {
+        }
+
+        virtual void run( TileScheduler &scheduler )
+        {
+            _inspector.inspectFile(scheduler, _filename, _level, _parent);
+        }
+
+    private :
+        DatabaseInspector &_inspector;
+        std::string _filename;
+        unsigned int _level;
+        Parent _parent;
+};
+
+
+DatabaseInspector::DatabaseInspector( unsigned int num_threads, unsigned int io_queue_depth ) :
+    _num_threads(num_threads),
+    _io_queue_depth(io_queue_depth),
+    _io(0),
+    _seconds(0.)
+{
+}
+
+bool DatabaseInspector::inspect( const std::string &root_filename )
+{
+    Trace::Scope trace("inspect_database", root_filename);
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    _root_filename = root_filename;
+    _submitted.clear();
+    _levels.clear();
+    _references.clear();
+    _issues.clear();
+
+    // a pack is inspected from its master file, the tiles are read from
+    // its entries
+    std::string filename = root_filename;
+    _pack = 0;
+    if (osgDB::getLowerCaseFileExtension(root_filename) == "tpk")
+    {
+        _pack = new TilePack(root_filename);
+        if (!_pack->open())
+        {
+            std::cout<<root_filename<<" is not a tile pack."<<std::endl;
+            _pack = 0;
+            return false;
+        }
+        filename = osgDB::concatPaths(osgDB::getFilePath(root_filename), _pack->getMasterFileName());
+    }
+
+    TileIO io(_io_queue_depth);
+    io.setPack(_pack.get());
+    _io = &io;
+    TileScheduler scheduler(_num_threads);
+    submit(scheduler, filename, 0, Parent());
+    scheduler.run();
+    _io = 0;
+
+    // the workers finish in any order, the report should not
+    std::sort(_references.begin(), _references.end(), referenceLess);
+    std::sort(_issues.begin(), _issues.end(), issueLess);
+
+    _seconds = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+    trace.arg("files", getNumFiles());
+    trace.arg("broken", _references.size());
+    trace.arg("issues", _issues.size());
+    return !_levels.empty();
+}
+
+unsigned int DatabaseInspector::getNumFiles( void ) const
+{
+    unsigned int num_files = 0;
+    for (size_t i = 0; i < _levels.size(); ++i)
+        num_files += _levels[i].num_files;
+    return num_files;
+}
+
+bool DatabaseInspector::referenceLess( const Reference &lhs, const Reference &rhs )
+{
+    if (lhs.filename != rhs.filename)
+        return lhs.filename < rhs.filename;
+    return lhs.child < rhs.child;
+}
+
+bool DatabaseInspector::issueLess( const Issue &lhs, const Issue &rhs )
+{
+    if (lhs.filename != rhs.filename)
+        return lhs.filename < rhs.filename;
+    if (lhs.check != rhs.check)
+        return lhs.check < rhs.check;
+    return lhs.detail < rhs.detail;
+}
+
+void DatabaseInspector::submit( TileScheduler &scheduler, const std::string &filename, unsigned int level,
+                                const Parent &parent )
+{
+    {
+        ScopedLock lock(_mutex);
+        if (!_submitted.insert(osgDB::getRealPath(filename)).second)
+            return;
+    }
+    scheduler.add(new FileTask(*this, filename, level, parent));
+}
+
+void DatabaseInspector::inspectFile( TileScheduler &scheduler, const std::string &filename, unsigned int level,
+                                     const Parent &parent )
+{
+    Trace::Scope trace("inspect_file", filename);
+    if (!exists(filename))
+    {
+        addReference(parent.filename, filename, "missing");
+        return;
+    }
+    osg::ref_ptr<TileIORequest> request = _io->read(filename);
+    request->wait();
+    osg::ref_ptr<osg::Node> node = request->getNode();
+    request = 0;
+    if (!node.valid())
+    {
+        addReference(parent.filename, filename, "unreadable");
+        return;
+    }
+
+    TileStatsVisitor stats;
+    node->accept(stats);
+
+    // the PagedLOD culls and selects the tile by the bound it was given
+    if (parent.bound.valid())
+    {
+        const osg::BoundingSphere &bound = node->getBound();
+        float distance = (bound.center() - parent.bound.center()).length();
+        if (bound.valid() && distance + bound.radius() > parent.bound.radius() * 1.001f)
+        {
+            std::ostringstream detail;
+            detail << "radius " << bound.radius() << " at " << distance << " from the center of "
+                << parent.filename << ", which expects radius " << parent.bound.radius();
+            addIssue(filename, "outside_parent_bound", detail.str());
+        }
+    }
+
+    for (size_t i_l = 0; i_l < stats.lods.size(); ++i_l)
+    {
+        std::vector< std::pair<std::string, std::string> > issues;
+        check_ranges(*stats.lods[i_l], issues);
+        for (size_t i = 0; i < issues.size(); ++i)
+            addIssue(filename, issues[i].first, issues[i].second);
+    }
+
+    for (size_t i_p = 0; i_p < stats.pagedlods.size(); ++i_p)
+    {
+        const osg::PagedLOD &plod = *stats.pagedlods[i_p];
+        Parent child_parent;
+        child_parent.filename = filename;
+        if (plod.getCenterMode() != osg::LOD::USE_BOUNDING_SPHERE_CENTER && plod.getRadius() > 0.f)
+            child_parent.bound.set(plod.getCenter(), plod.getRadius());
+        for (unsigned int i = 0; i < plod.getNumFileNames(); ++i)
+        {
+            if (!plod.getFileName(i).empty())
+                submit(scheduler, Utility::referencedFileName(plod, i, filename), level + 1, child_parent);
+        }
+    }
+
+    unsigned long long bytes = fileSize(filename);
+    trace.arg("bytes", bytes);
+    trace.arg("triangles", stats.triangles);
+
+    ScopedLock lock(_mutex);
+    if (_levels.size() <= level)
+        _levels.resize(level + 1);
+    Level &counts = _levels[level];
+    ++counts.num_files;
+    counts.num_pagedlods += static_cast<unsigned int>(stats.pagedlods.size());
+    counts.bytes += bytes;
+    counts.vertices += stats.vertices;
+    counts.triangles += stats.triangles;
+    counts.texture_bytes += stats.texture_bytes;
+    counts.max_bytes = std::max(counts.max_bytes, bytes);
+    counts.max_triangles = std::max(counts.max_triangles, stats.triangles);
+    counts.bytes_histogram.add(bytes);
+    counts.vertices_histogram.add(stats.vertices);
+    counts.triangles_histogram.add(stats.triangles);
+    counts.texture_bytes_histogram.add(stats.texture_bytes);
+}
+
+bool DatabaseInspector::exists( const std::string &filename ) const
+{
+    if (_pack.valid() && _pack->contains(_pack->entryName(filename)))
+        return true;
+    return osgDB::fileExists(filename);
+}
+
+unsigned long long DatabaseInspector::fileSize( const std::string &filename ) const
+{
+    if (_pack.valid())
+    {
+        unsigned long long size = _pack->getSize(_pack->entryName(filename));
+        if (size)
+            return size;
+    }
+    return Utility::fileSize(filename);
+}
+
+void DatabaseInspector::addReference( const std::string &filename, const std::string &child, const std::string &error )
+{
+    Reference reference;
+    reference.filename = filename;
+    reference.child = child;
+    reference.error = error;
+    ScopedLock lock(_mutex);
+    _references.push_back(reference);
+}
+
+void DatabaseInspector::addIssue( const std::string &filename, const std::string &check, const std::string &detail )
+{
+    Issue issue;
+    issue.filename = filename;
+    issue.check = check;
+    issue.detail = detail;
+    ScopedLock lock(_mutex);
+    _issues.push_back(issue);
+}
+
+void DatabaseInspector::writeJson( std::ostream &out ) const
+{
+    Level total;
+    for (size_t i = 0; i < _levels.size(); ++i)
+    {
+        total.num_files += _levels[i].num_files;
+        total.num_pagedlods += _levels[i].num_pagedlods;
+        total.bytes += _levels[i].bytes;
+        total.vertices += _levels[i].vertices;
+        total.triangles += _levels[i].triangles;
+        total.texture_bytes += _levels[i].texture_bytes;
+    }
+
+    out << "{\n"
+        << "  \"database\": " << Utility::jsonString(_root_filename) << ",\n"
+        << "  \"format_version\": 1,\n"
+        << "  \"time\": " << Utility::jsonString(Utility::utcTime()) << ",\n"
+        << "  \"seconds\": " << _seconds << ",\n"
+        << "  \"totals\": {\n"
+        << "    \"files\": " << total.num_files << ",\n"
+        << "    \"pagedlods\": " << total.num_pagedlods << ",\n"
+        << "    \"bytes\": " << total.bytes << ",\n"
+        << "    \"vertices\": " << total.vertices << ",\n"
+        << "    \"triangles\": " << total.triangles << ",\n"
+        << "    \"texture_bytes\": " << total.texture_bytes << ",\n"
+        << "    \"broken_references\": " << _references.size() << ",\n"
+        << "    \"range_issues\": " << _issues.size() << "\n"
+        << "  },\n";
+
+    // bucket i of a histogram counts the tiles whose value has i bits
+    out << "  \"levels\": [";
+    for (size_t i = 0; i < _levels.size(); ++i)
+    {
+        const Level &level = _levels[i];
+        out << (i ? ",\n" : "\n") << "    {\n"
+            << "      \"level\": " << i << ",\n"
+            << "      \"files\": " << level.num_files << ",\n"
+            << "      \"pagedlods\": " << level.num_pagedlods << ",\n"
+            << "      \"bytes\": " << level.bytes << ",\n"
+            << "      \"vertices\": " << level.vertices << ",\n"
+            << "      \"triangles\": " << level.triangles << ",\n"
+            << "      \"texture_bytes\": " << level.texture_bytes << ",\n"
+            << "      \"max_bytes\": " << level.max_bytes << ",\n"
+            << "      \"max_triangles\": " << level.max_triangles << ",\n"
+            << "      \"histograms_log2\": {\n";
+        write_histogram(out, "bytes", level.bytes_histogram, false);
+        write_histogram(out, "vertices", level.vertices_histogram, false);
+        write_histogram(out, "triangles", level.triangles_histogram, false);
+        write_histogram(out, "texture_bytes", level.texture_bytes_histogram, true);
+        out << "      }\n"
+            << "    }";
+    }
+    out << (_levels.empty() ? "],\n" : "\n  ],\n");
+
+    out << "  \"broken_references\": [";
+    for (size_t i = 0; i < _references.size(); ++i)
+    {
+        const Reference &reference = _references[i];
+        out << (i ? ",\n" : "\n") << "    {\"file\": " << Utility::jsonString(reference.filename)
+            << ", \"child\": " << Utility::jsonString(reference.child)
+            << ", \"error\": " << Utility::jsonString(reference.error) << "}";
+    }
+    out << (_references.empty() ? "],\n" : "\n  ],\n");
+
+    out << "  \"range_issues\": [";
+    for (size_t i = 0; i < _issues.size(); ++i)
+    {
+        const Issue &issue = _issues[i];
+        out << (i ? ",\n" : "\n") << "    {\"file\": " << Utility::jsonString(issue.filename)
+            << ", \"check\": " << Utility::jsonString(issue.check)
+            << ", \"detail\": " << Utility::jsonString(issue.detail) << "}";
+    }
+    out << (_issues.empty() ? "]\n" : "\n  ]\n") << "}\n";
+}
+
+bool DatabaseInspector::writeJson( const std::string &filename ) const
+{
+    std::ofstream file(filename.c_str());
+    writeJson(file);
+    return file.good();
+}
+
+void DatabaseInspector::writeSummary( std::ostream &out ) const
+{
+    const double mb = 1024. * 1024.;
+    for (size_t i = 0; i < _levels.size(); ++i)
+    {
+        const Level &level = _levels[i];
+        out << "level " << std::setw(2) << i << ": " << std::setw(8) << level.num_files << " files "
+            << std::fixed << std::setprecision(1) << std::setw(10) << level.bytes / mb << " MB "
+            << std::setw(12) << level.triangles << " triangles "
+            << std::setw(10) << level.texture_bytes / mb << " MB textures" << std::endl;
+    }
+    out << getNumFiles() << " files in " << std::setprecision(1) << _seconds << " s, "
+        << _references.size() << " broken references, " << _issues.size() << " range issues." << std::endl;
+    out.unsetf(std::ios::fixed);
+}
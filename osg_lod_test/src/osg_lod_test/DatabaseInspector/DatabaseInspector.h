@@ -0,0 +1,133 @@
+#ifndef _DATABASE_INSPECTOR_H
+#define _DATABASE_INSPECTOR_H
+
+#include <set>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include <osg/BoundingSphere>
+
+#include <OpenThreads/Mutex>
+
+#include "TileIO.h"
+#include "TilePack.h"
+
+class TileScheduler;
+
+/** statistics of a whole paged database on disk. the root file and every
+  * file its PagedLODs reference are read on a TileScheduler like the
+  * DatabaseTransformer does, each file is counted into the level of its
+  * depth below the root and dropped again, so only the tiles being
+  * inspected are held in memory. references to files that are missing or
+  * can't be read and LOD ranges that leave a gap or never switch are
+  * collected, the report is written as json.*/
+class DatabaseInspector {
+    public :
+        /** tiles per power of two, bucket i counts the values of i bits:
+          * 0, 1, 2-3, 4-7, ...*/
+        struct Histogram
+        {
+            std::vector<unsigned long long> counts;
+
+            void add( unsigned long long value );
+        };
+
+        struct Level
+        {
+            Level(void);
+
+            unsigned int num_files;
+            unsigned int num_pagedlods;
+            unsigned long long bytes;
+            unsigned long long vertices;
+            unsigned long long triangles;
+            /** pixel data of the distinct images of each tile.*/
+            unsigned long long texture_bytes;
+            unsigned long long max_bytes;
+            unsigned long long max_triangles;
+
+            Histogram bytes_histogram;
+            Histogram vertices_histogram;
+            Histogram triangles_histogram;
+            Histogram texture_bytes_histogram;
+        };
+
+        /** a file a PagedLOD references that is missing or can't be read.*/
+        struct Reference
+        {
+            std::string filename;
+            std::string child;
+            std::string error;
+        };
+
+        /** a failed range check of a LOD.*/
+        struct Issue
+        {
+            std::string filename;
+            std::string check;
+            std::string detail;
+        };
+
+        DatabaseInspector( unsigned int num_threads = 0, unsigned int io_queue_depth = 32 );
+
+        /** inspect the database of root_filename, a loose file or a .tpk
+          * pack. false if the root could not be read.*/
+        bool inspect( const std::string &root_filename );
+
+        const std::vector<Level>& getLevels(void) const { return _levels; }
+        const std::vector<Reference>& getBrokenReferences(void) const { return _references; }
+        const std::vector<Issue>& getIssues(void) const { return _issues; }
+        unsigned int getNumFiles(void) const;
+        double getSeconds(void) const { return _seconds; }
+
+        void writeJson( std::ostream &out ) const;
+        bool writeJson( const std::string &filename ) const;
+
+        /** one line per level for the console.*/
+        void writeSummary( std::ostream &out ) const;
+
+    private :
+        DatabaseInspector( const DatabaseInspector& ) {}
+        DatabaseInspector& operator = (const DatabaseInspector& ) { return *this; }
+
+        class FileTask;
+        friend class FileTask;
+
+        /** where a file is referenced from, the bound is the one its
+          * PagedLOD expects it in, an invalid bound for the root.*/
+        struct Parent
+        {
+            std::string filename;
+            osg::BoundingSphere bound;
+        };
+
+        /** queues filename unless an earlier reference did.*/
+        void submit( TileScheduler &scheduler, const std::string &filename, unsigned int level, const Parent &parent );
+
+        void inspectFile( TileScheduler &scheduler, const std::string &filename, unsigned int level, const Parent &parent );
+
+        bool exists( const std::string &filename ) const;
+        unsigned long long fileSize( const std::string &filename ) const;
+
+        void addReference( const std::string &filename, const std::string &child, const std::string &error );
+        void addIssue( const std::string &filename, const std::string &check, const std::string &detail );
+
+        static bool referenceLess( const Reference &lhs, const Reference &rhs );
+        static bool issueLess( const Issue &lhs, const Issue &rhs );
+
+        unsigned int _num_threads;
+        unsigned int _io_queue_depth;
+
+        TileIO *_io;
+        osg::ref_ptr<TilePack> _pack;
+        std::string _root_filename;
+        double _seconds;
+
+        OpenThreads::Mutex _mutex;
+        std::set<std::string> _submitted;
+        std::vector<Level> _levels;
+        std::vector<Reference> _references;
+        std::vector<Issue> _issues;
+};
+#endif
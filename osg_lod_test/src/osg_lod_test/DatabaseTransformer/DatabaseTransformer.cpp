@@ -0,0 +1,190 @@
+#include <vector>
+#include <iostream>
+#include <sstream>
+
+#include <osg/LOD>
+#include <osg/PagedLOD>
+#include <osg/NodeVisitor>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+
+#include <OpenThreads/ScopedLock>
+
+#include "DatabaseTransformer.h"
+#include "BuildManifest.h"
+#include "TileScheduler.h"
+#include "TileIO.h"
+#include "Trace.h"
+#include "Utility.h"
+
+typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+namespace
+{
+    class PagedLODCollector : public osg::NodeVisitor
+    {
+        public :
+            PagedLODCollector() :
+                osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+            {
+            }
+
+            virtual void apply( osg::PagedLOD &plod )
+            {
+                pagedlods.push_back(&plod);
+                traverse(plod);
+            }
+
+            std::vector< osg::ref_ptr<osg::PagedLOD> > pagedlods;
+    };
+}
+
+
+class DatabaseTransformer::FileTask : public TileTask
+{
+    public :
+        FileTask( DatabaseTransformer &transformer, const std::string &filename ) :
+            _transformer(transformer),
+            _filename(filename)
+        {
+        }
+
+        virtual void run( TileScheduler &scheduler )
+        {
+            if (_transformer.transformFile(scheduler, _filename))
+                ++_transformer._num_files;
+            else
+                ++_transformer._num_failed;
+        }
+
+    private :
+        DatabaseTransformer &_transformer;
+        std::string _filename;
+};
+
+
+DatabaseTransformer::DatabaseTransformer( OrientationConverter &converter, unsigned int num_threads,
+                                          unsigned int io_queue_depth ) :
+    _converter(&converter),
+    _num_threads(num_threads),
+    _io_queue_depth(io_queue_depth),
+    _bake(true),
+    _io(0)
+{
+    // each tile is converted on its own, about its own bound center otherwise
+    _converter->useWorldFrame(true);
+}
+
+std::string DatabaseTransformer::transform( const std::string &root_filename, const std::string &out_dir )
+{
+    Trace::Scope trace("transform_database", root_filename);
+    _root_dir = osgDB::getFilePath(root_filename);
+    _out_dir = out_dir;
+    _submitted.clear();
+    _num_files.exchange(0);
+    _num_failed.exchange(0);
+
+    TileIO io(_io_queue_depth);
+    _io = &io;
+    TileScheduler scheduler(_num_threads);
+    submit(scheduler, root_filename);
+    scheduler.run();
+    io.flush();
+    _io = 0;
+
+    for (size_t i_w = 0; i_w < _write_requests.size(); ++i_w)
+    {
+        if (_write_requests[i_w]->success())
+            continue;
+        std::cout<<_write_requests[i_w]->getFileName()<<" write failed.."<<std::endl;
+        --_num_files;
+        ++_num_failed;
+    }
+    _write_requests.clear();
+
+    trace.arg("files", _num_files);
+    trace.arg("failed", _num_failed);
+    std::string out_filename = outputFilename(root_filename);
+    return osgDB::fileExists(out_filename) ? out_filename : std::string();
+}
+
+void DatabaseTransformer::submit( TileScheduler &scheduler, const std::string &filename )
+{
+    {
+        ScopedLock lock(_mutex);
+        if (!_submitted.insert(osgDB::getRealPath(filename)).second)
+            return;
+    }
+    scheduler.add(new FileTask(*this, filename));
+}
+
+bool DatabaseTransformer::transformFile( TileScheduler &scheduler, const std::string &filename )
+{
+    Trace::Scope trace("transform_file", filename);
+    osg::ref_ptr<TileIORequest> request = _io->read(filename);
+    request->wait();
+    osg::ref_ptr<osg::Node> node = request->getNode();
+    request = 0;
+    if (!node.valid())
+    {
+        std::cout<<filename<<" could not be read."<<std::endl;
+        return false;
+    }
+
+    PagedLODCollector collector;
+    node->accept(collector);
+
+    // without baking only the root changes, the files it references load
+    // below its transform and are used where they are
+    if (_bake)
+        node = _converter->convert(node.get());
+    else
+        node = _converter->attach(node.get());
+
+    // the referenced files keep their place relative to this one
+    std::string out_filename = outputFilename(filename);
+    std::string out_path = osgDB::getFilePath(out_filename);
+    for (size_t i_p = 0; i_p < collector.pagedlods.size(); ++i_p)
+    {
+        osg::PagedLOD &plod = *collector.pagedlods[i_p];
+        for (unsigned int i = 0; i < plod.getNumFileNames(); ++i)
+        {
+            if (plod.getFileName(i).empty())
+                continue;
+            std::string child_filename = Utility::referencedFileName(plod, i, filename);
+            if (_bake)
+            {
+                submit(scheduler, child_filename);
+                child_filename = outputFilename(child_filename);
+            }
+            plod.setFileName(i, osgDB::getPathRelative(out_path, child_filename));
+        }
+        plod.setDatabasePath("");
+    }
+    trace.arg("pagedlods", collector.pagedlods.size());
+    trace.geometryArgs(*node);
+
+    if (!osgDB::makeDirectoryForFile(out_filename))
+    {
+        std::cout<<"failed to create the directory of "<<out_filename<<std::endl;
+        return false;
+    }
+    osg::ref_ptr<TileIORequest> write_request = _io->write(*node, out_filename);
+    ScopedLock lock(_mutex);
+    _write_requests.push_back(write_request);
+    return true;
+}
+
+std::string DatabaseTransformer::outputFilename( const std::string &filename ) const
+{
+    std::string relative = osgDB::getPathRelative(_root_dir, filename);
+    if (relative.empty() || relative.compare(0, 2, "..") == 0 || osgDB::isAbsolutePath(relative))
+    {
+        // one directory per outside directory, its files keep their names
+        std::string directory = osgDB::convertFileNameToUnixStyle(osgDB::getFilePath(filename));
+        std::ostringstream sstr;
+        sstr << "external/" << std::hex << BuildManifest::hashString(directory) << "/" << osgDB::getSimpleFileName(filename);
+        relative = sstr.str();
+    }
+    return osgDB::concatPaths(_out_dir, relative);
+}
@@ -0,0 +1,75 @@
+#ifndef _DATABASE_TRANSFORMER_H
+#define _DATABASE_TRANSFORMER_H
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <osg/Node>
+
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Atomic>
+
+#include "OrientationConverter.h"
+#include "TileIO.h"
+
+class TileScheduler;
+
+/** transforms a whole paged database on disk. the root file and every file
+  * its PagedLODs reference, followed recursively, are read, converted and
+  * written to the same path relative to the root below the output
+  * directory, with the file names of the PagedLODs rewritten to the new
+  * files. every file is a task of a TileScheduler that queues the files it
+  * references, so only the tiles being converted and the writes in flight
+  * are held in memory. files outside the directory of the root go to
+  * external/<hash of their directory>, so two of them with the same name
+  * don't overwrite each other.*/
+class DatabaseTransformer {
+    public :
+        /** the converter is shared by the worker threads, it is switched to
+          * its world frame so every tile gets the same transform.*/
+        DatabaseTransformer( OrientationConverter &converter, unsigned int num_threads = 0,
+                             unsigned int io_queue_depth = 32 );
+
+        /** false leaves every tile as it is and writes only the root below
+          * one transform, its PagedLODs referencing the input files.*/
+        void setBake( bool bake ) { _bake = bake; }
+        bool getBake(void) const { return _bake; }
+
+        /** the output name of the root, empty if it could not be read.*/
+        std::string transform( const std::string &root_filename, const std::string &out_dir );
+
+        unsigned int getNumFiles(void) const { return _num_files; }
+        unsigned int getNumFailed(void) const { return _num_failed; }
+
+    private :
+        DatabaseTransformer( const DatabaseTransformer& ) {}
+        DatabaseTransformer& operator = (const DatabaseTransformer& ) { return *this; }
+
+        class FileTask;
+        friend class FileTask;
+
+        /** queues filename unless an earlier reference did.*/
+        void submit( TileScheduler &scheduler, const std::string &filename );
+
+        bool transformFile( TileScheduler &scheduler, const std::string &filename );
+
+        std::string outputFilename( const std::string &filename ) const;
+
+        OrientationConverter *_converter;
+        unsigned int _num_threads;
+        unsigned int _io_queue_depth;
+        bool _bake;
+
+        TileIO *_io;
+        std::string _root_dir;
+        std::string _out_dir;
+
+        OpenThreads::Mutex _mutex;
+        std::set<std::string> _submitted;
+        /** checked once the io is flushed, a finished write holds no data.*/
+        std::vector< osg::ref_ptr<TileIORequest> > _write_requests;
+        OpenThreads::Atomic _num_files;
+        OpenThreads::Atomic _num_failed;
+};
+#endif
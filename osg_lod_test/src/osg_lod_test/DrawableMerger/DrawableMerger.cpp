@@ -0,0 +1,449 @@
+#include <cstring>
+#include <vector>
+
+#include <osg/Group>
+#include <osg/LOD>
+#include <osg/Switch>
+#include <osg/NodeVisitor>
+#include <osg/PrimitiveSet>
+#include <osg/TriangleIndexFunctor>
+
+#include <OpenThreads/ScopedLock>
+
+#include "DrawableMerger.h"
+
+typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+namespace
+{
+    typedef DrawableMerger::SlotArray SlotArray;
+
+    bool same_type( const osg::Array &a, const osg::Array &b )
+    {
+        return a.getType() == b.getType() && a.getDataSize() == b.getDataSize() &&
+            a.getDataType() == b.getDataType() && a.getNormalize() == b.getNormalize();
+    }
+
+    // the arrays of b line up with the ones of a, an array bound overall
+    // must hold the same values
+    bool compatible_arrays( const std::vector<SlotArray> &a, const std::vector<SlotArray> &b )
+    {
+        if (a.size() != b.size())
+            return false;
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            if (a[i].slot != b[i].slot || a[i].per_vertex != b[i].per_vertex ||
+                !same_type(*a[i].array, *b[i].array))
+                return false;
+            if (!a[i].per_vertex &&
+                (a[i].array->getTotalDataSize() != b[i].array->getTotalDataSize() ||
+                 memcmp(a[i].array->getDataPointer(), b[i].array->getDataPointer(), a[i].array->getTotalDataSize()) != 0))
+                return false;
+        }
+        return true;
+    }
+
+    bool equal_statesets( const osg::StateSet *a, const osg::StateSet *b )
+    {
+        return a == b || (a && b && a->compare(*b, true) == 0);
+    }
+
+    bool mergeable( const osg::Geometry &geometry )
+    {
+        if (geometry.getUpdateCallback() || geometry.getEventCallback() || geometry.getCullCallback() ||
+            geometry.getDrawCallback() || geometry.containsDeprecatedData())
+            return false;
+        if (!geometry.getVertexArray() || geometry.getVertexArray()->getNumElements() == 0 ||
+            geometry.getNumPrimitiveSets() == 0)
+            return false;
+        for (unsigned int i = 0; i < geometry.getNumPrimitiveSets(); ++i)
+        {
+            const osg::PrimitiveSet *primitives = geometry.getPrimitiveSet(i);
+            if (!DrawableMerger::triangleMode(primitives->getMode()) || primitives->getNumInstances() > 0)
+                return false;
+        }
+        return true;
+    }
+
+    // geometries of a geode that can become one
+    struct MergeGroup
+    {
+        std::vector<SlotArray> arrays;
+        std::vector<osg::Geometry*> geometries;
+    };
+
+    osg::ref_ptr<osg::Geometry> merge_geometries( const std::vector<osg::Geometry*> &geometries, const std::vector<SlotArray> &layout )
+    {
+        const osg::Geometry &first = *geometries[0];
+        unsigned int num_vertices = 0;
+        for (size_t i = 0; i < geometries.size(); ++i)
+            num_vertices += geometries[i]->getVertexArray()->getNumElements();
+
+        osg::ref_ptr<osg::Geometry> merged = new osg::Geometry;
+        merged->setName(first.getName());
+        merged->setDataVariance(first.getDataVariance());
+        merged->setStateSet(const_cast<osg::StateSet*>(first.getStateSet()));
+        merged->setUseDisplayList(first.getUseDisplayList());
+        merged->setUseVertexBufferObjects(first.getUseVertexBufferObjects());
+
+        for (size_t i_a = 0; i_a < layout.size(); ++i_a)
+        {
+            osg::ref_ptr<osg::Array> array;
+            if (layout[i_a].per_vertex)
+            {
+                array = dynamic_cast<osg::Array*>(layout[i_a].array->cloneType());
+                if (!array.valid())
+                    return 0;
+                array->resizeArray(num_vertices);
+                array->setBinding(osg::Array::BIND_PER_VERTEX);
+                array->setNormalize(layout[i_a].array->getNormalize());
+
+                unsigned char *data = static_cast<unsigned char*>(const_cast<void*>(array->getDataPointer()));
+                const size_t size = layout[i_a].array->getElementSize();
+                size_t offset = 0;
+                for (size_t i = 0; i < geometries.size(); ++i)
+                {
+                    std::vector<SlotArray> arrays;
+                    DrawableMerger::collectArrays(*geometries[i], arrays);
+                    size_t n = geometries[i]->getVertexArray()->getNumElements();
+                    memcpy(data + offset * size, arrays[i_a].array->getDataPointer(), n * size);
+                    offset += n;
+                }
+            }
+            else
+            {
+                array = dynamic_cast<osg::Array*>(layout[i_a].array->clone(osg::CopyOp::DEEP_COPY_ALL));
+                if (!array.valid())
+                    return 0;
+            }
+
+            int slot = layout[i_a].slot;
+            if (slot == 0)
+                merged->setVertexArray(array.get());
+            else if (slot == 1)
+                merged->setNormalArray(array.get(), array->getBinding());
+            else if (slot == 2)
+                merged->setColorArray(array.get(), array->getBinding());
+            else if (slot == 3)
+                merged->setSecondaryColorArray(array.get(), array->getBinding());
+            else if (slot == 4)
+                merged->setFogCoordArray(array.get(), array->getBinding());
+            else if (slot < DrawableMerger::ATTRIB_SLOT)
+                merged->setTexCoordArray(slot - DrawableMerger::TEXCOORD_SLOT, array.get(), array->getBinding());
+            else
+                merged->setVertexAttribArray(slot - DrawableMerger::ATTRIB_SLOT, array.get(), array->getBinding());
+        }
+
+        // strips, fans and quads become one list of triangles
+        std::vector<unsigned int> indices;
+        unsigned int base = 0;
+        for (size_t i = 0; i < geometries.size(); ++i)
+        {
+            unsigned int n = geometries[i]->getVertexArray()->getNumElements();
+            osg::TriangleIndexFunctor<DrawableMerger::TriangleIndices> triangles;
+            geometries[i]->accept(triangles);
+            for (size_t i_t = 0; i_t + 2 < triangles.indices.size(); i_t += 3)
+            {
+                const unsigned int *t = &triangles.indices[i_t];
+                if (t[0] >= n || t[1] >= n || t[2] >= n)
+                    continue;
+                for (int c = 0; c < 3; ++c)
+                    indices.push_back(base + t[c]);
+            }
+            base += n;
+        }
+        if (num_vertices <= 65536)
+            merged->addPrimitiveSet(new osg::DrawElementsUShort(osg::PrimitiveSet::TRIANGLES, indices.begin(), indices.end()));
+        else
+            merged->addPrimitiveSet(new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES, indices.begin(), indices.end()));
+        return merged;
+    }
+
+    class CountVisitor : public osg::NodeVisitor
+    {
+        public :
+            CountVisitor() :
+                osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+                geodes(0),
+                drawables(0),
+                draw_calls(0)
+            {
+            }
+
+            virtual void apply( osg::Geode &geode )
+            {
+                ++geodes;
+                drawables += geode.getNumDrawables();
+                for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+                {
+                    const osg::Geometry *geometry = geode.getDrawable(i)->asGeometry();
+                    draw_calls += geometry ? geometry->getNumPrimitiveSets() : 1;
+                }
+            }
+
+            unsigned int geodes;
+            unsigned int drawables;
+            unsigned long long draw_calls;
+    };
+
+    class MergeVisitor : public osg::NodeVisitor
+    {
+        public :
+            MergeVisitor( const DrawableMerger &merger ) :
+                osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+                _merger(merger)
+            {
+            }
+
+            virtual void apply( osg::Group &group )
+            {
+                // the children of a transform share its frame, the ones
+                // of other group kinds may be drawn one at a time
+                if (strcmp(group.className(), "Group") == 0 || group.asTransform())
+                    joinGeodes(group);
+                traverse(group);
+            }
+
+            virtual void apply( osg::LOD &lod )
+            {
+                traverse(lod);
+            }
+
+            virtual void apply( osg::Switch &node )
+            {
+                traverse(node);
+            }
+
+            virtual void apply( osg::Geode &geode )
+            {
+                _merger.merge(geode);
+            }
+
+        private :
+            MergeVisitor& operator = (const MergeVisitor& ) { return *this; }
+
+            static bool plainGeode( const osg::Node &node )
+            {
+                return strcmp(node.className(), "Geode") == 0 && !node.getStateSet() &&
+                    !node.getUpdateCallback() && !node.getEventCallback() && !node.getCullCallback() &&
+                    node.getNumParents() == 1;
+            }
+
+            // the drawables of the sibling geodes go into the first one
+            void joinGeodes( osg::Group &group )
+            {
+                osg::Geode *target = 0;
+                for (unsigned int i = 0; i < group.getNumChildren(); )
+                {
+                    osg::Node *child = group.getChild(i);
+                    if (!plainGeode(*child) || (target && child->getNodeMask() != target->getNodeMask()))
+                    {
+                        ++i;
+                        continue;
+                    }
+                    if (!target)
+                    {
+                        target = child->asGeode();
+                        ++i;
+                        continue;
+                    }
+                    osg::Geode *geode = child->asGeode();
+                    for (unsigned int i_d = 0; i_d < geode->getNumDrawables(); ++i_d)
+                        target->addDrawable(geode->getDrawable(i_d));
+                    group.removeChild(i);
+                }
+            }
+
+            const DrawableMerger &_merger;
+    };
+}
+
+
+DrawableMerger::Stats::Stats( void ) :
+    num_tiles(0),
+    geodes_before(0),
+    geodes_after(0),
+    drawables_before(0),
+    drawables_after(0),
+    draw_calls_before(0),
+    draw_calls_after(0)
+{
+}
+
+DrawableMerger::Stats& DrawableMerger::Stats::operator += (const Stats &rhs)
+{
+    num_tiles += rhs.num_tiles;
+    geodes_before += rhs.geodes_before;
+    geodes_after += rhs.geodes_after;
+    drawables_before += rhs.drawables_before;
+    drawables_after += rhs.drawables_after;
+    draw_calls_before += rhs.draw_calls_before;
+    draw_calls_after += rhs.draw_calls_after;
+    return *this;
+}
+
+DrawableMerger::DrawableMerger( unsigned int max_vertices ) :
+    _max_vertices(max_vertices)
+{
+}
+
+osg::ref_ptr<osg::Node> DrawableMerger::merge( const osg::Node &node, Stats *stats ) const
+{
+    // the arrays stay shared with node, the merged geometries get new ones
+    osg::ref_ptr<osg::Node> copy = dynamic_cast<osg::Node*>(
+        node.clone(osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES));
+    if (!copy.valid())
+        return 0;
+
+    CountVisitor before;
+    copy->accept(before);
+    MergeVisitor visitor(*this);
+    copy->accept(visitor);
+    CountVisitor after;
+    copy->accept(after);
+
+    if (stats)
+    {
+        ++stats->num_tiles;
+        stats->geodes_before += before.geodes;
+        stats->geodes_after += after.geodes;
+        stats->drawables_before += before.drawables;
+        stats->drawables_after += after.drawables;
+        stats->draw_calls_before += before.draw_calls;
+        stats->draw_calls_after += after.draw_calls;
+    }
+    return copy;
+}
+
+unsigned int DrawableMerger::merge( osg::Geode &geode ) const
+{
+    // geometries with an equal stateset and the same arrays, in order of
+    // their first drawable
+    std::vector<MergeGroup> groups;
+    std::vector<int> group_of(geode.getNumDrawables(), -1);
+    for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+    {
+        osg::Geometry *geometry = geode.getDrawable(i)->asGeometry();
+        if (!geometry || !mergeable(*geometry))
+            continue;
+        std::vector<SlotArray> arrays;
+        if (!collectArrays(*geometry, arrays))
+            continue;
+
+        size_t i_g = 0;
+        while (i_g < groups.size() &&
+               !(equal_statesets(groups[i_g].geometries[0]->getStateSet(), geometry->getStateSet()) &&
+                 compatible_arrays(groups[i_g].arrays, arrays)))
+            ++i_g;
+        if (i_g == groups.size())
+        {
+            groups.push_back(MergeGroup());
+            groups.back().arrays = arrays;
+        }
+        groups[i_g].geometries.push_back(geometry);
+        group_of[i] = static_cast<int>(i_g);
+    }
+
+    // each group is merged in runs that stay below the vertex limit, the
+    // merged geometry takes the place of the first of its run
+    std::vector< osg::ref_ptr<osg::Drawable> > drawables;
+    std::vector<size_t> next(groups.size(), 0);
+    unsigned int num_merged = 0;
+    for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+    {
+        int i_g = group_of[i];
+        if (i_g < 0)
+        {
+            drawables.push_back(geode.getDrawable(i));
+            continue;
+        }
+        MergeGroup &group = groups[i_g];
+        if (next[i_g] >= group.geometries.size() || group.geometries[next[i_g]] != geode.getDrawable(i))
+            continue;
+
+        std::vector<osg::Geometry*> run;
+        unsigned int num_vertices = 0;
+        while (next[i_g] < group.geometries.size())
+        {
+            unsigned int n = group.geometries[next[i_g]]->getVertexArray()->getNumElements();
+            if (!run.empty() && _max_vertices && num_vertices + n > _max_vertices)
+                break;
+            run.push_back(group.geometries[next[i_g]++]);
+            num_vertices += n;
+        }
+
+        osg::ref_ptr<osg::Geometry> merged = run.size() > 1 ? merge_geometries(run, group.arrays) : 0;
+        if (merged.valid())
+        {
+            drawables.push_back(merged.get());
+            num_merged += static_cast<unsigned int>(run.size()) - 1;
+        }
+        else
+            drawables.insert(drawables.end(), run.begin(), run.end());
+    }
+
+    if (num_merged == 0)
+        return 0;
+    geode.removeDrawables(0, geode.getNumDrawables());
+    for (size_t i = 0; i < drawables.size(); ++i)
+        geode.addDrawable(drawables[i].get());
+    return num_merged;
+}
+
+void DrawableMerger::addStats( const Stats &stats )
+{
+    ScopedLock lock(_mutex);
+    _total += stats;
+}
+
+DrawableMerger::Stats DrawableMerger::getTotal( void ) const
+{
+    ScopedLock lock(_mutex);
+    return _total;
+}
+
+bool DrawableMerger::triangleMode( GLenum mode )
+{
+    return mode == osg::PrimitiveSet::TRIANGLES || mode == osg::PrimitiveSet::TRIANGLE_STRIP ||
+        mode == osg::PrimitiveSet::TRIANGLE_FAN || mode == osg::PrimitiveSet::QUADS ||
+        mode == osg::PrimitiveSet::QUAD_STRIP || mode == osg::PrimitiveSet::POLYGON;
+}
+
+bool DrawableMerger::collectArrays( const osg::Geometry &geometry, std::vector<SlotArray> &arrays )
+{
+    const unsigned int num_vertices = geometry.getVertexArray()->getNumElements();
+
+    std::vector< std::pair<int, const osg::Array*> > candidates;
+    candidates.push_back(std::make_pair(0, geometry.getVertexArray()));
+    candidates.push_back(std::make_pair(1, geometry.getNormalArray()));
+    candidates.push_back(std::make_pair(2, geometry.getColorArray()));
+    candidates.push_back(std::make_pair(3, geometry.getSecondaryColorArray()));
+    candidates.push_back(std::make_pair(4, geometry.getFogCoordArray()));
+    for (unsigned int unit = 0; unit < geometry.getNumTexCoordArrays(); ++unit)
+        candidates.push_back(std::make_pair(TEXCOORD_SLOT + int(unit), geometry.getTexCoordArray(unit)));
+    const osg::Geometry::ArrayList &attribs = geometry.getVertexAttribArrayList();
+    for (size_t i = 0; i < attribs.size(); ++i)
+        candidates.push_back(std::make_pair(ATTRIB_SLOT + int(i), attribs[i].get()));
+
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        const osg::Array *array = candidates[i].second;
+        if (!array || array->getBinding() == osg::Array::BIND_OFF)
+            continue;
+        if (array->getBinding() == osg::Array::BIND_PER_PRIMITIVE_SET)
+            return false;
+
+        // vertices and texture coords are per vertex whatever their binding says
+        int slot = candidates[i].first;
+        SlotArray slot_array;
+        slot_array.slot = slot;
+        slot_array.array = array;
+        slot_array.per_vertex = slot == 0 || (slot >= TEXCOORD_SLOT && slot < ATTRIB_SLOT) ||
+            array->getBinding() == osg::Array::BIND_PER_VERTEX ||
+            (array->getBinding() != osg::Array::BIND_OVERALL && array->getNumElements() == num_vertices);
+        if (slot_array.per_vertex && array->getNumElements() < num_vertices)
+            return false;
+        arrays.push_back(slot_array);
+    }
+    return true;
+}
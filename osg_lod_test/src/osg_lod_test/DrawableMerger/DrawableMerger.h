@@ -0,0 +1,97 @@
+#ifndef _DRAWABLE_MERGER_H
+#define _DRAWABLE_MERGER_H
+
+#include <vector>
+
+#include <osg/Node>
+#include <osg/Geode>
+#include <osg/Geometry>
+
+#include <OpenThreads/Mutex>
+
+/** cuts the draw calls of a tile before it is written. the geodes below
+  * the same group are joined, and the geometries of a geode that have
+  * equal statesets and the same vertex arrays become one geometry with a
+  * single indexed triangle list. LODs, PagedLODs and switches keep their
+  * children, so the paging structure is not touched. geometries with
+  * callbacks, lines or points, or arrays bound per primitive set are left
+  * alone.*/
+class DrawableMerger {
+    public :
+        struct Stats
+        {
+            Stats(void);
+
+            unsigned int num_tiles;
+            unsigned int geodes_before;
+            unsigned int geodes_after;
+            unsigned int drawables_before;
+            unsigned int drawables_after;
+            /** a primitive set of a geometry is one draw call.*/
+            unsigned long long draw_calls_before;
+            unsigned long long draw_calls_after;
+
+            Stats& operator += (const Stats &rhs);
+        };
+
+        /** an attribute array of a geometry, slot says which one: 0 vertices,
+          * 1 normals, 2 colors, 3 secondary colors, 4 fog coords,
+          * TEXCOORD_SLOT + unit texture coords, ATTRIB_SLOT + index vertex
+          * attributes.*/
+        struct SlotArray
+        {
+            int slot;
+            const osg::Array *array;
+            bool per_vertex;
+        };
+
+        enum { TEXCOORD_SLOT = 100, ATTRIB_SLOT = 1000 };
+
+        /** the vertex indices of the triangles of a geometry, for
+          * osg::TriangleIndexFunctor.*/
+        struct TriangleIndices
+        {
+            std::vector<unsigned int> indices;
+
+            void operator() ( unsigned int i1, unsigned int i2, unsigned int i3 )
+            {
+                indices.push_back(i1);
+                indices.push_back(i2);
+                indices.push_back(i3);
+            }
+        };
+
+        /** a merged geometry stays below max_vertices, 65536 keeps its
+          * indices 16 bit. 0 merges without a limit.*/
+        DrawableMerger( unsigned int max_vertices = 65536 );
+
+        unsigned int getMaxVertices(void) const { return _max_vertices; }
+
+        /** a copy of node with merged geodes and geometries. nodes and
+          * drawables are copied, node itself is not touched. thread safe.*/
+        osg::ref_ptr<osg::Node> merge( const osg::Node &node, Stats *stats = 0 ) const;
+
+        /** merge the geometries of geode in place, the number merged away.*/
+        unsigned int merge( osg::Geode &geode ) const;
+
+        /** sum up the statistics of a written tile, thread safe.*/
+        void addStats( const Stats &stats );
+        Stats getTotal(void) const;
+
+        /** the primitive mode draws triangles.*/
+        static bool triangleMode( GLenum mode );
+
+        /** the bound arrays of a geometry, false if one is bound per
+          * primitive set or shorter than the vertices.*/
+        static bool collectArrays( const osg::Geometry &geometry, std::vector<SlotArray> &arrays );
+
+    private :
+        DrawableMerger( const DrawableMerger& ) {}
+        DrawableMerger& operator = (const DrawableMerger& ) { return *this; }
+
+        unsigned int _max_vertices;
+
+        Stats _total;
+        mutable OpenThreads::Mutex _mutex;
+};
+#endif
@@ -0,0 +1,301 @@
+#include <cmath>
+#include <cfloat>
+#include <cstdlib>
+#include <algorithm>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/NodeVisitor>
+#include <osg/TriangleIndexFunctor>
+
+#include "GeometricError.h"
+#include "DrawableMerger.h"
+
+namespace
+{
+    // the vertex arrays below a node with the matrix to world coordinates
+    class VertexCollector : public osg::NodeVisitor
+    {
+        public :
+            VertexCollector() :
+                osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+                num_vertices(0)
+            {
+            }
+
+            virtual void apply( osg::Geode &geode )
+            {
+                osg::Matrix matrix = osg::computeLocalToWorld(getNodePath());
+                for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+                {
+                    osg::Geometry *geometry = geode.getDrawable(i)->asGeometry();
+                    if (!geometry)
+                        continue;
+                    const osg::Vec3Array *vertices = dynamic_cast<const osg::Vec3Array*>(geometry->getVertexArray());
+                    if (!vertices || vertices->empty())
+                        continue;
+                    geometries.push_back(std::make_pair(geometry, matrix));
+                    num_vertices += vertices->size();
+                }
+                traverse(geode);
+            }
+
+            std::vector< std::pair<osg::Geometry*, osg::Matrix> > geometries;
+            size_t num_vertices;
+    };
+
+    // closest point on triangle abc to p, ericson's real-time collision detection 5.1.5
+    osg::Vec3d closest_point( const osg::Vec3d &p, const osg::Vec3d &a, const osg::Vec3d &b, const osg::Vec3d &c )
+    {
+        osg::Vec3d ab = b - a, ac = c - a, ap = p - a;
+        double d1 = ab * ap, d2 = ac * ap;
+        if (d1 <= 0. && d2 <= 0.)
+            return a;
+
+        osg::Vec3d bp = p - b;
+        double d3 = ab * bp, d4 = ac * bp;
+        if (d3 >= 0. && d4 <= d3)
+            return b;
+
+        double vc = d1 * d4 - d3 * d2;
+        if (vc <= 0. && d1 >= 0. && d3 <= 0.)
+            return a + ab * (d1 / (d1 - d3));
+
+        osg::Vec3d cp = p - c;
+        double d5 = ab * cp, d6 = ac * cp;
+        if (d6 >= 0. && d5 <= d6)
+            return c;
+
+        double vb = d5 * d2 - d1 * d6;
+        if (vb <= 0. && d2 >= 0. && d6 <= 0.)
+            return a + ac * (d2 / (d2 - d6));
+
+        double va = d3 * d6 - d5 * d4;
+        if (va <= 0. && (d4 - d3) >= 0. && (d5 - d6) >= 0.)
+            return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+        double denom = 1. / (va + vb + vc);
+        return a + ab * (vb * denom) + ac * (vc * denom);
+    }
+
+    // the triangles of the coarse tile bucketed in a uniform grid, a query
+    // searches shells of cells around the point until no closer triangle
+    // can be left
+    class TriangleGrid
+    {
+        public :
+            TriangleGrid( const std::vector<osg::Vec3d> &corners ) :
+                _corners(corners),
+                _stamps(corners.size() / 3, 0),
+                _query(0)
+            {
+                size_t num_triangles = corners.size() / 3;
+                osg::Vec3d lo(DBL_MAX, DBL_MAX, DBL_MAX), hi(-DBL_MAX, -DBL_MAX, -DBL_MAX);
+                for (size_t i = 0; i < corners.size(); ++i)
+                {
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        lo[a] = std::min(lo[a], corners[i][a]);
+                        hi[a] = std::max(hi[a], corners[i][a]);
+                    }
+                }
+
+                // about two triangles per cell, sized for the two longest
+                // extents since tiles are mostly flat
+                double extents[3] = { hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] };
+                double sorted[3] = { extents[0], extents[1], extents[2] };
+                std::sort(sorted, sorted + 3);
+                double target = std::max(double(num_triangles) / 2., 1.);
+                _cell = sqrt(sorted[2] * sorted[1] / target);
+                if (!(_cell > 0.))
+                    _cell = sorted[2] > 0. ? sorted[2] / target : 1.;
+                while (true)
+                {
+                    for (int a = 0; a < 3; ++a)
+                        _size[a] = std::min(static_cast<int>(extents[a] / _cell) + 1, 256);
+                    if (double(_size[0]) * _size[1] * _size[2] <= 4. * target + 64.)
+                        break;
+                    _cell *= 1.26;
+                }
+                _origin = lo;
+
+                // two passes, count then fill
+                std::vector<unsigned int> counts(_size[0] * _size[1] * _size[2] + 1, 0);
+                for (int pass = 0; pass < 2; ++pass)
+                {
+                    for (size_t i_t = 0; i_t < num_triangles; ++i_t)
+                    {
+                        int c_lo[3], c_hi[3];
+                        for (int a = 0; a < 3; ++a)
+                        {
+                            double t_lo = std::min(corners[i_t * 3][a], std::min(corners[i_t * 3 + 1][a], corners[i_t * 3 + 2][a]));
+                            double t_hi = std::max(corners[i_t * 3][a], std::max(corners[i_t * 3 + 1][a], corners[i_t * 3 + 2][a]));
+                            c_lo[a] = cellIndex(t_lo, a);
+                            c_hi[a] = cellIndex(t_hi, a);
+                        }
+                        for (int z = c_lo[2]; z <= c_hi[2]; ++z)
+                            for (int y = c_lo[1]; y <= c_hi[1]; ++y)
+                                for (int x = c_lo[0]; x <= c_hi[0]; ++x)
+                                {
+                                    unsigned int cell = (z * _size[1] + y) * _size[0] + x;
+                                    if (pass == 0)
+                                        ++counts[cell + 1];
+                                    else
+                                        _triangles[counts[cell]++] = static_cast<unsigned int>(i_t);
+                                }
+                    }
+                    if (pass == 0)
+                    {
+                        for (size_t i = 1; i < counts.size(); ++i)
+                            counts[i] += counts[i - 1];
+                        _starts = counts;
+                        _triangles.resize(counts.back());
+                    }
+                }
+            }
+
+            double distance2( const osg::Vec3d &p )
+            {
+                ++_query;
+                double best = DBL_MAX;
+                int c[3] = { cellIndex(p[0], 0), cellIndex(p[1], 1), cellIndex(p[2], 2) };
+                for (int r = 0; ; ++r)
+                {
+                    int lo[3], hi[3];
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        lo[a] = std::max(c[a] - r, 0);
+                        hi[a] = std::min(c[a] + r, _size[a] - 1);
+                    }
+                    for (int x = lo[0]; x <= hi[0]; ++x)
+                    {
+                        for (int y = lo[1]; y <= hi[1]; ++y)
+                        {
+                            bool edge = abs(x - c[0]) == r || abs(y - c[1]) == r;
+                            for (int z = lo[2]; z <= hi[2]; ++z)
+                            {
+                                // inside the shell, searched before
+                                if (!edge && abs(z - c[2]) != r)
+                                    continue;
+                                searchCell(x, y, z, p, best);
+                            }
+                        }
+                    }
+
+                    // the closest a triangle outside the searched block can be
+                    double bound = DBL_MAX;
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        if (c[a] - r > 0)
+                            bound = std::min(bound, std::max(p[a] - (_origin[a] + (c[a] - r) * _cell), 0.));
+                        if (c[a] + r < _size[a] - 1)
+                            bound = std::min(bound, std::max(_origin[a] + (c[a] + r + 1) * _cell - p[a], 0.));
+                    }
+                    if (bound == DBL_MAX || best <= bound * bound)
+                        break;
+                }
+                return best;
+            }
+
+        private :
+            int cellIndex( double value, int axis ) const
+            {
+                int index = static_cast<int>(floor((value - _origin[axis]) / _cell));
+                return std::min(std::max(index, 0), _size[axis] - 1);
+            }
+
+            void searchCell( int x, int y, int z, const osg::Vec3d &p, double &best )
+            {
+                unsigned int cell = (z * _size[1] + y) * _size[0] + x;
+                for (unsigned int i = _starts[cell]; i < _starts[cell + 1]; ++i)
+                {
+                    unsigned int i_t = _triangles[i];
+                    if (_stamps[i_t] == _query)
+                        continue;
+                    _stamps[i_t] = _query;
+                    osg::Vec3d q = closest_point(p, _corners[i_t * 3], _corners[i_t * 3 + 1], _corners[i_t * 3 + 2]);
+                    best = std::min(best, (q - p).length2());
+                }
+            }
+
+            const std::vector<osg::Vec3d> &_corners;
+            std::vector<unsigned int> _starts;
+            std::vector<unsigned int> _triangles;
+            std::vector<unsigned int> _stamps;
+            unsigned int _query;
+            osg::Vec3d _origin;
+            double _cell;
+            int _size[3];
+    };
+}
+
+void GeometricError::sampleVertices( const osg::Node &node, std::vector<osg::Vec3> &samples, unsigned int max_samples )
+{
+    VertexCollector collector;
+    const_cast<osg::Node&>(node).accept(collector);
+    if (collector.num_vertices == 0 || max_samples == 0)
+        return;
+
+    // every stride-th vertex across all geometries
+    double stride = std::max(double(collector.num_vertices) / max_samples, 1.);
+    double next = 0.;
+    size_t index = 0;
+    for (size_t i_g = 0; i_g < collector.geometries.size(); ++i_g)
+    {
+        const osg::Vec3Array &vertices = *static_cast<const osg::Vec3Array*>(collector.geometries[i_g].first->getVertexArray());
+        const osg::Matrix &matrix = collector.geometries[i_g].second;
+        bool identity = matrix.isIdentity();
+        for (size_t i_v = 0; i_v < vertices.size(); ++i_v, ++index)
+        {
+            if (index < next)
+                continue;
+            next += stride;
+            samples.push_back(identity ? vertices[i_v] : osg::Vec3(vertices[i_v] * matrix));
+        }
+    }
+}
+
+double GeometricError::distance( const std::vector<osg::Vec3> &samples, const osg::Node &coarse )
+{
+    if (samples.empty())
+        return 0.;
+
+    VertexCollector collector;
+    const_cast<osg::Node&>(coarse).accept(collector);
+    std::vector<osg::Vec3d> corners;
+    for (size_t i_g = 0; i_g < collector.geometries.size(); ++i_g)
+    {
+        osg::Geometry &geometry = *collector.geometries[i_g].first;
+        const osg::Vec3Array &vertices = *static_cast<const osg::Vec3Array*>(geometry.getVertexArray());
+        const osg::Matrix &matrix = collector.geometries[i_g].second;
+
+        osg::TriangleIndexFunctor<DrawableMerger::TriangleIndices> triangles;
+        geometry.accept(triangles);
+        for (size_t i = 0; i + 2 < triangles.indices.size(); i += 3)
+        {
+            if (triangles.indices[i] >= vertices.size() || triangles.indices[i + 1] >= vertices.size() ||
+                triangles.indices[i + 2] >= vertices.size())
+                continue;
+            for (int c = 0; c < 3; ++c)
+                corners.push_back(osg::Vec3d(vertices[triangles.indices[i + c]]) * matrix);
+        }
+    }
+    if (corners.empty())
+        return 0.;
+
+    TriangleGrid grid(corners);
+    double max_distance2 = 0.;
+    for (size_t i = 0; i < samples.size(); ++i)
+        max_distance2 = std::max(max_distance2, grid.distance2(samples[i]));
+    return sqrt(max_distance2);
+}
+
+float GeometricError::pixelSizeRange( double error, float radius, float pixel_error )
+{
+    // the coarse child covers error / radius of the pixels of the bound
+    // radius, it is refined once that is more than pixel_error
+    if (!(error > 0.) || !(radius > 0.f))
+        return FLT_MAX;
+    double range = pixel_error * radius / error;
+    return range < FLT_MAX ? static_cast<float>(range) : FLT_MAX;
+}
@@ -0,0 +1,31 @@
+#ifndef _GEOMETRIC_ERROR_H
+#define _GEOMETRIC_ERROR_H
+
+#include <vector>
+
+#include <osg/Vec3>
+#include <osg/Node>
+
+/** how far a coarse tile is from the finer tiles it stands in for, and the
+  * PagedLOD range that follows from it. the error is the largest distance
+  * from a vertex of the finer tiles to the triangles of the coarse tile (a
+  * one sided hausdorff distance on a sample of the vertices), so it grows
+  * with what the simplification dropped rather than with the tile size.*/
+class GeometricError {
+    public :
+        /** appends up to max_samples vertices below node, evenly spread over
+          * its geometries, in world coordinates.*/
+        static void sampleVertices( const osg::Node &node, std::vector<osg::Vec3> &samples,
+                                    unsigned int max_samples = 1024 );
+
+        /** largest distance from samples to the triangles below coarse, 0 if
+          * either is empty.*/
+        static double distance( const std::vector<osg::Vec3> &samples, const osg::Node &coarse );
+
+        /** PIXEL_SIZE_ON_SCREEN range where a PagedLOD with bound radius
+          * switches from its coarse child to the finer one, when the coarse
+          * child's error would cover more than pixel_error pixels. an error
+          * of 0 never switches.*/
+        static float pixelSizeRange( double error, float radius, float pixel_error );
+};
+#endif
@@ -0,0 +1,583 @@
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <algorithm>
+
+#include <osg/Geode>
+#include <osg/NodeVisitor>
+#include <osg/PrimitiveSet>
+
+#include <OpenThreads/ScopedLock>
+
+#include "GeometryOptimizer.h"
+
+typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+namespace
+{
+    // lru cache modelled by the triangle order, larger than any real cache
+    // so the order degrades gracefully on smaller ones.
+    const int max_cache_size = 32;
+    const int max_valence_score = 32;
+    const unsigned int no_vertex = ~0u;
+
+    // one attribute array with an element per vertex
+    struct VertexArray
+    {
+        const osg::Array *array;
+        const unsigned char *data;
+        unsigned int element_size;
+    };
+
+    class ScoreTables
+    {
+        public :
+            ScoreTables()
+            {
+                // a vertex used by the last triangle gets a fixed score so
+                // the order doesn't strip, older entries decay with age
+                for (int i = 0; i < max_cache_size; ++i)
+                {
+                    if (i < 3)
+                        cache[i] = 0.75f;
+                    else
+                        cache[i] = powf(1.f - float(i - 3) / float(max_cache_size - 3), 1.5f);
+                }
+                // vertices with few triangles left are finished first
+                valence[0] = 0.f;
+                for (int i = 1; i <= max_valence_score; ++i)
+                    valence[i] = 2.f * powf(float(i), -0.5f);
+            }
+
+            float score( int cache_position, unsigned int remaining ) const
+            {
+                if (remaining == 0)
+                    return -1.f;
+                float score = cache_position >= 0 ? cache[cache_position] : 0.f;
+                score += remaining <= (unsigned int)max_valence_score ? valence[remaining] : 2.f * powf(float(remaining), -0.5f);
+                return score;
+            }
+
+        private :
+            float cache[max_cache_size];
+            float valence[max_valence_score + 1];
+    };
+
+    const ScoreTables& score_tables( void )
+    {
+        static ScoreTables tables;
+        return tables;
+    }
+
+    // tom forsyth, linear-speed vertex cache optimisation. the triangles are
+    // emitted greedily by the score of their vertices, only the triangles of
+    // the vertices in the cache are rescored after each one.
+    void optimize_triangle_order( std::vector<unsigned int> &indices, unsigned int num_vertices )
+    {
+        const ScoreTables &tables = score_tables();
+        const unsigned int num_triangles = static_cast<unsigned int>(indices.size() / 3);
+
+        // the triangles of every vertex, the first remaining[v] are not emitted yet
+        std::vector<unsigned int> remaining(num_vertices, 0);
+        for (size_t i = 0; i < indices.size(); ++i)
+            ++remaining[indices[i]];
+        std::vector<unsigned int> offsets(num_vertices + 1, 0);
+        for (unsigned int v = 0; v < num_vertices; ++v)
+            offsets[v + 1] = offsets[v] + remaining[v];
+        std::vector<unsigned int> vertex_triangles(indices.size());
+        {
+            std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+            for (unsigned int t = 0; t < num_triangles; ++t)
+                for (int c = 0; c < 3; ++c)
+                    vertex_triangles[fill[indices[t * 3 + c]]++] = t;
+        }
+
+        std::vector<int> cache_position(num_vertices, -1);
+        std::vector<float> vertex_scores(num_vertices);
+        for (unsigned int v = 0; v < num_vertices; ++v)
+            vertex_scores[v] = tables.score(-1, remaining[v]);
+
+        int best = -1;
+        float best_score = -1.f;
+        for (unsigned int t = 0; t < num_triangles; ++t)
+        {
+            const unsigned int *tri = &indices[t * 3];
+            float score = vertex_scores[tri[0]] + vertex_scores[tri[1]] + vertex_scores[tri[2]];
+            if (score > best_score)
+            {
+                best_score = score;
+                best = t;
+            }
+        }
+
+        std::vector<char> emitted(num_triangles, 0);
+        std::vector<unsigned int> output;
+        output.reserve(indices.size());
+        unsigned int cache[max_cache_size + 3];
+        int cache_count = 0;
+        unsigned int scan = 0;
+        while (true)
+        {
+            if (best < 0)
+            {
+                // nothing in the cache has triangles left, start over at the next unused one
+                while (scan < num_triangles && emitted[scan])
+                    ++scan;
+                if (scan == num_triangles)
+                    break;
+                best = scan;
+            }
+
+            emitted[best] = 1;
+            const unsigned int *tri = &indices[best * 3];
+            output.insert(output.end(), tri, tri + 3);
+
+            // the emitted triangle goes to the back of the lists of its vertices
+            unsigned int new_cache[max_cache_size + 3];
+            int new_count = 0;
+            for (int c = 0; c < 3; ++c)
+            {
+                unsigned int v = tri[c];
+                if (std::find(new_cache, new_cache + new_count, v) != new_cache + new_count)
+                    continue;
+                new_cache[new_count++] = v;
+
+                unsigned int *list = &vertex_triangles[offsets[v]];
+                for (unsigned int i = 0; i < remaining[v]; ++i)
+                {
+                    if (list[i] == (unsigned int)best)
+                    {
+                        std::swap(list[i], list[remaining[v] - 1]);
+                        break;
+                    }
+                }
+                --remaining[v];
+            }
+
+            // its vertices move to the front, the oldest fall out
+            const int num_corners = new_count;
+            for (int i = 0; i < cache_count; ++i)
+            {
+                if (std::find(new_cache, new_cache + num_corners, cache[i]) == new_cache + num_corners)
+                    new_cache[new_count++] = cache[i];
+            }
+            for (int i = 0; i < new_count; ++i)
+            {
+                unsigned int v = new_cache[i];
+                cache_position[v] = i < max_cache_size ? i : -1;
+                vertex_scores[v] = tables.score(cache_position[v], remaining[v]);
+            }
+
+            best = -1;
+            best_score = -1.f;
+            for (int i = 0; i < new_count; ++i)
+            {
+                unsigned int v = new_cache[i];
+                const unsigned int *list = &vertex_triangles[offsets[v]];
+                for (unsigned int i_t = 0; i_t < remaining[v]; ++i_t)
+                {
+                    const unsigned int *t = &indices[list[i_t] * 3];
+                    float score = vertex_scores[t[0]] + vertex_scores[t[1]] + vertex_scores[t[2]];
+                    if (score > best_score)
+                    {
+                        best_score = score;
+                        best = list[i_t];
+                    }
+                }
+            }
+
+            cache_count = std::min(new_count, max_cache_size);
+            std::copy(new_cache, new_cache + cache_count, cache);
+        }
+
+        indices.swap(output);
+    }
+
+    // the attribute arrays that follow the vertices, false if one can't be
+    // remapped with them
+    bool collect_vertex_arrays( const osg::Geometry &geometry, std::vector<VertexArray> &arrays )
+    {
+        const osg::Array *vertices = geometry.getVertexArray();
+        const unsigned int num_vertices = vertices->getNumElements();
+
+        std::vector< std::pair<const osg::Array*, bool> > candidates;
+        candidates.push_back(std::make_pair(vertices, true));
+        candidates.push_back(std::make_pair(geometry.getNormalArray(), false));
+        candidates.push_back(std::make_pair(geometry.getColorArray(), false));
+        candidates.push_back(std::make_pair(geometry.getSecondaryColorArray(), false));
+        candidates.push_back(std::make_pair(geometry.getFogCoordArray(), false));
+        for (unsigned int unit = 0; unit < geometry.getNumTexCoordArrays(); ++unit)
+            candidates.push_back(std::make_pair(geometry.getTexCoordArray(unit), true));
+        const osg::Geometry::ArrayList &attribs = geometry.getVertexAttribArrayList();
+        for (size_t i = 0; i < attribs.size(); ++i)
+            candidates.push_back(std::make_pair(attribs[i].get(), false));
+
+        for (size_t i = 0; i < candidates.size(); ++i)
+        {
+            const osg::Array *array = candidates[i].first;
+            if (!array)
+                continue;
+
+            osg::Array::Binding binding = array->getBinding();
+            if (binding == osg::Array::BIND_PER_PRIMITIVE_SET)
+                return false;
+            bool per_vertex = candidates[i].second || binding == osg::Array::BIND_PER_VERTEX ||
+                (binding != osg::Array::BIND_OFF && binding != osg::Array::BIND_OVERALL &&
+                 array->getNumElements() == num_vertices);
+            if (!per_vertex)
+                continue;
+            if (array->getNumElements() < num_vertices)
+                return false;
+
+            VertexArray vertex_array;
+            vertex_array.array = array;
+            vertex_array.data = static_cast<const unsigned char*>(array->getDataPointer());
+            vertex_array.element_size = array->getElementSize();
+            arrays.push_back(vertex_array);
+        }
+        return true;
+    }
+
+    unsigned long long hash_vertex( const std::vector<VertexArray> &arrays, unsigned int v )
+    {
+        // 64 bit fnv-1a over the bytes of every attribute
+        unsigned long long hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < arrays.size(); ++i)
+        {
+            const unsigned char *p = arrays[i].data + size_t(v) * arrays[i].element_size;
+            for (unsigned int b = 0; b < arrays[i].element_size; ++b)
+            {
+                hash ^= p[b];
+                hash *= 1099511628211ULL;
+            }
+        }
+        return hash;
+    }
+
+    bool equal_vertices( const std::vector<VertexArray> &arrays, unsigned int a, unsigned int b )
+    {
+        for (size_t i = 0; i < arrays.size(); ++i)
+        {
+            size_t size = arrays[i].element_size;
+            if (memcmp(arrays[i].data + a * size, arrays[i].data + b * size, size) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    // welded id of every vertex, sources holds the first vertex of each id
+    void weld_vertices( const std::vector<VertexArray> &arrays, unsigned int num_vertices,
+                        std::vector<unsigned int> &welded, std::vector<unsigned int> &sources )
+    {
+        size_t table_size = 1;
+        while (table_size < size_t(num_vertices) * 2)
+            table_size <<= 1;
+        std::vector<unsigned int> table(table_size, no_vertex);
+
+        welded.resize(num_vertices);
+        sources.clear();
+        for (unsigned int v = 0; v < num_vertices; ++v)
+        {
+            size_t slot = static_cast<size_t>(hash_vertex(arrays, v)) & (table_size - 1);
+            while (table[slot] != no_vertex && !equal_vertices(arrays, sources[table[slot]], v))
+                slot = (slot + 1) & (table_size - 1);
+            if (table[slot] == no_vertex)
+            {
+                table[slot] = static_cast<unsigned int>(sources.size());
+                sources.push_back(v);
+            }
+            welded[v] = table[slot];
+        }
+    }
+
+    osg::ref_ptr<osg::Array> remap_array( const VertexArray &vertex_array, const std::vector<unsigned int> &sources )
+    {
+        osg::ref_ptr<osg::Array> array = dynamic_cast<osg::Array*>(vertex_array.array->cloneType());
+        if (!array.valid())
+            return 0;
+        array->resizeArray(static_cast<unsigned int>(sources.size()));
+        array->setBinding(vertex_array.array->getBinding());
+        array->setNormalize(vertex_array.array->getNormalize());
+
+        unsigned char *data = static_cast<unsigned char*>(const_cast<void*>(array->getDataPointer()));
+        const size_t size = vertex_array.element_size;
+        for (size_t i = 0; i < sources.size(); ++i)
+            memcpy(data + i * size, vertex_array.data + sources[i] * size, size);
+        return array;
+    }
+
+    unsigned int index_size( const osg::PrimitiveSet &primitives )
+    {
+        switch (primitives.getType())
+        {
+            case osg::PrimitiveSet::DrawElementsUBytePrimitiveType: return 1;
+            case osg::PrimitiveSet::DrawElementsUShortPrimitiveType: return 2;
+            case osg::PrimitiveSet::DrawElementsUIntPrimitiveType: return 4;
+            default: return 0;
+        }
+    }
+
+    bool report_less( const std::pair<std::string, GeometryOptimizer::Stats> &a,
+                      const std::pair<std::string, GeometryOptimizer::Stats> &b )
+    {
+        return a.first < b.first;
+    }
+
+    class OptimizeVisitor : public osg::NodeVisitor
+    {
+        public :
+            OptimizeVisitor( const GeometryOptimizer &optimizer, GeometryOptimizer::Stats *stats ) :
+                osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+                _optimizer(optimizer),
+                _stats(stats)
+            {
+            }
+
+            virtual void apply( osg::Geode &geode )
+            {
+                for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+                {
+                    osg::Geometry *geometry = geode.getDrawable(i)->asGeometry();
+                    if (geometry)
+                        _optimizer.optimize(*geometry, _stats);
+                }
+            }
+
+        private :
+            OptimizeVisitor& operator = (const OptimizeVisitor& ) { return *this; }
+
+            const GeometryOptimizer &_optimizer;
+            GeometryOptimizer::Stats *_stats;
+    };
+}
+
+GeometryOptimizer::Stats::Stats( void ) :
+    num_geometries(0),
+    num_triangles(0),
+    vertices_before(0),
+    vertices_after(0),
+    misses_before(0),
+    misses_after(0),
+    index_bytes_before(0),
+    index_bytes_after(0)
+{
+}
+
+double GeometryOptimizer::Stats::acmrBefore( void ) const
+{
+    return num_triangles ? double(misses_before) / double(num_triangles) : 0.;
+}
+
+double GeometryOptimizer::Stats::acmrAfter( void ) const
+{
+    return num_triangles ? double(misses_after) / double(num_triangles) : 0.;
+}
+
+GeometryOptimizer::Stats& GeometryOptimizer::Stats::operator += (const Stats &rhs)
+{
+    num_geometries += rhs.num_geometries;
+    num_triangles += rhs.num_triangles;
+    vertices_before += rhs.vertices_before;
+    vertices_after += rhs.vertices_after;
+    misses_before += rhs.misses_before;
+    misses_after += rhs.misses_after;
+    index_bytes_before += rhs.index_bytes_before;
+    index_bytes_after += rhs.index_bytes_after;
+    return *this;
+}
+
+GeometryOptimizer::GeometryOptimizer( unsigned int cache_size ) :
+    _cache_size(cache_size ? cache_size : 1)
+{
+}
+
+osg::ref_ptr<osg::Node> GeometryOptimizer::optimize( const osg::Node &node, Stats *stats ) const
+{
+    // the arrays stay shared with node, optimize only replaces them
+    osg::ref_ptr<osg::Node> copy = dynamic_cast<osg::Node*>(
+        node.clone(osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES));
+    if (!copy.valid())
+        return 0;
+
+    OptimizeVisitor visitor(*this, stats);
+    copy->accept(visitor);
+    return copy;
+}
+
+bool GeometryOptimizer::optimize( osg::Geometry &geometry, Stats *stats ) const
+{
+    const osg::Array *vertices = geometry.getVertexArray();
+    if (!vertices || vertices->getNumElements() == 0 || geometry.getNumPrimitiveSets() == 0)
+        return false;
+    const unsigned int num_vertices = vertices->getNumElements();
+
+    std::vector<unsigned int> indices;
+    unsigned long long index_bytes = 0;
+    for (unsigned int i = 0; i < geometry.getNumPrimitiveSets(); ++i)
+    {
+        const osg::PrimitiveSet *primitives = geometry.getPrimitiveSet(i);
+        if (primitives->getMode() != osg::PrimitiveSet::TRIANGLES || primitives->getNumInstances() > 0)
+            return false;
+        unsigned int num_indices = primitives->getNumIndices() / 3 * 3;
+        for (unsigned int j = 0; j < num_indices; ++j)
+        {
+            unsigned int index = primitives->index(j);
+            if (index >= num_vertices)
+                return false;
+            indices.push_back(index);
+        }
+        index_bytes += (unsigned long long)primitives->getNumIndices() * index_size(*primitives);
+    }
+    if (indices.empty())
+        return false;
+
+    std::vector<VertexArray> arrays;
+    if (!collect_vertex_arrays(geometry, arrays))
+        return false;
+
+    Stats geometry_stats;
+    geometry_stats.num_geometries = 1;
+    geometry_stats.num_triangles = indices.size() / 3;
+    geometry_stats.vertices_before = num_vertices;
+    geometry_stats.misses_before = simulateCache(indices, _cache_size);
+    geometry_stats.index_bytes_before = index_bytes;
+
+    // corners that are equal in every attribute become one vertex
+    std::vector<unsigned int> welded, sources;
+    weld_vertices(arrays, num_vertices, welded, sources);
+    for (size_t i = 0; i < indices.size(); ++i)
+        indices[i] = welded[indices[i]];
+
+    optimize_triangle_order(indices, static_cast<unsigned int>(sources.size()));
+
+    // renumber in order of first use, unused vertices drop out
+    std::vector<unsigned int> new_ids(sources.size(), no_vertex);
+    std::vector<unsigned int> fetch_sources;
+    fetch_sources.reserve(sources.size());
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        unsigned int &id = new_ids[indices[i]];
+        if (id == no_vertex)
+        {
+            id = static_cast<unsigned int>(fetch_sources.size());
+            fetch_sources.push_back(sources[indices[i]]);
+        }
+        indices[i] = id;
+    }
+
+    std::vector< osg::ref_ptr<osg::Array> > new_arrays(arrays.size());
+    for (size_t i = 0; i < arrays.size(); ++i)
+    {
+        new_arrays[i] = remap_array(arrays[i], fetch_sources);
+        if (!new_arrays[i].valid())
+            return false;
+    }
+
+    for (size_t i = 0; i < arrays.size(); ++i)
+    {
+        const osg::Array *old_array = arrays[i].array;
+        osg::Array *array = new_arrays[i].get();
+        if (old_array == geometry.getVertexArray())
+            geometry.setVertexArray(array);
+        else if (old_array == geometry.getNormalArray())
+            geometry.setNormalArray(array, array->getBinding());
+        else if (old_array == geometry.getColorArray())
+            geometry.setColorArray(array, array->getBinding());
+        else if (old_array == geometry.getSecondaryColorArray())
+            geometry.setSecondaryColorArray(array, array->getBinding());
+        else if (old_array == geometry.getFogCoordArray())
+            geometry.setFogCoordArray(array, array->getBinding());
+        else
+        {
+            for (unsigned int unit = 0; unit < geometry.getNumTexCoordArrays(); ++unit)
+                if (old_array == geometry.getTexCoordArray(unit))
+                    geometry.setTexCoordArray(unit, array, array->getBinding());
+            const osg::Geometry::ArrayList &attribs = geometry.getVertexAttribArrayList();
+            for (unsigned int index = 0; index < attribs.size(); ++index)
+                if (old_array == attribs[index].get())
+                    geometry.setVertexAttribArray(index, array, array->getBinding());
+        }
+    }
+
+    geometry.removePrimitiveSet(0, geometry.getNumPrimitiveSets());
+    if (fetch_sources.size() < 65536)
+    {
+        geometry.addPrimitiveSet(new osg::DrawElementsUShort(osg::PrimitiveSet::TRIANGLES, indices.begin(), indices.end()));
+        geometry_stats.index_bytes_after = indices.size() * sizeof(GLushort);
+    }
+    else
+    {
+        geometry.addPrimitiveSet(new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES, indices.begin(), indices.end()));
+        geometry_stats.index_bytes_after = indices.size() * sizeof(GLuint);
+    }
+    geometry.dirtyDisplayList();
+    geometry.dirtyBound();
+
+    geometry_stats.vertices_after = fetch_sources.size();
+    geometry_stats.misses_after = simulateCache(indices, _cache_size);
+    if (stats)
+        *stats += geometry_stats;
+    return true;
+}
+
+unsigned long long GeometryOptimizer::simulateCache( const std::vector<unsigned int> &indices, unsigned int cache_size )
+{
+    if (indices.empty())
+        return 0;
+
+    // a vertex is in the fifo while fewer than cache_size misses happened since it was loaded
+    unsigned int max_index = *std::max_element(indices.begin(), indices.end());
+    std::vector<unsigned long long> loaded_at(size_t(max_index) + 1, ~0ULL);
+    unsigned long long misses = 0;
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        unsigned long long &stamp = loaded_at[indices[i]];
+        if (stamp == ~0ULL || misses - stamp >= cache_size)
+        {
+            stamp = misses;
+            ++misses;
+        }
+    }
+    return misses;
+}
+
+void GeometryOptimizer::addReport( const std::string &name, const Stats &stats )
+{
+    ScopedLock lock(_mutex);
+    _reports.push_back(std::make_pair(name, stats));
+}
+
+GeometryOptimizer::Stats GeometryOptimizer::getTotal( void ) const
+{
+    ScopedLock lock(_mutex);
+    Stats total;
+    for (size_t i = 0; i < _reports.size(); ++i)
+        total += _reports[i].second;
+    return total;
+}
+
+void GeometryOptimizer::writeReport( std::ostream &out ) const
+{
+    std::vector< std::pair<std::string, Stats> > reports;
+    {
+        ScopedLock lock(_mutex);
+        reports = _reports;
+    }
+    std::sort(reports.begin(), reports.end(), report_less);
+
+    Stats total;
+    out << "# tile geometries triangles vertices_before vertices_after acmr_before acmr_after index_bytes_before index_bytes_after" << std::endl;
+    out << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i <= reports.size(); ++i)
+    {
+        const bool is_total = i == reports.size();
+        if (!is_total)
+            total += reports[i].second;
+        const Stats &stats = is_total ? total : reports[i].second;
+        out << (is_total ? std::string("total") : reports[i].first) << " "
+            << stats.num_geometries << " " << stats.num_triangles << " "
+            << stats.vertices_before << " " << stats.vertices_after << " "
+            << stats.acmrBefore() << " " << stats.acmrAfter() << " "
+            << stats.index_bytes_before << " " << stats.index_bytes_after << std::endl;
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef _GEOMETRY_OPTIMIZER_H
+#define _GEOMETRY_OPTIMIZER_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include <osg/Node>
+#include <osg/Geometry>
+
+#include <OpenThreads/Mutex>
+
+/** prepares the triangles of a tile for drawing before it is written. the
+  * vertices that are equal in every attribute are welded, the triangles
+  * reordered for the post transform vertex cache (tom forsyth's linear
+  * speed optimizer), the vertices renumbered in order of first use for
+  * fetch locality, and the indices stored as 16 bit when the geometry has
+  * fewer than 65536 vertices. geometries with primitives other than
+  * triangles are left alone.*/
+class GeometryOptimizer {
+    public :
+        struct Stats
+        {
+            Stats(void);
+
+            unsigned int num_geometries;
+            unsigned long long num_triangles;
+            unsigned long long vertices_before;
+            unsigned long long vertices_after;
+            unsigned long long misses_before;
+            unsigned long long misses_after;
+            unsigned long long index_bytes_before;
+            unsigned long long index_bytes_after;
+
+            /** average cache miss ratio, vertices transformed per triangle.*/
+            double acmrBefore(void) const;
+            double acmrAfter(void) const;
+
+            Stats& operator += (const Stats &rhs);
+        };
+
+        /** cache_size is the fifo simulated for the statistics.*/
+        GeometryOptimizer( unsigned int cache_size = 16 );
+
+        /** a copy of node with optimized geometries. nodes, drawables and
+          * primitive sets are copied, node itself is not touched, so it may
+          * be shared with other threads.*/
+        osg::ref_ptr<osg::Node> optimize( const osg::Node &node, Stats *stats = 0 ) const;
+
+        /** optimize geometry in place, false if it was left alone.*/
+        bool optimize( osg::Geometry &geometry, Stats *stats = 0 ) const;
+
+        /** vertices transformed when drawing indices through a fifo cache of cache_size.*/
+        static unsigned long long simulateCache( const std::vector<unsigned int> &indices, unsigned int cache_size );
+
+        /** remember the statistics of a written tile for writeReport, thread safe.*/
+        void addReport( const std::string &name, const Stats &stats );
+
+        /** one line per reported tile and the total.*/
+        void writeReport( std::ostream &out ) const;
+        Stats getTotal(void) const;
+
+    private :
+        GeometryOptimizer( const GeometryOptimizer& ) {}
+        GeometryOptimizer& operator = (const GeometryOptimizer& ) { return *this; }
+
+        unsigned int _cache_size;
+
+        std::vector< std::pair<std::string, Stats> > _reports;
+        mutable OpenThreads::Mutex _mutex;
+};
+#endif
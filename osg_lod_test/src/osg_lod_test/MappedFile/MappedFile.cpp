@@ -0,0 +1,155 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "MappedFile.h"
+
+MappedFile::MappedFile( void ) :
+    _open(false),
+    _data(0),
+    _size(0)
+#ifdef _WIN32
+    , _file(INVALID_HANDLE_VALUE),
+    _mapping(0)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open( const std::string &filename )
+{
+    close();
+
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        CloseHandle(file);
+        return false;
+    }
+    _file = file;
+    _size = static_cast<size_t>(size.QuadPart);
+    _open = true;
+    if (_size == 0)
+        return true;
+
+    _mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+    if (_mapping)
+        _data = MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!_data)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close( void )
+{
+    if (_data)
+        UnmapViewOfFile(_data);
+    if (_mapping)
+        CloseHandle(_mapping);
+    if (_file != INVALID_HANDLE_VALUE)
+        CloseHandle(_file);
+    _data = 0;
+    _mapping = 0;
+    _file = INVALID_HANDLE_VALUE;
+    _size = 0;
+    _open = false;
+}
+
+#else
+
+bool MappedFile::open( const std::string &filename )
+{
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    _size = static_cast<size_t>(st.st_size);
+    _open = true;
+    if (_size > 0)
+    {
+        void *data = mmap(0, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            ::close(fd);
+            _size = 0;
+            _open = false;
+            return false;
+        }
+        madvise(data, _size, MADV_SEQUENTIAL);
+        _data = data;
+    }
+    // the mapping keeps the file referenced
+    ::close(fd);
+    return true;
+}
+
+void MappedFile::close( void )
+{
+    if (_data)
+        munmap(_data, _size);
+    _data = 0;
+    _size = 0;
+    _open = false;
+}
+
+#endif
+
+
+MemoryStreamBuf::MemoryStreamBuf( const char *data, size_t size )
+{
+    char *begin = const_cast<char*>(data);
+    setg(begin, begin, begin + size);
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekoff( off_type off, std::ios_base::seekdir dir,
+                                                     std::ios_base::openmode which )
+{
+    char *pos = gptr();
+    if (dir == std::ios_base::beg)
+        pos = eback() + off;
+    else if (dir == std::ios_base::cur)
+        pos = gptr() + off;
+    else
+        pos = egptr() + off;
+
+    if (!(which & std::ios_base::in) || pos < eback() || pos > egptr())
+        return pos_type(off_type(-1));
+
+    setg(eback(), pos, egptr());
+    return pos_type(pos - eback());
+}
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekpos( pos_type pos, std::ios_base::openmode which )
+{
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
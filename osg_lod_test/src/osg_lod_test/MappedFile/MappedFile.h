@@ -0,0 +1,53 @@
+#ifndef _MAPPED_FILE_H
+#define _MAPPED_FILE_H
+
+#include <string>
+#include <streambuf>
+
+/** read only memory mapping of a whole file. the pages are brought in by
+  * the os as they are touched, so several threads can parse different
+  * parts of a large file without reading it through a stream first.*/
+class MappedFile {
+    public :
+        MappedFile(void);
+        ~MappedFile();
+
+        /** map filename, false if it cannot be opened. an empty file maps
+          * to a null data pointer and a size of 0.*/
+        bool open( const std::string &filename );
+        void close(void);
+
+        bool valid(void) const { return _open; }
+        const char* data(void) const { return static_cast<const char*>(_data); }
+        size_t size(void) const { return _size; }
+
+    private :
+        MappedFile( const MappedFile& ) {}
+        MappedFile& operator = (const MappedFile& ) { return *this; }
+
+        bool _open;
+        void *_data;
+        size_t _size;
+#ifdef _WIN32
+        void *_file;
+        void *_mapping;
+#endif
+};
+
+/** read only streambuf over a block of memory, so a buffer that is already
+  * in memory can be handed to a ReaderWriter without another copy.*/
+class MemoryStreamBuf : public std::streambuf {
+    public :
+        MemoryStreamBuf( const char *data, size_t size );
+
+        /** the whole block, for readers that parse it in place.*/
+        const char* data(void) const { return eback(); }
+        size_t size(void) const { return egptr() - eback(); }
+
+    protected :
+        virtual pos_type seekoff( off_type off, std::ios_base::seekdir dir,
+                                  std::ios_base::openmode which = std::ios_base::in );
+        virtual pos_type seekpos( pos_type pos,
+                                  std::ios_base::openmode which = std::ios_base::in );
+};
+#endif
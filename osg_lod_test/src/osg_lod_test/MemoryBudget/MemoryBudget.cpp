@@ -0,0 +1,78 @@
+#include <cstdlib>
+#include <cctype>
+
+#include <OpenThreads/ScopedLock>
+
+#include "MemoryBudget.h"
+#include "Trace.h"
+
+typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+MemoryBudget::MemoryBudget( unsigned long long budget ) :
+    _budget(budget),
+    _working(0),
+    _held(0),
+    _peak(0),
+    _num_waits(0)
+{
+}
+
+void MemoryBudget::acquire( unsigned long long bytes )
+{
+    ScopedLock lock(_mutex);
+    if (_budget > 0 && bytes > 0 && _working > 0 && _working + _held + bytes > _budget)
+    {
+        Trace::Scope trace("memory_wait", "memory");
+        trace.arg("bytes", bytes);
+        ++_num_waits;
+        while (_working > 0 && _working + _held + bytes > _budget)
+            _condition.wait(&_mutex);
+    }
+    _working += bytes;
+    if (_working + _held > _peak)
+        _peak = _working + _held;
+}
+
+void MemoryBudget::release( unsigned long long bytes )
+{
+    ScopedLock lock(_mutex);
+    _working -= bytes < _working ? bytes : _working;
+    _condition.broadcast();
+}
+
+bool MemoryBudget::tryHold( unsigned long long bytes )
+{
+    ScopedLock lock(_mutex);
+    if (_budget > 0 && _working + _held + bytes > _budget)
+        return false;
+    _held += bytes;
+    if (_working + _held > _peak)
+        _peak = _working + _held;
+    return true;
+}
+
+void MemoryBudget::releaseHeld( unsigned long long bytes )
+{
+    ScopedLock lock(_mutex);
+    _held -= bytes < _held ? bytes : _held;
+    _condition.broadcast();
+}
+
+unsigned long long MemoryBudget::parseSize( const std::string &size )
+{
+    char *end = 0;
+    double value = strtod(size.c_str(), &end);
+    if (end == size.c_str() || value < 0.)
+        return 0;
+
+    double unit = 1024. * 1024.;
+    switch (toupper(*end))
+    {
+        case 'K': unit = 1024.; break;
+        case 'M': unit = 1024. * 1024.; break;
+        case 'G': unit = 1024. * 1024. * 1024.; break;
+        case 'T': unit = 1024. * 1024. * 1024. * 1024.; break;
+        default: break;
+    }
+    return static_cast<unsigned long long>(value * unit);
+}
@@ -0,0 +1,76 @@
+#ifndef _MEMORY_BUDGET_H
+#define _MEMORY_BUDGET_H
+
+#include <string>
+
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+
+/** bytes of tile data the builder may hold at once. a task reserves the
+  * working memory of a tile before loading it and blocks while the budget
+  * is used up, which throttles the build to as many tiles as fit. data
+  * held between tasks is only kept when it fits, the caller spills it to
+  * disk otherwise. a working reservation passes when no other one is
+  * active, so a tile larger than the budget still builds, one at a time.
+  * a budget of 0 is unlimited.*/
+class MemoryBudget {
+    public :
+        MemoryBudget( unsigned long long budget = 0 );
+
+        /** working memory of a running task, blocks until it fits.*/
+        void acquire( unsigned long long bytes );
+        void release( unsigned long long bytes );
+
+        /** memory held between tasks, false if it doesn't fit.*/
+        bool tryHold( unsigned long long bytes );
+        void releaseHeld( unsigned long long bytes );
+
+        bool limited(void) const { return _budget > 0; }
+        unsigned long long getBudget(void) const { return _budget; }
+        unsigned long long getPeak(void) const { return _peak; }
+        unsigned int getNumWaits(void) const { return _num_waits; }
+
+        /** "512M", "4G", "800000K", a plain number is megabytes. 0 if the
+          * size can't be read.*/
+        static unsigned long long parseSize( const std::string &size );
+
+        /** the working memory of a task, released when it goes out of scope.*/
+        class Reservation
+        {
+            public :
+                Reservation( MemoryBudget *budget, unsigned long long bytes ) :
+                    _budget(budget),
+                    _bytes(bytes)
+                {
+                    if (_budget)
+                        _budget->acquire(_bytes);
+                }
+
+                ~Reservation()
+                {
+                    if (_budget)
+                        _budget->release(_bytes);
+                }
+
+            private :
+                Reservation( const Reservation& ) {}
+                Reservation& operator = (const Reservation& ) { return *this; }
+
+                MemoryBudget *_budget;
+                unsigned long long _bytes;
+        };
+
+    private :
+        MemoryBudget( const MemoryBudget& ) {}
+        MemoryBudget& operator = (const MemoryBudget& ) { return *this; }
+
+        unsigned long long _budget;
+        unsigned long long _working;
+        unsigned long long _held;
+        unsigned long long _peak;
+        unsigned int _num_waits;
+
+        OpenThreads::Mutex _mutex;
+        OpenThreads::Condition _condition;
+};
+#endif
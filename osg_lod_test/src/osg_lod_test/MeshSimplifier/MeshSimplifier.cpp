@@ -0,0 +1,575 @@
+#include <map>
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include <unordered_map>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Array>
+#include <osg/Matrix>
+#include <osg/Transform>
+#include <osg/NodeVisitor>
+#include <osg/TriangleIndexFunctor>
+
+#include "MeshSimplifier.h"
+#include "DrawableMerger.h"
+
+namespace
+{
+    // weight of the planes that hold texture and normal seams in place
+    const double seam_weight = 10.;
+
+    // smallest cosine between a face normal before and after a collapse
+    const double min_normal_cosine = 0.2;
+
+    struct Quadric
+    {
+        Quadric() { for (int i = 0; i < 10; ++i) a[i] = 0.; }
+
+        // squared distance to the plane n.p + d = 0, times w
+        static Quadric plane( const osg::Vec3d &n, double d, double w )
+        {
+            Quadric q;
+            q.a[0] = w * n.x() * n.x(); q.a[1] = w * n.x() * n.y(); q.a[2] = w * n.x() * n.z(); q.a[3] = w * n.x() * d;
+            q.a[4] = w * n.y() * n.y(); q.a[5] = w * n.y() * n.z(); q.a[6] = w * n.y() * d;
+            q.a[7] = w * n.z() * n.z(); q.a[8] = w * n.z() * d;
+            q.a[9] = w * d * d;
+            return q;
+        }
+
+        Quadric& operator += ( const Quadric &q )
+        {
+            for (int i = 0; i < 10; ++i) a[i] += q.a[i];
+            return *this;
+        }
+
+        double error( const osg::Vec3d &p ) const
+        {
+            double x = p.x(), y = p.y(), z = p.z();
+            return a[0]*x*x + 2.*a[1]*x*y + 2.*a[2]*x*z + 2.*a[3]*x
+                 + a[4]*y*y + 2.*a[5]*y*z + 2.*a[6]*y
+                 + a[7]*z*z + 2.*a[8]*z
+                 + a[9];
+        }
+
+        double a[10];
+    };
+
+    // a vertex position together with the attributes one triangle corner
+    // sees there. a vertex with several wedges lies on a seam.
+    struct Wedge
+    {
+        unsigned int vertex;
+        unsigned int material;
+        osg::Vec3 normal;
+        osg::Vec2 uv;
+
+        bool operator < ( const Wedge &w ) const
+        {
+            if (vertex != w.vertex) return vertex < w.vertex;
+            if (material != w.material) return material < w.material;
+            if (normal != w.normal) return normal < w.normal;
+            return uv < w.uv;
+        }
+    };
+
+    struct Material
+    {
+        osg::ref_ptr<osg::StateSet> stateset;
+        bool normals;
+        bool texcoords;
+    };
+
+    struct Triangle
+    {
+        unsigned int v[3];
+        unsigned int w[3];
+        bool removed;
+
+        int corner( unsigned int vertex ) const
+        {
+            return v[0] == vertex ? 0 : (v[1] == vertex ? 1 : (v[2] == vertex ? 2 : -1));
+        }
+    };
+
+    struct Mesh
+    {
+        std::vector<osg::Vec3d> positions;
+        std::vector<Wedge> wedges;
+        std::vector<Material> materials;
+        std::vector<Triangle> triangles;
+
+        std::map<osg::Vec3d, unsigned int> position_ids;
+        std::map<Wedge, unsigned int> wedge_ids;
+        std::map<osg::StateSet*, unsigned int> material_ids;
+    };
+
+    // collects the triangles of every geometry below a node in world coordinates
+    class MeshCollector : public osg::NodeVisitor
+    {
+    public:
+        MeshCollector( Mesh &mesh ) :
+            osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+            _mesh(mesh)
+        {
+        }
+
+        virtual void apply( osg::Geode &geode )
+        {
+            osg::Matrix matrix = osg::computeLocalToWorld(getNodePath());
+            for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+            {
+                osg::Geometry *geometry = dynamic_cast<osg::Geometry*>(geode.getDrawable(i));
+                if (geometry)
+                    addGeometry(*geometry, geometry->getStateSet() ? geometry->getStateSet() : geode.getStateSet(), matrix);
+            }
+            traverse(geode);
+        }
+
+    private:
+        void addGeometry( osg::Geometry &geometry, osg::StateSet *stateset, const osg::Matrix &matrix )
+        {
+            const osg::Vec3Array *vertices = dynamic_cast<const osg::Vec3Array*>(geometry.getVertexArray());
+            if (!vertices || vertices->empty())
+                return;
+            const osg::Vec3Array *normals = dynamic_cast<const osg::Vec3Array*>(geometry.getNormalArray());
+            if (normals && (geometry.getNormalBinding() != osg::Geometry::BIND_PER_VERTEX || normals->size() != vertices->size()))
+                normals = 0;
+            const osg::Vec2Array *uvs = dynamic_cast<const osg::Vec2Array*>(geometry.getTexCoordArray(0));
+            if (uvs && uvs->size() != vertices->size())
+                uvs = 0;
+
+            std::map<osg::StateSet*, unsigned int>::iterator mitr = _mesh.material_ids.find(stateset);
+            if (mitr == _mesh.material_ids.end())
+            {
+                Material material;
+                material.stateset = stateset;
+                material.normals = false;
+                material.texcoords = false;
+                mitr = _mesh.material_ids.insert(std::make_pair(stateset, (unsigned int)_mesh.materials.size())).first;
+                _mesh.materials.push_back(material);
+            }
+            unsigned int material_id = mitr->second;
+            _mesh.materials[material_id].normals |= normals != 0;
+            _mesh.materials[material_id].texcoords |= uvs != 0;
+
+            bool identity = matrix.isIdentity();
+            osg::Matrix inverse;
+            if (!identity)
+                inverse.invert(matrix);
+
+            osg::TriangleIndexFunctor<DrawableMerger::TriangleIndices> triangles;
+            geometry.accept(triangles);
+
+            for (size_t i = 0; i + 2 < triangles.indices.size(); i += 3)
+            {
+                Triangle triangle;
+                triangle.removed = false;
+                bool valid = true;
+                for (int c = 0; c < 3; ++c)
+                {
+                    unsigned int index = triangles.indices[i + c];
+                    if (index >= vertices->size())
+                    {
+                        valid = false;
+                        break;
+                    }
+
+                    osg::Vec3d position = (*vertices)[index];
+                    Wedge wedge;
+                    wedge.material = material_id;
+                    wedge.normal = normals ? (*normals)[index] : osg::Vec3();
+                    wedge.uv = uvs ? (*uvs)[index] : osg::Vec2();
+                    if (!identity)
+                    {
+                        position = position * matrix;
+                        wedge.normal = osg::Matrix::transform3x3(inverse, wedge.normal);
+                        wedge.normal.normalize();
+                    }
+
+                    std::map<osg::Vec3d, unsigned int>::iterator pitr = _mesh.position_ids.find(position);
+                    if (pitr == _mesh.position_ids.end())
+                    {
+                        pitr = _mesh.position_ids.insert(std::make_pair(position, (unsigned int)_mesh.positions.size())).first;
+                        _mesh.positions.push_back(position);
+                    }
+                    wedge.vertex = pitr->second;
+
+                    std::map<Wedge, unsigned int>::iterator witr = _mesh.wedge_ids.find(wedge);
+                    if (witr == _mesh.wedge_ids.end())
+                    {
+                        witr = _mesh.wedge_ids.insert(std::make_pair(wedge, (unsigned int)_mesh.wedges.size())).first;
+                        _mesh.wedges.push_back(wedge);
+                    }
+                    triangle.v[c] = wedge.vertex;
+                    triangle.w[c] = witr->second;
+                }
+
+                if (valid && triangle.v[0] != triangle.v[1] && triangle.v[1] != triangle.v[2] && triangle.v[0] != triangle.v[2])
+                    _mesh.triangles.push_back(triangle);
+            }
+        }
+
+        Mesh &_mesh;
+    };
+
+    struct Candidate
+    {
+        double cost;
+        unsigned int from;
+        unsigned int to;
+        unsigned int from_version;
+        unsigned int to_version;
+
+        bool operator > ( const Candidate &c ) const { return cost > c.cost; }
+    };
+
+    struct EdgeInfo
+    {
+        EdgeInfo() : count(0), triangle(0), seam(false) {}
+        unsigned int count;
+        unsigned int triangle;
+        bool seam;
+    };
+
+    // half edge collapses of one welded mesh
+    class Collapser
+    {
+    public:
+        Collapser( Mesh &mesh ) :
+            _mesh(mesh),
+            _quadrics(mesh.positions.size()),
+            _triangles_of(mesh.positions.size()),
+            _locked(mesh.positions.size(), false),
+            _removed(mesh.positions.size(), false),
+            _versions(mesh.positions.size(), 0)
+        {
+        }
+
+        void run( size_t target )
+        {
+            std::vector<Triangle> &triangles = _mesh.triangles;
+            size_t num_live = triangles.size();
+            if (num_live <= target)
+                return;
+
+            typedef std::unordered_map<unsigned long long, EdgeInfo> EdgeMap;
+            EdgeMap edges;
+            for (size_t t = 0; t < triangles.size(); ++t)
+            {
+                const Triangle &triangle = triangles[t];
+                for (int c = 0; c < 3; ++c)
+                    _triangles_of[triangle.v[c]].push_back(t);
+
+                osg::Vec3d normal = faceNormal(triangle.v[0], triangle.v[1], triangle.v[2]);
+                double area = normal.normalize() * 0.5;
+                Quadric q = Quadric::plane(normal, -(normal * _mesh.positions[triangle.v[0]]), area);
+                for (int c = 0; c < 3; ++c)
+                {
+                    _quadrics[triangle.v[c]] += q;
+
+                    unsigned int a = triangle.v[c], b = triangle.v[(c + 1) % 3];
+                    EdgeInfo &edge = edges[edgeKey(a, b)];
+                    if (edge.count == 0)
+                        edge.triangle = t;
+                    else
+                    {
+                        const Triangle &first = triangles[edge.triangle];
+                        if (first.w[first.corner(a)] != triangle.w[c] ||
+                            first.w[first.corner(b)] != triangle.w[(c + 1) % 3])
+                            edge.seam = true;
+                    }
+                    ++edge.count;
+                }
+            }
+
+            for (EdgeMap::const_iterator itr = edges.begin(); itr != edges.end(); ++itr)
+            {
+                unsigned int a = (unsigned int)(itr->first >> 32), b = (unsigned int)(itr->first & 0xffffffff);
+                if (itr->second.count != 2)
+                {
+                    // open border of the block or non manifold, stays where it is
+                    _locked[a] = _locked[b] = true;
+                }
+                else if (itr->second.seam)
+                {
+                    // plane through the seam, perpendicular to the surface
+                    const Triangle &triangle = triangles[itr->second.triangle];
+                    osg::Vec3d normal = faceNormal(triangle.v[0], triangle.v[1], triangle.v[2]);
+                    normal.normalize();
+                    osg::Vec3d dir = _mesh.positions[b] - _mesh.positions[a];
+                    double length2 = dir.length2();
+                    osg::Vec3d side = dir ^ normal;
+                    if (side.normalize() > 0.)
+                    {
+                        Quadric q = Quadric::plane(side, -(side * _mesh.positions[a]), seam_weight * length2);
+                        _quadrics[a] += q;
+                        _quadrics[b] += q;
+                    }
+                }
+            }
+
+            for (EdgeMap::const_iterator itr = edges.begin(); itr != edges.end(); ++itr)
+                push((unsigned int)(itr->first >> 32), (unsigned int)(itr->first & 0xffffffff));
+            EdgeMap().swap(edges);
+
+            while (num_live > target && !_heap.empty())
+            {
+                Candidate candidate = _heap.top();
+                _heap.pop();
+                if (_removed[candidate.from] || _removed[candidate.to] ||
+                    _versions[candidate.from] != candidate.from_version ||
+                    _versions[candidate.to] != candidate.to_version)
+                    continue;
+
+                size_t num_removed = collapse(candidate.from, candidate.to);
+                if (num_removed == 0)
+                    continue;
+                num_live -= num_removed;
+
+                std::vector<unsigned int> neighbours;
+                collectNeighbours(candidate.to, neighbours);
+                for (size_t i = 0; i < neighbours.size(); ++i)
+                    push(candidate.to, neighbours[i]);
+            }
+        }
+
+    private:
+        static unsigned long long edgeKey( unsigned int a, unsigned int b )
+        {
+            if (a > b) std::swap(a, b);
+            return (static_cast<unsigned long long>(a) << 32) | b;
+        }
+
+        osg::Vec3d faceNormal( unsigned int a, unsigned int b, unsigned int c ) const
+        {
+            const osg::Vec3d &pa = _mesh.positions[a];
+            return (_mesh.positions[b] - pa) ^ (_mesh.positions[c] - pa);
+        }
+
+        void push( unsigned int a, unsigned int b )
+        {
+            Quadric q = _quadrics[a];
+            q += _quadrics[b];
+            if (!_locked[a])
+            {
+                Candidate candidate = { q.error(_mesh.positions[b]), a, b, _versions[a], _versions[b] };
+                _heap.push(candidate);
+            }
+            if (!_locked[b])
+            {
+                Candidate candidate = { q.error(_mesh.positions[a]), b, a, _versions[b], _versions[a] };
+                _heap.push(candidate);
+            }
+        }
+
+        // drops the removed triangles from the list of a vertex
+        std::vector<unsigned int>& liveTriangles( unsigned int vertex )
+        {
+            std::vector<unsigned int> &list = _triangles_of[vertex];
+            size_t n = 0;
+            for (size_t i = 0; i < list.size(); ++i)
+                if (!_mesh.triangles[list[i]].removed)
+                    list[n++] = list[i];
+            list.resize(n);
+            return list;
+        }
+
+        void collectNeighbours( unsigned int vertex, std::vector<unsigned int> &neighbours )
+        {
+            neighbours.clear();
+            const std::vector<unsigned int> &list = liveTriangles(vertex);
+            for (size_t i = 0; i < list.size(); ++i)
+            {
+                const Triangle &triangle = _mesh.triangles[list[i]];
+                for (int c = 0; c < 3; ++c)
+                    if (triangle.v[c] != vertex)
+                        neighbours.push_back(triangle.v[c]);
+            }
+            std::sort(neighbours.begin(), neighbours.end());
+            neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+        }
+
+        // moves from onto to, 0 if that would fold the surface or tear a seam
+        size_t collapse( unsigned int from, unsigned int to )
+        {
+            std::vector<Triangle> &triangles = _mesh.triangles;
+            std::vector<unsigned int> &around = liveTriangles(from);
+
+            std::vector<unsigned int> shared, moved;
+            for (size_t i = 0; i < around.size(); ++i)
+            {
+                if (triangles[around[i]].corner(to) >= 0)
+                    shared.push_back(around[i]);
+                else
+                    moved.push_back(around[i]);
+            }
+            if (shared.empty())
+                return 0;
+
+            // link condition, the edge may only have the shared triangles' far corners as common neighbours
+            std::vector<unsigned int> from_neighbours, to_neighbours, common;
+            collectNeighbours(from, from_neighbours);
+            collectNeighbours(to, to_neighbours);
+            std::set_intersection(from_neighbours.begin(), from_neighbours.end(),
+                                  to_neighbours.begin(), to_neighbours.end(), std::back_inserter(common));
+            if (common.size() != shared.size())
+                return 0;
+
+            // every wedge of from needs a shared triangle that tells which wedge of to replaces it
+            std::vector< std::pair<unsigned int, unsigned int> > wedge_map;
+            for (size_t i = 0; i < moved.size(); ++i)
+            {
+                const Triangle &triangle = triangles[moved[i]];
+                unsigned int wedge = triangle.w[triangle.corner(from)];
+                bool found = false;
+                for (size_t j = 0; j < wedge_map.size() && !found; ++j)
+                    found = wedge_map[j].first == wedge;
+                for (size_t j = 0; j < shared.size() && !found; ++j)
+                {
+                    const Triangle &s = triangles[shared[j]];
+                    if (s.w[s.corner(from)] == wedge)
+                    {
+                        wedge_map.push_back(std::make_pair(wedge, s.w[s.corner(to)]));
+                        found = true;
+                    }
+                }
+                if (!found)
+                    return 0;
+            }
+
+            const osg::Vec3d &target = _mesh.positions[to];
+            for (size_t i = 0; i < moved.size(); ++i)
+            {
+                const Triangle &triangle = triangles[moved[i]];
+                osg::Vec3d p[3];
+                for (int c = 0; c < 3; ++c)
+                    p[c] = _mesh.positions[triangle.v[c]];
+                osg::Vec3d before = (p[1] - p[0]) ^ (p[2] - p[0]);
+                p[triangle.corner(from)] = target;
+                osg::Vec3d after = (p[1] - p[0]) ^ (p[2] - p[0]);
+                if (after.normalize() <= 0. || before.normalize() <= 0. || before * after < min_normal_cosine)
+                    return 0;
+            }
+
+            for (size_t i = 0; i < shared.size(); ++i)
+                triangles[shared[i]].removed = true;
+            for (size_t i = 0; i < moved.size(); ++i)
+            {
+                Triangle &triangle = triangles[moved[i]];
+                int c = triangle.corner(from);
+                for (size_t j = 0; j < wedge_map.size(); ++j)
+                {
+                    if (wedge_map[j].first == triangle.w[c])
+                    {
+                        triangle.w[c] = wedge_map[j].second;
+                        break;
+                    }
+                }
+                triangle.v[c] = to;
+                _triangles_of[to].push_back(moved[i]);
+            }
+
+            _quadrics[to] += _quadrics[from];
+            std::vector<unsigned int>().swap(_triangles_of[from]);
+            _removed[from] = true;
+            ++_versions[from];
+            ++_versions[to];
+            return shared.size();
+        }
+
+        Mesh &_mesh;
+        std::vector<Quadric> _quadrics;
+        std::vector< std::vector<unsigned int> > _triangles_of;
+        std::vector<bool> _locked;
+        std::vector<bool> _removed;
+        std::vector<unsigned int> _versions;
+        std::priority_queue< Candidate, std::vector<Candidate>, std::greater<Candidate> > _heap;
+    };
+
+    osg::ref_ptr<osg::Node> build_geode( const Mesh &mesh )
+    {
+        osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+        std::vector<int> remap(mesh.wedges.size(), -1);
+        for (unsigned int m = 0; m < mesh.materials.size(); ++m)
+        {
+            const Material &material = mesh.materials[m];
+            osg::ref_ptr<osg::Vec3Array> vertices = new osg::Vec3Array;
+            osg::ref_ptr<osg::Vec3Array> normals = material.normals ? new osg::Vec3Array : 0;
+            osg::ref_ptr<osg::Vec2Array> uvs = material.texcoords ? new osg::Vec2Array : 0;
+            osg::ref_ptr<osg::DrawElementsUInt> elements = new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES);
+
+            for (size_t t = 0; t < mesh.triangles.size(); ++t)
+            {
+                const Triangle &triangle = mesh.triangles[t];
+                if (triangle.removed || mesh.wedges[triangle.w[0]].material != m)
+                    continue;
+                for (int c = 0; c < 3; ++c)
+                {
+                    unsigned int w = triangle.w[c];
+                    if (remap[w] < 0)
+                    {
+                        const Wedge &wedge = mesh.wedges[w];
+                        remap[w] = vertices->size();
+                        vertices->push_back(mesh.positions[wedge.vertex]);
+                        if (normals.valid()) normals->push_back(wedge.normal);
+                        if (uvs.valid()) uvs->push_back(wedge.uv);
+                    }
+                    elements->push_back(remap[w]);
+                }
+            }
+            if (elements->empty())
+                continue;
+
+            osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry;
+            geometry->setVertexArray(vertices.get());
+            if (normals.valid())
+                geometry->setNormalArray(normals.get(), osg::Array::BIND_PER_VERTEX);
+            if (uvs.valid())
+                geometry->setTexCoordArray(0, uvs.get(), osg::Array::BIND_PER_VERTEX);
+            geometry->addPrimitiveSet(elements.get());
+            geometry->setStateSet(material.stateset.get());
+            geode->addDrawable(geometry.get());
+        }
+
+        if (geode->getNumDrawables() == 0)
+            return 0;
+        return geode;
+    }
+}
+
+MeshSimplifier::MeshSimplifier( float ratio ) :
+    _ratio(ratio)
+{
+}
+
+osg::ref_ptr<osg::Node> MeshSimplifier::simplify( const std::vector< osg::ref_ptr<osg::Node> > &nodes ) const
+{
+    Mesh mesh;
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        if (!nodes[i].valid())
+            continue;
+        MeshCollector collector(mesh);
+        nodes[i]->accept(collector);
+    }
+    if (mesh.triangles.empty())
+        return 0;
+
+    // the lookup tables are only needed while welding
+    std::map<osg::Vec3d, unsigned int>().swap(mesh.position_ids);
+    std::map<Wedge, unsigned int>().swap(mesh.wedge_ids);
+
+    size_t target = static_cast<size_t>(mesh.triangles.size() * std::max(0.f, std::min(_ratio, 1.f)));
+    Collapser collapser(mesh);
+    collapser.run(std::max<size_t>(target, 1));
+
+    return build_geode(mesh);
+}
+
+osg::ref_ptr<osg::Node> MeshSimplifier::simplify( osg::Node &node ) const
+{
+    std::vector< osg::ref_ptr<osg::Node> > nodes(1, &node);
+    return simplify(nodes);
+}
@@ -0,0 +1,34 @@
+#ifndef _MESH_SIMPLIFIER_H
+#define _MESH_SIMPLIFIER_H
+
+#include <vector>
+
+#include <osg/Node>
+#include <osg/ref_ptr>
+
+/** quadric error metric simplification of a block of tiles into one
+  * coarser tile. the geometries of all nodes are welded by position into a
+  * single mesh so the seams between the tiles simplify like any other
+  * edge, then vertices are collapsed onto a neighbour in order of least
+  * quadric error until the triangle count is down to ratio. vertices on
+  * the open border of the block are locked, so the tile still meets the
+  * tiles around it without cracks. texture and normal seams only collapse
+  * along the seam, and every geometry keeps its StateSet.*/
+class MeshSimplifier {
+    public :
+        MeshSimplifier( float ratio = 0.25f );
+
+        /** fraction of the triangles to keep.*/
+        void setRatio( float ratio ) { _ratio = ratio; }
+        float getRatio(void) const { return _ratio; }
+
+        /** the simplified tile, a Geode with one Geometry per StateSet in
+          * world coordinates, or null if the nodes hold no triangles.
+          * simplify() keeps no state and may run on several threads.*/
+        osg::ref_ptr<osg::Node> simplify( const std::vector< osg::ref_ptr<osg::Node> > &nodes ) const;
+        osg::ref_ptr<osg::Node> simplify( osg::Node &node ) const;
+
+    private :
+        float _ratio;
+};
+#endif
@@ -0,0 +1,778 @@
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Material>
+#include <osg/Texture2D>
+#include <osg/StateSet>
+#include <osgDB/Registry>
+#include <osgDB/ReadFile>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+#include <osgUtil/SmoothingVisitor>
+
+#include "TileScheduler.h"
+#include "MappedFile.h"
+#include "TileCache.h"
+#include "ObjReader.h"
+
+namespace
+{
+    // chunks below this are not worth a thread
+    const size_t min_chunk_size = 1 << 20;
+
+    const double pow10_table[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    const size_t invalid_index = ~size_t(0);
+
+    inline bool is_space( char c )
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    inline const char* skip_spaces( const char *p, const char *end )
+    {
+        while (p < end && is_space(*p)) ++p;
+        return p;
+    }
+
+    inline const char* line_end( const char *p, const char *end )
+    {
+        const char *e = static_cast<const char*>(memchr(p, '\n', end - p));
+        return e ? e : end;
+    }
+
+    // plain decimal numbers as written by mesh tools, no locale and no stream
+    inline const char* parse_float( const char *p, const char *end, float &value )
+    {
+        p = skip_spaces(p, end);
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            negative = *p == '-';
+            ++p;
+        }
+
+        unsigned long long mantissa = 0;
+        int exponent = 0;
+        int num_digits = 0;
+        bool any = false;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p, any = true)
+        {
+            if (num_digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa) ++num_digits;
+            }
+            else
+                ++exponent;
+        }
+        if (p < end && *p == '.')
+        {
+            for (++p; p < end && *p >= '0' && *p <= '9'; ++p, any = true)
+            {
+                if (num_digits < 19)
+                {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    if (mantissa) ++num_digits;
+                    --exponent;
+                }
+            }
+        }
+        if (any && p < end && (*p == 'e' || *p == 'E'))
+        {
+            ++p;
+            bool negative_exponent = false;
+            if (p < end && (*p == '-' || *p == '+'))
+            {
+                negative_exponent = *p == '-';
+                ++p;
+            }
+            int e = 0;
+            for (; p < end && *p >= '0' && *p <= '9'; ++p)
+                if (e < 10000) e = e * 10 + (*p - '0');
+            exponent += negative_exponent ? -e : e;
+        }
+
+        double v = static_cast<double>(mantissa);
+        if (exponent < 0)
+            v = exponent >= -22 ? v / pow10_table[-exponent] : v * std::pow(10., exponent);
+        else if (exponent > 0)
+            v = exponent <= 22 ? v * pow10_table[exponent] : v * std::pow(10., exponent);
+        value = static_cast<float>(negative ? -v : v);
+
+        // skip whatever is left of a token we don't understand (nan, inf)
+        while (p < end && !is_space(*p) && *p != '\n') ++p;
+        return p;
+    }
+
+    inline const char* parse_int( const char *p, const char *end, long long &value )
+    {
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            negative = *p == '-';
+            ++p;
+        }
+        long long v = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p)
+            v = v * 10 + (*p - '0');
+        value = negative ? -v : v;
+        return p;
+    }
+
+    // one face corner, "v", "v/t", "v//n" or "v/t/n". 0 for a missing index.
+    inline const char* parse_corner( const char *p, const char *end, long long &v, long long &t, long long &n )
+    {
+        t = n = 0;
+        p = parse_int(p, end, v);
+        if (p < end && *p == '/')
+        {
+            ++p;
+            if (p < end && *p != '/')
+                p = parse_int(p, end, t);
+            if (p < end && *p == '/')
+                p = parse_int(p + 1, end, n);
+        }
+        while (p < end && !is_space(*p) && *p != '\n') ++p;
+        return p;
+    }
+
+    enum LineType { LINE_OTHER, LINE_VERTEX, LINE_TEXCOORD, LINE_NORMAL, LINE_FACE, LINE_USEMTL, LINE_MTLLIB };
+
+    inline bool keyword( const char *p, const char *end, const char *word, size_t length )
+    {
+        return size_t(end - p) > length && memcmp(p, word, length) == 0 && is_space(p[length]);
+    }
+
+    // classifies a line and moves p past its keyword
+    inline LineType line_type( const char *&p, const char *end )
+    {
+        p = skip_spaces(p, end);
+        if (p >= end) return LINE_OTHER;
+        switch (*p)
+        {
+        case 'v':
+            if (keyword(p, end, "v", 1)) { p += 1; return LINE_VERTEX; }
+            if (keyword(p, end, "vt", 2)) { p += 2; return LINE_TEXCOORD; }
+            if (keyword(p, end, "vn", 2)) { p += 2; return LINE_NORMAL; }
+            break;
+        case 'f':
+            if (keyword(p, end, "f", 1)) { p += 1; return LINE_FACE; }
+            break;
+        case 'u':
+            if (keyword(p, end, "usemtl", 6)) { p += 6; return LINE_USEMTL; }
+            break;
+        case 'm':
+            if (keyword(p, end, "mtllib", 6)) { p += 6; return LINE_MTLLIB; }
+            break;
+        }
+        return LINE_OTHER;
+    }
+
+    inline std::string rest_of_line( const char *p, const char *end )
+    {
+        p = skip_spaces(p, end);
+        while (end > p && is_space(end[-1])) --end;
+        return std::string(p, end);
+    }
+
+    inline osg::Vec3 rotate_to_z_up( const osg::Vec3 &v, bool rotate )
+    {
+        return rotate ? osg::Vec3(v.x(), -v.z(), v.y()) : v;
+    }
+
+    inline size_t resolve_index( long long index, size_t base, size_t local, size_t total )
+    {
+        long long resolved = index > 0 ? index - 1 : (index < 0 ? (long long)(base + local) + index : -1);
+        return resolved >= 0 && resolved < (long long)total ? size_t(resolved) : invalid_index;
+    }
+
+    // the triangles between two usemtl lines of a chunk
+    struct MaterialRun
+    {
+        MaterialRun() : named(false), num_triangles(0), texcoords(false), normals(false), material(0), offset(0) {}
+        std::string name;
+        bool named;
+        size_t num_triangles;
+        bool texcoords;
+        bool normals;
+        unsigned int material;
+        size_t offset;
+    };
+
+    struct Chunk
+    {
+        Chunk() : begin(0), end(0), num_vertices(0), num_texcoords(0), num_normals(0),
+                  vertex_base(0), texcoord_base(0), normal_base(0) {}
+        const char *begin;
+        const char *end;
+        size_t num_vertices;
+        size_t num_texcoords;
+        size_t num_normals;
+        size_t vertex_base;
+        size_t texcoord_base;
+        size_t normal_base;
+        std::vector<MaterialRun> runs;
+        std::vector<std::string> libraries;
+    };
+
+    struct MaterialOutput
+    {
+        MaterialOutput() : num_triangles(0), texcoords(false), normals(false) {}
+        std::string name;
+        size_t num_triangles;
+        bool texcoords;
+        bool normals;
+        osg::ref_ptr<osg::Vec3Array> vertices;
+        osg::ref_ptr<osg::Vec3Array> normal_array;
+        osg::ref_ptr<osg::Vec2Array> texcoord_array;
+    };
+
+    struct ParseState
+    {
+        bool rotate;
+        std::vector<Chunk> chunks;
+        std::vector<osg::Vec3> vertices;
+        std::vector<osg::Vec2> texcoords;
+        std::vector<osg::Vec3> normals;
+        std::vector<MaterialOutput> materials;
+    };
+
+    void count_chunk( Chunk &chunk )
+    {
+        chunk.runs.push_back(MaterialRun());
+        for (const char *line = chunk.begin; line < chunk.end; )
+        {
+            const char *end = line_end(line, chunk.end);
+            const char *p = line;
+            switch (line_type(p, end))
+            {
+            case LINE_VERTEX: ++chunk.num_vertices; break;
+            case LINE_TEXCOORD: ++chunk.num_texcoords; break;
+            case LINE_NORMAL: ++chunk.num_normals; break;
+            case LINE_FACE:
+                {
+                    MaterialRun &run = chunk.runs.back();
+                    size_t num_corners = 0;
+                    for (p = skip_spaces(p, end); p < end; p = skip_spaces(p, end))
+                    {
+                        const char *token = p;
+                        while (p < end && !is_space(*p)) ++p;
+                        if (num_corners++ == 0)
+                        {
+                            const char *slash = static_cast<const char*>(memchr(token, '/', p - token));
+                            if (slash)
+                            {
+                                run.texcoords |= slash + 1 < p && slash[1] != '/';
+                                run.normals |= memchr(slash + 1, '/', p - slash - 1) != 0;
+                            }
+                        }
+                    }
+                    if (num_corners >= 3)
+                        run.num_triangles += num_corners - 2;
+                }
+                break;
+            case LINE_USEMTL:
+                chunk.runs.push_back(MaterialRun());
+                chunk.runs.back().name = rest_of_line(p, end);
+                chunk.runs.back().named = true;
+                break;
+            case LINE_MTLLIB:
+                chunk.libraries.push_back(rest_of_line(p, end));
+                break;
+            default:
+                break;
+            }
+            line = end + 1;
+        }
+    }
+
+    void parse_vertices( ParseState &state, const Chunk &chunk )
+    {
+        osg::Vec3 *vertex = state.vertices.empty() ? 0 : &state.vertices[chunk.vertex_base];
+        osg::Vec2 *texcoord = state.texcoords.empty() ? 0 : &state.texcoords[chunk.texcoord_base];
+        osg::Vec3 *normal = state.normals.empty() ? 0 : &state.normals[chunk.normal_base];
+        for (const char *line = chunk.begin; line < chunk.end; )
+        {
+            const char *end = line_end(line, chunk.end);
+            const char *p = line;
+            osg::Vec3 v;
+            switch (line_type(p, end))
+            {
+            case LINE_VERTEX:
+                p = parse_float(p, end, v.x());
+                p = parse_float(p, end, v.y());
+                p = parse_float(p, end, v.z());
+                *vertex++ = rotate_to_z_up(v, state.rotate);
+                break;
+            case LINE_TEXCOORD:
+                p = parse_float(p, end, v.x());
+                p = parse_float(p, end, v.y());
+                *texcoord++ = osg::Vec2(v.x(), v.y());
+                break;
+            case LINE_NORMAL:
+                p = parse_float(p, end, v.x());
+                p = parse_float(p, end, v.y());
+                p = parse_float(p, end, v.z());
+                *normal++ = rotate_to_z_up(v, state.rotate);
+                break;
+            default:
+                break;
+            }
+            line = end + 1;
+        }
+    }
+
+    void parse_faces( ParseState &state, const Chunk &chunk )
+    {
+        size_t num_vertices = 0, num_texcoords = 0, num_normals = 0;
+        size_t i_run = 0;
+        size_t write = chunk.runs[0].offset;
+        std::vector<size_t> corners;
+        for (const char *line = chunk.begin; line < chunk.end; )
+        {
+            const char *end = line_end(line, chunk.end);
+            const char *p = line;
+            switch (line_type(p, end))
+            {
+            case LINE_VERTEX: ++num_vertices; break;
+            case LINE_TEXCOORD: ++num_texcoords; break;
+            case LINE_NORMAL: ++num_normals; break;
+            case LINE_USEMTL:
+                ++i_run;
+                write = chunk.runs[i_run].offset;
+                break;
+            case LINE_FACE:
+                {
+                    corners.clear();
+                    for (p = skip_spaces(p, end); p < end; p = skip_spaces(p, end))
+                    {
+                        long long v = 0, t = 0, n = 0;
+                        p = parse_corner(p, end, v, t, n);
+                        corners.push_back(resolve_index(v, chunk.vertex_base, num_vertices, state.vertices.size()));
+                        corners.push_back(resolve_index(t, chunk.texcoord_base, num_texcoords, state.texcoords.size()));
+                        corners.push_back(resolve_index(n, chunk.normal_base, num_normals, state.normals.size()));
+                    }
+
+                    MaterialOutput &material = state.materials[chunk.runs[i_run].material];
+                    size_t num_corners = corners.size() / 3;
+                    for (size_t i_c = 1; i_c + 1 < num_corners; ++i_c)
+                    {
+                        size_t fan[3] = { 0, i_c, i_c + 1 };
+                        for (int k = 0; k < 3; ++k)
+                        {
+                            const size_t *corner = &corners[fan[k] * 3];
+                            size_t out = write * 3 + k;
+                            (*material.vertices)[out] = corner[0] != invalid_index ? state.vertices[corner[0]] : osg::Vec3();
+                            if (material.texcoords)
+                                (*material.texcoord_array)[out] = corner[1] != invalid_index ? state.texcoords[corner[1]] : osg::Vec2();
+                            if (material.normals)
+                                (*material.normal_array)[out] = corner[2] != invalid_index ? state.normals[corner[2]] : osg::Vec3();
+                        }
+                        ++write;
+                    }
+                }
+                break;
+            default:
+                break;
+            }
+            line = end + 1;
+        }
+    }
+
+    class ChunkTask : public TileTask
+    {
+        public :
+            enum Pass { COUNT, VERTICES, FACES };
+
+            ChunkTask( Pass pass, ParseState &state, Chunk &chunk ) :
+                _pass(pass), _state(state), _chunk(chunk)
+            {
+            }
+
+            virtual void run( TileScheduler & )
+            {
+                process();
+            }
+
+            void process(void)
+            {
+                if (_pass == COUNT)
+                    count_chunk(_chunk);
+                else if (_pass == VERTICES)
+                    parse_vertices(_state, _chunk);
+                else
+                    parse_faces(_state, _chunk);
+            }
+
+        private :
+            Pass _pass;
+            ParseState &_state;
+            Chunk &_chunk;
+    };
+
+    void run_pass( ChunkTask::Pass pass, ParseState &state, unsigned int num_threads )
+    {
+        if (state.chunks.size() == 1 || num_threads <= 1)
+        {
+            for (size_t i = 0; i < state.chunks.size(); ++i)
+            {
+                osg::ref_ptr<ChunkTask> task = new ChunkTask(pass, state, state.chunks[i]);
+                task->process();
+            }
+            return;
+        }
+
+        TileScheduler scheduler(num_threads);
+        for (size_t i = 0; i < state.chunks.size(); ++i)
+            scheduler.add(new ChunkTask(pass, state, state.chunks[i]));
+        scheduler.run();
+    }
+
+    struct MtlMaterial
+    {
+        MtlMaterial() :
+            ambient(0.2f, 0.2f, 0.2f, 1.f), diffuse(0.8f, 0.8f, 0.8f, 1.f),
+            specular(0.f, 0.f, 0.f, 1.f), emission(0.f, 0.f, 0.f, 1.f),
+            shininess(0.f), alpha(1.f) {}
+        osg::Vec4 ambient;
+        osg::Vec4 diffuse;
+        osg::Vec4 specular;
+        osg::Vec4 emission;
+        float shininess;
+        float alpha;
+        std::string diffuse_map;
+    };
+
+    void read_mtl( const std::string &filename, std::map<std::string, MtlMaterial> &materials )
+    {
+        std::ifstream file(filename.c_str());
+        MtlMaterial *material = 0;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            const char *p = line.c_str(), *end = p + line.size();
+            p = skip_spaces(p, end);
+            const char *word = p;
+            while (p < end && !is_space(*p)) ++p;
+            std::string key(word, p);
+
+            if (key == "newmtl")
+            {
+                material = &materials[rest_of_line(p, end)];
+                continue;
+            }
+            if (!material)
+                continue;
+
+            osg::Vec4 *color = key == "Ka" ? &material->ambient : key == "Kd" ? &material->diffuse :
+                               key == "Ks" ? &material->specular : key == "Ke" ? &material->emission : 0;
+            if (color)
+            {
+                p = parse_float(p, end, color->x());
+                p = parse_float(p, end, color->y());
+                p = parse_float(p, end, color->z());
+            }
+            else if (key == "Ns")
+                parse_float(p, end, material->shininess);
+            else if (key == "d")
+                parse_float(p, end, material->alpha);
+            else if (key == "Tr")
+            {
+                float transparency = 0.f;
+                parse_float(p, end, transparency);
+                material->alpha = 1.f - transparency;
+            }
+            else if (key == "map_Kd")
+            {
+                // the file name is the last token, options like -s come first
+                std::string rest = rest_of_line(p, end);
+                std::string::size_type pos = rest.find_last_of(" \t");
+                material->diffuse_map = pos == std::string::npos ? rest : rest.substr(pos + 1);
+            }
+        }
+    }
+
+    std::string find_file( const std::string &name, const std::string &directory, const osgDB::Options *options )
+    {
+        std::string path = osgDB::findDataFile(osgDB::concatPaths(directory, name), options);
+        return path.empty() ? osgDB::findDataFile(name, options) : path;
+    }
+
+    osg::ref_ptr<osg::StateSet> create_stateset( const MtlMaterial &mtl, const std::string &directory,
+                                                 const osgDB::Options *options )
+    {
+        osg::ref_ptr<osg::StateSet> stateset = new osg::StateSet;
+
+        osg::ref_ptr<osg::Material> material = new osg::Material;
+        material->setAmbient(osg::Material::FRONT_AND_BACK, osg::Vec4(mtl.ambient.x(), mtl.ambient.y(), mtl.ambient.z(), mtl.alpha));
+        material->setDiffuse(osg::Material::FRONT_AND_BACK, osg::Vec4(mtl.diffuse.x(), mtl.diffuse.y(), mtl.diffuse.z(), mtl.alpha));
+        material->setSpecular(osg::Material::FRONT_AND_BACK, osg::Vec4(mtl.specular.x(), mtl.specular.y(), mtl.specular.z(), mtl.alpha));
+        material->setEmission(osg::Material::FRONT_AND_BACK, osg::Vec4(mtl.emission.x(), mtl.emission.y(), mtl.emission.z(), mtl.alpha));
+        material->setShininess(osg::Material::FRONT_AND_BACK, std::min(mtl.shininess / 1000.f * 128.f, 128.f));
+        stateset->setAttribute(material.get());
+
+        if (mtl.alpha < 1.f)
+        {
+            stateset->setMode(GL_BLEND, osg::StateAttribute::ON);
+            stateset->setRenderingHint(osg::StateSet::TRANSPARENT_BIN);
+        }
+
+        if (!mtl.diffuse_map.empty())
+        {
+            std::string path = find_file(mtl.diffuse_map, directory, options);
+            osg::ref_ptr<osg::Image> image = path.empty() ? 0 : osgDB::readImageFile(path, options);
+            if (image.valid())
+            {
+                osg::ref_ptr<osg::Texture2D> texture = new osg::Texture2D(image.get());
+                texture->setWrap(osg::Texture::WRAP_S, osg::Texture::REPEAT);
+                texture->setWrap(osg::Texture::WRAP_T, osg::Texture::REPEAT);
+                stateset->setTextureAttributeAndModes(0, texture.get(), osg::StateAttribute::ON);
+            }
+            else
+                osg::notify(osg::NOTICE)<<"texture "<<mtl.diffuse_map<<" not found."<<std::endl;
+        }
+        return stateset;
+    }
+}
+
+// ahead of the obj plugin, which the registry only loads when no reader takes the extension
+static osgDB::RegisterReaderWriterProxy<ObjReader> g_obj_reader_proxy;
+
+ObjReader::ObjReader( void ) :
+    _num_threads(1)
+{
+    supportsExtension("obj", "Alias Wavefront OBJ format");
+}
+
+ObjReader::ReadResult ObjReader::readNode( const std::string &filename, const Options *options ) const
+{
+    if (!acceptsExtension(osgDB::getLowerCaseFileExtension(filename)))
+        return ReadResult::FILE_NOT_HANDLED;
+
+    std::string path = osgDB::findDataFile(filename, options);
+    if (path.empty())
+        return ReadResult::FILE_NOT_FOUND;
+
+    osg::ref_ptr<osg::Node> node = TileCache::read(path, options);
+    if (node.valid())
+        return ReadResult(node.get());
+
+    MappedFile file;
+    if (!file.open(path))
+        return ReadResult::ERROR_IN_READING_FILE;
+
+    node = parse(file.data(), file.size(), osgDB::getFilePath(path), options);
+    TileCache::write(path, *node, options);
+    return ReadResult(node.get());
+}
+
+bool ObjReader::references( const std::string &filename, std::vector<std::string> &files )
+{
+    MappedFile file;
+    if (!file.open(filename))
+        return false;
+
+    std::vector<std::string> libraries;
+    const char *line = file.data(), *data_end = line + file.size();
+    while (line < data_end)
+    {
+        const char *end = static_cast<const char*>(memchr(line, '\n', data_end - line));
+        if (!end)
+            end = data_end;
+        const char *p = skip_spaces(line, end);
+        if (keyword(p, end, "mtllib", 6))
+            libraries.push_back(rest_of_line(p + 6, end));
+        line = end + 1;
+    }
+
+    // the maps resolve against the directory of the obj like in create_stateset
+    std::string directory = osgDB::getFilePath(filename);
+    bool found = true;
+    for (size_t i = 0; i < libraries.size(); ++i)
+    {
+        std::string path = find_file(libraries[i], directory, 0);
+        if (path.empty())
+        {
+            found = false;
+            continue;
+        }
+        files.push_back(path);
+
+        std::ifstream mtl(path.c_str());
+        std::string mtl_line;
+        while (std::getline(mtl, mtl_line))
+        {
+            const char *p = mtl_line.c_str(), *end = p + mtl_line.size();
+            p = skip_spaces(p, end);
+            const char *word = p;
+            while (p < end && !is_space(*p)) ++p;
+            std::string key(word, p);
+            if (key.compare(0, 4, "map_") != 0 && key != "bump" && key != "disp" && key != "decal")
+                continue;
+
+            // the file name is the last token, options like -s come first
+            std::string rest = rest_of_line(p, end);
+            std::string::size_type pos = rest.find_last_of(" \t");
+            std::string name = pos == std::string::npos ? rest : rest.substr(pos + 1);
+            if (name.empty())
+                continue;
+            std::string map = find_file(name, directory, 0);
+            if (map.empty())
+                found = false;
+            else
+                files.push_back(map);
+        }
+    }
+    return found;
+}
+
+ObjReader::ReadResult ObjReader::readNode( std::istream &fin, const Options *options ) const
+{
+    std::string directory;
+    if (options && !options->getDatabasePathList().empty())
+        directory = options->getDatabasePathList().front();
+
+    // TileIO hands over the whole file in memory, parse it where it is
+    MemoryStreamBuf *buf = dynamic_cast<MemoryStreamBuf*>(fin.rdbuf());
+    if (buf)
+        return ReadResult(parse(buf->data(), buf->size(), directory, options).get());
+
+    std::string text((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+    return ReadResult(parse(text.data(), text.size(), directory, options).get());
+}
+
+osg::ref_ptr<osg::Node> ObjReader::parse( const char *data, size_t size, const std::string &directory,
+                                          const Options *options ) const
+{
+    ParseState state;
+    state.rotate = !(options && options->getOptionString().find("noRotation") != std::string::npos);
+
+    // newline aligned chunks, a few per thread
+    unsigned int num_threads = _num_threads ? _num_threads : TileScheduler::defaultNumThreads();
+    size_t chunk_size = size / (num_threads * 4) + 1;
+    if (chunk_size < min_chunk_size) chunk_size = min_chunk_size;
+    const char *end = data + size;
+    for (const char *begin = data; begin < end; )
+    {
+        const char *chunk_end = size_t(end - begin) > chunk_size ? line_end(begin + chunk_size, end) : end;
+        if (chunk_end < end) ++chunk_end;
+        Chunk chunk;
+        chunk.begin = begin;
+        chunk.end = chunk_end;
+        state.chunks.push_back(chunk);
+        begin = chunk_end;
+    }
+
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    if (state.chunks.empty())
+        return geode;
+
+    run_pass(ChunkTask::COUNT, state, num_threads);
+
+    // lay out the arrays: element bases per chunk, materials in order of
+    // first use, the runs of every material in file order.
+    std::map<std::string, unsigned int> material_ids;
+    std::vector<std::string> libraries;
+    std::string current;
+    size_t num_vertices = 0, num_texcoords = 0, num_normals = 0;
+    for (size_t i = 0; i < state.chunks.size(); ++i)
+    {
+        Chunk &chunk = state.chunks[i];
+        chunk.vertex_base = num_vertices;
+        chunk.texcoord_base = num_texcoords;
+        chunk.normal_base = num_normals;
+        num_vertices += chunk.num_vertices;
+        num_texcoords += chunk.num_texcoords;
+        num_normals += chunk.num_normals;
+        libraries.insert(libraries.end(), chunk.libraries.begin(), chunk.libraries.end());
+
+        for (size_t i_r = 0; i_r < chunk.runs.size(); ++i_r)
+        {
+            MaterialRun &run = chunk.runs[i_r];
+            if (run.named)
+                current = run.name;
+            if (run.num_triangles == 0)
+                continue;
+
+            std::map<std::string, unsigned int>::iterator itr = material_ids.find(current);
+            if (itr == material_ids.end())
+            {
+                itr = material_ids.insert(std::make_pair(current, (unsigned int)state.materials.size())).first;
+                state.materials.push_back(MaterialOutput());
+                state.materials.back().name = current;
+            }
+            MaterialOutput &material = state.materials[itr->second];
+            run.material = itr->second;
+            run.offset = material.num_triangles;
+            material.num_triangles += run.num_triangles;
+            material.texcoords |= run.texcoords && num_texcoords > 0;
+            material.normals |= run.normals;
+        }
+    }
+
+    // texcoords may be declared after the faces that use them, decide once all are counted
+    for (size_t i = 0; i < state.materials.size(); ++i)
+    {
+        MaterialOutput &material = state.materials[i];
+        material.texcoords = material.texcoords && num_texcoords > 0;
+        material.normals = material.normals && num_normals > 0;
+        size_t num_corners = material.num_triangles * 3;
+        material.vertices = new osg::Vec3Array(num_corners);
+        if (material.texcoords) material.texcoord_array = new osg::Vec2Array(num_corners);
+        if (material.normals) material.normal_array = new osg::Vec3Array(num_corners);
+    }
+    state.vertices.resize(num_vertices);
+    state.texcoords.resize(num_texcoords);
+    state.normals.resize(num_normals);
+
+    run_pass(ChunkTask::VERTICES, state, num_threads);
+    run_pass(ChunkTask::FACES, state, num_threads);
+
+    std::vector<osg::Vec3>().swap(state.vertices);
+    std::vector<osg::Vec2>().swap(state.texcoords);
+    std::vector<osg::Vec3>().swap(state.normals);
+
+    std::map<std::string, MtlMaterial> mtl_materials;
+    for (size_t i = 0; i < libraries.size(); ++i)
+    {
+        std::string path = find_file(libraries[i], directory, options);
+        if (!path.empty())
+            read_mtl(path, mtl_materials);
+    }
+
+    for (size_t i = 0; i < state.materials.size(); ++i)
+    {
+        MaterialOutput &material = state.materials[i];
+
+        osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry;
+        geometry->setName(material.name);
+        geometry->setVertexArray(material.vertices.get());
+        if (material.normals)
+            geometry->setNormalArray(material.normal_array.get(), osg::Array::BIND_PER_VERTEX);
+        if (material.texcoords)
+            geometry->setTexCoordArray(0, material.texcoord_array.get(), osg::Array::BIND_PER_VERTEX);
+        geometry->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::TRIANGLES, 0, material.num_triangles * 3));
+
+        std::map<std::string, MtlMaterial>::const_iterator itr = mtl_materials.find(material.name);
+        if (itr != mtl_materials.end())
+            geometry->setStateSet(create_stateset(itr->second, directory, options).get());
+
+        // like the obj plugin, smooth normals where the file has none
+        if (!material.normals)
+            osgUtil::SmoothingVisitor::smooth(*geometry);
+
+        geode->addDrawable(geometry.get());
+    }
+
+    return geode;
+}
@@ -0,0 +1,48 @@
+#ifndef _OBJ_READER_H
+#define _OBJ_READER_H
+
+#include <string>
+#include <vector>
+
+#include <osg/Node>
+#include <osgDB/ReaderWriter>
+
+/** wavefront obj reader for large mesh tiles. the file is memory mapped
+  * and cut into newline aligned chunks that can be parsed on several
+  * threads: one pass counts the elements of every chunk, a second parses the
+  * v/vt/vn lines into arrays sized from the counts and a third writes the
+  * triangles of every material straight into their final arrays. the
+  * result is a Geode with one Geometry per material, rotated to z up like
+  * the stock obj plugin does ("noRotation" turns that off).
+  *
+  * registered ahead of the obj plugin, so osgDB::readNodeFile and TileIO
+  * load every .obj through it. a stream backed by a MemoryStreamBuf is
+  * parsed in place.*/
+class ObjReader : public osgDB::ReaderWriter {
+    public :
+        ObjReader(void);
+
+        virtual const char* className() const { return "memory mapped obj reader"; }
+
+        virtual ReadResult readNode( const std::string &filename, const Options *options = 0 ) const;
+        virtual ReadResult readNode( std::istream &fin, const Options *options = 0 ) const;
+
+        /** parse size bytes of obj text, material libraries resolve against directory.*/
+        osg::ref_ptr<osg::Node> parse( const char *data, size_t size, const std::string &directory,
+                                       const Options *options = 0 ) const;
+
+        /** the mtl libraries of an obj file and the texture maps of their
+          * materials, found the way the reader finds them. false if one of
+          * them is missing.*/
+        static bool references( const std::string &filename, std::vector<std::string> &files );
+
+        /** 1 by default: the registry's reader runs on the build and io
+          * threads, one tile per thread already. 0 uses one thread per
+          * processor.*/
+        void setNumThreads( unsigned int num_threads ) { _num_threads = num_threads; }
+        unsigned int getNumThreads(void) const { return _num_threads; }
+
+    private :
+        unsigned int _num_threads;
+};
+#endif
@@ -1,9 +1,16 @@
 #include <stdio.h>
+#include <vector>
+#include <algorithm>
 
 #include <osg/MatrixTransform>
-#include <osgUtil/Optimizer>
+#include <osg/Geometry>
+#include <osg/PagedLOD>
+#include <osg/NodeVisitor>
+#include <osg/Notify>
 
 #include "OrientationConverter.h"
+#include "VertexTransform.h"
+#include "Trace.h"
 
 using namespace osg;
 
@@ -47,7 +54,7 @@ void OrientationConverter::useWorldFrame( bool worldFrame )
    _use_world_frame = worldFrame;
 }
 
-Node* OrientationConverter::convert( Node *node )
+Matrix OrientationConverter::getMatrix( const Node &node ) const
 {
     // Order of operations here is :
     // 1. If world frame option not set, translate to world origin (0,0,0)
@@ -57,42 +64,193 @@ Node* OrientationConverter::convert( Node *node )
     //        - translate to absolute translation in world coordinates
     //    else if world frame option not set,
     //        - translate back to model's original origin.
-    BoundingSphere bs = node->getBound();
-    Matrix C;
-
     if (_use_world_frame)
+        return R * S * T;
+
+    BoundingSphere bs = node.getBound();
+    Matrix C = Matrix::translate( -bs.center() );
+    Matrix back = _trans_set ? T : Matrix::translate( bs.center() );
+    return C * R * S * back;
+}
+
+Node* OrientationConverter::convert( Node *node )
+{
+    return bake(node);
+}
+
+namespace
+{
+    class BakeVisitor : public osg::NodeVisitor
     {
-        C.makeIdentity();
-    }
-    else
+        public :
+            BakeVisitor( const Matrix &matrix ) :
+                osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+                _matrix(matrix),
+                _transform(toMatrix3x4(matrix)),
+                _num_vertices(0)
+            {
+                Vec3d scale = matrix.getScale();
+                _scale = (scale.x() + scale.y() + scale.z()) / 3.;
+            }
+
+            virtual void apply( osg::Node &node )
+            {
+                if (once(node))
+                    traverse(node);
+            }
+
+            virtual void apply( osg::Transform &transform )
+            {
+                if (!once(transform))
+                    return;
+                if (transform.getReferenceFrame() != osg::Transform::RELATIVE_RF)
+                    return;
+
+                // a transform that is not a matrix can't take the bake, a
+                // matrix transform above it does. the root has no parent and
+                // is wrapped by bake()
+                osg::ref_ptr<osg::MatrixTransform> baked = new osg::MatrixTransform(_matrix);
+                baked->setDataVariance(osg::Object::STATIC);
+                osg::Node::ParentList parents = transform.getParents();
+                for (size_t i = 0; i < parents.size(); ++i)
+                    parents[i]->replaceChild(&transform, baked.get());
+                baked->addChild(&transform);
+            }
+
+            virtual void apply( osg::MatrixTransform &transform )
+            {
+                // the subgraph is in the frame of the transform
+                if (once(transform))
+                    transform.setMatrix(transform.getMatrix() * _matrix);
+            }
+
+            virtual void apply( osg::LOD &lod )
+            {
+                if (!once(lod))
+                    return;
+                bakeLOD(lod);
+                traverse(lod);
+            }
+
+            virtual void apply( osg::PagedLOD &plod )
+            {
+                if (!once(plod))
+                    return;
+                bakeLOD(plod);
+                traverse(plod);
+            }
+
+            virtual void apply( osg::Geode &geode )
+            {
+                if (!once(geode))
+                    return;
+                for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+                {
+                    osg::Geometry *geometry = geode.getDrawable(i)->asGeometry();
+                    if (!geometry || (geometry->getNumParents() > 1 && !first(geometry)))
+                        continue;
+
+                    osg::Vec3Array *vertices = dynamic_cast<osg::Vec3Array*>(geometry->getVertexArray());
+                    if (vertices && (vertices->referenceCount() == 1 || first(vertices)))
+                    {
+                        _transform.transformVertices(*vertices);
+                        _num_vertices += vertices->size();
+                    }
+                    osg::Vec3Array *normals = dynamic_cast<osg::Vec3Array*>(geometry->getNormalArray());
+                    if (normals && (normals->referenceCount() == 1 || first(normals)))
+                        _transform.transformNormals(*normals);
+
+                    // dirties the geode and every parent up to one that was dirty already
+                    geometry->dirtyBound();
+                }
+            }
+
+            unsigned int getNumVertices(void) const { return _num_vertices; }
+
+        private :
+            static VertexTransform::Matrix3x4 toMatrix3x4( const Matrix &matrix )
+            {
+                // osg multiplies row vectors, the 3x4 transform column vectors
+                VertexTransform::Matrix3x4 m;
+                for (int r = 0; r < 3; ++r)
+                {
+                    for (int c = 0; c < 3; ++c)
+                        m(r, c) = matrix(c, r);
+                    m(r, 3) = matrix(3, r);
+                }
+                return m;
+            }
+
+            void bakeLOD( osg::LOD &lod )
+            {
+                if (lod.getCenterMode() != osg::LOD::USE_BOUNDING_SPHERE_CENTER)
+                    lod.setCenter(lod.getCenter() * _matrix);
+                if (lod.getRadius() > 0.f)
+                    lod.setRadius(lod.getRadius() * _scale);
+                // a pixel size does not change with the scale
+                if (lod.getRangeMode() == osg::LOD::DISTANCE_FROM_EYE_POINT)
+                {
+                    for (unsigned int i = 0; i < lod.getNumRanges(); ++i)
+                        lod.setRange(i, lod.getMinRange(i) * _scale, lod.getMaxRange(i) * _scale);
+                }
+            }
+
+            // objects with several parents are met once per parent, the
+            // few of them are kept in a plain list
+            bool first( const osg::Referenced *object )
+            {
+                if (std::find(_shared.begin(), _shared.end(), object) != _shared.end())
+                    return false;
+                _shared.push_back(object);
+                return true;
+            }
+
+            bool once( const osg::Node &node )
+            {
+                return node.getNumParents() <= 1 || first(&node);
+            }
+
+            Matrix _matrix;
+            VertexTransform _transform;
+            double _scale;
+            std::vector<const osg::Referenced*> _shared;
+            unsigned int _num_vertices;
+    };
+}
+
+Node* OrientationConverter::bake( Node *node ) const
+{
+    Trace::Scope trace("orientation_bake");
+    Matrix matrix = getMatrix(*node);
+    osg::Transform *transform = node->asTransform();
+    if (transform && !transform->asMatrixTransform() && transform->getReferenceFrame() == osg::Transform::RELATIVE_RF)
     {
-        C = Matrix::translate( -bs.center() );
-        
-        if (_trans_set == false)
-            T = Matrix::translate( bs.center() );
+        osg::MatrixTransform *baked = new osg::MatrixTransform(matrix);
+        baked->setDataVariance(osg::Object::STATIC);
+        baked->addChild(node);
+        return baked;
     }
 
+    BakeVisitor visitor(matrix);
+    node->accept(visitor);
+    trace.arg("vertices", visitor.getNumVertices());
+    return node;
+}
 
-    osg::Group* root = new osg::Group;
+MatrixTransform* OrientationConverter::attach( Node *node ) const
+{
     osg::MatrixTransform* transform = new osg::MatrixTransform;
-
     transform->setDataVariance(osg::Object::STATIC);
-    transform->setMatrix( C * R * S * T );
-    
+    transform->setMatrix( getMatrix(*node) );
+
     if (!S.isIdentity())
     {
         #if !defined(OSG_GLES2_AVAILABLE)
-            // Add a normalize state. This will be removed if the FlattenStaticTransformsVisitor works
+            // the normals are not rescaled
             transform->getOrCreateStateSet()->setMode(GL_NORMALIZE, osg::StateAttribute::ON);
         #endif
     }
 
-    root->addChild(transform);
     transform->addChild(node);
-
-    osgUtil::Optimizer::FlattenStaticTransformsVisitor fstv;
-    root->accept(fstv);
-    fstv.removeTransforms(root);
-    
-    return root->getChild(0);
+    return transform;
 }
@@ -5,6 +5,7 @@
 #include <osg/Matrix>
 #include <osg/Node>
 #include <osg/Geode>
+#include <osg/MatrixTransform>
 
 class OrientationConverter {
     public :
@@ -20,9 +21,29 @@ class OrientationConverter {
 		void setRotation(const osg::Matrix & rot);
         
         /** return the root of the updated subgraph as the subgraph
-          * the node passed in my flatten during optimization.*/
+          * the node passed in my flatten during optimization.
+          * the transform is baked into the graph in place, see bake().*/
         osg::Node* convert( osg::Node* node );
 
+        /** the C*R*S*T matrix convert() applies to node.*/
+        osg::Matrix getMatrix( const osg::Node &node ) const;
+
+        /** applies the transform to the vertex and normal arrays below node
+          * in one pass and returns the new root. arrays, drawables and nodes shared
+          * by several parents are transformed once, normals are
+          * renormalized, LOD centers, radii and distance ranges follow
+          * the transform. a MatrixTransform in the graph takes the
+          * transform on its matrix and its subgraph is left alone, any
+          * other transform is put below a new MatrixTransform holding it,
+          * which is returned when node itself is one. safe to call from
+          * several threads on different graphs.*/
+        osg::Node* bake( osg::Node* node ) const;
+
+        /** the no-bake mode, node below one MatrixTransform holding the
+          * transform. no geometry is touched, paged children loaded below
+          * node get the transform too.*/
+        osg::MatrixTransform* attach( osg::Node* node ) const;
+
     private :
         OrientationConverter( const OrientationConverter& ) {}
         OrientationConverter& operator = (const OrientationConverter& ) { return *this; }
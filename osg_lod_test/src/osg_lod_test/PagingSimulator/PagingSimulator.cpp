@@ -0,0 +1,695 @@
+#include <cmath>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Texture>
+#include <osg/NodeVisitor>
+#include <osgDB/ReadFile>
+#include <osgDB/Registry>
+#include <osgDB/SharedStateManager>
+
+#include "PagingSimulator.h"
+#include "Utility.h"
+
+namespace
+{
+    // the nodes and PagedLODs of a subgraph, file children that are not
+    // loaded are not there to visit
+    class CollectVisitor : public osg::NodeVisitor
+    {
+        public :
+            CollectVisitor() :
+                osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+            {
+            }
+
+            virtual void apply( osg::Node &node )
+            {
+                nodes.push_back(&node);
+                traverse(node);
+            }
+
+            virtual void apply( osg::PagedLOD &plod )
+            {
+                plods.push_back(&plod);
+                apply(static_cast<osg::Node&>(plod));
+            }
+
+            std::vector<osg::Node*> nodes;
+            std::vector<osg::PagedLOD*> plods;
+    };
+
+    class ResidentSizeVisitor : public osg::NodeVisitor
+    {
+        public :
+            // images are left to the caller when there is a list for them
+            ResidentSizeVisitor( std::vector<const osg::Image*> *images = 0 ) :
+                osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+                num_bytes(0),
+                _images(images)
+            {
+            }
+
+            virtual void apply( osg::Node &node )
+            {
+                addStateSet(node.getStateSet());
+                traverse(node);
+            }
+
+            virtual void apply( osg::Geode &geode )
+            {
+                addStateSet(geode.getStateSet());
+                for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+                {
+                    const osg::Drawable *drawable = geode.getDrawable(i);
+                    addStateSet(drawable->getStateSet());
+
+                    const osg::Geometry *geometry = drawable->asGeometry();
+                    if (!geometry || !_seen.insert(geometry).second)
+                        continue;
+                    addData(geometry->getVertexArray());
+                    addData(geometry->getNormalArray());
+                    addData(geometry->getColorArray());
+                    addData(geometry->getSecondaryColorArray());
+                    addData(geometry->getFogCoordArray());
+                    for (unsigned int i_t = 0; i_t < geometry->getNumTexCoordArrays(); ++i_t)
+                        addData(geometry->getTexCoordArray(i_t));
+                    for (unsigned int i_a = 0; i_a < geometry->getNumVertexAttribArrays(); ++i_a)
+                        addData(const_cast<osg::Geometry*>(geometry)->getVertexAttribArray(i_a));
+                    for (unsigned int i_p = 0; i_p < geometry->getNumPrimitiveSets(); ++i_p)
+                        addData(geometry->getPrimitiveSet(i_p));
+                }
+            }
+
+            unsigned long long num_bytes;
+
+        private :
+            void addData( const osg::BufferData *data )
+            {
+                if (data && _seen.insert(data).second)
+                    num_bytes += data->getTotalDataSize();
+            }
+
+            void addStateSet( const osg::StateSet *stateset )
+            {
+                if (!stateset || !_seen.insert(stateset).second)
+                    return;
+                const osg::StateSet::TextureAttributeList &units = stateset->getTextureAttributeList();
+                for (size_t i_u = 0; i_u < units.size(); ++i_u)
+                {
+                    for (osg::StateSet::AttributeList::const_iterator itr = units[i_u].begin(); itr != units[i_u].end(); ++itr)
+                    {
+                        osg::Texture *texture = dynamic_cast<osg::Texture*>(itr->second.first.get());
+                        if (!texture)
+                            continue;
+                        for (unsigned int i_i = 0; i_i < texture->getNumImages(); ++i_i)
+                        {
+                            const osg::Image *image = texture->getImage(i_i);
+                            if (!image || !_seen.insert(image).second)
+                                continue;
+                            if (_images)
+                                _images->push_back(image);
+                            else
+                                num_bytes += image->getTotalSizeInBytesIncludingMipmaps();
+                        }
+                    }
+                }
+            }
+
+            std::set<const osg::Object*> _seen;
+            std::vector<const osg::Image*> *_images;
+    };
+}
+
+
+// the parts of osgUtil::CullVisitor and PagedLOD::traverse that decide
+// what is drawn and what is paged
+class PagingSimulator::Cull : public osg::NodeVisitor
+{
+    public :
+        Cull( PagingSimulator &simulator, const Keyframe &camera, double time ) :
+            osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ACTIVE_CHILDREN),
+            _simulator(simulator),
+            _time(time),
+            _eye(camera.eye),
+            _num_visible(0)
+        {
+            _direction = camera.center - camera.eye;
+            _direction.normalize();
+            osg::Vec3d up(0., 0., 1.);
+            if (fabs(_direction * up) > 0.999)
+                up.set(0., 1., 0.);
+
+            // the near and far planes are computed by the viewer, they don't cull
+            double aspect = double(simulator._width) / double(simulator._height);
+            osg::Matrixd view = osg::Matrixd::lookAt(camera.eye, camera.center, up);
+            osg::Matrixd projection = osg::Matrixd::perspective(simulator._fovy, aspect, 1., 1e6);
+            _frustum.setToUnitFrustum(false, false);
+            _frustum.transformProvidingInverse(view * projection);
+
+            _pixel_scale = 0.5 * simulator._height / tan(osg::DegreesToRadians(simulator._fovy) * 0.5);
+        }
+
+        unsigned int getNumVisible(void) const { return _num_visible; }
+
+        virtual void apply( osg::Node &node )
+        {
+            if (!culled(node))
+                traverse(node);
+        }
+
+        virtual void apply( osg::LOD &lod )
+        {
+            if (culled(lod))
+                return;
+            float required_range = requiredRange(lod);
+            unsigned int num = std::min(lod.getNumRanges(), lod.getNumChildren());
+            for (unsigned int i = 0; i < num; ++i)
+            {
+                if (lod.getMinRange(i) <= required_range && required_range < lod.getMaxRange(i))
+                    lod.getChild(i)->accept(*this);
+            }
+        }
+
+        virtual void apply( osg::PagedLOD &plod )
+        {
+            if (culled(plod))
+                return;
+            ++_num_visible;
+
+            std::map<osg::PagedLOD*, PagedLODEntry>::iterator entry = _simulator._pagedlods.find(&plod);
+            if (entry != _simulator._pagedlods.end())
+                entry->second.last_frame = _simulator._frame;
+
+            float required_range = requiredRange(plod);
+            int last_child_traversed = -1;
+            bool need_to_load_child = false;
+            for (unsigned int i = 0; i < plod.getNumRanges(); ++i)
+            {
+                if (plod.getMinRange(i) <= required_range && required_range < plod.getMaxRange(i))
+                {
+                    if (i < plod.getNumChildren())
+                    {
+                        stamp(plod, i);
+                        plod.getChild(i)->accept(*this);
+                        last_child_traversed = static_cast<int>(i);
+                    }
+                    else
+                        need_to_load_child = true;
+                }
+            }
+            if (!need_to_load_child)
+                return;
+
+            // the finest child loaded so far stands in for the missing one
+            unsigned int num_children = plod.getNumChildren();
+            if (num_children > 0 && static_cast<int>(num_children) - 1 != last_child_traversed)
+            {
+                stamp(plod, num_children - 1);
+                plod.getChild(num_children - 1)->accept(*this);
+            }
+
+            // the children are loaded one after the other
+            if (plod.getDisableExternalChildrenPaging() || num_children >= plod.getNumFileNames())
+                return;
+            float min_range = plod.getMinRange(num_children), max_range = plod.getMaxRange(num_children);
+            float priority = max_range > min_range ? (max_range - required_range) / (max_range - min_range) : 0.f;
+            if (plod.getRangeMode() == osg::LOD::PIXEL_SIZE_ON_SCREEN)
+                priority = -priority;
+            priority = plod.getPriorityOffset(num_children) + priority * plod.getPriorityScale(num_children);
+            _simulator.request(plod, num_children, priority);
+        }
+
+    private :
+        bool culled( const osg::Node &node ) const
+        {
+            if (node.getNodeMask() == 0)
+                return true;
+            const osg::BoundingSphere &bound = node.getBound();
+            return !bound.valid() || !_frustum.contains(bound);
+        }
+
+        float requiredRange( const osg::LOD &lod ) const
+        {
+            if (lod.getRangeMode() == osg::LOD::DISTANCE_FROM_EYE_POINT)
+                return static_cast<float>((osg::Vec3d(lod.getCenter()) - _eye).length() * _simulator._lod_scale);
+
+            // radius in pixels at the depth of the centre, like CullStack::clampedPixelSize
+            const osg::BoundingSphere &bound = lod.getBound();
+            double depth = std::max(fabs((osg::Vec3d(bound.center()) - _eye) * _direction), 1e-6);
+            return static_cast<float>(bound.radius() * _pixel_scale / depth / _simulator._lod_scale);
+        }
+
+        void stamp( osg::PagedLOD &plod, unsigned int child )
+        {
+            plod.setTimeStamp(child, _time);
+            plod.setFrameNumber(child, _simulator._frame);
+        }
+
+        Cull( const Cull& );
+        Cull& operator = (const Cull& );
+
+        PagingSimulator &_simulator;
+        double _time;
+        osg::Vec3d _eye;
+        osg::Vec3d _direction;
+        osg::Polytope _frustum;
+        double _pixel_scale;
+        unsigned int _num_visible;
+};
+
+
+PagingSimulator::Keyframe::Keyframe( void ) :
+    time(0.)
+{
+}
+
+PagingSimulator::Keyframe::Keyframe( double time, const osg::Vec3d &eye, const osg::Vec3d &center ) :
+    time(time),
+    eye(eye),
+    center(center)
+{
+}
+
+PagingSimulator::FrameStats::FrameStats( void ) :
+    frame(0),
+    num_visible(0),
+    num_requested(0),
+    num_loaded(0),
+    num_expired(0),
+    num_pending(0),
+    num_resident(0),
+    num_pagedlods(0),
+    bytes_read(0),
+    resident_bytes(0)
+{
+}
+
+PagingSimulator::Summary::Summary( void ) :
+    num_frames(0),
+    num_requested(0),
+    num_loaded(0),
+    num_failed(0),
+    num_expired(0),
+    max_loaded_per_frame(0),
+    max_pending(0),
+    peak_resident(0),
+    bytes_read(0),
+    peak_resident_bytes(0),
+    mean_latency(0.),
+    max_latency(0)
+{
+}
+
+PagingSimulator::PagingSimulator( void ) :
+    _width(1920),
+    _height(1080),
+    _fovy(30.),
+    _lod_scale(1.f),
+    _fps(60.),
+    _target_num_pagedlods(300),
+    _expiry_delay(0.1),
+    _expiry_frames(1),
+    _max_loads_per_frame(0),
+    _share_state(false),
+    _frame(0),
+    _next_serial(0),
+    _resident_bytes(0),
+    _latency_frames(0)
+{
+}
+
+void PagingSimulator::setViewport( unsigned int width, unsigned int height )
+{
+    _width = width ? width : 1;
+    _height = height ? height : 1;
+}
+
+bool PagingSimulator::readCameraPath( const std::string &filename, CameraPath &path )
+{
+    std::ifstream file(filename.c_str());
+    if (!file.good())
+        return false;
+
+    path.clear();
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::string::size_type comment = line.find('#');
+        if (comment != std::string::npos)
+            line.erase(comment);
+
+        std::istringstream sstr(line);
+        Keyframe keyframe;
+        if (!(sstr >> keyframe.time))
+            continue;
+        if (!(sstr >> keyframe.eye.x() >> keyframe.eye.y() >> keyframe.eye.z()
+                   >> keyframe.center.x() >> keyframe.center.y() >> keyframe.center.z()))
+            return false;
+        if (!path.empty() && keyframe.time < path.back().time)
+            return false;
+        path.push_back(keyframe);
+    }
+    return !path.empty();
+}
+
+PagingSimulator::CameraPath PagingSimulator::flyover( const osg::BoundingSphere &bound, double seconds )
+{
+    osg::Vec3d c = bound.center();
+    double r = bound.radius();
+
+    CameraPath path;
+    path.push_back(Keyframe(0., c + osg::Vec3d(-r, -r, 2. * r), c));
+    path.push_back(Keyframe(seconds * 0.4, c + osg::Vec3d(-0.6 * r, -0.6 * r, 0.3 * r), c));
+    path.push_back(Keyframe(seconds * 0.7, c + osg::Vec3d(-0.1 * r, -0.1 * r, 0.1 * r), c + osg::Vec3d(r, r, 0.)));
+    path.push_back(Keyframe(seconds, c + osg::Vec3d(0.7 * r, 0.7 * r, 0.1 * r), c + osg::Vec3d(2. * r, 2. * r, 0.)));
+    return path;
+}
+
+PagingSimulator::Keyframe PagingSimulator::interpolate( const CameraPath &path, double time )
+{
+    if (path.empty())
+        return Keyframe();
+    if (time <= path.front().time)
+        return path.front();
+    if (time >= path.back().time)
+        return path.back();
+
+    size_t i = 1;
+    while (path[i].time < time)
+        ++i;
+    const Keyframe &a = path[i - 1], &b = path[i];
+    double t = b.time > a.time ? (time - a.time) / (b.time - a.time) : 1.;
+    return Keyframe(time, a.eye + (b.eye - a.eye) * t, a.center + (b.center - a.center) * t);
+}
+
+unsigned long long PagingSimulator::residentBytes( const osg::Node &node )
+{
+    ResidentSizeVisitor size;
+    const_cast<osg::Node&>(node).accept(size);
+    return size.num_bytes;
+}
+
+void PagingSimulator::registerPagedLODs( osg::Node &node )
+{
+    CollectVisitor collect;
+    node.accept(collect);
+    for (size_t i = 0; i < collect.plods.size(); ++i)
+    {
+        if (_pagedlods.find(collect.plods[i]) != _pagedlods.end())
+            continue;
+        PagedLODEntry entry;
+        entry.last_frame = _frame;
+        entry.serial = _next_serial++;
+        _pagedlods[collect.plods[i]] = entry;
+    }
+}
+
+unsigned int PagingSimulator::unregister( osg::Node &node )
+{
+    CollectVisitor collect;
+    node.accept(collect);
+
+    unsigned int num_pagedlods = 0;
+    for (size_t i = 0; i < collect.plods.size(); ++i)
+        num_pagedlods += static_cast<unsigned int>(_pagedlods.erase(collect.plods[i]));
+    for (size_t i = 0; i < collect.nodes.size(); ++i)
+    {
+        std::map<osg::Node*, unsigned long long>::iterator tile = _tiles.find(collect.nodes[i]);
+        if (tile == _tiles.end())
+            continue;
+        _resident_bytes -= tile->second;
+        _tiles.erase(tile);
+
+        std::map< osg::Node*, std::vector<const osg::Image*> >::iterator images = _tile_images.find(collect.nodes[i]);
+        if (images == _tile_images.end())
+            continue;
+        for (size_t i_i = 0; i_i < images->second.size(); ++i_i)
+        {
+            std::map<const osg::Image*, SharedImage>::iterator shared = _shared_images.find(images->second[i_i]);
+            if (--shared->second.num_tiles > 0)
+                continue;
+            _resident_bytes -= shared->second.num_bytes;
+            _shared_images.erase(shared);
+        }
+        _tile_images.erase(images);
+    }
+    return num_pagedlods;
+}
+
+unsigned long long PagingSimulator::tileBytes( osg::Node &node )
+{
+    if (!_share_state)
+        return residentBytes(node);
+
+    std::vector<const osg::Image*> images;
+    ResidentSizeVisitor size(&images);
+    node.accept(size);
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        SharedImage &shared = _shared_images[images[i]];
+        if (shared.num_tiles == 0)
+        {
+            shared.num_bytes = images[i]->getTotalSizeInBytesIncludingMipmaps();
+            _resident_bytes += shared.num_bytes;
+        }
+        ++shared.num_tiles;
+    }
+    _tile_images[&node].swap(images);
+    return size.num_bytes;
+}
+
+void PagingSimulator::request( osg::PagedLOD &plod, unsigned int child, float priority )
+{
+    RequestKey key(&plod, child);
+    std::map<RequestKey, Request>::iterator itr = _requests.find(key);
+    if (itr != _requests.end())
+    {
+        itr->second.priority = priority;
+        itr->second.last_frame = _frame;
+        return;
+    }
+
+    Request &request = _requests[key];
+    request.plod = &plod;
+    request.child = child;
+    request.filename = plod.getDatabasePath().empty() ? plod.getFileName(child) :
+        plod.getDatabasePath() + plod.getFileName(child);
+    request.priority = priority;
+    request.first_frame = _frame;
+    request.last_frame = _frame;
+}
+
+namespace
+{
+    struct RequestOrder
+    {
+        RequestOrder( float priority, unsigned int first_frame ) : priority(priority), first_frame(first_frame) {}
+
+        bool operator < ( const RequestOrder &rhs ) const
+        {
+            if (priority != rhs.priority)
+                return priority > rhs.priority;
+            return first_frame < rhs.first_frame;
+        }
+
+        float priority;
+        unsigned int first_frame;
+    };
+}
+
+void PagingSimulator::loadRequests( FrameStats &stats )
+{
+    // highest priority first, like the pager's request queue
+    typedef std::multimap<RequestOrder, RequestKey> Queue;
+    Queue queue;
+    for (std::map<RequestKey, Request>::iterator itr = _requests.begin(); itr != _requests.end(); ++itr)
+        queue.insert(Queue::value_type(RequestOrder(itr->second.priority, itr->second.first_frame), itr->first));
+
+    for (Queue::iterator itr = queue.begin(); itr != queue.end(); ++itr)
+    {
+        if (_max_loads_per_frame > 0 && stats.num_loaded >= _max_loads_per_frame)
+            break;
+
+        std::map<RequestKey, Request>::iterator request_itr = _requests.find(itr->second);
+        Request request = request_itr->second;
+        _requests.erase(request_itr);
+        if (request.plod->getNumChildren() != request.child)
+            continue;
+
+        osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(request.filename, _options.get());
+        stats.bytes_read += Utility::fileSize(request.filename);
+        if (!node.valid())
+        {
+            ++_summary.num_failed;
+            continue;
+        }
+
+        // the pager's database thread shares the state of a loaded tile
+        if (_share_state)
+            osgDB::Registry::instance()->getOrCreateSharedStateManager()->share(node.get());
+
+        request.plod->addChild(node.get());
+        unsigned long long num_bytes = tileBytes(*node);
+        _tiles[node.get()] = num_bytes;
+        _resident_bytes += num_bytes;
+        registerPagedLODs(*node);
+
+        ++stats.num_loaded;
+        unsigned int latency = _frame - request.first_frame;
+        _latency_frames += latency;
+        _summary.max_latency = std::max(_summary.max_latency, latency);
+    }
+}
+
+void PagingSimulator::expire( double time, FrameStats &stats )
+{
+    if (_pagedlods.size() <= _target_num_pagedlods || _frame < _expiry_frames)
+        return;
+
+    int num_to_prune = static_cast<int>(_pagedlods.size() - _target_num_pagedlods);
+    double expiry_time = time - _expiry_delay;
+    unsigned int expiry_frame = _frame - _expiry_frames;
+
+    // the PagedLODs drawn longest ago first, the ones not drawn this frame
+    // go before the active ones like in the pager
+    typedef std::map< std::pair<unsigned int, unsigned int>, osg::PagedLOD* > Candidates;
+    Candidates candidates;
+    for (std::map<osg::PagedLOD*, PagedLODEntry>::iterator itr = _pagedlods.begin(); itr != _pagedlods.end(); ++itr)
+        candidates[std::make_pair(itr->second.last_frame, itr->second.serial)] = itr->first;
+
+    for (Candidates::iterator itr = candidates.begin(); itr != candidates.end() && num_to_prune > 0; ++itr)
+    {
+        // gone with a subgraph expired before it
+        if (_pagedlods.find(itr->second) == _pagedlods.end())
+            continue;
+
+        osg::NodeList removed;
+        itr->second->removeExpiredChildren(expiry_time, expiry_frame, removed);
+        for (size_t i = 0; i < removed.size(); ++i)
+        {
+            num_to_prune -= static_cast<int>(unregister(*removed[i]));
+            ++stats.num_expired;
+        }
+    }
+
+    // the shared objects no resident tile uses any more
+    if (_share_state && stats.num_expired > 0)
+        osgDB::Registry::instance()->getOrCreateSharedStateManager()->prune();
+}
+
+bool PagingSimulator::run( osg::Node &root, const CameraPath &path )
+{
+    _requests.clear();
+    _pagedlods.clear();
+    _tiles.clear();
+    _tile_images.clear();
+    _shared_images.clear();
+    _frames.clear();
+    _summary = Summary();
+    _next_serial = 0;
+    _latency_frames = 0;
+    _frame = 0;
+    if (path.empty())
+        return false;
+
+    // every run starts with an empty cache
+    _options = 0;
+    if (_share_state)
+    {
+        _options = osgDB::Registry::instance()->getOptions() ?
+            osgDB::Registry::instance()->getOptions()->cloneOptions() : new osgDB::Options;
+        _options->setObjectCacheHint(osgDB::Options::CACHE_IMAGES);
+        osgDB::Registry::instance()->clearObjectCache();
+    }
+
+    _resident_bytes = residentBytes(root);
+    registerPagedLODs(root);
+
+    double start = path.front().time;
+    unsigned int num_frames = static_cast<unsigned int>((path.back().time - start) * _fps) + 1;
+    for (_frame = 0; _frame < num_frames; ++_frame)
+    {
+        double time = _frame / _fps;
+        FrameStats stats;
+        stats.frame = _frame;
+
+        Cull cull(*this, interpolate(path, start + time), time);
+        root.accept(cull);
+        stats.num_visible = cull.getNumVisible();
+
+        // a request the cull traversal did not repeat is dropped, like the
+        // pager drops requests that went out of date
+        for (std::map<RequestKey, Request>::iterator itr = _requests.begin(); itr != _requests.end(); )
+        {
+            if (itr->second.last_frame != _frame)
+                _requests.erase(itr++);
+            else
+            {
+                if (itr->second.first_frame == _frame)
+                    ++stats.num_requested;
+                ++itr;
+            }
+        }
+
+        loadRequests(stats);
+        expire(time, stats);
+
+        stats.num_pending = static_cast<unsigned int>(_requests.size());
+        stats.num_resident = static_cast<unsigned int>(_tiles.size());
+        stats.num_pagedlods = static_cast<unsigned int>(_pagedlods.size());
+        stats.resident_bytes = _resident_bytes;
+        _frames.push_back(stats);
+
+        _summary.num_requested += stats.num_requested;
+        _summary.num_loaded += stats.num_loaded;
+        _summary.num_expired += stats.num_expired;
+        _summary.bytes_read += stats.bytes_read;
+        _summary.max_loaded_per_frame = std::max(_summary.max_loaded_per_frame, stats.num_loaded);
+        _summary.max_pending = std::max(_summary.max_pending, stats.num_pending);
+        _summary.peak_resident = std::max(_summary.peak_resident, stats.num_resident);
+        _summary.peak_resident_bytes = std::max(_summary.peak_resident_bytes, stats.resident_bytes);
+    }
+
+    _summary.num_frames = num_frames;
+    _summary.mean_latency = _summary.num_loaded > 0 ? double(_latency_frames) / _summary.num_loaded : 0.;
+    return true;
+}
+
+void PagingSimulator::writeCsv( std::ostream &out ) const
+{
+    out << "frame,visible,requested,loaded,expired,pending,resident,pagedlods,bytes_read,resident_bytes\n";
+    for (size_t i = 0; i < _frames.size(); ++i)
+    {
+        const FrameStats &stats = _frames[i];
+        out << stats.frame << "," << stats.num_visible << "," << stats.num_requested << "," << stats.num_loaded << ","
+            << stats.num_expired << "," << stats.num_pending << "," << stats.num_resident << ","
+            << stats.num_pagedlods << "," << stats.bytes_read << "," << stats.resident_bytes << "\n";
+    }
+}
+
+bool PagingSimulator::writeCsv( const std::string &filename ) const
+{
+    std::ofstream file(filename.c_str());
+    if (!file.good())
+        return false;
+    writeCsv(file);
+    return file.good();
+}
+
+void PagingSimulator::writeSummary( std::ostream &out ) const
+{
+    const double mb = 1024. * 1024.;
+    out << _summary.num_frames << " frames at " << _fps << " fps, " << _summary.num_requested << " tiles requested, "
+        << _summary.num_loaded << " loaded, " << _summary.num_failed << " failed, " << _summary.num_expired
+        << " expired." << std::endl;
+    out << "read " << _summary.bytes_read / mb << " MB, up to " << _summary.max_loaded_per_frame
+        << " tiles loaded and " << _summary.max_pending << " pending in a frame." << std::endl;
+    out << "peak resident " << _summary.peak_resident << " tiles, " << _summary.peak_resident_bytes / mb
+        << " MB, request to merge " << _summary.mean_latency << " frames on average, " << _summary.max_latency
+        << " at most." << std::endl;
+}
@@ -0,0 +1,199 @@
+#ifndef _PAGING_SIMULATOR_H
+#define _PAGING_SIMULATOR_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include <osg/Node>
+#include <osg/PagedLOD>
+#include <osg/Polytope>
+#include <osg/BoundingSphere>
+#include <osgDB/Options>
+
+/** replays a camera path over a paged database without a window. every
+  * frame the PagedLODs are evaluated like the cull traversal of osgViewer
+  * does (frustum culling, distance or pixel size ranges, the last loaded
+  * child drawn while the next one is requested), the requests are loaded
+  * and merged like the DatabasePager does, and children are expired when
+  * more PagedLODs than the target are resident. the per frame counts tell
+  * how many tiles, bytes and resident megabytes a viewer would page in for
+  * the ranges a builder wrote.
+  *
+  * transforms above the PagedLODs are not applied, the builders write none.*/
+class PagingSimulator {
+    public :
+        /** camera at time seconds, z up.*/
+        struct Keyframe
+        {
+            Keyframe(void);
+            Keyframe( double time, const osg::Vec3d &eye, const osg::Vec3d &center );
+
+            double time;
+            osg::Vec3d eye;
+            osg::Vec3d center;
+        };
+        typedef std::vector<Keyframe> CameraPath;
+
+        struct FrameStats
+        {
+            FrameStats(void);
+
+            unsigned int frame;
+            unsigned int num_visible;
+            unsigned int num_requested;
+            unsigned int num_loaded;
+            unsigned int num_expired;
+            unsigned int num_pending;
+            unsigned int num_resident;
+            unsigned int num_pagedlods;
+            unsigned long long bytes_read;
+            unsigned long long resident_bytes;
+        };
+
+        struct Summary
+        {
+            Summary(void);
+
+            unsigned int num_frames;
+            unsigned int num_requested;
+            unsigned int num_loaded;
+            unsigned int num_failed;
+            unsigned int num_expired;
+            unsigned int max_loaded_per_frame;
+            unsigned int max_pending;
+            unsigned int peak_resident;
+            unsigned long long bytes_read;
+            unsigned long long peak_resident_bytes;
+            /** frames from the first request of a tile to its merge.*/
+            double mean_latency;
+            unsigned int max_latency;
+        };
+
+        PagingSimulator(void);
+
+        /** the view, defaults to 1920x1080 with a 30 degree vertical field of view.*/
+        void setViewport( unsigned int width, unsigned int height );
+        void setFieldOfView( double fovy ) { _fovy = fovy; }
+        void setLODScale( float scale ) { _lod_scale = scale; }
+        void setFrameRate( double fps ) { _fps = fps > 0. ? fps : 60.; }
+
+        /** the pager cache, children are expired only while more PagedLODs
+          * than this are resident (300 like the DatabasePager).*/
+        void setTargetMaximumNumberOfPageLOD( unsigned int num ) { _target_num_pagedlods = num; }
+        /** a child expires when it was not drawn for delay seconds and frames
+          * (0.1 seconds and 1 frame like the DatabasePager).*/
+        void setExpiryDelay( double seconds ) { _expiry_delay = seconds; }
+        void setExpiryFrames( unsigned int frames ) { _expiry_frames = frames; }
+        /** tiles loaded and merged per frame, 0 loads every request before
+          * the next frame.*/
+        void setMaxLoadsPerFrame( unsigned int num ) { _max_loads_per_frame = num; }
+        /** share state across tiles like a viewer set up for it: tiles are
+          * read with osgDB::Options::CACHE_IMAGES and their textures and
+          * statesets merged by the registry's SharedStateManager. an image
+          * counts once while any resident tile holds it.*/
+        void setShareState( bool share ) { _share_state = share; }
+
+        /** lines of "time eye_x eye_y eye_z center_x center_y center_z", # starts a comment.*/
+        static bool readCameraPath( const std::string &filename, CameraPath &path );
+
+        /** from high above the database down to a low pass across it, seconds long.*/
+        static CameraPath flyover( const osg::BoundingSphere &bound, double seconds = 20. );
+
+        /** the camera at time, linear between the keyframes.*/
+        static Keyframe interpolate( const CameraPath &path, double time );
+
+        /** replays path over root at the frame rate. the loaded tiles are
+          * merged into root and expired from it, read a fresh root for every
+          * run.*/
+        bool run( osg::Node &root, const CameraPath &path );
+
+        const std::vector<FrameStats>& getFrames(void) const { return _frames; }
+        const Summary& getSummary(void) const { return _summary; }
+
+        /** one line per frame.*/
+        void writeCsv( std::ostream &out ) const;
+        bool writeCsv( const std::string &filename ) const;
+
+        void writeSummary( std::ostream &out ) const;
+
+        /** bytes of the arrays, primitives and images below node, shared objects once.*/
+        static unsigned long long residentBytes( const osg::Node &node );
+
+    private :
+        PagingSimulator( const PagingSimulator& ) {}
+        PagingSimulator& operator = (const PagingSimulator& ) { return *this; }
+
+        class Cull;
+        friend class Cull;
+
+        struct Request
+        {
+            osg::ref_ptr<osg::PagedLOD> plod;
+            unsigned int child;
+            std::string filename;
+            float priority;
+            unsigned int first_frame;
+            unsigned int last_frame;
+        };
+        typedef std::pair<osg::PagedLOD*, unsigned int> RequestKey;
+
+        /** a PagedLOD in the pager's list, serial keeps the expiry order
+          * stable between runs.*/
+        struct PagedLODEntry
+        {
+            unsigned int last_frame;
+            unsigned int serial;
+        };
+
+        /** cull traversal asking for child of plod.*/
+        void request( osg::PagedLOD &plod, unsigned int child, float priority );
+
+        void loadRequests( FrameStats &stats );
+        void expire( double time, FrameStats &stats );
+
+        /** the PagedLODs of a merged subgraph join the pager's list.*/
+        void registerPagedLODs( osg::Node &node );
+        /** forget the PagedLODs and tiles of an expired subgraph, returns
+          * the number of PagedLODs in it.*/
+        unsigned int unregister( osg::Node &node );
+
+        /** resident bytes of a loaded tile, its shared images go to
+          * _shared_images instead.*/
+        unsigned long long tileBytes( osg::Node &node );
+
+        struct SharedImage
+        {
+            unsigned int num_tiles;
+            unsigned long long num_bytes;
+        };
+
+        unsigned int _width;
+        unsigned int _height;
+        double _fovy;
+        float _lod_scale;
+        double _fps;
+        unsigned int _target_num_pagedlods;
+        double _expiry_delay;
+        unsigned int _expiry_frames;
+        unsigned int _max_loads_per_frame;
+        bool _share_state;
+        osg::ref_ptr<osgDB::Options> _options;
+
+        unsigned int _frame;
+        std::map<RequestKey, Request> _requests;
+        std::map<osg::PagedLOD*, PagedLODEntry> _pagedlods;
+        unsigned int _next_serial;
+        /** resident bytes of every merged file child.*/
+        std::map<osg::Node*, unsigned long long> _tiles;
+        /** the images of every merged file child when state is shared.*/
+        std::map< osg::Node*, std::vector<const osg::Image*> > _tile_images;
+        std::map<const osg::Image*, SharedImage> _shared_images;
+        unsigned long long _resident_bytes;
+        unsigned long long _latency_frames;
+
+        std::vector<FrameStats> _frames;
+        Summary _summary;
+};
+#endif
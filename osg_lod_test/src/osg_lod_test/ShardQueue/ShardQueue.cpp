@@ -0,0 +1,486 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+
+#include "ShardQueue.h"
+#include "Utility.h"
+
+namespace
+{
+    // false if the file exists already
+    bool create_exclusive( const std::string &filename, const std::string &contents )
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_WRITE, 0, 0, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, 0);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        DWORD written = 0;
+        WriteFile(file, contents.data(), static_cast<DWORD>(contents.size()), &written, 0);
+        CloseHandle(file);
+        return true;
+#else
+        int fd = open(filename.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+        if (fd < 0)
+            return false;
+        ssize_t written = write(fd, contents.data(), contents.size());
+        (void)written;
+        close(fd);
+        return true;
+#endif
+    }
+
+    // false if to exists already
+    bool move_exclusive( const std::string &from, const std::string &to )
+    {
+#ifdef _WIN32
+        return MoveFileA(from.c_str(), to.c_str()) != 0;
+#else
+        if (link(from.c_str(), to.c_str()) != 0)
+            return false;
+        unlink(from.c_str());
+        return true;
+#endif
+    }
+
+    std::string host_name( void )
+    {
+#ifdef _WIN32
+        char name[MAX_COMPUTERNAME_LENGTH + 1];
+        DWORD size = sizeof(name);
+        if (!GetComputerNameA(name, &size))
+            return "localhost";
+        return std::string(name, size);
+#else
+        char name[256];
+        if (gethostname(name, sizeof(name)) != 0)
+            return "localhost";
+        name[sizeof(name) - 1] = '\0';
+        return name;
+#endif
+    }
+
+    // a process of this host
+    bool process_alive( unsigned long pid )
+    {
+#ifdef _WIN32
+        HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, static_cast<DWORD>(pid));
+        if (!process)
+            return GetLastError() == ERROR_ACCESS_DENIED;
+        bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+        CloseHandle(process);
+        return alive;
+#else
+        return kill(static_cast<pid_t>(pid), 0) == 0 || errno == EPERM;
+#endif
+    }
+
+    std::string read_file( const std::string &filename )
+    {
+        std::ifstream file(filename.c_str());
+        std::stringstream sstr;
+        sstr << file.rdbuf();
+        return sstr.str();
+    }
+
+#ifdef _WIN32
+    // the quoting CommandLineToArgvW undoes
+    std::string quote_argument( const std::string &arg )
+    {
+        if (!arg.empty() && arg.find_first_of(" \t\"") == std::string::npos)
+            return arg;
+        std::string quoted("\"");
+        size_t num_backslashes = 0;
+        for (size_t i = 0; i < arg.size(); ++i)
+        {
+            if (arg[i] == '\\')
+            {
+                ++num_backslashes;
+                continue;
+            }
+            if (arg[i] == '"')
+                quoted.append(num_backslashes * 2 + 1, '\\');
+            else
+                quoted.append(num_backslashes, '\\');
+            num_backslashes = 0;
+            quoted += arg[i];
+        }
+        quoted.append(num_backslashes * 2, '\\');
+        quoted += '"';
+        return quoted;
+    }
+#endif
+}
+
+ShardQueue::Lease::Lease( ShardQueue &queue, const Shard &shard ) :
+    _queue(queue),
+    _shard(shard)
+{
+    start();
+}
+
+ShardQueue::Lease::~Lease()
+{
+    ++_stop;
+    join();
+}
+
+void ShardQueue::Lease::run()
+{
+    unsigned int interval = _queue.getLeaseSeconds() / 4;
+    if (interval < 1)
+        interval = 1;
+
+    // short sleeps so the lease ends with its worker
+    unsigned int seconds = 0;
+    while (_stop == 0)
+    {
+        OpenThreads::Thread::microSleep(1000000);
+        if (++seconds < interval)
+            continue;
+        seconds = 0;
+        if (!_queue.renew(_shard))
+            break;
+    }
+}
+
+ShardQueue::ShardQueue( const std::string &dir, unsigned int lease_seconds ) :
+    _dir(dir),
+    _lease_seconds(lease_seconds > 0 ? lease_seconds : 1),
+    _max_attempts(2)
+{
+    std::string host = host_name();
+    std::stringstream sstr;
+    sstr << host << " " << Utility::processId() << "\n";
+    _owner = sstr.str();
+
+    std::stringstream ext;
+    ext << ".taken_" << host << "_" << Utility::processId();
+    _taken_ext = ext.str();
+}
+
+std::string ShardQueue::shardName( const Shard &shard )
+{
+    std::stringstream sstr;
+    sstr << "shard_" << shard.level << "_" << shard.x << "_" << shard.y;
+    return sstr.str();
+}
+
+std::string ShardQueue::shardFile( const Shard &shard, const char *ext ) const
+{
+    return osgDB::concatPaths(_dir, shardName(shard) + ext);
+}
+
+bool ShardQueue::create( int level )
+{
+    if (!osgDB::makeDirectory(_dir))
+        return false;
+
+    // the quads of level, row by row
+    int num_quads = 1 << (level - 1);
+    _shards.clear();
+    for (int y = 0; y < num_quads; ++y)
+        for (int x = 0; x < num_quads; ++x)
+            _shards.push_back(Shard(level, x, y));
+
+    for (size_t i = 0; i < _shards.size(); ++i)
+    {
+        remove(shardFile(_shards[i], ".claim").c_str());
+        remove(shardFile(_shards[i], ".done").c_str());
+        remove(shardFile(_shards[i], ".failed").c_str());
+        remove(shardFile(_shards[i], ".failures").c_str());
+    }
+
+    std::ofstream file(osgDB::concatPaths(_dir, "shards.txt").c_str());
+    for (size_t i = 0; i < _shards.size(); ++i)
+        file << _shards[i].level << " " << _shards[i].x << " " << _shards[i].y << "\n";
+    return file.good();
+}
+
+bool ShardQueue::load( void )
+{
+    std::ifstream file(osgDB::concatPaths(_dir, "shards.txt").c_str());
+    if (!file.good())
+        return false;
+
+    _shards.clear();
+    Shard shard;
+    while (file >> shard.level >> shard.x >> shard.y)
+        _shards.push_back(shard);
+    return !_shards.empty();
+}
+
+bool ShardQueue::claim( Shard &shard )
+{
+    for (size_t i = 0; i < _shards.size(); ++i)
+    {
+        if (create_exclusive(shardFile(_shards[i], ".claim"), _owner))
+        {
+            shard = _shards[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+void ShardQueue::release( const Shard &shard )
+{
+    remove(shardFile(shard, ".claim").c_str());
+}
+
+bool ShardQueue::renew( const Shard &shard )
+{
+    // opened without creating, a taken claim stays gone. the same owner is
+    // written over itself, the claim never reads empty
+    std::fstream file(shardFile(shard, ".claim").c_str(), std::ios::in | std::ios::out | std::ios::binary);
+    std::stringstream sstr;
+    sstr << file.rdbuf();
+    if (sstr.str() != _owner)
+        return false;
+    file.clear();
+    file.seekp(0);
+    file << _owner;
+    file.flush();
+    return file.good();
+}
+
+bool ShardQueue::finish( const Shard &shard, bool success )
+{
+    std::string taken = takeClaim(shard);
+    if (taken.empty())
+        return false;
+    if (read_file(taken) != _owner)
+    {
+        restoreClaim(shard, taken);
+        return false;
+    }
+
+    bool written = false;
+    {
+        std::ofstream file(shardFile(shard, success ? ".done" : ".failed").c_str());
+        written = file.good();
+    }
+    if (!written)
+    {
+        restoreClaim(shard, taken);
+        return false;
+    }
+    remove(taken.c_str());
+    return true;
+}
+
+bool ShardQueue::fail( const Shard &shard )
+{
+    std::string taken = takeClaim(shard);
+    if (taken.empty())
+        return false;
+    if (read_file(taken) != _owner)
+    {
+        restoreClaim(shard, taken);
+        return false;
+    }
+    countFailure(shard, taken);
+    return true;
+}
+
+std::string ShardQueue::takeClaim( const Shard &shard ) const
+{
+    // the rename is atomic, the claim is gone for everyone else after it
+    std::string claim = shardFile(shard, ".claim");
+    std::string taken = claim + _taken_ext;
+    if (rename(claim.c_str(), taken.c_str()) != 0)
+        return std::string();
+    return taken;
+}
+
+void ShardQueue::restoreClaim( const Shard &shard, const std::string &taken ) const
+{
+    if (!move_exclusive(taken, shardFile(shard, ".claim")))
+        remove(taken.c_str());
+}
+
+void ShardQueue::countFailure( const Shard &shard, const std::string &taken ) const
+{
+    // only the process holding the taken claim counts, one at a time
+    std::string failures = shardFile(shard, ".failures");
+    unsigned int num_failures = 0;
+    {
+        std::ifstream file(failures.c_str());
+        file >> num_failures;
+    }
+    ++num_failures;
+    {
+        std::ofstream file(failures.c_str());
+        file << num_failures << "\n";
+    }
+
+    // failed before the claim goes, the shard never looks free meanwhile
+    if (num_failures >= _max_attempts)
+    {
+        std::ofstream file(shardFile(shard, ".failed").c_str());
+    }
+    remove(taken.c_str());
+}
+
+unsigned int ShardQueue::reclaimStale( void )
+{
+    std::string host = host_name();
+    long long now = static_cast<long long>(time(0));
+    unsigned int num_reclaimed = 0;
+    for (size_t i = 0; i < _shards.size(); ++i)
+    {
+        if (finished(_shards[i]))
+            continue;
+
+        std::string claim = shardFile(_shards[i], ".claim");
+        unsigned long long size = 0;
+        long long mtime = 0;
+        if (!Utility::fileStatus(claim, size, mtime))
+            continue;
+
+        // a claim being created may read empty, only its age counts then
+        std::string owner = read_file(claim);
+        std::stringstream sstr(owner);
+        std::string owner_host;
+        unsigned long owner_pid = 0;
+        sstr >> owner_host >> owner_pid;
+        bool gone = owner_pid != 0 && owner_host == host && !process_alive(owner_pid);
+        bool expired = now - mtime > static_cast<long long>(_lease_seconds);
+        if ((!gone && !expired) || finished(_shards[i]))
+            continue;
+
+        // the claim may have been renewed, or taken back and claimed anew,
+        // since it was looked at
+        std::string taken = takeClaim(_shards[i]);
+        if (taken.empty())
+            continue;
+        unsigned long long taken_size = 0;
+        long long taken_mtime = 0;
+        if (!Utility::fileStatus(taken, taken_size, taken_mtime) || taken_mtime != mtime ||
+            read_file(taken) != owner || finished(_shards[i]))
+        {
+            restoreClaim(_shards[i], taken);
+            continue;
+        }
+
+        countFailure(_shards[i], taken);
+        ++num_reclaimed;
+    }
+    return num_reclaimed;
+}
+
+bool ShardQueue::claimable( void ) const
+{
+    for (size_t i = 0; i < _shards.size(); ++i)
+        if (!finished(_shards[i]) && !osgDB::fileExists(shardFile(_shards[i], ".claim")))
+            return true;
+    return false;
+}
+
+bool ShardQueue::finished( const Shard &shard ) const
+{
+    return osgDB::fileExists(shardFile(shard, ".done")) || osgDB::fileExists(shardFile(shard, ".failed"));
+}
+
+unsigned int ShardQueue::getNumDone( void ) const
+{
+    unsigned int num_done = 0;
+    for (size_t i = 0; i < _shards.size(); ++i)
+        if (osgDB::fileExists(shardFile(_shards[i], ".done")))
+            ++num_done;
+    return num_done;
+}
+
+unsigned int ShardQueue::getNumFailed( void ) const
+{
+    unsigned int num_failed = 0;
+    for (size_t i = 0; i < _shards.size(); ++i)
+        if (osgDB::fileExists(shardFile(_shards[i], ".failed")))
+            ++num_failed;
+    return num_failed;
+}
+
+bool ShardQueue::complete( void ) const
+{
+    for (size_t i = 0; i < _shards.size(); ++i)
+        if (!finished(_shards[i]))
+            return false;
+    return true;
+}
+
+#ifdef _WIN32
+
+int ShardQueue::runProcess( const std::vector<std::string> &args )
+{
+    if (args.empty())
+        return -1;
+
+    std::string command_line;
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        if (i > 0)
+            command_line += ' ';
+        command_line += quote_argument(args[i]);
+    }
+
+    STARTUPINFOA startup;
+    ZeroMemory(&startup, sizeof(startup));
+    startup.cb = sizeof(startup);
+    PROCESS_INFORMATION process;
+    std::vector<char> buffer(command_line.begin(), command_line.end());
+    buffer.push_back('\0');
+    if (!CreateProcessA(0, &buffer[0], 0, 0, FALSE, 0, 0, 0, &startup, &process))
+        return -1;
+
+    WaitForSingleObject(process.hProcess, INFINITE);
+    DWORD exit_code = 0;
+    GetExitCodeProcess(process.hProcess, &exit_code);
+    CloseHandle(process.hThread);
+    CloseHandle(process.hProcess);
+    return static_cast<int>(exit_code);
+}
+
+#else
+
+int ShardQueue::runProcess( const std::vector<std::string> &args )
+{
+    if (args.empty())
+        return -1;
+
+    std::vector<char*> argv;
+    for (size_t i = 0; i < args.size(); ++i)
+        argv.push_back(const_cast<char*>(args[i].c_str()));
+    argv.push_back(0);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0)
+    {
+        execvp(argv[0], &argv[0]);
+        _exit(127);
+    }
+
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0)
+        return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef _SHARD_QUEUE_H
+#define _SHARD_QUEUE_H
+
+#include <string>
+#include <vector>
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+
+/** the shards of a multi process build, kept as files in a directory of
+  * the shared output so workers on other machines can join. a shard is the
+  * subtree of quads below one quad of the shard level. the coordinator
+  * lists every shard in shards.txt, a worker claims the next one by
+  * creating its .claim file (exclusive create, so two workers never get
+  * the same shard) and leaves a .done or .failed file when it is through.
+  * the claim holds the host and pid of its worker and is renewed while the
+  * worker runs, the coordinator takes back the claims of workers that are
+  * gone or stopped renewing for the lease time. whoever finishes, fails or
+  * takes back a claim first renames it to a name of its own, so of several
+  * processes at it only one goes on.*/
+class ShardQueue {
+    public :
+        struct Shard
+        {
+            Shard(void) : level(0), x(0), y(0) {}
+            Shard( int level, int x, int y ) : level(level), x(x), y(y) {}
+
+            int level;
+            int x;
+            int y;
+        };
+
+        /** renews the claim of a shard every quarter of the lease while it
+          * is in scope.*/
+        class Lease : public OpenThreads::Thread
+        {
+            public :
+                Lease( ShardQueue &queue, const Shard &shard );
+                ~Lease();
+
+                virtual void run();
+
+            private :
+                Lease( const Lease& );
+                Lease& operator = (const Lease& );
+
+                ShardQueue &_queue;
+                Shard _shard;
+                OpenThreads::Atomic _stop;
+        };
+
+        ShardQueue( const std::string &dir, unsigned int lease_seconds = 300 );
+
+        const std::string& getDirectory(void) const { return _dir; }
+
+        unsigned int getLeaseSeconds(void) const { return _lease_seconds; }
+
+        /** tries of a shard before it is failed.*/
+        void setMaxAttempts( unsigned int attempts ) { _max_attempts = attempts; }
+        unsigned int getMaxAttempts(void) const { return _max_attempts; }
+
+        /** the coordinator's queue of every quad of level, the files of a
+          * previous run are removed.*/
+        bool create( int level );
+
+        /** read the queue a coordinator created, false if there is none.*/
+        bool load(void);
+
+        /** the next shard nobody claimed, false once every shard is taken.*/
+        bool claim( Shard &shard );
+
+        /** give a claimed shard back to the queue.*/
+        void release( const Shard &shard );
+
+        /** touch the claim of a shard this process holds, false if it is
+          * not ours anymore.*/
+        bool renew( const Shard &shard );
+
+        /** mark a shard this process holds done or failed, false if the
+          * claim is not ours anymore or the mark can't be written.*/
+        bool finish( const Shard &shard, bool success );
+
+        /** a failed try of a shard this process holds, it goes back to the
+          * queue until it failed max attempts times. false if the claim is
+          * not ours anymore.*/
+        bool fail( const Shard &shard );
+
+        /** fail the claims whose process is gone or that were not renewed
+          * within the lease, the number of them.*/
+        unsigned int reclaimStale(void);
+
+        /** a shard nobody claimed or finished.*/
+        bool claimable(void) const;
+
+        unsigned int getNumShards(void) const { return static_cast<unsigned int>(_shards.size()); }
+        unsigned int getNumDone(void) const;
+        unsigned int getNumFailed(void) const;
+        /** every shard done or failed.*/
+        bool complete(void) const;
+
+        static std::string shardName( const Shard &shard );
+
+        /** run a process and wait for it, its exit code or -1 if it could
+          * not be started. args[0] is the executable.*/
+        static int runProcess( const std::vector<std::string> &args );
+
+    private :
+        std::string shardFile( const Shard &shard, const char *ext ) const;
+        bool finished( const Shard &shard ) const;
+
+        /** the file the claim of shard was renamed to, empty if there was
+          * none or another process took it first.*/
+        std::string takeClaim( const Shard &shard ) const;
+        /** put a taken claim back, dropped if a new claim took its place.*/
+        void restoreClaim( const Shard &shard, const std::string &taken ) const;
+        /** count a failed try of a taken claim and drop the claim.*/
+        void countFailure( const Shard &shard, const std::string &taken ) const;
+
+        std::string _dir;
+        unsigned int _lease_seconds;
+        unsigned int _max_attempts;
+        /** host and pid written to the claims of this process.*/
+        std::string _owner;
+        /** extension of the claims this process took.*/
+        std::string _taken_ext;
+        std::vector<Shard> _shards;
+};
+#endif
@@ -0,0 +1,112 @@
+#include <cmath>
+#include <algorithm>
+
+#include "SphereIndex.h"
+
+SphereIndex::SphereIndex( const std::vector<osg::BoundingSphere> &spheres ) :
+    _spheres(spheres),
+    _cell_size(1.)
+{
+    double sum_radius = 0.;
+    unsigned int num_valid = 0;
+    bool first = true;
+    for (size_t i = 0; i < _spheres.size(); ++i)
+    {
+        const osg::BoundingSphere &sphere = _spheres[i];
+        if (!sphere.valid())
+            continue;
+        osg::Vec3d center = sphere.center();
+        if (first)
+        {
+            _origin = center;
+            first = false;
+        }
+        _origin.x() = std::min(_origin.x(), center.x());
+        _origin.y() = std::min(_origin.y(), center.y());
+        _origin.z() = std::min(_origin.z(), center.z());
+        sum_radius += sphere.radius();
+        ++num_valid;
+    }
+    if (num_valid > 0 && sum_radius > 0.)
+        _cell_size = 2. * sum_radius / num_valid;
+
+    for (size_t i = 0; i < _spheres.size(); ++i)
+    {
+        const osg::BoundingSphere &sphere = _spheres[i];
+        if (!sphere.valid())
+        {
+            _invalid.push_back(i);
+            continue;
+        }
+        osg::Vec3d center = sphere.center();
+        _cells[makeKey(cellCoord(center.x(), _origin.x()),
+                       cellCoord(center.y(), _origin.y()),
+                       cellCoord(center.z(), _origin.z()))].push_back(i);
+    }
+}
+
+SphereIndex::Key SphereIndex::makeKey( int x, int y, int z ) const
+{
+    return (static_cast<Key>(x & 0x1fffff) << 42) |
+           (static_cast<Key>(y & 0x1fffff) << 21) |
+            static_cast<Key>(z & 0x1fffff);
+}
+
+int SphereIndex::cellCoord( double value, double origin ) const
+{
+    return static_cast<int>(std::floor((value - origin) / _cell_size));
+}
+
+void SphereIndex::query( const osg::BoundingSphere &sphere, std::vector<unsigned int> &indices ) const
+{
+    indices.assign(_invalid.begin(), _invalid.end());
+    if (!sphere.valid() || _cells.empty())
+        return;
+
+    // a little slack so rounding never drops a center on the boundary
+    double radius = sphere.radius() * 1.001 + 1e-6;
+    double radius2 = radius * radius;
+    osg::Vec3d center = sphere.center();
+    int min_x = cellCoord(center.x() - radius, _origin.x()), max_x = cellCoord(center.x() + radius, _origin.x());
+    int min_y = cellCoord(center.y() - radius, _origin.y()), max_y = cellCoord(center.y() + radius, _origin.y());
+    int min_z = cellCoord(center.z() - radius, _origin.z()), max_z = cellCoord(center.z() + radius, _origin.z());
+
+    double num_query_cells = double(max_x - min_x + 1) * double(max_y - min_y + 1) * double(max_z - min_z + 1);
+    if (num_query_cells > double(_cells.size()))
+    {
+        // the sphere covers more cells than are occupied, walk the occupied ones
+        for (CellMap::const_iterator itr = _cells.begin(); itr != _cells.end(); ++itr)
+        {
+            for (size_t i = 0; i < itr->second.size(); ++i)
+            {
+                unsigned int index = itr->second[i];
+                if ((osg::Vec3d(_spheres[index].center()) - center).length2() <= radius2)
+                    indices.push_back(index);
+            }
+        }
+    }
+    else
+    {
+        for (int z = min_z; z <= max_z; ++z)
+        {
+            for (int y = min_y; y <= max_y; ++y)
+            {
+                for (int x = min_x; x <= max_x; ++x)
+                {
+                    CellMap::const_iterator itr = _cells.find(makeKey(x, y, z));
+                    if (itr == _cells.end())
+                        continue;
+                    for (size_t i = 0; i < itr->second.size(); ++i)
+                    {
+                        unsigned int index = itr->second[i];
+                        if ((osg::Vec3d(_spheres[index].center()) - center).length2() <= radius2)
+                            indices.push_back(index);
+                    }
+                }
+            }
+        }
+    }
+
+    // callers link children in their original order
+    std::sort(indices.begin(), indices.end());
+}
@@ -0,0 +1,37 @@
+#ifndef _SPHERE_INDEX_H
+#define _SPHERE_INDEX_H
+
+#include <vector>
+#include <unordered_map>
+
+#include <osg/BoundingSphere>
+
+/** uniform grid over the centers of a set of bounding spheres, hashed so
+  * only occupied cells take memory. the cell size follows the mean
+  * diameter of the spheres, so the spheres of the next level up, which are
+  * about twice as large, touch a handful of cells per query.*/
+class SphereIndex {
+    public :
+        /** spheres is referenced, not copied, and must outlive the index.*/
+        SphereIndex( const std::vector<osg::BoundingSphere> &spheres );
+
+        /** indices, in ascending order, of every sphere whose center lies
+          * within the radius of sphere. a sphere contained in it, even only
+          * for the most part, is always among them; invalid spheres are
+          * always returned so the caller's own test decides about them.*/
+        void query( const osg::BoundingSphere &sphere, std::vector<unsigned int> &indices ) const;
+
+    private :
+        typedef unsigned long long Key;
+        typedef std::unordered_map< Key, std::vector<unsigned int> > CellMap;
+
+        Key makeKey( int x, int y, int z ) const;
+        int cellCoord( double value, double origin ) const;
+
+        const std::vector<osg::BoundingSphere> &_spheres;
+        osg::Vec3d _origin;
+        double _cell_size;
+        CellMap _cells;
+        std::vector<unsigned int> _invalid;
+};
+#endif
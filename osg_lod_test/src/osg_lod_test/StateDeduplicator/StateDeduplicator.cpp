@@ -0,0 +1,367 @@
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <osg/Geode>
+#include <osg/Texture>
+#include <osg/NodeVisitor>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/Registry>
+#include <osgDB/WriteFile>
+
+#include <OpenThreads/ScopedLock>
+
+#include "StateDeduplicator.h"
+#include "Utility.h"
+
+typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+namespace
+{
+    // the nodes and drawables of a subgraph that have a stateset
+    class StateSetCollector : public osg::NodeVisitor
+    {
+        public :
+            StateSetCollector() :
+                osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+            {
+            }
+
+            virtual void apply( osg::Node &node )
+            {
+                if (node.getStateSet())
+                    nodes.push_back(&node);
+                traverse(node);
+            }
+
+            virtual void apply( osg::Geode &geode )
+            {
+                if (geode.getStateSet())
+                    nodes.push_back(&geode);
+                for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+                {
+                    if (geode.getDrawable(i)->getStateSet())
+                        drawables.push_back(geode.getDrawable(i));
+                }
+            }
+
+            std::vector<osg::Node*> nodes;
+            std::vector<osg::Drawable*> drawables;
+    };
+
+    // equal statesets have equal signatures once their textures are shared
+    BuildManifest::Hash stateset_signature( const osg::StateSet &stateset )
+    {
+        BuildManifest::Hash hash = BuildManifest::hashCombine(0, stateset.getAttributeList().size());
+        hash = BuildManifest::hashCombine(hash, stateset.getModeList().size());
+        hash = BuildManifest::hashCombine(hash, static_cast<unsigned int>(stateset.getRenderingHint()));
+        hash = BuildManifest::hashCombine(hash, static_cast<unsigned int>(stateset.getBinNumber()));
+
+        const osg::StateSet::TextureAttributeList &units = stateset.getTextureAttributeList();
+        for (size_t i_u = 0; i_u < units.size(); ++i_u)
+        {
+            for (osg::StateSet::AttributeList::const_iterator itr = units[i_u].begin(); itr != units[i_u].end(); ++itr)
+            {
+                hash = BuildManifest::hashCombine(hash, i_u);
+                hash = BuildManifest::hashCombine(hash, static_cast<unsigned int>(itr->first.first));
+                if (dynamic_cast<const osg::Texture*>(itr->second.first.get()))
+                    hash = BuildManifest::hashCombine(hash, reinterpret_cast<size_t>(itr->second.first.get()));
+            }
+        }
+        return hash;
+    }
+}
+
+
+// the textures and statesets of one tile, each source object is shared once
+class StateDeduplicator::Tile
+{
+    public :
+        Tile( StateDeduplicator &dedup, Stats &stats ) :
+            _dedup(dedup),
+            _stats(stats)
+        {
+        }
+
+        osg::StateSet* share( const osg::StateSet &stateset )
+        {
+            std::map<const osg::StateSet*, osg::ref_ptr<osg::StateSet> >::iterator shared = _shared_statesets.find(&stateset);
+            if (shared != _shared_statesets.end())
+                return shared->second.get();
+
+            // textures with shared images first, equal images make equal textures
+            osg::ref_ptr<osg::StateSet> copy = new osg::StateSet(stateset, osg::CopyOp::SHALLOW_COPY);
+            const osg::StateSet::TextureAttributeList &units = stateset.getTextureAttributeList();
+            for (unsigned int i_u = 0; i_u < units.size(); ++i_u)
+            {
+                for (osg::StateSet::AttributeList::const_iterator itr = units[i_u].begin(); itr != units[i_u].end(); ++itr)
+                {
+                    const osg::Texture *texture = dynamic_cast<const osg::Texture*>(itr->second.first.get());
+                    if (!texture)
+                        continue;
+                    osg::Texture *shared_texture = share(*texture);
+                    if (!shared_texture)
+                        return 0;
+                    if (shared_texture != texture)
+                        copy->setTextureAttribute(i_u, shared_texture, itr->second.second);
+                }
+            }
+            copy->setDataVariance(osg::Object::STATIC);
+
+            BuildManifest::Hash signature = stateset_signature(*copy);
+            osg::StateSet *result = copy.get();
+            typedef std::multimap<BuildManifest::Hash, osg::StateSet*>::iterator Iterator;
+            std::pair<Iterator, Iterator> range = _statesets.equal_range(signature);
+            for (Iterator itr = range.first; itr != range.second; ++itr)
+            {
+                if (itr->second->compare(*copy, true) == 0)
+                {
+                    result = itr->second;
+                    break;
+                }
+            }
+            if (result == copy.get())
+            {
+                _statesets.insert(std::make_pair(signature, result));
+                ++_stats.num_statesets;
+            } else
+                ++_stats.num_shared_statesets;
+
+            _shared_statesets[&stateset] = result;
+            return result;
+        }
+
+    private :
+        osg::Texture* share( const osg::Texture &texture )
+        {
+            std::map<const osg::Texture*, osg::ref_ptr<osg::Texture> >::iterator shared = _shared_textures.find(&texture);
+            if (shared != _shared_textures.end())
+                return shared->second.get();
+
+            osg::ref_ptr<osg::Texture> copy = osg::clone(&texture, osg::CopyOp::SHALLOW_COPY);
+            for (unsigned int i = 0; i < texture.getNumImages(); ++i)
+            {
+                const osg::Image *image = texture.getImage(i);
+                if (!image || !image->data())
+                    continue;
+                osg::ref_ptr<osg::Image> reference = _dedup.shareImage(*image, _stats);
+                if (!reference.valid())
+                    return 0;
+                copy->setImage(i, reference.get());
+            }
+            copy->setDataVariance(osg::Object::STATIC);
+
+            const osg::Image *key = copy->getNumImages() > 0 ? copy->getImage(0) : 0;
+            osg::Texture *result = copy.get();
+            typedef std::multimap<const osg::Image*, osg::Texture*>::iterator Iterator;
+            std::pair<Iterator, Iterator> range = _textures.equal_range(key);
+            for (Iterator itr = range.first; itr != range.second; ++itr)
+            {
+                if (itr->second->compare(*copy) == 0)
+                {
+                    result = itr->second;
+                    break;
+                }
+            }
+            if (result == copy.get())
+                _textures.insert(std::make_pair(key, result));
+
+            _shared_textures[&texture] = result;
+            return result;
+        }
+
+        StateDeduplicator &_dedup;
+        Stats &_stats;
+
+        /** the shared object of every source object of the tile.*/
+        std::map<const osg::StateSet*, osg::ref_ptr<osg::StateSet> > _shared_statesets;
+        std::map<const osg::Texture*, osg::ref_ptr<osg::Texture> > _shared_textures;
+
+        /** the distinct statesets by signature, textures by first image.*/
+        std::multimap<BuildManifest::Hash, osg::StateSet*> _statesets;
+        std::multimap<const osg::Image*, osg::Texture*> _textures;
+};
+
+
+StateDeduplicator::Stats::Stats( void ) :
+    num_images(0),
+    num_shared_images(0),
+    num_statesets(0),
+    num_shared_statesets(0),
+    bytes_written(0),
+    bytes_shared(0)
+{
+}
+
+StateDeduplicator::Stats& StateDeduplicator::Stats::operator += (const Stats &rhs)
+{
+    num_images += rhs.num_images;
+    num_shared_images += rhs.num_shared_images;
+    num_statesets += rhs.num_statesets;
+    num_shared_statesets += rhs.num_shared_statesets;
+    bytes_written += rhs.bytes_written;
+    bytes_shared += rhs.bytes_shared;
+    return *this;
+}
+
+StateDeduplicator::StateDeduplicator( const std::string &tile_dir, const std::string &image_dir ) :
+    _tile_dir(tile_dir),
+    _image_dir(image_dir)
+{
+}
+
+osg::ref_ptr<osg::Node> StateDeduplicator::share( const osg::Node &node, Stats *stats )
+{
+    osg::ref_ptr<osg::Node> copy = dynamic_cast<osg::Node*>(
+        node.clone(osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES));
+    if (!copy.valid())
+        return 0;
+
+    StateSetCollector collect;
+    copy->accept(collect);
+
+    Stats tile_stats;
+    Tile tile(*this, tile_stats);
+    for (size_t i = 0; i < collect.nodes.size(); ++i)
+    {
+        osg::StateSet *stateset = tile.share(*collect.nodes[i]->getStateSet());
+        if (!stateset)
+            return 0;
+        collect.nodes[i]->setStateSet(stateset);
+    }
+    for (size_t i = 0; i < collect.drawables.size(); ++i)
+    {
+        osg::StateSet *stateset = tile.share(*collect.drawables[i]->getStateSet());
+        if (!stateset)
+            return 0;
+        collect.drawables[i]->setStateSet(stateset);
+    }
+
+    if (stats)
+        *stats += tile_stats;
+    return copy;
+}
+
+osg::ref_ptr<osg::Image> StateDeduplicator::shareImage( const osg::Image &image, Stats &stats )
+{
+    BuildManifest::Hash hash = hashImage(image);
+    unsigned long long bytes = image.getTotalSizeInBytesIncludingMipmaps();
+
+    // the image is published once its file is written, the tiles asking for
+    // it meanwhile wait. a failed write leaves it to the next tile
+    {
+        ScopedLock lock(_mutex);
+        for (;;)
+        {
+            std::map<BuildManifest::Hash, SharedImage>::iterator itr = _images.find(hash);
+            if (itr == _images.end())
+                break;
+            if (!itr->second.pending)
+            {
+                ++stats.num_shared_images;
+                stats.bytes_shared += bytes;
+                return itr->second.reference;
+            }
+            _image_written.wait(&_mutex);
+        }
+        _images[hash] = SharedImage();
+    }
+
+    osg::ref_ptr<osg::Image> reference = new osg::Image;
+    reference->setFileName(imageFileName(hash, image));
+    reference->setWriteHint(osg::Image::EXTERNAL_FILE);
+
+    // the files are named by their pixels, one left by an earlier build or
+    // another shard holds the same image. written under a name of this
+    // process so an interrupted write is not taken for one and two
+    // processes never write the same file
+    std::string filename = osgDB::concatPaths(_tile_dir, reference->getFileName());
+    std::string pack_name = _pack.valid() ? _pack->entryName(filename) : std::string();
+    bool written = true;
+    if (!pack_name.empty())
+    {
+        osgDB::ReaderWriter *rw = osgDB::Registry::instance()->getReaderWriterForExtension(
+            osgDB::getLowerCaseFileExtension(filename));
+        std::ostringstream sstr(std::ios::out | std::ios::binary);
+        written = rw && rw->writeImage(image, sstr).success();
+        if (written)
+        {
+            std::string data = sstr.str();
+            written = _pack->add(pack_name, data.data(), data.size());
+        }
+    }
+    else if (!osgDB::fileExists(filename))
+    {
+        // the extension picks the image writer
+        std::string temp_filename = Utility::tempFileName(osgDB::getNameLessExtension(filename)) + "." +
+            osgDB::getFileExtension(filename);
+        written = osgDB::makeDirectoryForFile(filename) && osgDB::writeImageFile(image, temp_filename) &&
+            (rename(temp_filename.c_str(), filename.c_str()) == 0 || osgDB::fileExists(filename));
+        remove(temp_filename.c_str());
+    }
+
+    {
+        ScopedLock lock(_mutex);
+        if (written)
+        {
+            SharedImage &entry = _images[hash];
+            entry.reference = reference;
+            entry.pending = false;
+        }
+        else
+            _images.erase(hash);
+        _image_written.broadcast();
+    }
+    if (!written)
+    {
+        std::cout<<filename<<" write failed.."<<std::endl;
+        return 0;
+    }
+    ++stats.num_images;
+    stats.bytes_written += bytes;
+    return reference;
+}
+
+void StateDeduplicator::addStats( const Stats &stats )
+{
+    ScopedLock lock(_mutex);
+    _total += stats;
+}
+
+StateDeduplicator::Stats StateDeduplicator::getTotal( void ) const
+{
+    ScopedLock lock(_mutex);
+    return _total;
+}
+
+BuildManifest::Hash StateDeduplicator::hashImage( const osg::Image &image )
+{
+    unsigned int header[] = {
+        static_cast<unsigned int>(image.s()), static_cast<unsigned int>(image.t()), static_cast<unsigned int>(image.r()),
+        static_cast<unsigned int>(image.getInternalTextureFormat()), image.getPixelFormat(), image.getDataType(),
+        image.getPacking(), image.getNumMipmapLevels() };
+    BuildManifest::Hash hash = BuildManifest::hashData(header, sizeof(header));
+
+    if (image.isDataContiguous())
+        return BuildManifest::hashData(image.data(), image.getTotalSizeInBytesIncludingMipmaps(), hash);
+    for (osg::Image::DataIterator itr(&image); itr.valid(); ++itr)
+        hash = BuildManifest::hashData(itr.data(), itr.size(), hash);
+    return hash;
+}
+
+std::string StateDeduplicator::imageFileName( BuildManifest::Hash hash, const osg::Image &image ) const
+{
+    // png holds 8 bit images without mipmaps, dds everything else
+    GLenum format = image.getPixelFormat();
+    bool png = !image.isCompressed() && !image.isMipmap() && image.r() == 1 &&
+        image.getDataType() == GL_UNSIGNED_BYTE &&
+        (format == GL_RGB || format == GL_RGBA || format == GL_LUMINANCE || format == GL_LUMINANCE_ALPHA);
+
+    // a path inside the tiles, '/' on every platform
+    std::stringstream sstr;
+    sstr << _image_dir << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << (png ? ".png" : ".dds");
+    return sstr.str();
+}
@@ -0,0 +1,103 @@
+#ifndef _STATE_DEDUPLICATOR_H
+#define _STATE_DEDUPLICATOR_H
+
+#include <map>
+#include <string>
+
+#include <osg/Node>
+#include <osg/Image>
+#include <osg/StateSet>
+
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+
+#include "BuildManifest.h"
+#include "TilePack.h"
+
+/** shares the images and statesets of the generated tiles across a build.
+  * every image is hashed by its pixels and written once to a shared
+  * image file next to the tiles, a tile keeps a reference to the file
+  * instead of its own copy of the pixels. within a tile, textures and
+  * statesets that are equal once their images are shared become one
+  * object.
+  *
+  * a tile file can't reference the objects of another one, the viewer
+  * shares them: reading the tiles with osgDB::Options::CACHE_IMAGES loads
+  * every image file once, and osgDB::Registry's SharedStateManager merges
+  * the equal textures and statesets (all marked STATIC) of the loaded
+  * tiles.*/
+class StateDeduplicator {
+    public :
+        struct Stats
+        {
+            Stats(void);
+
+            unsigned int num_images;
+            unsigned int num_shared_images;
+            unsigned int num_statesets;
+            unsigned int num_shared_statesets;
+            unsigned long long bytes_written;
+            unsigned long long bytes_shared;
+
+            Stats& operator += (const Stats &rhs);
+        };
+
+        /** the shared images are written to image_dir below tile_dir, the
+          * directory of the tiles that reference them.*/
+        StateDeduplicator( const std::string &tile_dir, const std::string &image_dir = "textures" );
+
+        const std::string& getImageDirectory(void) const { return _image_dir; }
+
+        /** write the shared images into pack along with the tiles, 0 for files.*/
+        void setPack( TilePack *pack ) { _pack = pack; }
+
+        /** a copy of node with shared images, textures and statesets. the
+          * nodes, drawables, statesets and textures that change are copied,
+          * node is not touched. null if a shared image can't be written.
+          * thread safe.*/
+        osg::ref_ptr<osg::Node> share( const osg::Node &node, Stats *stats = 0 );
+
+        /** sum up the statistics of a written tile, thread safe.*/
+        void addStats( const Stats &stats );
+        Stats getTotal(void) const;
+
+        /** hash of the size, format and pixels of image, mipmaps included.*/
+        static BuildManifest::Hash hashImage( const osg::Image &image );
+
+        /** name of the shared image file of hash relative to the tiles, dds
+          * where png can't hold the image.*/
+        std::string imageFileName( BuildManifest::Hash hash, const osg::Image &image ) const;
+
+    private :
+        StateDeduplicator( const StateDeduplicator& ) {}
+        StateDeduplicator& operator = (const StateDeduplicator& ) { return *this; }
+
+        /** an image without pixels referencing the shared file of image,
+          * written by the first tile that uses it, the others wait for the
+          * write. null if it fails.*/
+        osg::ref_ptr<osg::Image> shareImage( const osg::Image &image, Stats &stats );
+
+        class Tile;
+        friend class Tile;
+
+        std::string _tile_dir;
+        std::string _image_dir;
+        osg::ref_ptr<TilePack> _pack;
+
+        struct SharedImage
+        {
+            SharedImage(void) : pending(true) {}
+
+            osg::ref_ptr<osg::Image> reference;
+            /** the file is being written.*/
+            bool pending;
+        };
+
+        /** the reference images written by this build.*/
+        std::map<BuildManifest::Hash, SharedImage> _images;
+
+        Stats _total;
+        mutable OpenThreads::Mutex _mutex;
+        OpenThreads::Condition _image_written;
+};
+#endif
@@ -0,0 +1,260 @@
+#include <cmath>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+
+#include "TerrainGenerator.h"
+#include "TileIndex.h"
+
+namespace
+{
+    const unsigned int num_octaves = 6;
+
+    // hills across the terrain at the lowest octave, and their height
+    const double base_frequency = 4.;
+    const double base_amplitude = 0.04;
+
+    unsigned int hash( int x, int y, unsigned int seed )
+    {
+        unsigned int h = static_cast<unsigned int>(x) * 374761393u + static_cast<unsigned int>(y) * 668265263u +
+                         seed * 2246822519u;
+        h = (h ^ (h >> 13)) * 1274126177u;
+        return h ^ (h >> 16);
+    }
+
+    double lattice( int x, int y, unsigned int seed )
+    {
+        return hash(x, y, seed) / 4294967295. * 2. - 1.;
+    }
+
+    double smooth( double t )
+    {
+        return t * t * (3. - 2. * t);
+    }
+
+    bool write_file( const std::string &filename, const std::string &content, unsigned long long &num_bytes )
+    {
+        std::ofstream file(filename.c_str(), std::ios::out | std::ios::binary);
+        file.write(content.data(), content.size());
+        if (!file.good())
+            return false;
+        num_bytes += content.size();
+        return true;
+    }
+
+    void put_le16( std::string &out, unsigned int value )
+    {
+        out += static_cast<char>(value & 0xff);
+        out += static_cast<char>((value >> 8) & 0xff);
+    }
+}
+
+TerrainGenerator::Stats::Stats( void ) :
+    num_tiles(0),
+    num_triangles(0),
+    num_bytes(0)
+{
+}
+
+TerrainGenerator::TerrainGenerator( unsigned int num_levels, unsigned int tile_resolution,
+                                    unsigned int texture_size, double extent ) :
+    _num_levels(std::min(std::max(num_levels, 1u), 12u)),
+    _tile_resolution(std::max(tile_resolution, 1u)),
+    _texture_size(std::min(texture_size, 8192u)),
+    _extent(extent > 0. ? extent : 1000.),
+    _seed(1)
+{
+}
+
+double TerrainGenerator::noise( double x, double y, unsigned int octave ) const
+{
+    double fx = floor(x), fy = floor(y);
+    int xi = static_cast<int>(fx), yi = static_cast<int>(fy);
+    double tx = smooth(x - fx), ty = smooth(y - fy);
+    unsigned int seed = _seed * 31u + octave;
+
+    double a = lattice(xi, yi, seed), b = lattice(xi + 1, yi, seed);
+    double c = lattice(xi, yi + 1, seed), d = lattice(xi + 1, yi + 1, seed);
+    return (a + (b - a) * tx) * (1. - ty) + (c + (d - c) * tx) * ty;
+}
+
+double TerrainGenerator::height( double x, double y ) const
+{
+    double frequency = base_frequency / _extent;
+    double amplitude = base_amplitude * _extent;
+    double h = 0.;
+    for (unsigned int octave = 0; octave < num_octaves; ++octave)
+    {
+        h += noise(x * frequency, y * frequency, octave) * amplitude;
+        frequency *= 2.;
+        amplitude *= 0.5;
+    }
+    return h;
+}
+
+std::string TerrainGenerator::levelDirectory( const std::string &directory, unsigned int level )
+{
+    std::stringstream sstr;
+    sstr << "level_" << level;
+    return osgDB::concatPaths(directory, sstr.str());
+}
+
+bool TerrainGenerator::writeTile( const std::string &directory, const std::string &name, double x0, double y0, double size,
+                                  Stats &stats ) const
+{
+    // obj is y up, the readers turn (x, h, -y) back to z up
+    const unsigned int r = _tile_resolution;
+    const double step = size / r;
+    std::string base = osgDB::getStrippedName(name);
+
+    std::ostringstream obj;
+    obj.precision(9);
+    if (_texture_size > 0)
+        obj << "mtllib " << base << ".mtl\n";
+
+    for (unsigned int j = 0; j <= r; ++j)
+    {
+        for (unsigned int i = 0; i <= r; ++i)
+        {
+            double x = x0 + i * step, y = y0 + j * step;
+            obj << "v " << x << " " << height(x, y) << " " << -y << "\n";
+        }
+    }
+    for (unsigned int j = 0; j <= r; ++j)
+    {
+        for (unsigned int i = 0; i <= r; ++i)
+        {
+            double x = x0 + i * step, y = y0 + j * step;
+            double dx = (height(x + step, y) - height(x - step, y)) / (2. * step);
+            double dy = (height(x, y + step) - height(x, y - step)) / (2. * step);
+            double length = sqrt(dx * dx + dy * dy + 1.);
+            obj << "vn " << -dx / length << " " << 1. / length << " " << dy / length << "\n";
+        }
+    }
+    for (unsigned int j = 0; j <= r; ++j)
+    {
+        for (unsigned int i = 0; i <= r; ++i)
+            obj << "vt " << double(i) / r << " " << double(j) / r << "\n";
+    }
+
+    if (_texture_size > 0)
+        obj << "usemtl terrain\n";
+    for (unsigned int j = 0; j < r; ++j)
+    {
+        for (unsigned int i = 0; i < r; ++i)
+        {
+            // obj counts from 1, position, texcoord and normal share the index
+            unsigned int a = j * (r + 1) + i + 1, b = a + 1, c = a + r + 2, d = a + r + 1;
+            obj << "f " << a << "/" << a << "/" << a << " " << b << "/" << b << "/" << b << " "
+                << c << "/" << c << "/" << c << "\n";
+            obj << "f " << a << "/" << a << "/" << a << " " << c << "/" << c << "/" << c << " "
+                << d << "/" << d << "/" << d << "\n";
+        }
+    }
+    if (!write_file(osgDB::concatPaths(directory, name), obj.str(), stats.num_bytes))
+        return false;
+
+    if (_texture_size > 0)
+    {
+        std::ostringstream mtl;
+        mtl << "newmtl terrain\n"
+               "Ka 0.2 0.2 0.2\n"
+               "Kd 1 1 1\n"
+               "Ks 0 0 0\n"
+               "map_Kd " << base << ".tga\n";
+        if (!write_file(osgDB::concatPaths(directory, base + ".mtl"), mtl.str(), stats.num_bytes))
+            return false;
+
+        // uncompressed 24 bit tga, rows from the bottom like the texcoords.
+        // grass to rock to snow by height, darker on the slopes
+        const unsigned int n = _texture_size;
+        std::string tga;
+        tga.reserve(18 + n * n * 3);
+        tga += '\0'; tga += '\0'; tga += '\2';
+        tga.append(9, '\0');
+        put_le16(tga, n);
+        put_le16(tga, n);
+        tga += static_cast<char>(24);
+        tga += '\0';
+
+        const double texel = size / n;
+        const double top = base_amplitude * _extent;
+        for (unsigned int j = 0; j < n; ++j)
+        {
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                double x = x0 + (i + 0.5) * texel, y = y0 + (j + 0.5) * texel;
+                double h = height(x, y);
+                double t = std::min(std::max((h / top + 1.) * 0.5, 0.), 1.);
+                double slope = fabs(height(x + texel, y) - h) + fabs(height(x, y + texel) - h);
+                double shade = 1. / (1. + slope / texel);
+
+                double rgb[3];
+                if (t < 0.5)
+                {
+                    double s = t * 2.;
+                    rgb[0] = 60. + s * 70.; rgb[1] = 120. - s * 10.; rgb[2] = 50. + s * 30.;
+                }
+                else
+                {
+                    double s = (t - 0.5) * 2.;
+                    rgb[0] = 130. + s * 110.; rgb[1] = 110. + s * 130.; rgb[2] = 80. + s * 160.;
+                }
+                for (int c = 2; c >= 0; --c)
+                    tga += static_cast<char>(static_cast<unsigned char>(std::min(rgb[c] * (0.5 + 0.5 * shade), 255.)));
+            }
+        }
+        if (!write_file(osgDB::concatPaths(directory, base + ".tga"), tga, stats.num_bytes))
+            return false;
+    }
+
+    stats.num_tiles++;
+    stats.num_triangles += 2ull * r * r;
+    return true;
+}
+
+std::string TerrainGenerator::generate( const std::string &directory, Stats *stats ) const
+{
+    Stats generated;
+    if (!osgDB::makeDirectory(directory))
+        return std::string();
+
+    std::string config_filename = osgDB::concatPaths(directory, "config.txt");
+    std::string top_level_filename = osgDB::concatPaths(directory, "top.obj");
+    if (!writeTile(directory, "top.obj", 0., 0., _extent, generated))
+        return std::string();
+
+    std::ostringstream config;
+    config << top_level_filename << "\n";
+    for (unsigned int level = 1; level <= _num_levels; ++level)
+    {
+        std::string level_dir = levelDirectory(directory, level);
+        if (!osgDB::makeDirectory(level_dir))
+            return std::string();
+
+        const unsigned int n = 1u << level;
+        const double size = _extent / n;
+        for (unsigned int y = 0; y < n; ++y)
+        {
+            for (unsigned int x = 0; x < n; ++x)
+            {
+                if (!writeTile(level_dir, TileIndex::meshName(x, y), x * size, y * size, size, generated))
+                    return std::string();
+            }
+        }
+        config << level_dir << "\n";
+    }
+
+    unsigned long long num_bytes = 0;
+    if (!write_file(config_filename, config.str(), num_bytes))
+        return std::string();
+    generated.num_bytes += num_bytes;
+
+    if (stats)
+        *stats = generated;
+    return config_filename;
+}
@@ -0,0 +1,63 @@
+#ifndef _TERRAIN_GENERATOR_H
+#define _TERRAIN_GENERATOR_H
+
+#include <string>
+
+/** writes a synthetic tiled terrain in the layout process_config_file2
+  * reads: a config file, a top level obj and one directory per level with
+  * 2^level x 2^level mesh_<x>_<y>_adj_model.obj tiles, each with its own
+  * mtl and tga texture, y up like any obj. the heights are fractal value
+  * noise, so the tiles of every level join and the same seed gives the
+  * same dataset.*/
+class TerrainGenerator {
+    public :
+        struct Stats
+        {
+            Stats(void);
+
+            unsigned int num_tiles;
+            unsigned long long num_triangles;
+            unsigned long long num_bytes;
+        };
+
+        /** tile_resolution quads along a tile side at every level, so the
+          * coarser levels have fewer triangles per area. texture_size 0
+          * writes untextured tiles.*/
+        TerrainGenerator( unsigned int num_levels = 3, unsigned int tile_resolution = 64,
+                          unsigned int texture_size = 256, double extent = 1000. );
+
+        void setSeed( unsigned int seed ) { _seed = seed; }
+        unsigned int getSeed(void) const { return _seed; }
+
+        unsigned int getNumLevels(void) const { return _num_levels; }
+        unsigned int getTileResolution(void) const { return _tile_resolution; }
+        unsigned int getTextureSize(void) const { return _texture_size; }
+        double getExtent(void) const { return _extent; }
+
+        /** height at x, y in [0, extent].*/
+        double height( double x, double y ) const;
+
+        /** writes the dataset into directory (created if needed), returns the
+          * config file name or an empty string on failure.*/
+        std::string generate( const std::string &directory, Stats *stats = 0 ) const;
+
+        /** the directory of level (1 to num_levels) below directory.*/
+        static std::string levelDirectory( const std::string &directory, unsigned int level );
+
+    private :
+        TerrainGenerator( const TerrainGenerator& ) {}
+        TerrainGenerator& operator = (const TerrainGenerator& ) { return *this; }
+
+        /** one square of the terrain as an obj, its mtl and texture.*/
+        bool writeTile( const std::string &directory, const std::string &name, double x0, double y0, double size,
+                        Stats &stats ) const;
+
+        double noise( double x, double y, unsigned int octave ) const;
+
+        unsigned int _num_levels;
+        unsigned int _tile_resolution;
+        unsigned int _texture_size;
+        double _extent;
+        unsigned int _seed;
+};
+#endif
@@ -0,0 +1,783 @@
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/NodeVisitor>
+#include <osg/Texture2D>
+
+#include <OpenThreads/ScopedLock>
+
+#include "TextureProcessor.h"
+#include "TileScheduler.h"
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    #define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    #define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_BGR
+    #define GL_BGR 0x80E0
+#endif
+#ifndef GL_BGRA
+    #define GL_BGRA 0x80E1
+#endif
+
+typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+namespace
+{
+    // block rows of a chunk task, smaller images are encoded inline
+    const unsigned int min_chunk_blocks = 4096;
+
+    // an atlas cell smaller than this loses too much of its textures
+    const unsigned int min_atlas_cell = 16;
+
+    // texcoords this far outside [0,1] still count as inside
+    const float texcoord_tolerance = 1e-3f;
+
+    class CollectVisitor : public osg::NodeVisitor
+    {
+        public :
+            CollectVisitor() :
+                osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+            {
+            }
+
+            virtual void apply( osg::Geode &geode )
+            {
+                for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+                {
+                    osg::Geometry *geometry = geode.getDrawable(i)->asGeometry();
+                    if (geometry)
+                        geometries.push_back(geometry);
+                }
+            }
+
+            std::vector<osg::Geometry*> geometries;
+    };
+
+    struct Textured
+    {
+        osg::Geometry *geometry;
+        const osg::Texture2D *texture;
+        const osg::Image *image;
+    };
+
+    const osg::Texture2D* texture_of( const osg::Geometry &geometry )
+    {
+        const osg::StateSet *stateset = geometry.getStateSet();
+        if (!stateset)
+            return 0;
+        return dynamic_cast<const osg::Texture2D*>(stateset->getTextureAttribute(0, osg::StateAttribute::TEXTURE));
+    }
+
+    // 8 bit rgba copy of image, false when it can't be read back
+    bool read_rgba( const osg::Image &image, std::vector<unsigned char> &rgba )
+    {
+        if (image.isCompressed() || image.r() != 1 || image.s() <= 0 || image.t() <= 0 || !image.data())
+            return false;
+
+        const unsigned int width = image.s();
+        const unsigned int height = image.t();
+        rgba.resize(size_t(width) * height * 4);
+
+        // offsets of r, g, b and a in a pixel of the byte formats, -1 is opaque
+        int components = 0;
+        int offsets[4] = { 0, 0, 0, -1 };
+        switch (image.getDataType() == GL_UNSIGNED_BYTE ? image.getPixelFormat() : 0)
+        {
+            case GL_RGB :             components = 3; offsets[1] = 1; offsets[2] = 2; break;
+            case GL_RGBA :            components = 4; offsets[1] = 1; offsets[2] = 2; offsets[3] = 3; break;
+            case GL_BGR :             components = 3; offsets[0] = 2; offsets[1] = 1; break;
+            case GL_BGRA :            components = 4; offsets[0] = 2; offsets[1] = 1; offsets[3] = 3; break;
+            case GL_LUMINANCE :       components = 1; break;
+            case GL_LUMINANCE_ALPHA : components = 2; offsets[3] = 1; break;
+            default : break;
+        }
+
+        for (unsigned int y = 0; y < height; ++y)
+        {
+            unsigned char *dst = &rgba[size_t(y) * width * 4];
+            if (components)
+            {
+                const unsigned char *src = image.data(0, y);
+                for (unsigned int x = 0; x < width; ++x, src += components, dst += 4)
+                {
+                    for (int c = 0; c < 4; ++c)
+                        dst[c] = offsets[c] < 0 ? 255 : src[offsets[c]];
+                }
+            }
+            else
+            {
+                for (unsigned int x = 0; x < width; ++x, dst += 4)
+                {
+                    osg::Vec4 color = image.getColor(x, y);
+                    for (int c = 0; c < 4; ++c)
+                        dst[c] = static_cast<unsigned char>(std::min(std::max(color[c], 0.f), 1.f) * 255.f + 0.5f);
+                }
+            }
+        }
+        return true;
+    }
+
+    // area average of the src pixels into dst, dst_stride is in pixels.
+    // growing repeats the pixels.
+    void resample( const unsigned char *src, unsigned int src_width, unsigned int src_height,
+                   unsigned char *dst, unsigned int dst_width, unsigned int dst_height, unsigned int dst_stride )
+    {
+        for (unsigned int y = 0; y < dst_height; ++y)
+        {
+            unsigned int y0 = static_cast<unsigned int>((unsigned long long)y * src_height / dst_height);
+            unsigned int y1 = static_cast<unsigned int>((unsigned long long)(y + 1) * src_height / dst_height);
+            if (y1 <= y0) y1 = y0 + 1;
+
+            for (unsigned int x = 0; x < dst_width; ++x)
+            {
+                unsigned int x0 = static_cast<unsigned int>((unsigned long long)x * src_width / dst_width);
+                unsigned int x1 = static_cast<unsigned int>((unsigned long long)(x + 1) * src_width / dst_width);
+                if (x1 <= x0) x1 = x0 + 1;
+
+                unsigned long long sum[4] = { 0, 0, 0, 0 };
+                for (unsigned int sy = y0; sy < y1; ++sy)
+                {
+                    const unsigned char *p = src + (size_t(sy) * src_width + x0) * 4;
+                    for (unsigned int sx = x0; sx < x1; ++sx, p += 4)
+                    {
+                        sum[0] += p[0]; sum[1] += p[1]; sum[2] += p[2]; sum[3] += p[3];
+                    }
+                }
+
+                unsigned long long count = (unsigned long long)(y1 - y0) * (x1 - x0);
+                unsigned char *d = dst + (size_t(y) * dst_stride + x) * 4;
+                for (int c = 0; c < 4; ++c)
+                    d[c] = static_cast<unsigned char>((sum[c] + count / 2) / count);
+            }
+        }
+    }
+
+    // halves width and height until both fit size_limit, which keeps the
+    // mip chain of power of two images exact.
+    void fit_size( unsigned int &width, unsigned int &height, unsigned int size_limit )
+    {
+        while (width > size_limit || height > size_limit)
+        {
+            width = std::max(width / 2, 1u);
+            height = std::max(height / 2, 1u);
+        }
+    }
+
+    bool has_alpha( const std::vector<unsigned char> &rgba )
+    {
+        for (size_t i = 3; i < rgba.size(); i += 4)
+        {
+            if (rgba[i] != 255)
+                return true;
+        }
+        return false;
+    }
+
+    unsigned short to_565( const float *color )
+    {
+        int r = static_cast<int>(floorf(color[0] * 31.f / 255.f + 0.5f));
+        int g = static_cast<int>(floorf(color[1] * 63.f / 255.f + 0.5f));
+        int b = static_cast<int>(floorf(color[2] * 31.f / 255.f + 0.5f));
+        r = std::min(std::max(r, 0), 31);
+        g = std::min(std::max(g, 0), 63);
+        b = std::min(std::max(b, 0), 31);
+        return static_cast<unsigned short>((r << 11) | (g << 5) | b);
+    }
+
+    void from_565( unsigned short value, int *color )
+    {
+        int r = (value >> 11) & 31, g = (value >> 5) & 63, b = value & 31;
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+
+    // end points on the principal axis of the block's colors, pulled in by
+    // a sixteenth of their distance, and the nearest of the four colors
+    // for every pixel.
+    void encode_color( const unsigned char *rgba, unsigned char *block )
+    {
+        float mean[3] = { 0.f, 0.f, 0.f };
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int c = 0; c < 3; ++c)
+                mean[c] += rgba[i * 4 + c];
+        }
+        for (int c = 0; c < 3; ++c)
+            mean[c] /= 16.f;
+
+        // xx xy xz yy yz zz
+        float cov[6] = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+        for (int i = 0; i < 16; ++i)
+        {
+            float d[3] = { rgba[i * 4] - mean[0], rgba[i * 4 + 1] - mean[1], rgba[i * 4 + 2] - mean[2] };
+            cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+            cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+        }
+
+        float axis[3] = { 1.f, 1.f, 1.f };
+        for (int iteration = 0; iteration < 8; ++iteration)
+        {
+            float next[3] = { cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                              cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                              cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2] };
+            float largest = std::max(fabsf(next[0]), std::max(fabsf(next[1]), fabsf(next[2])));
+            if (largest < 1e-6f)
+                break;
+            for (int c = 0; c < 3; ++c)
+                axis[c] = next[c] / largest;
+        }
+        float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        for (int c = 0; c < 3; ++c)
+            axis[c] /= length;
+
+        float lo = 1e30f, hi = -1e30f;
+        for (int i = 0; i < 16; ++i)
+        {
+            float t = (rgba[i * 4] - mean[0]) * axis[0] + (rgba[i * 4 + 1] - mean[1]) * axis[1] +
+                      (rgba[i * 4 + 2] - mean[2]) * axis[2];
+            lo = std::min(lo, t);
+            hi = std::max(hi, t);
+        }
+        float inset = (hi - lo) / 16.f;
+        lo += inset;
+        hi -= inset;
+
+        float e0[3], e1[3];
+        for (int c = 0; c < 3; ++c)
+        {
+            e0[c] = mean[c] + axis[c] * hi;
+            e1[c] = mean[c] + axis[c] * lo;
+        }
+        unsigned short c0 = to_565(e0), c1 = to_565(e1);
+        if (c0 < c1)
+            std::swap(c0, c1);
+
+        // c0 > c1 selects the four color mode, equal end points need no indices
+        unsigned int indices = 0;
+        if (c0 != c1)
+        {
+            int palette[4][3];
+            from_565(c0, palette[0]);
+            from_565(c1, palette[1]);
+            for (int c = 0; c < 3; ++c)
+            {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+
+            for (int i = 0; i < 16; ++i)
+            {
+                int best = 0, best_distance = 1 << 30;
+                for (int j = 0; j < 4; ++j)
+                {
+                    int dr = rgba[i * 4] - palette[j][0];
+                    int dg = rgba[i * 4 + 1] - palette[j][1];
+                    int db = rgba[i * 4 + 2] - palette[j][2];
+                    int distance = dr * dr + dg * dg + db * db;
+                    if (distance < best_distance)
+                    {
+                        best = j;
+                        best_distance = distance;
+                    }
+                }
+                indices |= static_cast<unsigned int>(best) << (i * 2);
+            }
+        }
+
+        block[0] = static_cast<unsigned char>(c0 & 0xff);
+        block[1] = static_cast<unsigned char>(c0 >> 8);
+        block[2] = static_cast<unsigned char>(c1 & 0xff);
+        block[3] = static_cast<unsigned char>(c1 >> 8);
+        for (int b = 0; b < 4; ++b)
+            block[4 + b] = static_cast<unsigned char>(indices >> (b * 8));
+    }
+
+    // the largest and smallest alpha as end points, eight values between them
+    void encode_alpha( const unsigned char *rgba, unsigned char *block )
+    {
+        int a0 = 0, a1 = 255;
+        for (int i = 0; i < 16; ++i)
+        {
+            a0 = std::max(a0, int(rgba[i * 4 + 3]));
+            a1 = std::min(a1, int(rgba[i * 4 + 3]));
+        }
+        block[0] = static_cast<unsigned char>(a0);
+        block[1] = static_cast<unsigned char>(a1);
+
+        unsigned long long indices = 0;
+        if (a0 != a1)
+        {
+            int palette[8] = { a0, a1 };
+            for (int k = 2; k < 8; ++k)
+                palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+
+            for (int i = 0; i < 16; ++i)
+            {
+                int best = 0, best_distance = 256;
+                for (int j = 0; j < 8; ++j)
+                {
+                    int distance = std::abs(rgba[i * 4 + 3] - palette[j]);
+                    if (distance < best_distance)
+                    {
+                        best = j;
+                        best_distance = distance;
+                    }
+                }
+                indices |= static_cast<unsigned long long>(best) << (i * 3);
+            }
+        }
+        for (int b = 0; b < 6; ++b)
+            block[2 + b] = static_cast<unsigned char>(indices >> (b * 8));
+    }
+
+    // the blocks of rows [first_row, first_row + num_rows) of one level,
+    // pixels past the edge repeat the last row and column.
+    void encode_rows( const unsigned char *rgba, unsigned int width, unsigned int height, bool alpha,
+                      unsigned int first_row, unsigned int num_rows, unsigned char *out )
+    {
+        const unsigned int blocks_x = (width + 3) / 4;
+        const unsigned int block_size = alpha ? 16 : 8;
+        unsigned char pixels[64];
+
+        for (unsigned int by = first_row; by < first_row + num_rows; ++by)
+        {
+            for (unsigned int bx = 0; bx < blocks_x; ++bx)
+            {
+                for (unsigned int py = 0; py < 4; ++py)
+                {
+                    unsigned int y = std::min(by * 4 + py, height - 1);
+                    for (unsigned int px = 0; px < 4; ++px)
+                    {
+                        unsigned int x = std::min(bx * 4 + px, width - 1);
+                        const unsigned char *p = rgba + (size_t(y) * width + x) * 4;
+                        unsigned char *q = pixels + (py * 4 + px) * 4;
+                        q[0] = p[0]; q[1] = p[1]; q[2] = p[2]; q[3] = p[3];
+                    }
+                }
+
+                unsigned char *block = out + (size_t(by) * blocks_x + bx) * block_size;
+                if (alpha)
+                    TextureProcessor::encodeBC3(pixels, block);
+                else
+                    TextureProcessor::encodeBC1(pixels, block);
+            }
+        }
+    }
+
+    class EncodeChunkTask : public TileTask
+    {
+        public :
+            EncodeChunkTask( const unsigned char *rgba, unsigned int width, unsigned int height, bool alpha,
+                             unsigned int first_row, unsigned int num_rows, unsigned char *out ) :
+                _rgba(rgba), _width(width), _height(height), _alpha(alpha),
+                _first_row(first_row), _num_rows(num_rows), _out(out)
+            {
+            }
+
+            virtual void run( TileScheduler & )
+            {
+                encode_rows(_rgba, _width, _height, _alpha, _first_row, _num_rows, _out);
+            }
+
+        private :
+            const unsigned char *_rgba;
+            unsigned int _width;
+            unsigned int _height;
+            bool _alpha;
+            unsigned int _first_row;
+            unsigned int _num_rows;
+            unsigned char *_out;
+    };
+
+    // copy of a texture holding image, the chain replaces any hardware mipmaps
+    osg::ref_ptr<osg::Texture2D> texture_with( const osg::Texture2D &texture, osg::Image *image )
+    {
+        osg::ref_ptr<osg::Texture2D> copy = new osg::Texture2D(texture, osg::CopyOp::SHALLOW_COPY);
+        copy->setImage(image);
+        copy->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR_MIPMAP_LINEAR);
+        copy->setUseHardwareMipMapGeneration(false);
+        return copy;
+    }
+
+    osg::StateSet* stateset_with( const osg::StateSet &stateset, osg::Texture2D *texture,
+                                  std::map<const osg::StateSet*, osg::ref_ptr<osg::StateSet> > &statesets )
+    {
+        osg::ref_ptr<osg::StateSet> &copy = statesets[&stateset];
+        if (!copy.valid())
+        {
+            copy = new osg::StateSet(stateset, osg::CopyOp::SHALLOW_COPY);
+            copy->setTextureAttribute(0, texture);
+        }
+        return copy.get();
+    }
+
+    bool texcoords_in_unit_square( const osg::Geometry &geometry )
+    {
+        const osg::Vec2Array *texcoords = dynamic_cast<const osg::Vec2Array*>(
+            geometry.getNumTexCoordArrays() > 0 ? geometry.getTexCoordArray(0) : 0);
+        if (!texcoords)
+            return false;
+        for (size_t i = 0; i < texcoords->size(); ++i)
+        {
+            const osg::Vec2 &t = (*texcoords)[i];
+            if (t.x() < -texcoord_tolerance || t.x() > 1.f + texcoord_tolerance ||
+                t.y() < -texcoord_tolerance || t.y() > 1.f + texcoord_tolerance)
+                return false;
+        }
+        return true;
+    }
+}
+
+TextureProcessor::Stats::Stats( void ) :
+    num_images(0),
+    num_atlases(0),
+    bytes_before(0),
+    bytes_after(0)
+{
+}
+
+TextureProcessor::Stats& TextureProcessor::Stats::operator += (const Stats &rhs)
+{
+    num_images += rhs.num_images;
+    num_atlases += rhs.num_atlases;
+    bytes_before += rhs.bytes_before;
+    bytes_after += rhs.bytes_after;
+    return *this;
+}
+
+TextureProcessor::TextureProcessor( unsigned int max_size, unsigned int min_size ) :
+    _max_size(std::max(max_size, 1u)),
+    _min_size(std::min(std::max(min_size, 1u), std::max(max_size, 1u))),
+    _compress(true),
+    _atlas(true),
+    _num_threads(1)
+{
+}
+
+unsigned int TextureProcessor::sizeLimit( unsigned int level_shift ) const
+{
+    unsigned int limit = level_shift < 32 ? _max_size >> level_shift : 0;
+    return std::max(limit, _min_size);
+}
+
+void TextureProcessor::encodeBC1( const unsigned char *rgba, unsigned char *block )
+{
+    encode_color(rgba, block);
+}
+
+void TextureProcessor::encodeBC3( const unsigned char *rgba, unsigned char *block )
+{
+    encode_alpha(rgba, block);
+    encode_color(rgba, block + 8);
+}
+
+osg::ref_ptr<osg::Image> TextureProcessor::buildImage( const unsigned char *rgba, unsigned int width, unsigned int height,
+                                                       bool alpha, unsigned int max_levels ) const
+{
+    // box filtered chain down to 1x1 or max_levels
+    std::vector< std::vector<unsigned char> > levels(1, std::vector<unsigned char>(rgba, rgba + size_t(width) * height * 4));
+    std::vector< std::pair<unsigned int, unsigned int> > sizes(1, std::make_pair(width, height));
+    while ((sizes.back().first > 1 || sizes.back().second > 1) && (max_levels == 0 || levels.size() < max_levels))
+    {
+        unsigned int w = std::max(sizes.back().first / 2, 1u);
+        unsigned int h = std::max(sizes.back().second / 2, 1u);
+        levels.push_back(std::vector<unsigned char>(size_t(w) * h * 4));
+        resample(&levels[levels.size() - 2][0], sizes.back().first, sizes.back().second, &levels.back()[0], w, h, w);
+        sizes.push_back(std::make_pair(w, h));
+    }
+
+    const unsigned int block_size = alpha ? 16 : 8;
+    const unsigned int pixel_size = alpha ? 4 : 3;
+    std::vector<size_t> offsets(levels.size() + 1, 0);
+    for (size_t i = 0; i < levels.size(); ++i)
+    {
+        size_t w = sizes[i].first, h = sizes[i].second;
+        offsets[i + 1] = offsets[i] + (_compress ? ((w + 3) / 4) * ((h + 3) / 4) * block_size : w * h * pixel_size);
+    }
+
+    unsigned char *data = new unsigned char[offsets.back()];
+    if (_compress)
+    {
+        unsigned int num_threads = _num_threads ? _num_threads : TileScheduler::defaultNumThreads();
+        unsigned long long num_blocks = offsets.back() / block_size;
+        if (num_threads <= 1 || num_blocks < 2 * min_chunk_blocks)
+        {
+            for (size_t i = 0; i < levels.size(); ++i)
+                encode_rows(&levels[i][0], sizes[i].first, sizes[i].second, alpha,
+                            0, (sizes[i].second + 3) / 4, data + offsets[i]);
+        }
+        else
+        {
+            TileScheduler scheduler(num_threads);
+            for (size_t i = 0; i < levels.size(); ++i)
+            {
+                unsigned int blocks_x = (sizes[i].first + 3) / 4;
+                unsigned int blocks_y = (sizes[i].second + 3) / 4;
+                unsigned int chunk_rows = std::max(min_chunk_blocks / blocks_x, 1u);
+                for (unsigned int first = 0; first < blocks_y; first += chunk_rows)
+                    scheduler.add(new EncodeChunkTask(&levels[i][0], sizes[i].first, sizes[i].second, alpha, first,
+                                                      std::min(chunk_rows, blocks_y - first), data + offsets[i]));
+            }
+            scheduler.run();
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < levels.size(); ++i)
+        {
+            const unsigned char *src = &levels[i][0];
+            unsigned char *dst = data + offsets[i];
+            for (size_t p = 0; p < size_t(sizes[i].first) * sizes[i].second; ++p, src += 4, dst += pixel_size)
+            {
+                for (unsigned int c = 0; c < pixel_size; ++c)
+                    dst[c] = src[c];
+            }
+        }
+    }
+
+    GLenum format = _compress ? (alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT) :
+                                (alpha ? GL_RGBA : GL_RGB);
+    osg::ref_ptr<osg::Image> image = new osg::Image;
+    image->setImage(width, height, 1, format, format, GL_UNSIGNED_BYTE, data, osg::Image::USE_NEW_DELETE, 1);
+
+    osg::Image::MipmapDataType mipmaps;
+    for (size_t i = 1; i < levels.size(); ++i)
+        mipmaps.push_back(static_cast<unsigned int>(offsets[i]));
+    image->setMipmapLevels(mipmaps);
+    return image;
+}
+
+osg::ref_ptr<osg::Image> TextureProcessor::processImage( const osg::Image &image, unsigned int size_limit ) const
+{
+    std::vector<unsigned char> rgba;
+    if (!read_rgba(image, rgba))
+        return 0;
+
+    unsigned int width = image.s(), height = image.t();
+    fit_size(width, height, size_limit);
+    if (width != static_cast<unsigned int>(image.s()) || height != static_cast<unsigned int>(image.t()))
+    {
+        std::vector<unsigned char> scaled(size_t(width) * height * 4);
+        resample(&rgba[0], image.s(), image.t(), &scaled[0], width, height, width);
+        rgba.swap(scaled);
+    }
+
+    osg::ref_ptr<osg::Image> processed = buildImage(&rgba[0], width, height, has_alpha(rgba));
+    processed->setFileName(image.getFileName());
+    return processed;
+}
+
+osg::ref_ptr<osg::Node> TextureProcessor::process( const osg::Node &node, unsigned int level_shift, Stats *stats ) const
+{
+    osg::ref_ptr<osg::Node> copy = dynamic_cast<osg::Node*>(
+        node.clone(osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES));
+    if (!copy.valid())
+        return 0;
+
+    CollectVisitor collect;
+    copy->accept(collect);
+    processGeometries(collect.geometries, level_shift, stats);
+    return copy;
+}
+
+bool TextureProcessor::process( std::vector< osg::ref_ptr<osg::Node> > &nodes, unsigned int level_shift, Stats *stats ) const
+{
+    std::vector< osg::ref_ptr<osg::Node> > copies(nodes.size());
+    std::vector< std::vector<osg::Geometry*> > geometries(nodes.size());
+    std::vector<osg::Geometry*> all_geometries;
+    for (size_t i_n = 0; i_n < nodes.size(); ++i_n)
+    {
+        if (!nodes[i_n].valid())
+            continue;
+        copies[i_n] = dynamic_cast<osg::Node*>(
+            nodes[i_n]->clone(osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES));
+        if (!copies[i_n].valid())
+            return false;
+
+        CollectVisitor collect;
+        copies[i_n]->accept(collect);
+        geometries[i_n].swap(collect.geometries);
+        all_geometries.insert(all_geometries.end(), geometries[i_n].begin(), geometries[i_n].end());
+    }
+
+    // one atlas when all of them fit one, each on its own otherwise
+    if (_atlas && fitsAtlas(all_geometries))
+        processGeometries(all_geometries, level_shift, stats);
+    else
+    {
+        for (size_t i_n = 0; i_n < geometries.size(); ++i_n)
+            processGeometries(geometries[i_n], level_shift, stats);
+    }
+    nodes.swap(copies);
+    return true;
+}
+
+bool TextureProcessor::fitsAtlas( const std::vector<osg::Geometry*> &geometries )
+{
+    for (size_t i = 0; i < geometries.size(); ++i)
+    {
+        const osg::Texture2D *texture = texture_of(*geometries[i]);
+        const osg::Image *image = texture ? texture->getImage() : 0;
+        if (image && (image->isCompressed() || !texcoords_in_unit_square(*geometries[i])))
+            return false;
+    }
+    return true;
+}
+
+void TextureProcessor::processGeometries( const std::vector<osg::Geometry*> &geometries, unsigned int level_shift,
+                                          Stats *stats ) const
+{
+    std::vector<Textured> textured;
+    std::vector<const osg::Image*> images;
+    std::map<const osg::Image*, unsigned int> image_index;
+    bool atlas = _atlas && fitsAtlas(geometries);
+    for (size_t i = 0; i < geometries.size(); ++i)
+    {
+        const osg::Texture2D *texture = texture_of(*geometries[i]);
+        const osg::Image *image = texture ? texture->getImage() : 0;
+        if (!image)
+            continue;
+
+        Textured entry = { geometries[i], texture, image };
+        textured.push_back(entry);
+        if (image_index.insert(std::make_pair(image, static_cast<unsigned int>(images.size()))).second)
+            images.push_back(image);
+    }
+
+    Stats tile_stats;
+    const unsigned int size_limit = sizeLimit(level_shift);
+    std::map<const osg::StateSet*, osg::ref_ptr<osg::StateSet> > statesets;
+
+    // equal cells as large as the largest fitted image, in the smallest
+    // square grid that holds them all
+    unsigned int grid = static_cast<unsigned int>(ceil(sqrt(double(images.size()))));
+    unsigned int cell = 0;
+    if (atlas && images.size() >= 2)
+    {
+        for (size_t i = 0; i < images.size(); ++i)
+        {
+            unsigned int width = images[i]->s(), height = images[i]->t();
+            fit_size(width, height, size_limit);
+            cell = std::max(cell, std::max(width, height));
+        }
+        while (cell * grid > _max_size && cell > 1)
+            cell /= 2;
+    }
+
+    if (cell >= min_atlas_cell)
+    {
+        const unsigned int rows = static_cast<unsigned int>((images.size() + grid - 1) / grid);
+        const unsigned int width = grid * cell, height = rows * cell;
+        std::vector<unsigned char> rgba(size_t(width) * height * 4, 255);
+
+        bool complete = true;
+        std::vector<unsigned char> source;
+        for (size_t i = 0; i < images.size() && complete; ++i)
+        {
+            complete = read_rgba(*images[i], source);
+            if (complete)
+            {
+                unsigned int cx = static_cast<unsigned int>(i % grid), cy = static_cast<unsigned int>(i / grid);
+                resample(&source[0], images[i]->s(), images[i]->t(),
+                         &rgba[(size_t(cy) * cell * width + size_t(cx) * cell) * 4], cell, cell, width);
+            }
+            tile_stats.bytes_before += images[i]->getTotalSizeInBytesIncludingMipmaps();
+        }
+
+        if (complete)
+        {
+            // the half texel inset only holds at level 0, so the chain stops
+            // while the cells still halve exactly and span a whole
+            // compression block, the levels below would mix the cells
+            const unsigned int min_level_cell = _compress ? 4 : 1;
+            unsigned int max_levels = 1;
+            for (unsigned int level_cell = cell; level_cell % 2 == 0 && level_cell / 2 >= min_level_cell; level_cell /= 2)
+                ++max_levels;
+
+            osg::ref_ptr<osg::Image> image = buildImage(&rgba[0], width, height, has_alpha(rgba), max_levels);
+            osg::ref_ptr<osg::Texture2D> texture = texture_with(*textured.front().texture, image.get());
+            texture->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+            texture->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+
+            for (size_t i = 0; i < textured.size(); ++i)
+            {
+                osg::Geometry &geometry = *textured[i].geometry;
+                unsigned int index = image_index[textured[i].image];
+                float x0 = float((index % grid) * cell) + 0.5f, y0 = float((index / grid) * cell) + 0.5f;
+                float span = float(cell - 1);
+
+                // texel centres of the cell's edges, so linear filtering stays inside it
+                const osg::Vec2Array &texcoords = *static_cast<const osg::Vec2Array*>(geometry.getTexCoordArray(0));
+                osg::ref_ptr<osg::Vec2Array> remapped = new osg::Vec2Array(texcoords.size());
+                for (size_t i_t = 0; i_t < texcoords.size(); ++i_t)
+                {
+                    float u = std::min(std::max(texcoords[i_t].x(), 0.f), 1.f);
+                    float v = std::min(std::max(texcoords[i_t].y(), 0.f), 1.f);
+                    (*remapped)[i_t] = osg::Vec2((x0 + u * span) / width, (y0 + v * span) / height);
+                }
+                geometry.setTexCoordArray(0, remapped.get(), osg::Array::BIND_PER_VERTEX);
+                geometry.setStateSet(stateset_with(*geometry.getStateSet(), texture.get(), statesets));
+                geometry.dirtyDisplayList();
+            }
+
+            tile_stats.num_images = static_cast<unsigned int>(images.size());
+            tile_stats.num_atlases = 1;
+            tile_stats.bytes_after += image->getTotalSizeInBytesIncludingMipmaps();
+            if (stats)
+                *stats += tile_stats;
+            return;
+        }
+        tile_stats = Stats();
+    }
+
+    // each image on its own, shared images and textures stay shared
+    std::map<const osg::Image*, osg::ref_ptr<osg::Image> > processed;
+    std::map<const osg::Texture2D*, osg::ref_ptr<osg::Texture2D> > textures;
+    for (size_t i = 0; i < textured.size(); ++i)
+    {
+        std::map<const osg::Image*, osg::ref_ptr<osg::Image> >::iterator itr = processed.find(textured[i].image);
+        if (itr == processed.end())
+        {
+            itr = processed.insert(std::make_pair(textured[i].image, processImage(*textured[i].image, size_limit))).first;
+            if (itr->second.valid())
+            {
+                tile_stats.num_images++;
+                tile_stats.bytes_before += textured[i].image->getTotalSizeInBytesIncludingMipmaps();
+                tile_stats.bytes_after += itr->second->getTotalSizeInBytesIncludingMipmaps();
+            }
+        }
+        if (!itr->second.valid())
+            continue;
+
+        osg::ref_ptr<osg::Texture2D> &texture = textures[textured[i].texture];
+        if (!texture.valid())
+            texture = texture_with(*textured[i].texture, itr->second.get());
+
+        osg::Geometry &geometry = *textured[i].geometry;
+        geometry.setStateSet(stateset_with(*geometry.getStateSet(), texture.get(), statesets));
+    }
+
+    if (stats)
+        *stats += tile_stats;
+}
+
+void TextureProcessor::addStats( const Stats &stats )
+{
+    ScopedLock lock(_mutex);
+    _total += stats;
+}
+
+TextureProcessor::Stats TextureProcessor::getTotal( void ) const
+{
+    ScopedLock lock(_mutex);
+    return _total;
+}
@@ -0,0 +1,101 @@
+#ifndef _TEXTURE_PROCESSOR_H
+#define _TEXTURE_PROCESSOR_H
+
+#include <vector>
+
+#include <osg/Node>
+#include <osg/Image>
+#include <osg/Geometry>
+
+#include <OpenThreads/Mutex>
+
+/** fits the textures of a tile to the distance it is seen from. every
+  * image is box filtered down to the size limit of the tile's level, the
+  * limit halving with each level above the leaves, then given a full
+  * mipmap chain and encoded to bc1 (bc3 where there is alpha) on the cpu.
+  *
+  * when every textured geometry of a tile maps its texture into [0,1] the
+  * textures are packed into one atlas, a grid of equal cells with the
+  * texcoords moved into them, so a parent holds one image instead of the
+  * images of all the tiles below it. the four tiles of a quad are written
+  * and paged in together, so they go into one atlas when they all fit.*/
+class TextureProcessor {
+    public :
+        struct Stats
+        {
+            Stats(void);
+
+            unsigned int num_images;
+            unsigned int num_atlases;
+            unsigned long long bytes_before;
+            unsigned long long bytes_after;
+
+            Stats& operator += (const Stats &rhs);
+        };
+
+        /** images of the leaves are limited to max_size, each level up to
+          * half the size of the one below, never less than min_size.*/
+        TextureProcessor( unsigned int max_size = 4096, unsigned int min_size = 64 );
+
+        void setCompress( bool compress ) { _compress = compress; }
+        bool getCompress(void) const { return _compress; }
+
+        void setAtlas( bool atlas ) { _atlas = atlas; }
+        bool getAtlas(void) const { return _atlas; }
+
+        /** threads encoding one image, 0 uses one per processor. tiles that
+          * are already built in parallel are best left at 1.*/
+        void setNumThreads( unsigned int num_threads ) { _num_threads = num_threads; }
+        unsigned int getNumThreads(void) const { return _num_threads; }
+
+        unsigned int getMaxSize(void) const { return _max_size; }
+        unsigned int getMinSize(void) const { return _min_size; }
+
+        /** size limit of the images level_shift levels above the leaves.*/
+        unsigned int sizeLimit( unsigned int level_shift ) const;
+
+        /** a copy of node with processed textures. the nodes, drawables,
+          * statesets and textures that change are copied, node is not touched.*/
+        osg::ref_ptr<osg::Node> process( const osg::Node &node, unsigned int level_shift, Stats *stats = 0 ) const;
+
+        /** process() over several tiles, their textures packed into one
+          * atlas when every one of them fits it. nodes is replaced by the
+          * copies, null entries stay null. false if a node can't be copied.*/
+        bool process( std::vector< osg::ref_ptr<osg::Node> > &nodes, unsigned int level_shift, Stats *stats = 0 ) const;
+
+        /** image scaled to fit size_limit, mipmapped and compressed. null for
+          * images that can't be read back, compressed ones for instance.*/
+        osg::ref_ptr<osg::Image> processImage( const osg::Image &image, unsigned int size_limit ) const;
+
+        /** sum up the statistics of a written tile, thread safe.*/
+        void addStats( const Stats &stats );
+        Stats getTotal(void) const;
+
+        /** one 4x4 block, rgba holds 16 pixels of 4 bytes row by row.*/
+        static void encodeBC1( const unsigned char *rgba, unsigned char *block );
+        static void encodeBC3( const unsigned char *rgba, unsigned char *block );
+
+    private :
+        TextureProcessor( const TextureProcessor& ) {}
+        TextureProcessor& operator = (const TextureProcessor& ) { return *this; }
+
+        /** whether every textured geometry maps an uncompressed image into [0,1].*/
+        static bool fitsAtlas( const std::vector<osg::Geometry*> &geometries );
+        void processGeometries( const std::vector<osg::Geometry*> &geometries, unsigned int level_shift,
+                                Stats *stats ) const;
+
+        /** mipmapped and compressed image, the chain stops after max_levels
+          * levels when that is not 0.*/
+        osg::ref_ptr<osg::Image> buildImage( const unsigned char *rgba, unsigned int width, unsigned int height,
+                                             bool alpha, unsigned int max_levels = 0 ) const;
+
+        unsigned int _max_size;
+        unsigned int _min_size;
+        bool _compress;
+        bool _atlas;
+        unsigned int _num_threads;
+
+        Stats _total;
+        mutable OpenThreads::Mutex _mutex;
+};
+#endif
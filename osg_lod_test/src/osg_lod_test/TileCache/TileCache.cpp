@@ -0,0 +1,601 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <fstream>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Material>
+#include <osg/Texture2D>
+#include <osg/StateSet>
+#include <osg/Notify>
+#include <osgDB/ReadFile>
+#include <osgDB/FileNameUtils>
+
+#include "MappedFile.h"
+#include "TileCache.h"
+#include "Utility.h"
+
+namespace
+{
+    const char cache_magic[8] = { 'O', 'L', 'T', 'C', 'A', 'C', 'H', 'E' };
+    const unsigned int cache_version = 1;
+    const unsigned long long block_alignment = 16;
+    const unsigned int no_material = ~0u;
+
+    enum MaterialFlags { MATERIAL_ATTRIBUTE = 1, MATERIAL_BLEND = 2, MATERIAL_TRANSPARENT_BIN = 4, MATERIAL_TEXTURE = 8 };
+    enum GeometryFlags { GEOMETRY_NORMALS = 1, GEOMETRY_TEXCOORDS = 2, GEOMETRY_INDEXED = 4 };
+
+    // on disk layout, every field little endian. offsets are from the start of the file.
+    struct FileHeader
+    {
+        char magic[8];
+        unsigned int version;
+        unsigned int num_geometries;
+        unsigned int num_materials;
+        unsigned int options_length;        // option string, first in the string block
+        unsigned long long source_size;
+        long long source_mtime;
+        unsigned long long file_size;
+        unsigned long long strings_offset;
+        unsigned long long strings_size;
+    };
+
+    struct MaterialRecord
+    {
+        float ambient[4];
+        float diffuse[4];
+        float specular[4];
+        float emission[4];
+        float shininess;
+        unsigned int flags;
+        unsigned int wrap_s;
+        unsigned int wrap_t;
+        unsigned int texture_name;          // in the string block
+        unsigned int texture_name_length;
+        unsigned int reserved[2];
+    };
+
+    struct GeometryRecord
+    {
+        unsigned int name;
+        unsigned int name_length;
+        unsigned int material;
+        unsigned int flags;
+        unsigned long long num_vertices;
+        unsigned long long num_indices;
+        unsigned long long positions;
+        unsigned long long normals;
+        unsigned long long texcoords;
+        unsigned long long indices;
+    };
+
+    // the records are written as they are in memory
+    typedef char file_header_size_check[sizeof(FileHeader) == 64 ? 1 : -1];
+    typedef char material_record_size_check[sizeof(MaterialRecord) == 96 ? 1 : -1];
+    typedef char geometry_record_size_check[sizeof(GeometryRecord) == 64 ? 1 : -1];
+
+    bool g_enabled = true;
+
+    bool little_endian( void )
+    {
+        const unsigned int one = 1;
+        return *reinterpret_cast<const unsigned char*>(&one) == 1;
+    }
+
+
+    std::string option_string( const osgDB::Options *options )
+    {
+        return options ? options->getOptionString() : std::string();
+    }
+
+    unsigned long long align( unsigned long long offset )
+    {
+        return (offset + block_alignment - 1) / block_alignment * block_alignment;
+    }
+
+    bool in_file( unsigned long long offset, unsigned long long size, unsigned long long file_size )
+    {
+        return offset <= file_size && size <= file_size - offset;
+    }
+
+    unsigned int add_string( std::string &strings, const std::string &str )
+    {
+        unsigned int offset = static_cast<unsigned int>(strings.size());
+        strings += str;
+        return offset;
+    }
+
+    void copy_vec4( const osg::Vec4 &v, float *out )
+    {
+        for (int i = 0; i < 4; ++i)
+            out[i] = v[i];
+    }
+
+    bool collect_geometries( const osg::Node &node, std::vector<const osg::Geometry*> &geometries )
+    {
+        // a state on the scene graph itself would be lost
+        if (node.getStateSet())
+            return false;
+
+        const osg::Geode *geode = dynamic_cast<const osg::Geode*>(&node);
+        if (geode)
+        {
+            for (unsigned int i = 0; i < geode->getNumDrawables(); ++i)
+            {
+                const osg::Geometry *geometry = geode->getDrawable(i)->asGeometry();
+                if (!geometry)
+                    return false;
+                geometries.push_back(geometry);
+            }
+            return true;
+        }
+
+        // plain groups only, no transforms or lods
+        const osg::Group *group = node.asGroup();
+        if (!group || strcmp(node.className(), "Group") != 0)
+            return false;
+        for (unsigned int i = 0; i < group->getNumChildren(); ++i)
+        {
+            if (!collect_geometries(*group->getChild(i), geometries))
+                return false;
+        }
+        return true;
+    }
+
+    bool cacheable( const osg::Geometry &geometry )
+    {
+        const osg::Vec3Array *vertices = dynamic_cast<const osg::Vec3Array*>(geometry.getVertexArray());
+        if (!vertices)
+            return false;
+
+        const osg::Array *normals = geometry.getNormalArray();
+        if (normals && (!dynamic_cast<const osg::Vec3Array*>(normals) ||
+                        normals->getBinding() != osg::Array::BIND_PER_VERTEX ||
+                        normals->getNumElements() != vertices->size()))
+            return false;
+
+        if (geometry.getColorArray() || geometry.getSecondaryColorArray() ||
+            geometry.getFogCoordArray() || !geometry.getVertexAttribArrayList().empty())
+            return false;
+
+        for (unsigned int unit = 0; unit < geometry.getNumTexCoordArrays(); ++unit)
+        {
+            const osg::Array *texcoords = geometry.getTexCoordArray(unit);
+            if (!texcoords)
+                continue;
+            if (unit != 0 || !dynamic_cast<const osg::Vec2Array*>(texcoords) ||
+                texcoords->getNumElements() != vertices->size())
+                return false;
+        }
+
+        if (geometry.getNumPrimitiveSets() != 1)
+            return false;
+        const osg::PrimitiveSet *primitives = geometry.getPrimitiveSet(0);
+        if (primitives->getMode() != osg::PrimitiveSet::TRIANGLES)
+            return false;
+
+        const osg::DrawArrays *draw_arrays = dynamic_cast<const osg::DrawArrays*>(primitives);
+        if (draw_arrays)
+            return draw_arrays->getFirst() == 0 && static_cast<size_t>(draw_arrays->getCount()) == vertices->size();
+        return dynamic_cast<const osg::DrawElementsUInt*>(primitives) != 0;
+    }
+
+    // a material, blending and one diffuse texture, what the obj reader puts on its geometries
+    bool describe_stateset( const osg::StateSet &stateset, MaterialRecord &record, std::string &texture_name )
+    {
+        memset(&record, 0, sizeof(record));
+
+        const osg::StateSet::AttributeList &attributes = stateset.getAttributeList();
+        for (osg::StateSet::AttributeList::const_iterator itr = attributes.begin(); itr != attributes.end(); ++itr)
+        {
+            if (itr->second.first->getType() != osg::StateAttribute::MATERIAL)
+                return false;
+        }
+
+        const osg::StateSet::ModeList &modes = stateset.getModeList();
+        for (osg::StateSet::ModeList::const_iterator itr = modes.begin(); itr != modes.end(); ++itr)
+        {
+            if (itr->first != GL_BLEND || !(itr->second & osg::StateAttribute::ON))
+                return false;
+            record.flags |= MATERIAL_BLEND;
+        }
+        if (stateset.getRenderingHint() == osg::StateSet::TRANSPARENT_BIN)
+            record.flags |= MATERIAL_TRANSPARENT_BIN;
+
+        const osg::Material *material = dynamic_cast<const osg::Material*>(
+            stateset.getAttribute(osg::StateAttribute::MATERIAL));
+        if (material)
+        {
+            record.flags |= MATERIAL_ATTRIBUTE;
+            copy_vec4(material->getAmbient(osg::Material::FRONT_AND_BACK), record.ambient);
+            copy_vec4(material->getDiffuse(osg::Material::FRONT_AND_BACK), record.diffuse);
+            copy_vec4(material->getSpecular(osg::Material::FRONT_AND_BACK), record.specular);
+            copy_vec4(material->getEmission(osg::Material::FRONT_AND_BACK), record.emission);
+            record.shininess = material->getShininess(osg::Material::FRONT_AND_BACK);
+        }
+
+        const osg::StateSet::TextureAttributeList &textures = stateset.getTextureAttributeList();
+        for (size_t unit = 0; unit < textures.size(); ++unit)
+        {
+            for (osg::StateSet::AttributeList::const_iterator itr = textures[unit].begin();
+                itr != textures[unit].end(); ++itr)
+            {
+                const osg::Texture2D *texture = dynamic_cast<const osg::Texture2D*>(itr->second.first.get());
+                if (unit != 0 || !texture || !texture->getImage() || texture->getImage()->getFileName().empty())
+                    return false;
+                record.flags |= MATERIAL_TEXTURE;
+                record.wrap_s = texture->getWrap(osg::Texture::WRAP_S);
+                record.wrap_t = texture->getWrap(osg::Texture::WRAP_T);
+                texture_name = texture->getImage()->getFileName();
+            }
+        }
+        return true;
+    }
+
+    osg::ref_ptr<osg::StateSet> create_stateset( const MaterialRecord &record, const std::string &texture_name,
+                                                 const osgDB::Options *options )
+    {
+        osg::ref_ptr<osg::StateSet> stateset = new osg::StateSet;
+
+        if (record.flags & MATERIAL_ATTRIBUTE)
+        {
+            osg::ref_ptr<osg::Material> material = new osg::Material;
+            const float *c = record.ambient;
+            material->setAmbient(osg::Material::FRONT_AND_BACK, osg::Vec4(c[0], c[1], c[2], c[3]));
+            c = record.diffuse;
+            material->setDiffuse(osg::Material::FRONT_AND_BACK, osg::Vec4(c[0], c[1], c[2], c[3]));
+            c = record.specular;
+            material->setSpecular(osg::Material::FRONT_AND_BACK, osg::Vec4(c[0], c[1], c[2], c[3]));
+            c = record.emission;
+            material->setEmission(osg::Material::FRONT_AND_BACK, osg::Vec4(c[0], c[1], c[2], c[3]));
+            material->setShininess(osg::Material::FRONT_AND_BACK, record.shininess);
+            stateset->setAttribute(material.get());
+        }
+
+        if (record.flags & MATERIAL_BLEND)
+            stateset->setMode(GL_BLEND, osg::StateAttribute::ON);
+        if (record.flags & MATERIAL_TRANSPARENT_BIN)
+            stateset->setRenderingHint(osg::StateSet::TRANSPARENT_BIN);
+
+        if (record.flags & MATERIAL_TEXTURE)
+        {
+            osg::ref_ptr<osg::Image> image = osgDB::readImageFile(texture_name, options);
+            if (image.valid())
+            {
+                osg::ref_ptr<osg::Texture2D> texture = new osg::Texture2D(image.get());
+                texture->setWrap(osg::Texture::WRAP_S, static_cast<osg::Texture::WrapMode>(record.wrap_s));
+                texture->setWrap(osg::Texture::WRAP_T, static_cast<osg::Texture::WrapMode>(record.wrap_t));
+                stateset->setTextureAttributeAndModes(0, texture.get(), osg::StateAttribute::ON);
+            }
+            else
+                osg::notify(osg::NOTICE)<<"texture "<<texture_name<<" not found."<<std::endl;
+        }
+        return stateset;
+    }
+
+    // writes keep track of the position so blocks can be padded to their offsets
+    class BlockWriter
+    {
+        public :
+            BlockWriter( std::ofstream &file ) : _file(file), _position(0) {}
+
+            void write( const void *data, unsigned long long size )
+            {
+                if (size)
+                    _file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+                _position += size;
+            }
+
+            void seek( unsigned long long offset )
+            {
+                static const char zeros[block_alignment] = { 0 };
+                while (_position < offset)
+                    write(zeros, std::min(offset - _position, block_alignment));
+            }
+
+        private :
+            BlockWriter& operator = (const BlockWriter& ) { return *this; }
+
+            std::ofstream &_file;
+            unsigned long long _position;
+    };
+}
+
+void TileCache::setEnabled( bool enabled )
+{
+    g_enabled = enabled;
+}
+
+bool TileCache::getEnabled( void )
+{
+    return g_enabled;
+}
+
+bool TileCache::accepts( const std::string &source )
+{
+    // the blocks are copied as they are, a big endian host would need to swap them
+    return g_enabled && little_endian() && osgDB::getLowerCaseFileExtension(source) == "obj";
+}
+
+std::string TileCache::cacheFileName( const std::string &source )
+{
+    return source + ".tilecache";
+}
+
+osg::ref_ptr<osg::Node> TileCache::read( const std::string &source, const osgDB::Options *options )
+{
+    if (!accepts(source))
+        return 0;
+
+    unsigned long long source_size = 0;
+    long long source_mtime = 0;
+    if (!Utility::fileStatus(source, source_size, source_mtime))
+        return 0;
+
+    MappedFile file;
+    if (!file.open(cacheFileName(source)) || file.size() < sizeof(FileHeader))
+        return 0;
+
+    // the mapping is page aligned, the records can be read in place
+    const char *data = file.data();
+    const unsigned long long file_size = file.size();
+    const FileHeader &header = *reinterpret_cast<const FileHeader*>(data);
+    if (memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.version != cache_version ||
+        header.source_size != source_size || header.source_mtime != source_mtime ||
+        header.file_size != file_size)
+        return 0;
+
+    unsigned long long records_size = header.num_geometries * (unsigned long long)sizeof(GeometryRecord) +
+                                      header.num_materials * (unsigned long long)sizeof(MaterialRecord);
+    if (!in_file(sizeof(FileHeader), records_size, header.strings_offset) ||
+        !in_file(header.strings_offset, header.strings_size, file_size) ||
+        header.options_length > header.strings_size)
+        return 0;
+
+    const char *strings = data + header.strings_offset;
+    if (std::string(strings, header.options_length) != option_string(options))
+        return 0;
+
+    const GeometryRecord *geometry_records = reinterpret_cast<const GeometryRecord*>(data + sizeof(FileHeader));
+    const MaterialRecord *material_records = reinterpret_cast<const MaterialRecord*>(geometry_records + header.num_geometries);
+
+    std::vector< osg::ref_ptr<osg::StateSet> > statesets(header.num_materials);
+    for (unsigned int i = 0; i < header.num_materials; ++i)
+    {
+        const MaterialRecord &record = material_records[i];
+        if (!in_file(record.texture_name, record.texture_name_length, header.strings_size))
+            return 0;
+        statesets[i] = create_stateset(record, std::string(strings + record.texture_name, record.texture_name_length), options);
+    }
+
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    for (unsigned int i = 0; i < header.num_geometries; ++i)
+    {
+        const GeometryRecord &record = geometry_records[i];
+        const unsigned long long n = record.num_vertices;
+        if (!in_file(record.name, record.name_length, header.strings_size) ||
+            (record.material != no_material && record.material >= header.num_materials) ||
+            !in_file(record.positions, n * sizeof(osg::Vec3), file_size) ||
+            ((record.flags & GEOMETRY_NORMALS) && !in_file(record.normals, n * sizeof(osg::Vec3), file_size)) ||
+            ((record.flags & GEOMETRY_TEXCOORDS) && !in_file(record.texcoords, n * sizeof(osg::Vec2), file_size)) ||
+            ((record.flags & GEOMETRY_INDEXED) && !in_file(record.indices, record.num_indices * sizeof(GLuint), file_size)))
+        {
+            osg::notify(osg::NOTICE)<<cacheFileName(source)<<" is damaged, ignored."<<std::endl;
+            return 0;
+        }
+
+        osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry;
+        geometry->setName(std::string(strings + record.name, record.name_length));
+
+        osg::ref_ptr<osg::Vec3Array> vertices = new osg::Vec3Array(static_cast<unsigned int>(n));
+        if (n) memcpy(&(*vertices)[0], data + record.positions, n * sizeof(osg::Vec3));
+        geometry->setVertexArray(vertices.get());
+
+        if (record.flags & GEOMETRY_NORMALS)
+        {
+            osg::ref_ptr<osg::Vec3Array> normals = new osg::Vec3Array(static_cast<unsigned int>(n));
+            if (n) memcpy(&(*normals)[0], data + record.normals, n * sizeof(osg::Vec3));
+            geometry->setNormalArray(normals.get(), osg::Array::BIND_PER_VERTEX);
+        }
+        if (record.flags & GEOMETRY_TEXCOORDS)
+        {
+            osg::ref_ptr<osg::Vec2Array> texcoords = new osg::Vec2Array(static_cast<unsigned int>(n));
+            if (n) memcpy(&(*texcoords)[0], data + record.texcoords, n * sizeof(osg::Vec2));
+            geometry->setTexCoordArray(0, texcoords.get(), osg::Array::BIND_PER_VERTEX);
+        }
+
+        if (record.flags & GEOMETRY_INDEXED)
+        {
+            osg::ref_ptr<osg::DrawElementsUInt> indices = new osg::DrawElementsUInt(
+                osg::PrimitiveSet::TRIANGLES, static_cast<unsigned int>(record.num_indices));
+            if (record.num_indices)
+                memcpy(&(*indices)[0], data + record.indices, record.num_indices * sizeof(GLuint));
+            geometry->addPrimitiveSet(indices.get());
+        }
+        else
+            geometry->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::TRIANGLES, 0, static_cast<GLsizei>(n)));
+
+        if (record.material != no_material)
+            geometry->setStateSet(statesets[record.material].get());
+
+        geode->addDrawable(geometry.get());
+    }
+    return geode;
+}
+
+bool TileCache::write( const std::string &source, const osg::Node &node, const osgDB::Options *options )
+{
+    if (!accepts(source))
+        return false;
+
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    if (!Utility::fileStatus(source, header.source_size, header.source_mtime))
+        return false;
+
+    std::vector<const osg::Geometry*> geometries;
+    if (!collect_geometries(node, geometries))
+        return false;
+    for (size_t i = 0; i < geometries.size(); ++i)
+    {
+        if (!cacheable(*geometries[i]))
+            return false;
+    }
+
+    std::string strings = option_string(options);
+    header.options_length = static_cast<unsigned int>(strings.size());
+
+    // shared statesets stay shared
+    std::vector<MaterialRecord> material_records;
+    std::map<const osg::StateSet*, unsigned int> material_ids;
+    std::vector<GeometryRecord> geometry_records(geometries.size());
+    for (size_t i = 0; i < geometries.size(); ++i)
+    {
+        const osg::Geometry &geometry = *geometries[i];
+        GeometryRecord &record = geometry_records[i];
+        memset(&record, 0, sizeof(record));
+
+        record.name_length = static_cast<unsigned int>(geometry.getName().size());
+        record.name = add_string(strings, geometry.getName());
+
+        record.material = no_material;
+        const osg::StateSet *stateset = geometry.getStateSet();
+        if (stateset)
+        {
+            std::map<const osg::StateSet*, unsigned int>::iterator itr = material_ids.find(stateset);
+            if (itr == material_ids.end())
+            {
+                MaterialRecord material;
+                std::string texture_name;
+                if (!describe_stateset(*stateset, material, texture_name))
+                    return false;
+                material.texture_name_length = static_cast<unsigned int>(texture_name.size());
+                material.texture_name = add_string(strings, texture_name);
+                itr = material_ids.insert(std::make_pair(stateset, (unsigned int)material_records.size())).first;
+                material_records.push_back(material);
+            }
+            record.material = itr->second;
+        }
+
+        record.num_vertices = geometry.getVertexArray()->getNumElements();
+        if (geometry.getNormalArray())
+            record.flags |= GEOMETRY_NORMALS;
+        if (geometry.getNumTexCoordArrays() > 0 && geometry.getTexCoordArray(0))
+            record.flags |= GEOMETRY_TEXCOORDS;
+        const osg::DrawElementsUInt *indices = dynamic_cast<const osg::DrawElementsUInt*>(geometry.getPrimitiveSet(0));
+        if (indices)
+        {
+            record.flags |= GEOMETRY_INDEXED;
+            record.num_indices = indices->size();
+        }
+    }
+
+    header.num_geometries = static_cast<unsigned int>(geometry_records.size());
+    header.num_materials = static_cast<unsigned int>(material_records.size());
+
+    // index, strings, then one block per kind of data
+    unsigned long long offset = sizeof(FileHeader) + geometry_records.size() * sizeof(GeometryRecord) +
+                                material_records.size() * sizeof(MaterialRecord);
+    header.strings_offset = offset;
+    header.strings_size = strings.size();
+    offset = align(offset + strings.size());
+    for (size_t i = 0; i < geometry_records.size(); ++i)
+    {
+        geometry_records[i].positions = offset;
+        offset = align(offset + geometry_records[i].num_vertices * sizeof(osg::Vec3));
+    }
+    for (size_t i = 0; i < geometry_records.size(); ++i)
+    {
+        if (!(geometry_records[i].flags & GEOMETRY_NORMALS))
+            continue;
+        geometry_records[i].normals = offset;
+        offset = align(offset + geometry_records[i].num_vertices * sizeof(osg::Vec3));
+    }
+    for (size_t i = 0; i < geometry_records.size(); ++i)
+    {
+        if (!(geometry_records[i].flags & GEOMETRY_TEXCOORDS))
+            continue;
+        geometry_records[i].texcoords = offset;
+        offset = align(offset + geometry_records[i].num_vertices * sizeof(osg::Vec2));
+    }
+    for (size_t i = 0; i < geometry_records.size(); ++i)
+    {
+        if (!(geometry_records[i].flags & GEOMETRY_INDEXED))
+            continue;
+        geometry_records[i].indices = offset;
+        offset = align(offset + geometry_records[i].num_indices * sizeof(GLuint));
+    }
+    header.file_size = offset;
+
+    // written aside and renamed, a reader never maps half a cache
+    std::string filename = cacheFileName(source);
+    std::string tmp_filename = Utility::tempFileName(filename);
+    {
+        std::ofstream file(tmp_filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.good())
+            return false;
+
+        BlockWriter writer(file);
+        writer.write(&header, sizeof(header));
+        if (!geometry_records.empty())
+            writer.write(&geometry_records[0], geometry_records.size() * sizeof(GeometryRecord));
+        if (!material_records.empty())
+            writer.write(&material_records[0], material_records.size() * sizeof(MaterialRecord));
+        writer.write(strings.data(), strings.size());
+
+        for (size_t i = 0; i < geometries.size(); ++i)
+        {
+            const osg::Vec3Array *vertices = static_cast<const osg::Vec3Array*>(geometries[i]->getVertexArray());
+            writer.seek(geometry_records[i].positions);
+            if (!vertices->empty())
+                writer.write(&vertices->front(), vertices->size() * sizeof(osg::Vec3));
+        }
+        for (size_t i = 0; i < geometries.size(); ++i)
+        {
+            const osg::Vec3Array *normals = static_cast<const osg::Vec3Array*>(geometries[i]->getNormalArray());
+            if (!normals)
+                continue;
+            writer.seek(geometry_records[i].normals);
+            if (!normals->empty())
+                writer.write(&normals->front(), normals->size() * sizeof(osg::Vec3));
+        }
+        for (size_t i = 0; i < geometries.size(); ++i)
+        {
+            if (!(geometry_records[i].flags & GEOMETRY_TEXCOORDS))
+                continue;
+            const osg::Vec2Array *texcoords = static_cast<const osg::Vec2Array*>(geometries[i]->getTexCoordArray(0));
+            writer.seek(geometry_records[i].texcoords);
+            if (!texcoords->empty())
+                writer.write(&texcoords->front(), texcoords->size() * sizeof(osg::Vec2));
+        }
+        for (size_t i = 0; i < geometries.size(); ++i)
+        {
+            const osg::DrawElementsUInt *indices = dynamic_cast<const osg::DrawElementsUInt*>(geometries[i]->getPrimitiveSet(0));
+            if (!indices)
+                continue;
+            writer.seek(geometry_records[i].indices);
+            if (!indices->empty())
+                writer.write(&indices->front(), indices->size() * sizeof(GLuint));
+        }
+        writer.seek(header.file_size);
+
+        file.close();
+        if (file.fail())
+        {
+            std::remove(tmp_filename.c_str());
+            return false;
+        }
+    }
+
+    std::remove(filename.c_str());
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) == 0)
+        return true;
+    // another writer got there first, its cache is as good as this one
+    std::remove(tmp_filename.c_str());
+    return false;
+}
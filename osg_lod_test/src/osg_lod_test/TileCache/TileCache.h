@@ -0,0 +1,43 @@
+#ifndef _TILE_CACHE_H
+#define _TILE_CACHE_H
+
+#include <string>
+
+#include <osg/Node>
+#include <osgDB/Options>
+
+/** binary copy of a parsed input tile, kept next to it as <source>.tilecache.
+  * the file starts with an index of the geometries and their materials,
+  * followed by the positions, normals, texcoords and indices of all
+  * geometries, each kind in one contiguous little endian block. it is
+  * memory mapped and the blocks are copied straight into the arrays, so a
+  * warm load costs about as much as reading the file.
+  *
+  * a cache holds the size and modification time of its source and the
+  * options it was parsed with, and is ignored as soon as one of them
+  * differs. material libraries are not tracked, touch the obj after
+  * editing its .mtl. only obj tiles are cached.*/
+class TileCache {
+    public :
+        /** on by default, off turns read and write into no-ops.*/
+        static void setEnabled( bool enabled );
+        static bool getEnabled(void);
+
+        /** true if source is of a kind the cache takes.*/
+        static bool accepts( const std::string &source );
+
+        static std::string cacheFileName( const std::string &source );
+
+        /** the node cached for source, null if there is no cache or it is stale.*/
+        static osg::ref_ptr<osg::Node> read( const std::string &source, const osgDB::Options *options = 0 );
+
+        /** cache node as the parse of source. false if the node holds
+          * something the format can't represent, transforms, primitives
+          * other than triangles or arrays other than vertices, normals and
+          * one texcoord unit, or if the file can't be written.*/
+        static bool write( const std::string &source, const osg::Node &node, const osgDB::Options *options = 0 );
+
+    private :
+        TileCache(void) {}
+};
+#endif
@@ -0,0 +1,316 @@
+#include <fstream>
+#include <sstream>
+#include <istream>
+
+#include <osg/Notify>
+#include <osgDB/Registry>
+#include <osgDB/ReaderWriter>
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <osgDB/FileNameUtils>
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/ScopedLock>
+
+#include "TileCache.h"
+#include "TileIO.h"
+#include "Trace.h"
+
+typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+TileIORequest::TileIORequest( Type type, const std::string &filename ) :
+    _io(0),
+    _type(type),
+    _filename(filename),
+    _success(false),
+    _decode(false)
+{
+}
+
+void TileIORequest::wait( void )
+{
+    _done.block();
+    if (_io)
+        _io->decode(this);
+}
+
+
+class TileIO::Worker : public OpenThreads::Thread
+{
+    public :
+        Worker( TileIO &io ) : _io(io) {}
+
+        virtual void run()
+        {
+            if (Trace::enabled())
+                Trace::setThreadName("io");
+            while (true)
+            {
+                osg::ref_ptr<TileIORequest> request = _io.next();
+                if (!request.valid())
+                    break;
+                _io.process(request.get());
+            }
+        }
+
+    private :
+        TileIO &_io;
+};
+
+
+TileIO::TileIO( unsigned int queue_depth, unsigned int num_threads ) :
+    _queue_depth(queue_depth ? queue_depth : 1),
+    _num_in_flight(0),
+    _done(false)
+{
+    if (num_threads == 0)
+        num_threads = _queue_depth < 8 ? _queue_depth : 8;
+
+    for (unsigned int i = 0; i < num_threads; ++i)
+    {
+        Worker *worker = new Worker(*this);
+        _workers.push_back(worker);
+        worker->start();
+    }
+}
+
+TileIO::~TileIO()
+{
+    flush();
+
+    {
+        ScopedLock lock(_mutex);
+        _done = true;
+        _queue_condition.broadcast();
+    }
+
+    for (unsigned int i = 0; i < _workers.size(); ++i)
+    {
+        _workers[i]->join();
+        delete _workers[i];
+    }
+}
+
+TileIORequest* TileIO::read( const std::string &filename )
+{
+    TileIORequest *request = new TileIORequest(TileIORequest::READ, filename);
+    request->_io = this;
+    submit(request);
+    return request;
+}
+
+void TileIO::readBatch( const std::vector<std::string> &filenames,
+                        std::vector< osg::ref_ptr<TileIORequest> > &requests )
+{
+    requests.resize(filenames.size());
+    for (size_t i = 0; i < filenames.size(); ++i)
+        requests[i] = filenames[i].empty() ? 0 : read(filenames[i]);
+}
+
+TileIORequest* TileIO::write( const osg::Node &node, const std::string &filename, bool packed )
+{
+    TileIORequest *request = new TileIORequest(TileIORequest::WRITE, filename);
+    if (packed && _pack.valid())
+        request->_pack_name = _pack->entryName(filename);
+    Trace::Scope trace("encode", filename, "io");
+
+    // encode here, the node belongs to the caller and may go away as soon
+    // as we return.
+    osgDB::ReaderWriter *rw = osgDB::Registry::instance()->getReaderWriterForExtension(
+        osgDB::getLowerCaseFileExtension(filename));
+    if (rw)
+    {
+        osg::ref_ptr<osgDB::Options> options = new osgDB::Options;
+        options->setDatabasePath(osgDB::getFilePath(filename));
+
+        std::ostringstream sstr(std::ios::out | std::ios::binary);
+        osgDB::ReaderWriter::WriteResult wr = rw->writeNode(node, sstr, options.get());
+        if (wr.success())
+        {
+            request->_buffer = sstr.str();
+            trace.arg("bytes", request->_buffer.size());
+            submit(request);
+            return request;
+        }
+    }
+
+    // no stream support for this format, write it the blocking way.
+    finish(request, request->_pack_name.empty() && osgDB::writeNodeFile(node, filename));
+    return request;
+}
+
+void TileIO::flush( void )
+{
+    ScopedLock lock(_mutex);
+    while (_num_in_flight > 0)
+        _slot_condition.wait(&_mutex);
+}
+
+void TileIO::submit( TileIORequest *request )
+{
+    ScopedLock lock(_mutex);
+    while (_num_in_flight >= _queue_depth)
+        _slot_condition.wait(&_mutex);
+
+    ++_num_in_flight;
+    _queue.push_back(request);
+    _queue_condition.signal();
+}
+
+osg::ref_ptr<TileIORequest> TileIO::next( void )
+{
+    osg::ref_ptr<TileIORequest> request;
+
+    ScopedLock lock(_mutex);
+    while (_queue.empty() && !_done)
+        _queue_condition.wait(&_mutex);
+
+    if (!_queue.empty())
+    {
+        request = _queue.front();
+        _queue.pop_front();
+    }
+    return request;
+}
+
+void TileIO::process( TileIORequest *request )
+{
+    bool success = request->getType() == TileIORequest::READ ?
+        readRequest(request) : writeRequest(request);
+
+    finish(request, success);
+
+    ScopedLock lock(_mutex);
+    --_num_in_flight;
+    _slot_condition.broadcast();
+}
+
+void TileIO::finish( TileIORequest *request, bool success )
+{
+    // the bytes of a read stay for the waiting thread to parse
+    if (!request->_decode)
+        std::string().swap(request->_buffer);
+    request->_success = success;
+    request->_done.release();
+}
+
+void TileIO::decode( TileIORequest *request )
+{
+    // any number of threads may wait on one request, one of them parses
+    ScopedLock lock(request->_decode_mutex);
+    if (!request->_decode)
+        return;
+
+    request->_success = decodeRequest(request);
+    request->_decode = false;
+    request->_options = 0;
+    std::string().swap(request->_buffer);
+}
+
+bool TileIO::readRequest( TileIORequest *request )
+{
+    const std::string &filename = request->getFileName();
+    Trace::Scope trace("read", filename, "io");
+
+    // relative material and texture names resolve against the tile's directory.
+    osg::ref_ptr<osgDB::Options> options = osgDB::Registry::instance()->getOptions() ?
+        osgDB::Registry::instance()->getOptions()->cloneOptions() : new osgDB::Options;
+    options->getDatabasePathList().push_front(osgDB::getFilePath(filename));
+
+    // a packed tile is one positional read, no file of its own to open
+    if (_pack.valid())
+    {
+        std::string name = _pack->entryName(filename);
+        if (!name.empty() && _pack->contains(name))
+        {
+            trace.arg("packed", 1);
+            request->_pack_name = name;
+            if (!_pack->read(name, request->_buffer))
+                return false;
+            trace.arg("bytes", request->_buffer.size());
+            request->_options = options;
+            request->_decode = true;
+            return true;
+        }
+    }
+
+    // a parsed copy of the tile is mapped, the text is not read at all
+    request->_node = TileCache::read(filename, options.get());
+    if (request->_node.valid())
+    {
+        trace.arg("cached", 1);
+        return true;
+    }
+
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!file.good())
+    {
+        osg::notify(osg::NOTICE)<<filename<<" could not be opened."<<std::endl;
+        return false;
+    }
+
+    file.seekg(0, std::ios::end);
+    std::streamoff size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    request->_buffer.resize(static_cast<size_t>(size));
+    if (size > 0)
+        file.read(&request->_buffer[0], size);
+    file.close();
+    trace.arg("bytes", static_cast<unsigned long long>(size));
+
+    request->_options = options;
+    request->_decode = true;
+    return true;
+}
+
+bool TileIO::decodeRequest( TileIORequest *request )
+{
+    const std::string &filename = request->getFileName();
+    Trace::Scope trace("parse", filename, "io");
+    trace.arg("bytes", request->_buffer.size());
+    osgDB::Options *options = request->_options.get();
+
+    if (!request->_pack_name.empty())
+    {
+        trace.arg("packed", 1);
+        request->_node = _pack->readNode(request->_pack_name, request->_buffer, options).getNode();
+        return request->_node.valid();
+    }
+
+    osgDB::ReaderWriter *rw = osgDB::Registry::instance()->getReaderWriterForExtension(
+        osgDB::getLowerCaseFileExtension(filename));
+    if (rw && !request->_buffer.empty())
+    {
+        MemoryStreamBuf buf(request->_buffer.data(), request->_buffer.size());
+        std::istream stream(&buf);
+        osgDB::ReaderWriter::ReadResult rr = rw->readNode(stream, options);
+        if (rr.validNode())
+        {
+            request->_node = rr.getNode();
+            TileCache::write(filename, *request->_node, options);
+            return true;
+        }
+    }
+
+    // the plugin can't read from a stream, let osgDB open the file itself.
+    request->_node = osgDB::readNodeFile(filename);
+    return request->_node.valid();
+}
+
+bool TileIO::writeRequest( TileIORequest *request )
+{
+    const std::string &filename = request->getFileName();
+    Trace::Scope trace("write", filename, "io");
+    trace.arg("bytes", request->_buffer.size());
+
+    if (!request->_pack_name.empty())
+        return _pack->add(request->_pack_name, request->_buffer.data(), request->_buffer.size());
+
+    std::ofstream file(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.good())
+        return false;
+
+    file.write(request->_buffer.data(), request->_buffer.size());
+    file.close();
+    return !file.fail();
+}
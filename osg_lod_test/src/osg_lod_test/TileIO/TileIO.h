@@ -0,0 +1,125 @@
+#ifndef _TILE_IO_H
+#define _TILE_IO_H
+
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <osg/Node>
+#include <osgDB/Options>
+
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+#include <OpenThreads/Block>
+
+#include "MappedFile.h"
+#include "TilePack.h"
+
+class TileIO;
+
+/** one tile read or write in flight. wait() blocks until the io threads
+  * are done with it, the bytes of a read are then parsed on the thread that
+  * waits.*/
+class TileIORequest : public osg::Referenced
+{
+    public :
+        enum Type { READ, WRITE };
+
+        TileIORequest( Type type, const std::string &filename );
+
+        Type getType(void) const { return _type; }
+        const std::string& getFileName(void) const { return _filename; }
+
+        void wait(void);
+        bool success(void) const { return _success; }
+
+        /** the loaded node of a finished read request.*/
+        osg::Node* getNode(void) { return _node.get(); }
+
+    protected :
+        virtual ~TileIORequest() {}
+
+    private :
+        friend class TileIO;
+
+        TileIO *_io;
+        Type _type;
+        std::string _filename;
+        std::string _pack_name;
+        std::string _buffer;
+        osg::ref_ptr<osg::Node> _node;
+        bool _success;
+        /** the io thread read the bytes, wait() still has to parse them.*/
+        bool _decode;
+        osg::ref_ptr<osgDB::Options> _options;
+        OpenThreads::Mutex _decode_mutex;
+        OpenThreads::Block _done;
+};
+
+/** batched asynchronous tile reads and writes. requests are queued to a
+  * small pool of io threads that only move bytes: a read pulls the whole
+  * file (or pack entry) into memory and the thread that waits for it hands
+  * the bytes to the ReaderWriter of its extension through a stream, so the
+  * parsing runs on the build threads and not behind the io queue. a write
+  * encodes the node on the calling thread and leaves the disk write to the
+  * pool. queue_depth bounds the number of requests in flight, submitting
+  * blocks while the queue is full.*/
+class TileIO {
+    public :
+        TileIO( unsigned int queue_depth = 32, unsigned int num_threads = 0 );
+        ~TileIO();
+
+        TileIORequest* read( const std::string &filename );
+        /** packed, a tile below the directory of the pack goes into it
+          * instead of a file of its own. temporary files pass false.*/
+        TileIORequest* write( const osg::Node &node, const std::string &filename, bool packed = true );
+
+        /** submit the reads of several tiles at once, empty names are
+          * skipped and leave a null request.*/
+        void readBatch( const std::vector<std::string> &filenames,
+                        std::vector< osg::ref_ptr<TileIORequest> > &requests );
+
+        /** block until every submitted request has finished.*/
+        void flush(void);
+
+        unsigned int getQueueDepth(void) const { return _queue_depth; }
+
+        /** write the tiles into pack and read the ones in it from there, 0
+          * for files of their own.*/
+        void setPack( TilePack *pack ) { _pack = pack; }
+        TilePack* getPack(void) { return _pack.get(); }
+
+    private :
+        TileIO( const TileIO& ) {}
+        TileIO& operator = (const TileIO& ) { return *this; }
+
+        class Worker;
+        friend class Worker;
+        friend class TileIORequest;
+
+        void submit( TileIORequest *request );
+        osg::ref_ptr<TileIORequest> next(void);
+        void process( TileIORequest *request );
+        void finish( TileIORequest *request, bool success );
+
+        bool readRequest( TileIORequest *request );
+        /** parse the bytes of a read, on the waiting thread.*/
+        void decode( TileIORequest *request );
+        bool decodeRequest( TileIORequest *request );
+        bool writeRequest( TileIORequest *request );
+
+        unsigned int _queue_depth;
+        unsigned int _num_in_flight;
+        osg::ref_ptr<TilePack> _pack;
+        bool _done;
+
+        std::deque< osg::ref_ptr<TileIORequest> > _queue;
+        std::vector<Worker*> _workers;
+
+        OpenThreads::Mutex _mutex;
+        OpenThreads::Condition _queue_condition;
+        OpenThreads::Condition _slot_condition;
+};
+#endif
@@ -0,0 +1,135 @@
+#include <cstdio>
+#include <sstream>
+
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+
+#include <OpenThreads/ScopedLock>
+
+#include "TileIndex.h"
+
+typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+TileIndex::TileIndex( const std::string &dir ) :
+    _dir(dir)
+{
+}
+
+std::string TileIndex::meshName( int x, int y )
+{
+    std::stringstream sstr;
+    sstr << "mesh_" << x << "_" << y << "_adj_model.obj";
+    return sstr.str();
+}
+
+std::string TileIndex::quadName( int level, int x, int y )
+{
+    std::stringstream sstr;
+    sstr << "quad_" << level << "_" << x << "_" << y << ".ive";
+    return sstr.str();
+}
+
+TileIndex::Key TileIndex::makeKey( int level, int x, int y )
+{
+    return (static_cast<Key>(level & 0xff) << 56) |
+           (static_cast<Key>(x & 0xfffffff) << 28) |
+            static_cast<Key>(y & 0xfffffff);
+}
+
+bool TileIndex::scan( void )
+{
+    if (osgDB::fileType(_dir) != osgDB::DIRECTORY)
+        return false;
+
+    osgDB::DirectoryContents contents = osgDB::getDirectoryContents(_dir);
+
+    KeySet meshes, quads;
+    for (osgDB::DirectoryContents::const_iterator itr = contents.begin(); itr != contents.end(); ++itr)
+    {
+        // the names are parsed and printed back, so only the exact names
+        // the tile loops would have built are indexed (no leading zeros).
+        // the case only matters to the match, the file keeps its own name.
+        std::string name = osgDB::convertToLowerCase(*itr);
+        int level = 0, x = 0, y = 0;
+        bool is_mesh = false;
+        if (sscanf(name.c_str(), "mesh_%d_%d_", &x, &y) == 2 && x >= 0 && y >= 0)
+            is_mesh = (name == meshName(x, y));
+        else if (sscanf(name.c_str(), "quad_%d_%d_%d", &level, &x, &y) == 3 && x >= 0 && y >= 0)
+        {
+            if (name != quadName(level, x, y))
+                continue;
+        }
+        else
+            continue;
+
+        // only matching names pay for the stat
+        if (osgDB::fileType(osgDB::concatPaths(_dir, *itr)) != osgDB::REGULAR_FILE)
+            continue;
+
+        if (is_mesh)
+            meshes[makeKey(0, x, y)] = *itr;
+        else
+            quads[makeKey(level, x, y)] = *itr;
+    }
+
+    ScopedLock lock(_mutex);
+    _meshes.swap(meshes);
+    _quads.swap(quads);
+    return true;
+}
+
+bool TileIndex::hasMesh( int x, int y ) const
+{
+    ScopedLock lock(_mutex);
+    return _meshes.find(makeKey(0, x, y)) != _meshes.end();
+}
+
+bool TileIndex::hasQuad( int level, int x, int y ) const
+{
+    ScopedLock lock(_mutex);
+    return _quads.find(makeKey(level, x, y)) != _quads.end();
+}
+
+std::string TileIndex::getMeshFilename( int x, int y ) const
+{
+    ScopedLock lock(_mutex);
+    KeySet::const_iterator itr = _meshes.find(makeKey(0, x, y));
+    if (itr == _meshes.end())
+        return std::string();
+    return osgDB::concatPaths(_dir, itr->second);
+}
+
+std::string TileIndex::getQuadFilename( int level, int x, int y ) const
+{
+    ScopedLock lock(_mutex);
+    KeySet::const_iterator itr = _quads.find(makeKey(level, x, y));
+    if (itr == _quads.end())
+        return std::string();
+    return osgDB::concatPaths(_dir, itr->second);
+}
+
+void TileIndex::addQuad( int level, int x, int y )
+{
+    ScopedLock lock(_mutex);
+    _quads[makeKey(level, x, y)] = quadName(level, x, y);
+}
+
+void TileIndex::getMeshes( std::vector< std::pair<int, int> > &cells ) const
+{
+    ScopedLock lock(_mutex);
+    cells.reserve(cells.size() + _meshes.size());
+    for (KeySet::const_iterator itr = _meshes.begin(); itr != _meshes.end(); ++itr)
+        cells.push_back(std::make_pair(static_cast<int>((itr->first >> 28) & 0xfffffff), static_cast<int>(itr->first & 0xfffffff)));
+}
+
+size_t TileIndex::getNumMeshes( void ) const
+{
+    ScopedLock lock(_mutex);
+    return _meshes.size();
+}
+
+size_t TileIndex::getNumQuads( void ) const
+{
+    ScopedLock lock(_mutex);
+    return _quads.size();
+}
@@ -0,0 +1,65 @@
+#ifndef _TILE_INDEX_H
+#define _TILE_INDEX_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+
+#include <osg/Referenced>
+
+#include <OpenThreads/Mutex>
+
+/** in memory index of the tiles of one directory. the directory is listed
+  * once and every mesh_<x>_<y>_adj_model.obj and quad_<level>_<x>_<y>.ive
+  * entry is parsed into a map of grid cells, so looking up a cell costs no
+  * file system call and an empty cell costs nothing at all. names match
+  * in any case, the cell keeps the name the file has on disk. tiles written
+  * after the scan are announced with addQuad().*/
+class TileIndex : public osg::Referenced
+{
+    public :
+        TileIndex( const std::string &dir );
+
+        const std::string& getDirectory(void) const { return _dir; }
+
+        /** list the directory, false if it cannot be read.*/
+        bool scan(void);
+
+        bool hasMesh( int x, int y ) const;
+        bool hasQuad( int level, int x, int y ) const;
+
+        /** full path of the tile, empty if the cell has no file.*/
+        std::string getMeshFilename( int x, int y ) const;
+        std::string getQuadFilename( int level, int x, int y ) const;
+
+        void addQuad( int level, int x, int y );
+
+        /** the cells that have a mesh file, in no particular order.*/
+        void getMeshes( std::vector< std::pair<int, int> > &cells ) const;
+
+        size_t getNumMeshes(void) const;
+        size_t getNumQuads(void) const;
+
+        static std::string meshName( int x, int y );
+        static std::string quadName( int level, int x, int y );
+
+    protected :
+        virtual ~TileIndex() {}
+
+    private :
+        TileIndex( const TileIndex& ) {}
+        TileIndex& operator = (const TileIndex& ) { return *this; }
+
+        typedef unsigned long long Key;
+        /** cell to the file name as listed.*/
+        typedef std::unordered_map<Key, std::string> KeySet;
+
+        static Key makeKey( int level, int x, int y );
+
+        std::string _dir;
+        KeySet _meshes;
+        KeySet _quads;
+        mutable OpenThreads::Mutex _mutex;
+};
+#endif
@@ -0,0 +1,623 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/Registry>
+
+#include <OpenThreads/ScopedLock>
+
+#include "TilePack.h"
+#include "MappedFile.h"
+
+typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+namespace
+{
+    const char pack_magic[4] = { 'T', 'P', 'K', '1' };
+
+    // names longer than this are a broken index
+    const unsigned long long max_name_length = 1 << 16;
+
+    void write_u64( std::ostream &out, unsigned long long value )
+    {
+        unsigned char bytes[8];
+        for (int i = 0; i < 8; ++i)
+            bytes[i] = static_cast<unsigned char>(value >> (i * 8));
+        out.write(reinterpret_cast<const char*>(bytes), 8);
+    }
+
+    bool read_u64( std::istream &in, unsigned long long &value )
+    {
+        unsigned char bytes[8];
+        if (!in.read(reinterpret_cast<char*>(bytes), 8))
+            return false;
+        value = 0;
+        for (int i = 0; i < 8; ++i)
+            value |= static_cast<unsigned long long>(bytes[i]) << (i * 8);
+        return true;
+    }
+
+    void write_string( std::ostream &out, const std::string &str )
+    {
+        write_u64(out, str.size());
+        out.write(str.data(), str.size());
+    }
+
+    bool read_string( std::istream &in, std::string &str )
+    {
+        unsigned long long size = 0;
+        if (!read_u64(in, size) || size > max_name_length)
+            return false;
+        str.resize(static_cast<size_t>(size));
+        return size == 0 || in.read(&str[0], static_cast<std::streamsize>(size));
+    }
+
+    // '/' separated, without a leading "./"
+    std::string entry_path( const std::string &name )
+    {
+        std::string path(name);
+        for (size_t i = 0; i < path.size(); ++i)
+            if (path[i] == '\\')
+                path[i] = '/';
+        while (path.compare(0, 2, "./") == 0)
+            path.erase(0, 2);
+        return path;
+    }
+
+    // the images an entry references are read from the pack when they are
+    // in it, through the registry so its image cache sees them
+    class PackReadFileCallback : public osgDB::ReadFileCallback
+    {
+        public :
+            PackReadFileCallback( const TilePack *pack, const std::string &directory ) :
+                _pack(pack),
+                _directory(directory)
+            {
+            }
+
+            virtual osgDB::ReaderWriter::ReadResult readImage( const std::string &filename, const osgDB::Options *options )
+            {
+                if (!osgDB::isAbsolutePath(filename))
+                {
+                    std::string name = entry_path(_directory.empty() ? filename : _directory + "/" + filename);
+                    if (_pack->contains(name))
+                        return osgDB::Registry::instance()->readImageImplementation(_pack->getFileName() + "/" + name, options);
+                }
+                return osgDB::Registry::instance()->readImageImplementation(filename, options);
+            }
+
+        private :
+            osg::ref_ptr<const TilePack> _pack;
+            std::string _directory;
+    };
+}
+
+
+TilePack::TilePack( const std::string &filename ) :
+    _filename(filename),
+    _created(false),
+    _max_data_size(0),
+    _end(0)
+{
+}
+
+TilePack::~TilePack()
+{
+    close();
+}
+
+bool TilePack::create( unsigned long long max_data_size )
+{
+    close();
+
+    ScopedLock lock(_mutex);
+    _entries.clear();
+    _master.clear();
+    _max_data_size = max_data_size;
+    _end = 0;
+
+    // no index of an earlier build may describe the new data files, and
+    // data files it had beyond the first are left over
+    remove(_filename.c_str());
+    for (unsigned int i = 1; ; ++i)
+    {
+        std::stringstream sstr;
+        sstr << osgDB::getNameLessExtension(_filename) << "." << i << ".tpd";
+        if (remove(sstr.str().c_str()) != 0)
+            break;
+    }
+
+    _created = openDataFile(osgDB::getNameLessExtension(_filename) + ".0.tpd", true);
+    return _created;
+}
+
+bool TilePack::open( void )
+{
+    close();
+
+    std::ifstream in(_filename.c_str(), std::ios::in | std::ios::binary);
+    char magic[4];
+    if (!in.read(magic, 4) || memcmp(magic, pack_magic, 4) != 0)
+        return false;
+
+    ScopedLock lock(_mutex);
+    _entries.clear();
+    unsigned long long num_data_files = 0;
+    bool valid = read_string(in, _master) && read_u64(in, num_data_files);
+
+    // the data files are found next to the index, wherever the pack was copied to
+    std::string directory = osgDB::getFilePath(_filename);
+    for (unsigned long long i = 0; i < num_data_files && valid; ++i)
+    {
+        std::string name;
+        valid = read_string(in, name) && openDataFile(osgDB::concatPaths(directory, name), false);
+    }
+
+    unsigned long long num_entries = 0;
+    valid = valid && read_u64(in, num_entries);
+    for (unsigned long long i = 0; i < num_entries && valid; ++i)
+    {
+        std::string name;
+        unsigned long long data_file = 0;
+        Entry entry;
+        valid = read_string(in, name) && read_u64(in, data_file) && read_u64(in, entry.offset) &&
+            read_u64(in, entry.size) && data_file < _data_files.size();
+        entry.data_file = static_cast<unsigned int>(data_file);
+        if (valid)
+            _entries[name] = entry;
+    }
+
+    if (!valid)
+    {
+        _entries.clear();
+        closeDataFiles();
+    }
+    return valid;
+}
+
+bool TilePack::close( void )
+{
+    ScopedLock lock(_mutex);
+    bool success = true;
+    if (_created)
+    {
+        // written aside and moved in place, a reader never sees half an index
+        std::string part_filename = _filename + ".part";
+        {
+            std::ofstream out(part_filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            out.write(pack_magic, 4);
+            write_string(out, _master);
+            write_u64(out, _data_files.size());
+            for (size_t i = 0; i < _data_files.size(); ++i)
+                write_string(out, osgDB::getSimpleFileName(_data_files[i].name));
+            write_u64(out, _entries.size());
+            for (std::map<std::string, Entry>::const_iterator itr = _entries.begin(); itr != _entries.end(); ++itr)
+            {
+                write_string(out, itr->first);
+                write_u64(out, itr->second.data_file);
+                write_u64(out, itr->second.offset);
+                write_u64(out, itr->second.size);
+            }
+            out.close();
+            success = !out.fail();
+        }
+        remove(_filename.c_str());
+        success = success && rename(part_filename.c_str(), _filename.c_str()) == 0;
+        _created = false;
+    }
+    closeDataFiles();
+    return success;
+}
+
+void TilePack::abort( void )
+{
+    ScopedLock lock(_mutex);
+    std::vector<std::string> data_names;
+    if (_created)
+    {
+        for (size_t i = 0; i < _data_files.size(); ++i)
+            data_names.push_back(_data_files[i].name);
+        _created = false;
+    }
+    closeDataFiles();
+    for (size_t i = 0; i < data_names.size(); ++i)
+        remove(data_names[i].c_str());
+}
+
+std::string TilePack::entryName( const std::string &filename ) const
+{
+    std::string directory = osgDB::getFilePath(_filename);
+    std::string name = directory.empty() ? filename : osgDB::getPathRelative(directory, filename);
+    if (name.empty() || name.compare(0, 2, "..") == 0 || osgDB::isAbsolutePath(name))
+        return std::string();
+    return entry_path(name);
+}
+
+bool TilePack::add( const std::string &name, const char *data, size_t size )
+{
+    std::string path = entry_path(name);
+    if (path.empty())
+        return false;
+
+    Entry entry;
+    DataFile file;
+    {
+        ScopedLock lock(_mutex);
+        if (!_created)
+            return false;
+
+        // a new data file once this one is full, an entry is never split
+        if (_end > 0 && _end + size > _max_data_size)
+        {
+            std::stringstream sstr;
+            sstr << osgDB::getNameLessExtension(_filename) << "." << _data_files.size() << ".tpd";
+            if (!openDataFile(sstr.str(), true))
+                return false;
+            _end = 0;
+        }
+        entry.data_file = static_cast<unsigned int>(_data_files.size() - 1);
+        entry.offset = _end;
+        entry.size = size;
+        _end += size;
+        file = _data_files.back();
+    }
+
+    // the space is reserved, several tiles are written at once
+    if (!writeAt(file, entry.offset, data, size))
+        return false;
+
+    ScopedLock lock(_mutex);
+    _entries[path] = entry;
+    return true;
+}
+
+bool TilePack::contains( const std::string &name ) const
+{
+    ScopedLock lock(_mutex);
+    return _entries.find(entry_path(name)) != _entries.end();
+}
+
+unsigned long long TilePack::getSize( const std::string &name ) const
+{
+    ScopedLock lock(_mutex);
+    std::map<std::string, Entry>::const_iterator itr = _entries.find(entry_path(name));
+    return itr != _entries.end() ? itr->second.size : 0;
+}
+
+bool TilePack::read( const std::string &name, std::string &buffer ) const
+{
+    Entry entry;
+    DataFile file;
+    {
+        ScopedLock lock(_mutex);
+        std::map<std::string, Entry>::const_iterator itr = _entries.find(entry_path(name));
+        if (itr == _entries.end())
+            return false;
+        entry = itr->second;
+        file = _data_files[entry.data_file];
+    }
+
+    buffer.resize(static_cast<size_t>(entry.size));
+    return entry.size == 0 || readAt(file, entry.offset, &buffer[0], buffer.size());
+}
+
+void TilePack::getNames( std::vector<std::string> &names ) const
+{
+    ScopedLock lock(_mutex);
+    for (std::map<std::string, Entry>::const_iterator itr = _entries.begin(); itr != _entries.end(); ++itr)
+        names.push_back(itr->first);
+}
+
+osgDB::ReaderWriter::ReadResult TilePack::readNode( const std::string &name, const osgDB::Options *options ) const
+{
+    std::string buffer;
+    if (!read(entry_path(name), buffer))
+        return osgDB::ReaderWriter::ReadResult(osgDB::ReaderWriter::ReadResult::FILE_NOT_FOUND);
+    return readNode(name, buffer, options);
+}
+
+osgDB::ReaderWriter::ReadResult TilePack::readNode( const std::string &name, const std::string &buffer,
+                                                    const osgDB::Options *options ) const
+{
+    std::string path = entry_path(name);
+    osgDB::ReaderWriter *rw = osgDB::Registry::instance()->getReaderWriterForExtension(
+        osgDB::getLowerCaseFileExtension(path));
+    if (!rw)
+        return osgDB::ReaderWriter::ReadResult(osgDB::ReaderWriter::ReadResult::FILE_NOT_HANDLED);
+
+    // the paged children resolve to "<pack>/<directory>/<child>", which the
+    // registry hands back to the pack as an archive
+    std::string directory = osgDB::getFilePath(path);
+    osg::ref_ptr<osgDB::Options> local_options = options ? options->cloneOptions() : new osgDB::Options;
+    local_options->getDatabasePathList().push_front(directory.empty() ? _filename : _filename + "/" + directory);
+    local_options->setReadFileCallback(new PackReadFileCallback(this, directory));
+
+    MemoryStreamBuf buf(buffer.data(), buffer.size());
+    std::istream stream(&buf);
+    return rw->readNode(stream, local_options.get());
+}
+
+osgDB::ReaderWriter::ReadResult TilePack::readImage( const std::string &name, const osgDB::Options *options ) const
+{
+    std::string path = entry_path(name);
+    std::string buffer;
+    if (!read(path, buffer))
+        return osgDB::ReaderWriter::ReadResult(osgDB::ReaderWriter::ReadResult::FILE_NOT_FOUND);
+
+    osgDB::ReaderWriter *rw = osgDB::Registry::instance()->getReaderWriterForExtension(
+        osgDB::getLowerCaseFileExtension(path));
+    if (!rw)
+        return osgDB::ReaderWriter::ReadResult(osgDB::ReaderWriter::ReadResult::FILE_NOT_HANDLED);
+
+    MemoryStreamBuf buf(buffer.data(), buffer.size());
+    std::istream stream(&buf);
+    osgDB::ReaderWriter::ReadResult result = rw->readImage(stream, options);
+    if (result.validImage())
+        result.getImage()->setFileName(path);
+    return result;
+}
+
+unsigned int TilePack::getNumEntries( void ) const
+{
+    ScopedLock lock(_mutex);
+    return static_cast<unsigned int>(_entries.size());
+}
+
+unsigned long long TilePack::getNumBytes( void ) const
+{
+    ScopedLock lock(_mutex);
+    unsigned long long num_bytes = 0;
+    for (std::map<std::string, Entry>::const_iterator itr = _entries.begin(); itr != _entries.end(); ++itr)
+        num_bytes += itr->second.size;
+    return num_bytes;
+}
+
+#ifdef _WIN32
+
+bool TilePack::openDataFile( const std::string &name, bool create )
+{
+    HANDLE handle = CreateFileA(name.c_str(), create ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+                                FILE_SHARE_READ, 0, create ? CREATE_ALWAYS : OPEN_EXISTING,
+                                FILE_FLAG_RANDOM_ACCESS, 0);
+    if (handle == INVALID_HANDLE_VALUE)
+        return false;
+    DataFile file;
+    file.name = name;
+    file.handle = handle;
+    _data_files.push_back(file);
+    return true;
+}
+
+void TilePack::closeDataFiles( void )
+{
+    for (size_t i = 0; i < _data_files.size(); ++i)
+        CloseHandle(_data_files[i].handle);
+    _data_files.clear();
+}
+
+// an explicit offset makes ReadFile and WriteFile positional, the file
+// pointer of the shared handle is never relied on
+bool TilePack::readAt( const DataFile &file, unsigned long long offset, char *data, size_t size ) const
+{
+    while (size > 0)
+    {
+        OVERLAPPED overlapped;
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD chunk = static_cast<DWORD>(size > (1u << 30) ? (1u << 30) : size), num_read = 0;
+        if (!ReadFile(file.handle, data, chunk, &num_read, &overlapped) || num_read == 0)
+            return false;
+        data += num_read;
+        size -= num_read;
+        offset += num_read;
+    }
+    return true;
+}
+
+bool TilePack::writeAt( const DataFile &file, unsigned long long offset, const char *data, size_t size ) const
+{
+    while (size > 0)
+    {
+        OVERLAPPED overlapped;
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD chunk = static_cast<DWORD>(size > (1u << 30) ? (1u << 30) : size), num_written = 0;
+        if (!WriteFile(file.handle, data, chunk, &num_written, &overlapped) || num_written == 0)
+            return false;
+        data += num_written;
+        size -= num_written;
+        offset += num_written;
+    }
+    return true;
+}
+
+#else
+
+bool TilePack::openDataFile( const std::string &name, bool create )
+{
+    int fd = ::open(name.c_str(), create ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+    if (fd < 0)
+        return false;
+    DataFile file;
+    file.name = name;
+    file.fd = fd;
+    _data_files.push_back(file);
+    return true;
+}
+
+void TilePack::closeDataFiles( void )
+{
+    for (size_t i = 0; i < _data_files.size(); ++i)
+        ::close(_data_files[i].fd);
+    _data_files.clear();
+}
+
+bool TilePack::readAt( const DataFile &file, unsigned long long offset, char *data, size_t size ) const
+{
+    while (size > 0)
+    {
+        ssize_t num_read = pread(file.fd, data, size, static_cast<off_t>(offset));
+        if (num_read <= 0)
+            return false;
+        data += num_read;
+        size -= num_read;
+        offset += num_read;
+    }
+    return true;
+}
+
+bool TilePack::writeAt( const DataFile &file, unsigned long long offset, const char *data, size_t size ) const
+{
+    while (size > 0)
+    {
+        ssize_t num_written = pwrite(file.fd, data, size, static_cast<off_t>(offset));
+        if (num_written <= 0)
+            return false;
+        data += num_written;
+        size -= num_written;
+        offset += num_written;
+    }
+    return true;
+}
+
+#endif
+
+
+TilePackArchive::TilePackArchive( TilePack *pack ) :
+    _pack(pack)
+{
+}
+
+bool TilePackArchive::acceptsExtension( const std::string &extension ) const
+{
+    return osgDB::equalCaseInsensitive(extension, "tpk");
+}
+
+void TilePackArchive::close()
+{
+    _pack->close();
+}
+
+bool TilePackArchive::fileExists( const std::string &filename ) const
+{
+    return _pack->contains(filename);
+}
+
+osgDB::FileType TilePackArchive::getFileType( const std::string &filename ) const
+{
+    return _pack->contains(filename) ? osgDB::REGULAR_FILE : osgDB::FILE_NOT_FOUND;
+}
+
+bool TilePackArchive::getFileNames( FileNameList &names ) const
+{
+    _pack->getNames(names);
+    return !names.empty();
+}
+
+osgDB::ReaderWriter::ReadResult TilePackArchive::readObject( const std::string &filename, const Options *options ) const
+{
+    return readNode(filename, options);
+}
+
+osgDB::ReaderWriter::ReadResult TilePackArchive::readImage( const std::string &filename, const Options *options ) const
+{
+    return _pack->readImage(filename, options);
+}
+
+osgDB::ReaderWriter::ReadResult TilePackArchive::readHeightField( const std::string &, const Options * ) const
+{
+    return ReadResult(ReadResult::NOT_IMPLEMENTED);
+}
+
+osgDB::ReaderWriter::ReadResult TilePackArchive::readNode( const std::string &filename, const Options *options ) const
+{
+    return _pack->readNode(filename, options);
+}
+
+osgDB::ReaderWriter::ReadResult TilePackArchive::readShader( const std::string &, const Options * ) const
+{
+    return ReadResult(ReadResult::NOT_IMPLEMENTED);
+}
+
+// packs are written by the builder through TilePack::add
+osgDB::ReaderWriter::WriteResult TilePackArchive::writeObject( const osg::Object &, const std::string &, const Options * ) const
+{
+    return WriteResult(WriteResult::NOT_IMPLEMENTED);
+}
+
+osgDB::ReaderWriter::WriteResult TilePackArchive::writeImage( const osg::Image &, const std::string &, const Options * ) const
+{
+    return WriteResult(WriteResult::NOT_IMPLEMENTED);
+}
+
+osgDB::ReaderWriter::WriteResult TilePackArchive::writeHeightField( const osg::HeightField &, const std::string &, const Options * ) const
+{
+    return WriteResult(WriteResult::NOT_IMPLEMENTED);
+}
+
+osgDB::ReaderWriter::WriteResult TilePackArchive::writeNode( const osg::Node &, const std::string &, const Options * ) const
+{
+    return WriteResult(WriteResult::NOT_IMPLEMENTED);
+}
+
+osgDB::ReaderWriter::WriteResult TilePackArchive::writeShader( const osg::Shader &, const std::string &, const Options * ) const
+{
+    return WriteResult(WriteResult::NOT_IMPLEMENTED);
+}
+
+
+// packs open through osgDB::readNodeFile like any other database
+static osgDB::RegisterReaderWriterProxy<TilePackReader> g_tile_pack_reader_proxy;
+
+TilePackReader::TilePackReader( void )
+{
+    supportsExtension("tpk", "tile pack of a paged database");
+    osgDB::Registry::instance()->addArchiveExtension("tpk");
+}
+
+TilePackReader::ReadResult TilePackReader::openArchive( const std::string &filename, ArchiveStatus status,
+                                                        unsigned int, const Options *options ) const
+{
+    if (!acceptsExtension(osgDB::getLowerCaseFileExtension(filename)))
+        return ReadResult::FILE_NOT_HANDLED;
+    if (status != READ)
+        return ReadResult::FILE_NOT_HANDLED;
+
+    std::string path = osgDB::fileExists(filename) ? filename : osgDB::findDataFile(filename, options);
+    if (path.empty())
+        return ReadResult::FILE_NOT_FOUND;
+
+    osg::ref_ptr<TilePack> pack = new TilePack(path);
+    if (!pack->open())
+        return ReadResult::ERROR_IN_READING_FILE;
+    return ReadResult(new TilePackArchive(pack.get()));
+}
+
+TilePackReader::ReadResult TilePackReader::readNode( const std::string &filename, const Options *options ) const
+{
+    ReadResult result = openArchive(filename, READ, 4096, options);
+    if (!result.validArchive())
+        return result;
+
+    // kept by the registry, the paged children are read from the same archive
+    osg::ref_ptr<osgDB::Archive> archive = result.getArchive();
+    if (!options || (options->getObjectCacheHint() & osgDB::Options::CACHE_ARCHIVES))
+        osgDB::Registry::instance()->addToArchiveCache(archive->getArchiveFileName(), archive.get());
+    return archive->readNode(archive->getMasterFileName(), options);
+}
@@ -0,0 +1,160 @@
+#ifndef _TILE_PACK_H
+#define _TILE_PACK_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <osg/Referenced>
+#include <osg/Node>
+#include <osg/Image>
+#include <osgDB/Archive>
+#include <osgDB/ReaderWriter>
+
+#include <OpenThreads/Mutex>
+
+/** a database in a handful of files. the tiles are appended to large data
+  * files (name.0.tpd, name.1.tpd, ... a new one once max_data_size is
+  * reached) and name.tpk indexes them by their path relative to the
+  * directory of the pack, so a tile is one lookup and one positional read
+  * instead of a file of its own.
+  *
+  * name.tpk is a binary file: "TPK1", the master file name, the data file
+  * names, then name, data file, offset and size of every entry. it is
+  * written by close(), the data files are written while the tiles are
+  * added. a build that fails calls abort() so no index describes it.*/
+class TilePack : public osg::Referenced {
+    public :
+        TilePack( const std::string &filename );
+
+        const std::string& getFileName(void) const { return _filename; }
+
+        /** start an empty pack, the previous data files are truncated.*/
+        bool create( unsigned long long max_data_size = 4ULL << 30 );
+
+        /** read the index of a written pack.*/
+        bool open(void);
+
+        /** write the index of a created pack and close the data files.*/
+        bool close(void);
+
+        /** close a created pack without its index, its data files are
+          * removed.*/
+        void abort(void);
+
+        /** the tile of filename is the entry opened by reading the pack itself.*/
+        void setMasterFileName( const std::string &filename ) { _master = entryName(filename); }
+        const std::string& getMasterFileName(void) const { return _master; }
+
+        /** name relative to the directory of the pack with '/' separators,
+          * empty for a filename outside of it.*/
+        std::string entryName( const std::string &filename ) const;
+
+        /** append an entry, thread safe. an entry added again replaces the
+          * earlier one, its bytes stay in the data file.*/
+        bool add( const std::string &name, const char *data, size_t size );
+
+        bool contains( const std::string &name ) const;
+        /** bytes of an entry, 0 if it is not in the pack.*/
+        unsigned long long getSize( const std::string &name ) const;
+        bool read( const std::string &name, std::string &buffer ) const;
+        void getNames( std::vector<std::string> &names ) const;
+
+        /** read an entry with the ReaderWriter of its extension. the paged
+          * children and the images it references resolve inside the pack.*/
+        osgDB::ReaderWriter::ReadResult readNode( const std::string &name, const osgDB::Options *options = 0 ) const;
+        /** decode the bytes of entry name already fetched with read().*/
+        osgDB::ReaderWriter::ReadResult readNode( const std::string &name, const std::string &buffer,
+                                                  const osgDB::Options *options = 0 ) const;
+        osgDB::ReaderWriter::ReadResult readImage( const std::string &name, const osgDB::Options *options = 0 ) const;
+
+        unsigned int getNumEntries(void) const;
+        unsigned long long getNumBytes(void) const;
+
+    protected :
+        virtual ~TilePack();
+
+    private :
+        TilePack( const TilePack& );
+        TilePack& operator = (const TilePack& );
+
+        struct Entry
+        {
+            unsigned int data_file;
+            unsigned long long offset;
+            unsigned long long size;
+        };
+
+        struct DataFile
+        {
+            std::string name;
+#ifdef _WIN32
+            void *handle;
+#else
+            int fd;
+#endif
+        };
+
+        bool openDataFile( const std::string &name, bool create );
+        void closeDataFiles(void);
+        bool readAt( const DataFile &file, unsigned long long offset, char *data, size_t size ) const;
+        bool writeAt( const DataFile &file, unsigned long long offset, const char *data, size_t size ) const;
+
+        std::string _filename;
+        std::string _master;
+        bool _created;
+        unsigned long long _max_data_size;
+
+        std::vector<DataFile> _data_files;
+        unsigned long long _end;
+        std::map<std::string, Entry> _entries;
+        mutable OpenThreads::Mutex _mutex;
+};
+
+/** a TilePack as an osgDB archive, so the registry resolves
+  * "name.tpk/ive/quad_1_0_0.ive" to an entry of the pack.*/
+class TilePackArchive : public osgDB::Archive {
+    public :
+        TilePackArchive( TilePack *pack );
+
+        virtual const char* libraryName() const { return "osg_lod_test"; }
+        virtual const char* className() const { return "TilePackArchive"; }
+        virtual bool acceptsExtension( const std::string &extension ) const;
+
+        virtual void close();
+        virtual bool fileExists( const std::string &filename ) const;
+        virtual osgDB::FileType getFileType( const std::string &filename ) const;
+        virtual std::string getArchiveFileName() const { return _pack->getFileName(); }
+        virtual std::string getMasterFileName() const { return _pack->getMasterFileName(); }
+        virtual bool getFileNames( FileNameList &names ) const;
+
+        virtual ReadResult readObject( const std::string &filename, const Options *options = 0 ) const;
+        virtual ReadResult readImage( const std::string &filename, const Options *options = 0 ) const;
+        virtual ReadResult readHeightField( const std::string &filename, const Options *options = 0 ) const;
+        virtual ReadResult readNode( const std::string &filename, const Options *options = 0 ) const;
+        virtual ReadResult readShader( const std::string &filename, const Options *options = 0 ) const;
+
+        virtual WriteResult writeObject( const osg::Object &object, const std::string &filename, const Options *options = 0 ) const;
+        virtual WriteResult writeImage( const osg::Image &image, const std::string &filename, const Options *options = 0 ) const;
+        virtual WriteResult writeHeightField( const osg::HeightField &heightfield, const std::string &filename, const Options *options = 0 ) const;
+        virtual WriteResult writeNode( const osg::Node &node, const std::string &filename, const Options *options = 0 ) const;
+        virtual WriteResult writeShader( const osg::Shader &shader, const std::string &filename, const Options *options = 0 ) const;
+
+    private :
+        osg::ref_ptr<TilePack> _pack;
+};
+
+/** reads .tpk packs, registered with the registry like ObjReader.
+  * reading a pack loads its master file, the registry opens it as an
+  * archive for the paths inside it.*/
+class TilePackReader : public osgDB::ReaderWriter {
+    public :
+        TilePackReader(void);
+
+        virtual const char* className() const { return "tile pack reader"; }
+
+        virtual ReadResult openArchive( const std::string &filename, ArchiveStatus status,
+                                        unsigned int indexBlockSizeHint = 4096, const Options *options = 0 ) const;
+        virtual ReadResult readNode( const std::string &filename, const Options *options = 0 ) const;
+};
+#endif
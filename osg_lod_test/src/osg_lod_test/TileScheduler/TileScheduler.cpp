@@ -0,0 +1,193 @@
+#include <OpenThreads/Thread>
+#include <OpenThreads/ScopedLock>
+
+#include "TileScheduler.h"
+#include "Trace.h"
+
+typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+TileTask::TileTask( void ) :
+    _num_pending(0)
+{
+}
+
+void TileTask::addDependency( TileTask *task )
+{
+    task->_dependents.push_back(this);
+    ++_num_pending;
+}
+
+
+class TileScheduler::Worker : public OpenThreads::Thread
+{
+    public :
+        Worker( TileScheduler &scheduler, unsigned int queue_index ) :
+            _scheduler(scheduler),
+            _queue_index(queue_index)
+        {
+        }
+
+        virtual void run()
+        {
+            if (Trace::enabled())
+                Trace::setThreadName("worker");
+            _scheduler.workerLoop(_queue_index);
+        }
+
+        unsigned int getQueueIndex() const { return _queue_index; }
+        TileScheduler* getScheduler() const { return &_scheduler; }
+
+    private :
+        TileScheduler &_scheduler;
+        unsigned int _queue_index;
+};
+
+
+TileScheduler::TileScheduler( unsigned int num_threads ) :
+    _num_threads(num_threads ? num_threads : defaultNumThreads()),
+    _num_remaining(0),
+    _num_queued(0),
+    _next_queue(0)
+{
+    for (unsigned int i = 0; i < _num_threads; ++i)
+        _queues.push_back(new WorkQueue);
+}
+
+TileScheduler::~TileScheduler()
+{
+    for (unsigned int i = 0; i < _queues.size(); ++i)
+        delete _queues[i];
+}
+
+unsigned int TileScheduler::defaultNumThreads( void )
+{
+    int num = OpenThreads::GetNumberOfProcessors();
+    return num > 0 ? num : 1;
+}
+
+unsigned int TileScheduler::currentQueueIndex( void ) const
+{
+    // workers keep feeding their own deque, everybody else spreads the
+    // tasks round robin.
+    Worker *worker = dynamic_cast<Worker*>(OpenThreads::Thread::CurrentThread());
+    if (worker && worker->getScheduler() == this)
+        return worker->getQueueIndex();
+
+    unsigned int next = ++const_cast<OpenThreads::Atomic&>(_next_queue);
+    return next % _num_threads;
+}
+
+void TileScheduler::add( TileTask *task )
+{
+    ++_num_remaining;
+    if (task->_num_pending == 0)
+        push(task, currentQueueIndex());
+}
+
+void TileScheduler::push( TileTask *task, unsigned int queue_index )
+{
+    // count first so an idle worker never misses a queued task.
+    ++_num_queued;
+
+    {
+        WorkQueue *queue = _queues[queue_index];
+        ScopedLock lock(queue->mutex);
+        queue->tasks.push_back(task);
+    }
+
+    ScopedLock lock(_idle_mutex);
+    _idle_condition.broadcast();
+}
+
+osg::ref_ptr<TileTask> TileScheduler::pop( unsigned int queue_index )
+{
+    osg::ref_ptr<TileTask> task;
+
+    WorkQueue *queue = _queues[queue_index];
+    ScopedLock lock(queue->mutex);
+    if (!queue->tasks.empty())
+    {
+        task = queue->tasks.back();
+        queue->tasks.pop_back();
+        --_num_queued;
+    }
+    return task;
+}
+
+osg::ref_ptr<TileTask> TileScheduler::steal( unsigned int queue_index )
+{
+    osg::ref_ptr<TileTask> task;
+
+    for (unsigned int i = 1; i < _num_threads && !task; ++i)
+    {
+        WorkQueue *queue = _queues[(queue_index + i) % _num_threads];
+        ScopedLock lock(queue->mutex);
+        if (!queue->tasks.empty())
+        {
+            task = queue->tasks.front();
+            queue->tasks.pop_front();
+            --_num_queued;
+        }
+    }
+    return task;
+}
+
+void TileScheduler::complete( TileTask *task, unsigned int queue_index )
+{
+    for (unsigned int i = 0; i < task->_dependents.size(); ++i)
+    {
+        TileTask *dependent = task->_dependents[i].get();
+        if (--dependent->_num_pending == 0)
+            push(dependent, queue_index);
+    }
+    task->_dependents.clear();
+
+    if (--_num_remaining == 0)
+    {
+        ScopedLock lock(_idle_mutex);
+        _idle_condition.broadcast();
+    }
+}
+
+void TileScheduler::workerLoop( unsigned int queue_index )
+{
+    while (true)
+    {
+        osg::ref_ptr<TileTask> task = pop(queue_index);
+        if (!task.valid())
+            task = steal(queue_index);
+
+        if (task.valid())
+        {
+            task->run(*this);
+            complete(task.get(), queue_index);
+            continue;
+        }
+
+        ScopedLock lock(_idle_mutex);
+        if (_num_remaining == 0)
+            break;
+        if (_num_queued == 0)
+            _idle_condition.wait(&_idle_mutex);
+    }
+}
+
+void TileScheduler::run( void )
+{
+    if (_num_remaining == 0)
+        return;
+
+    for (unsigned int i = 0; i < _num_threads; ++i)
+    {
+        Worker *worker = new Worker(*this, i);
+        _workers.push_back(worker);
+        worker->start();
+    }
+
+    for (unsigned int i = 0; i < _workers.size(); ++i)
+    {
+        _workers[i]->join();
+        delete _workers[i];
+    }
+    _workers.clear();
+}
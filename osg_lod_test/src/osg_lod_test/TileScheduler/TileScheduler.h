@@ -0,0 +1,94 @@
+#ifndef _TILE_SCHEDULER_H
+#define _TILE_SCHEDULER_H
+
+#include <vector>
+#include <deque>
+
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+#include <OpenThreads/Atomic>
+
+class TileScheduler;
+
+/** a node of the tile dependency graph. the task is handed to a worker
+  * thread once every task it depends on has finished running.*/
+class TileTask : public osg::Referenced
+{
+    public :
+        TileTask(void);
+
+        /** this task may only start once task has finished. dependencies
+          * must be declared before either task is added to the scheduler.*/
+        void addDependency( TileTask *task );
+
+        virtual void run( TileScheduler &scheduler ) = 0;
+
+    protected :
+        virtual ~TileTask() {}
+
+    private :
+        friend class TileScheduler;
+
+        TileTask( const TileTask& );
+        TileTask& operator = (const TileTask& );
+
+        std::vector< osg::ref_ptr<TileTask> > _dependents;
+        OpenThreads::Atomic _num_pending;
+};
+
+/** runs a dag of TileTasks on a pool of work-stealing threads. every
+  * worker owns a deque, runs its own newest task first and steals the
+  * oldest task of another worker when it runs dry, so independent tiles
+  * of different levels overlap.*/
+class TileScheduler {
+    public :
+        /** num_threads == 0 uses one thread per processor.*/
+        TileScheduler( unsigned int num_threads = 0 );
+        ~TileScheduler();
+
+        /** add a task to the graph. may also be called from a running task,
+          * in which case the new task must not have pending dependencies.*/
+        void add( TileTask *task );
+
+        /** run every added task, block until the graph is drained.*/
+        void run(void);
+
+        unsigned int getNumThreads(void) const { return _num_threads; }
+
+        static unsigned int defaultNumThreads(void);
+
+    private :
+        TileScheduler( const TileScheduler& ) {}
+        TileScheduler& operator = (const TileScheduler& ) { return *this; }
+
+        class Worker;
+        friend class Worker;
+
+        struct WorkQueue
+        {
+            OpenThreads::Mutex mutex;
+            std::deque< osg::ref_ptr<TileTask> > tasks;
+        };
+
+        void push( TileTask *task, unsigned int queue_index );
+        osg::ref_ptr<TileTask> pop( unsigned int queue_index );
+        osg::ref_ptr<TileTask> steal( unsigned int queue_index );
+        void complete( TileTask *task, unsigned int queue_index );
+        void workerLoop( unsigned int queue_index );
+        unsigned int currentQueueIndex(void) const;
+
+        unsigned int _num_threads;
+        std::vector<WorkQueue*> _queues;
+        std::vector<Worker*> _workers;
+
+        OpenThreads::Atomic _num_remaining;
+        OpenThreads::Atomic _num_queued;
+        OpenThreads::Atomic _next_queue;
+
+        OpenThreads::Mutex _idle_mutex;
+        OpenThreads::Condition _idle_condition;
+};
+#endif
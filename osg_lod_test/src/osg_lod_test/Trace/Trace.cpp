@@ -0,0 +1,236 @@
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/NodeVisitor>
+
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+
+#include "Trace.h"
+#include "Utility.h"
+
+// a plain pointer per thread, vs2012 has no thread_local
+#if defined(_MSC_VER)
+    #define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+    #define TRACE_THREAD_LOCAL __thread
+#endif
+
+typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+namespace
+{
+    struct Event
+    {
+        const char *name;
+        const char *category;
+        std::string detail;
+        osg::Timer_t start;
+        osg::Timer_t end;
+        const char *keys[Trace::MAX_ARGS];
+        unsigned long long values[Trace::MAX_ARGS];
+        unsigned int num_args;
+    };
+
+    // the buffers live as long as the process, a thread that is gone may
+    // still have events to write
+    struct ThreadBuffer
+    {
+        unsigned int id;
+        std::string name;
+        std::vector<Event> events;
+    };
+
+    OpenThreads::Mutex buffers_mutex;
+    std::vector<ThreadBuffer*> buffers;
+    osg::Timer_t start_tick = 0;
+
+    TRACE_THREAD_LOCAL ThreadBuffer *thread_buffer = 0;
+
+    ThreadBuffer* current_buffer(void)
+    {
+        if (!thread_buffer)
+        {
+            ScopedLock lock(buffers_mutex);
+            thread_buffer = new ThreadBuffer;
+            thread_buffer->id = static_cast<unsigned int>(buffers.size()) + 1;
+            buffers.push_back(thread_buffer);
+        }
+        return thread_buffer;
+    }
+
+    unsigned long long count_triangles( const osg::PrimitiveSet &primitives )
+    {
+        const osg::DrawArrayLengths *lengths = dynamic_cast<const osg::DrawArrayLengths*>(&primitives);
+        unsigned long long num_triangles = 0;
+        switch (primitives.getMode())
+        {
+            case osg::PrimitiveSet::TRIANGLES :
+                return primitives.getNumIndices() / 3;
+            case osg::PrimitiveSet::QUADS :
+                return primitives.getNumIndices() / 4 * 2;
+            case osg::PrimitiveSet::TRIANGLE_STRIP :
+            case osg::PrimitiveSet::TRIANGLE_FAN :
+            case osg::PrimitiveSet::QUAD_STRIP :
+            case osg::PrimitiveSet::POLYGON :
+                if (!lengths)
+                    return primitives.getNumIndices() > 2 ? primitives.getNumIndices() - 2 : 0;
+                for (size_t i = 0; i < lengths->size(); ++i)
+                    num_triangles += (*lengths)[i] > 2 ? (*lengths)[i] - 2 : 0;
+                return num_triangles;
+            default :
+                return 0;
+        }
+    }
+
+    class CountVisitor : public osg::NodeVisitor
+    {
+        public :
+            CountVisitor() :
+                osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+                num_vertices(0),
+                num_triangles(0)
+            {
+            }
+
+            virtual void apply( osg::Geode &geode )
+            {
+                for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+                {
+                    const osg::Geometry *geometry = geode.getDrawable(i)->asGeometry();
+                    if (!geometry)
+                        continue;
+                    if (geometry->getVertexArray())
+                        num_vertices += geometry->getVertexArray()->getNumElements();
+                    for (unsigned int i_p = 0; i_p < geometry->getNumPrimitiveSets(); ++i_p)
+                        num_triangles += count_triangles(*geometry->getPrimitiveSet(i_p));
+                }
+            }
+
+            unsigned long long num_vertices;
+            unsigned long long num_triangles;
+    };
+}
+
+bool Trace::_enabled = false;
+
+void Trace::start( void )
+{
+    ScopedLock lock(buffers_mutex);
+    for (size_t i = 0; i < buffers.size(); ++i)
+        buffers[i]->events.clear();
+    start_tick = osg::Timer::instance()->tick();
+    _enabled = true;
+}
+
+void Trace::stop( void )
+{
+    _enabled = false;
+}
+
+void Trace::setThreadName( const std::string &name )
+{
+    current_buffer()->name = name;
+}
+
+void Trace::countGeometry( const osg::Node &node, unsigned long long &num_vertices, unsigned long long &num_triangles )
+{
+    CountVisitor count;
+    const_cast<osg::Node&>(node).accept(count);
+    num_vertices = count.num_vertices;
+    num_triangles = count.num_triangles;
+}
+
+bool Trace::write( const std::string &filename )
+{
+    std::ofstream file(filename.c_str());
+    if (!file.good())
+        return false;
+
+    ScopedLock lock(buffers_mutex);
+    const osg::Timer *timer = osg::Timer::instance();
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (size_t i_b = 0; i_b < buffers.size(); ++i_b)
+    {
+        const ThreadBuffer &buffer = *buffers[i_b];
+        if (buffer.events.empty())
+            continue;
+
+        std::string name = buffer.name;
+        if (name.empty())
+        {
+            std::ostringstream sstr;
+            sstr << "thread " << buffer.id;
+            name = sstr.str();
+        }
+        file << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.id
+             << ",\"args\":{\"name\":" << Utility::jsonString(name) << "}}";
+        first = false;
+
+        for (size_t i_e = 0; i_e < buffer.events.size(); ++i_e)
+        {
+            const Event &event = buffer.events[i_e];
+            file << ",\n{\"name\":" << Utility::jsonString(event.name) << ",\"cat\":" << Utility::jsonString(event.category)
+                 << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer.id
+                 << ",\"ts\":" << timer->delta_u(start_tick, event.start)
+                 << ",\"dur\":" << timer->delta_u(event.start, event.end);
+            if (!event.detail.empty() || event.num_args > 0)
+            {
+                file << ",\"args\":{";
+                if (!event.detail.empty())
+                    file << "\"tile\":" << Utility::jsonString(event.detail);
+                for (unsigned int i_a = 0; i_a < event.num_args; ++i_a)
+                    file << (i_a > 0 || !event.detail.empty() ? "," : "") << Utility::jsonString(event.keys[i_a])
+                         << ":" << event.values[i_a];
+                file << "}";
+            }
+            file << "}";
+        }
+    }
+    file << "\n]}\n";
+    return file.good();
+}
+
+void Trace::Scope::begin( const char *name, const char *category )
+{
+    _name = name;
+    _category = category;
+    _num_args = 0;
+    _start = osg::Timer::instance()->tick();
+}
+
+void Trace::Scope::end( void )
+{
+    osg::Timer_t end = osg::Timer::instance()->tick();
+
+    ThreadBuffer *buffer = current_buffer();
+    buffer->events.push_back(Event());
+    Event &event = buffer->events.back();
+    event.name = _name;
+    event.category = _category;
+    event.detail.swap(_detail);
+    event.start = _start;
+    event.end = end;
+    event.num_args = _num_args;
+    for (unsigned int i = 0; i < _num_args; ++i)
+    {
+        event.keys[i] = _keys[i];
+        event.values[i] = _values[i];
+    }
+}
+
+void Trace::Scope::geometryArgs( const osg::Node &node )
+{
+    if (!_active)
+        return;
+    unsigned long long num_vertices = 0, num_triangles = 0;
+    countGeometry(node, num_vertices, num_triangles);
+    arg("vertices", num_vertices);
+    arg("triangles", num_triangles);
+}
@@ -0,0 +1,101 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <string>
+
+#include <osg/Timer>
+
+namespace osg { class Node; }
+
+/** scoped timing of the build for chrome://tracing and perfetto. a Scope
+  * records one complete event, with the tile it worked on and a few
+  * counts (bytes, vertices, triangles), into a buffer owned by the calling
+  * thread, so recording takes no lock. write() merges the buffers into a
+  * chrome trace json file.
+  *
+  * while tracing is off a Scope costs the test of one flag.*/
+class Trace {
+    public :
+        /** numeric arguments of one event.*/
+        enum { MAX_ARGS = 4 };
+
+        /** start recording, the events of an earlier start are dropped.
+          * call it before the traced threads start working.*/
+        static void start(void);
+        static void stop(void);
+        static bool enabled(void) { return _enabled; }
+
+        /** the recorded events as chrome trace json, call it once the traced
+          * threads are done.*/
+        static bool write( const std::string &filename );
+
+        /** name of the calling thread in the trace.*/
+        static void setThreadName( const std::string &name );
+
+        /** vertices and triangles of the geometries below node.*/
+        static void countGeometry( const osg::Node &node, unsigned long long &num_vertices,
+                                   unsigned long long &num_triangles );
+
+        /** one event from construction to destruction. name, category and
+          * the argument keys must be string literals, they are kept as
+          * pointers.*/
+        class Scope
+        {
+            public :
+                Scope( const char *name, const char *category = "build" ) :
+                    _active(Trace::enabled())
+                {
+                    if (_active) begin(name, category);
+                }
+
+                Scope( const char *name, const std::string &detail, const char *category = "build" ) :
+                    _active(Trace::enabled())
+                {
+                    if (_active)
+                    {
+                        begin(name, category);
+                        _detail = detail;
+                    }
+                }
+
+                ~Scope()
+                {
+                    if (_active) end();
+                }
+
+                bool active(void) const { return _active; }
+
+                /** count of the event, the first MAX_ARGS are kept.*/
+                void arg( const char *key, unsigned long long value )
+                {
+                    if (_active && _num_args < MAX_ARGS)
+                    {
+                        _keys[_num_args] = key;
+                        _values[_num_args++] = value;
+                    }
+                }
+
+                /** vertices and triangles of node as arguments.*/
+                void geometryArgs( const osg::Node &node );
+
+            private :
+                Scope( const Scope& ) {}
+                Scope& operator = (const Scope& ) { return *this; }
+
+                void begin( const char *name, const char *category );
+                void end(void);
+
+                bool _active;
+                const char *_name;
+                const char *_category;
+                std::string _detail;
+                osg::Timer_t _start;
+                const char *_keys[MAX_ARGS];
+                unsigned long long _values[MAX_ARGS];
+                unsigned int _num_args;
+        };
+
+    private :
+        static bool _enabled;
+};
+#endif
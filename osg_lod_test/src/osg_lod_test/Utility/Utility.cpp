@@ -0,0 +1,103 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
+#include <osg/PagedLOD>
+#include <osgDB/FileNameUtils>
+
+#include <OpenThreads/Atomic>
+
+#include "Utility.h"
+
+unsigned long Utility::processId( void )
+{
+#ifdef _WIN32
+    return static_cast<unsigned long>(GetCurrentProcessId());
+#else
+    return static_cast<unsigned long>(getpid());
+#endif
+}
+
+std::string Utility::tempFileName( const std::string &filename )
+{
+    static OpenThreads::Atomic s_counter;
+    std::ostringstream sstr;
+    sstr << filename << "." << processId() << "." << ++s_counter << ".tmp";
+    return sstr.str();
+}
+
+bool Utility::fileStatus( const std::string &filename, unsigned long long &size, long long &mtime )
+{
+#ifdef _WIN32
+    struct __stat64 st;
+    if (_stat64(filename.c_str(), &st) != 0)
+        return false;
+#else
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+        return false;
+#endif
+    size = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+}
+
+unsigned long long Utility::fileSize( const std::string &filename )
+{
+    unsigned long long size = 0;
+    long long mtime = 0;
+    return fileStatus(filename, size, mtime) ? size : 0;
+}
+
+std::string Utility::referencedFileName( const osg::PagedLOD &plod, unsigned int i, const std::string &parent_filename )
+{
+    const std::string &filename = plod.getFileName(i);
+    if (osgDB::isAbsolutePath(filename))
+        return filename;
+    if (!plod.getDatabasePath().empty())
+        return osgDB::concatPaths(plod.getDatabasePath(), filename);
+    return osgDB::concatPaths(osgDB::getFilePath(parent_filename), filename);
+}
+
+std::string Utility::jsonString( const std::string &value )
+{
+    std::ostringstream out;
+    out << '"';
+    for (std::string::const_iterator itr = value.begin(); itr != value.end(); ++itr)
+    {
+        unsigned char c = static_cast<unsigned char>(*itr);
+        if (c == '"' || c == '\\')
+            out << '\\' << *itr;
+        else if (c < 0x20)
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+        else
+            out << *itr;
+    }
+    out << '"';
+    return out.str();
+}
+
+std::string Utility::utcTime( void )
+{
+    time_t now = time(0);
+    struct tm utc;
+#ifdef _WIN32
+    gmtime_s(&utc, &now);
+#else
+    gmtime_r(&now, &utc);
+#endif
+    char buffer[32];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", &utc);
+    return buffer;
+}
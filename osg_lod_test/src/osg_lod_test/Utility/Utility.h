@@ -0,0 +1,36 @@
+#ifndef _UTILITY_H
+#define _UTILITY_H
+
+#include <string>
+
+namespace osg { class PagedLOD; }
+
+/** small helpers the modules share.*/
+class Utility {
+    public :
+        static unsigned long processId(void);
+
+        /** a name next to filename to write it aside under and rename, unique
+          * to this process and call, so builds and threads writing the same
+          * file never write into each other's temp file.*/
+        static std::string tempFileName( const std::string &filename );
+
+        /** size and modification time in seconds of a file, false if it
+          * can't be read.*/
+        static bool fileStatus( const std::string &filename, unsigned long long &size, long long &mtime );
+
+        /** bytes of a file, 0 if it can't be read.*/
+        static unsigned long long fileSize( const std::string &filename );
+
+        /** the file of child i of plod, read from parent_filename, as the
+          * database pager resolves it.*/
+        static std::string referencedFileName( const osg::PagedLOD &plod, unsigned int i,
+                                               const std::string &parent_filename );
+
+        /** value as a quoted json string.*/
+        static std::string jsonString( const std::string &value );
+
+        /** the current time as iso 8601 utc.*/
+        static std::string utcTime(void);
+};
+#endif
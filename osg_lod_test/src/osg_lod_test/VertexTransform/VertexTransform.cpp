@@ -0,0 +1,299 @@
+#include <cmath>
+#include <vector>
+
+#include "VertexTransform.h"
+#include "TileScheduler.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #define VERTEX_TRANSFORM_X86
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #endif
+#endif
+
+// gcc only emits avx instructions in functions that ask for them, msvc
+// takes the intrinsics anywhere.
+#if defined(__GNUC__) && !defined(__AVX__)
+    #define VERTEX_TRANSFORM_AVX_TARGET __attribute__((target("avx")))
+#else
+    #define VERTEX_TRANSFORM_AVX_TARGET
+#endif
+
+namespace
+{
+    const float min_normal_length = 1e-30f;
+
+    // chunks smaller than this are not worth a thread.
+    const size_t min_chunk_size = 1 << 16;
+
+    void scalar_kernel( const float *m, float *p, size_t count, bool normalize )
+    {
+        for (size_t i = 0; i < count; ++i, p += 3)
+        {
+            float x = p[0], y = p[1], z = p[2];
+            float rx = m[0] * x + m[1] * y + m[2]  * z + m[3];
+            float ry = m[4] * x + m[5] * y + m[6]  * z + m[7];
+            float rz = m[8] * x + m[9] * y + m[10] * z + m[11];
+            if (normalize)
+            {
+                float length = std::sqrt(rx * rx + ry * ry + rz * rz);
+                if (length < min_normal_length) length = min_normal_length;
+                rx /= length; ry /= length; rz /= length;
+            }
+            p[0] = rx; p[1] = ry; p[2] = rz;
+        }
+    }
+
+#ifdef VERTEX_TRANSFORM_X86
+    // one point per iteration, the matrix columns are multiplied by the
+    // broadcast coordinates.
+    void sse_kernel( const float *m, float *p, size_t count, bool normalize )
+    {
+        __m128 c0 = _mm_setr_ps(m[0], m[4], m[8],  0.f);
+        __m128 c1 = _mm_setr_ps(m[1], m[5], m[9],  0.f);
+        __m128 c2 = _mm_setr_ps(m[2], m[6], m[10], 0.f);
+        __m128 c3 = _mm_setr_ps(m[3], m[7], m[11], 0.f);
+        __m128 min_length = _mm_set1_ps(min_normal_length);
+
+        float result[4];
+        for (size_t i = 0; i < count; ++i, p += 3)
+        {
+            __m128 r = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])), _mm_mul_ps(c1, _mm_set1_ps(p[1]))),
+                _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p[2])), c3));
+
+            if (normalize)
+            {
+                __m128 sq = _mm_mul_ps(r, r);
+                __m128 sum = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(3, 0, 2, 1)));
+                sum = _mm_add_ps(sum, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(3, 1, 0, 2)));
+                r = _mm_div_ps(r, _mm_max_ps(_mm_sqrt_ps(sum), min_length));
+            }
+
+            _mm_storeu_ps(result, r);
+            p[0] = result[0]; p[1] = result[1]; p[2] = result[2];
+        }
+    }
+
+    // eight points per iteration: the xyz triples are shuffled into x, y
+    // and z registers, transformed and shuffled back.
+    VERTEX_TRANSFORM_AVX_TARGET
+    void avx_kernel( const float *m, float *p, size_t count, bool normalize )
+    {
+        __m256 m00 = _mm256_set1_ps(m[0]), m01 = _mm256_set1_ps(m[1]), m02 = _mm256_set1_ps(m[2]),  m03 = _mm256_set1_ps(m[3]);
+        __m256 m10 = _mm256_set1_ps(m[4]), m11 = _mm256_set1_ps(m[5]), m12 = _mm256_set1_ps(m[6]),  m13 = _mm256_set1_ps(m[7]);
+        __m256 m20 = _mm256_set1_ps(m[8]), m21 = _mm256_set1_ps(m[9]), m22 = _mm256_set1_ps(m[10]), m23 = _mm256_set1_ps(m[11]);
+        __m256 min_length = _mm256_set1_ps(min_normal_length);
+
+        size_t num_blocks = count / 8;
+        for (size_t b = 0; b < num_blocks; ++b, p += 24)
+        {
+            __m256 a03 = _mm256_castps128_ps256(_mm_loadu_ps(p));
+            __m256 a14 = _mm256_castps128_ps256(_mm_loadu_ps(p + 4));
+            __m256 a25 = _mm256_castps128_ps256(_mm_loadu_ps(p + 8));
+            a03 = _mm256_insertf128_ps(a03, _mm_loadu_ps(p + 12), 1);
+            a14 = _mm256_insertf128_ps(a14, _mm_loadu_ps(p + 16), 1);
+            a25 = _mm256_insertf128_ps(a25, _mm_loadu_ps(p + 20), 1);
+
+            __m256 xy = _mm256_shuffle_ps(a14, a25, _MM_SHUFFLE(2, 1, 3, 2));
+            __m256 yz = _mm256_shuffle_ps(a03, a14, _MM_SHUFFLE(1, 0, 2, 1));
+            __m256 x  = _mm256_shuffle_ps(a03, xy,  _MM_SHUFFLE(2, 0, 3, 0));
+            __m256 y  = _mm256_shuffle_ps(yz,  xy,  _MM_SHUFFLE(3, 1, 2, 0));
+            __m256 z  = _mm256_shuffle_ps(yz,  a25, _MM_SHUFFLE(3, 0, 3, 1));
+
+            __m256 rx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m00, x), _mm256_mul_ps(m01, y)),
+                                      _mm256_add_ps(_mm256_mul_ps(m02, z), m03));
+            __m256 ry = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m10, x), _mm256_mul_ps(m11, y)),
+                                      _mm256_add_ps(_mm256_mul_ps(m12, z), m13));
+            __m256 rz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m20, x), _mm256_mul_ps(m21, y)),
+                                      _mm256_add_ps(_mm256_mul_ps(m22, z), m23));
+
+            if (normalize)
+            {
+                __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rx, rx), _mm256_mul_ps(ry, ry)),
+                                                             _mm256_mul_ps(rz, rz)));
+                length = _mm256_max_ps(length, min_length);
+                rx = _mm256_div_ps(rx, length);
+                ry = _mm256_div_ps(ry, length);
+                rz = _mm256_div_ps(rz, length);
+            }
+
+            __m256 rxy = _mm256_shuffle_ps(rx,  ry,  _MM_SHUFFLE(2, 0, 2, 0));
+            __m256 ryz = _mm256_shuffle_ps(ry,  rz,  _MM_SHUFFLE(3, 1, 3, 1));
+            __m256 rzx = _mm256_shuffle_ps(rz,  rx,  _MM_SHUFFLE(3, 1, 2, 0));
+            __m256 r03 = _mm256_shuffle_ps(rxy, rzx, _MM_SHUFFLE(2, 0, 2, 0));
+            __m256 r14 = _mm256_shuffle_ps(ryz, rxy, _MM_SHUFFLE(3, 1, 2, 0));
+            __m256 r25 = _mm256_shuffle_ps(rzx, ryz, _MM_SHUFFLE(3, 1, 3, 1));
+
+            _mm_storeu_ps(p,      _mm256_castps256_ps128(r03));
+            _mm_storeu_ps(p + 4,  _mm256_castps256_ps128(r14));
+            _mm_storeu_ps(p + 8,  _mm256_castps256_ps128(r25));
+            _mm_storeu_ps(p + 12, _mm256_extractf128_ps(r03, 1));
+            _mm_storeu_ps(p + 16, _mm256_extractf128_ps(r14, 1));
+            _mm_storeu_ps(p + 20, _mm256_extractf128_ps(r25, 1));
+        }
+
+        _mm256_zeroupper();
+        sse_kernel(m, p, count - num_blocks * 8, normalize);
+    }
+#endif
+
+    void run_kernel( VertexTransform::Kernel kernel, const float *m, float *p, size_t count, bool normalize )
+    {
+#ifdef VERTEX_TRANSFORM_X86
+        if (kernel == VertexTransform::AVX)
+        {
+            avx_kernel(m, p, count, normalize);
+            return;
+        }
+        if (kernel == VertexTransform::SSE)
+        {
+            sse_kernel(m, p, count, normalize);
+            return;
+        }
+#endif
+        scalar_kernel(m, p, count, normalize);
+    }
+
+    class TransformChunkTask : public TileTask
+    {
+        public :
+            TransformChunkTask( VertexTransform::Kernel kernel, const float *m, float *p, size_t count, bool normalize ) :
+                _kernel(kernel), _m(m), _p(p), _count(count), _normalize(normalize)
+            {
+            }
+
+            virtual void run( TileScheduler & )
+            {
+                run_kernel(_kernel, _m, _p, _count, _normalize);
+            }
+
+        private :
+            VertexTransform::Kernel _kernel;
+            const float *_m;
+            float *_p;
+            size_t _count;
+            bool _normalize;
+    };
+}
+
+
+VertexTransform::VertexTransform( const Eigen::Matrix3d &rot, const Eigen::Vector3d &trans, double scale,
+                                  bool obj_axes ) :
+    _kernel(bestKernel()),
+    _num_threads(1)
+{
+    // obj tiles come in y up: v is taken to the frame of the
+    // transformation with (x, y, z) -> (x, z, -y) and back with the inverse.
+    Eigen::Matrix3d axes = Eigen::Matrix3d::Identity();
+    if (obj_axes)
+    {
+        axes << 1, 0, 0,
+                0, 0, 1,
+                0, -1, 0;
+    }
+
+    Matrix3x4 matrix;
+    matrix.block<3, 3>(0, 0) = axes.transpose() * (scale * rot) * axes;
+    matrix.col(3) = axes.transpose() * trans;
+    setMatrix(matrix);
+}
+
+VertexTransform::VertexTransform( const Matrix3x4 &matrix ) :
+    _kernel(bestKernel()),
+    _num_threads(1)
+{
+    setMatrix(matrix);
+}
+
+void VertexTransform::setMatrix( const Matrix3x4 &matrix )
+{
+    _matrix = matrix;
+
+    Eigen::Matrix3d linear = matrix.block<3, 3>(0, 0);
+    Eigen::Matrix3d normal = linear.inverse().transpose();
+
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            _vm[r * 4 + c] = static_cast<float>(linear(r, c));
+            _nm[r * 4 + c] = static_cast<float>(normal(r, c));
+        }
+        _vm[r * 4 + 3] = static_cast<float>(matrix(r, 3));
+        _nm[r * 4 + 3] = 0.f;
+    }
+}
+
+VertexTransform::Kernel VertexTransform::bestKernel( void )
+{
+#if defined(VERTEX_TRANSFORM_X86) && defined(_MSC_VER)
+    // avx needs the cpu flag and the os saving the ymm registers.
+    int info[4];
+    __cpuid(info, 1);
+    bool avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+    return avx ? AVX : SSE;
+#elif defined(VERTEX_TRANSFORM_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx") ? AVX : SSE;
+#else
+    return SCALAR;
+#endif
+}
+
+osg::Vec3d VertexTransform::transformPoint( const osg::Vec3d &point ) const
+{
+    Eigen::Vector3d p = _matrix.block<3, 3>(0, 0) * Eigen::Vector3d(point.x(), point.y(), point.z()) + _matrix.col(3);
+    return osg::Vec3d(p(0), p(1), p(2));
+}
+
+void VertexTransform::transformVertices( osg::Vec3Array &vertices ) const
+{
+    if (!vertices.empty())
+        transformVertices(&vertices[0]._v[0], vertices.size());
+    vertices.dirty();
+}
+
+void VertexTransform::transformNormals( osg::Vec3Array &normals ) const
+{
+    if (!normals.empty())
+        transformNormals(&normals[0]._v[0], normals.size());
+    normals.dirty();
+}
+
+void VertexTransform::transformVertices( float *xyz, size_t count ) const
+{
+    run(xyz, count, false);
+}
+
+void VertexTransform::transformNormals( float *xyz, size_t count ) const
+{
+    run(xyz, count, true);
+}
+
+void VertexTransform::run( float *xyz, size_t count, bool normals ) const
+{
+    const float *m = normals ? _nm : _vm;
+
+    unsigned int num_threads = _num_threads ? _num_threads : TileScheduler::defaultNumThreads();
+    if (num_threads <= 1 || count < 2 * min_chunk_size)
+    {
+        run_kernel(_kernel, m, xyz, count, normals);
+        return;
+    }
+
+    // a few chunks per thread so stealing evens out the load, kept a
+    // multiple of the avx block.
+    size_t chunk_size = count / (num_threads * 4);
+    if (chunk_size < min_chunk_size) chunk_size = min_chunk_size;
+    chunk_size = (chunk_size + 7) / 8 * 8;
+
+    TileScheduler scheduler(num_threads);
+    for (size_t first = 0; first < count; first += chunk_size)
+    {
+        size_t chunk_count = count - first < chunk_size ? count - first : chunk_size;
+        scheduler.add(new TransformChunkTask(_kernel, m, xyz + first * 3, chunk_count, normals));
+    }
+    scheduler.run();
+}
@@ -0,0 +1,65 @@
+#ifndef _VERTEX_TRANSFORM_H
+#define _VERTEX_TRANSFORM_H
+
+#include <cstddef>
+
+#include <osg/Array>
+#include <osg/Vec3d>
+
+#include <Eigen/Dense>
+
+/** applies the rotation, translation and scale of a .transformation file
+  * to whole vertex and normal arrays. the obj axis convention (flip y, swap
+  * y and z, transform, swap back) and scale * rot * v + trans are folded
+  * into one 3x4 matrix when the transform is built; normals get the
+  * inverse transpose of its upper 3x3 and are renormalized. arrays run on
+  * an AVX, SSE or scalar kernel depending on the cpu, and can be cut into
+  * chunks that run on several threads.*/
+class VertexTransform {
+    public :
+        typedef Eigen::Matrix<double, 3, 4, Eigen::DontAlign> Matrix3x4;
+
+        VertexTransform( const Eigen::Matrix3d &rot, const Eigen::Vector3d &trans, double scale,
+                         bool obj_axes = true );
+
+        /** a plain 3x4 transform (row major, translation in the last column).*/
+        VertexTransform( const Matrix3x4 &matrix );
+
+        /** 1, the default, keeps everything on the calling thread: the tiles
+          * are transformed on the scheduler workers already, a pool per
+          * array there would only oversubscribe them. 0 uses one thread per
+          * processor.*/
+        void setNumThreads( unsigned int num_threads ) { _num_threads = num_threads; }
+        unsigned int getNumThreads(void) const { return _num_threads; }
+
+        void transformVertices( osg::Vec3Array &vertices ) const;
+        void transformNormals( osg::Vec3Array &normals ) const;
+
+        /** xyz holds count tightly packed x,y,z float triples.*/
+        void transformVertices( float *xyz, size_t count ) const;
+        void transformNormals( float *xyz, size_t count ) const;
+
+        const Matrix3x4& getMatrix(void) const { return _matrix; }
+
+        osg::Vec3d transformPoint( const osg::Vec3d &point ) const;
+
+        enum Kernel { SCALAR, SSE, AVX };
+
+        /** the widest kernel the cpu supports.*/
+        static Kernel bestKernel(void);
+
+        /** force a kernel, for comparing them.*/
+        void setKernel( Kernel kernel ) { _kernel = kernel; }
+        Kernel getKernel(void) const { return _kernel; }
+
+    private :
+        void setMatrix( const Matrix3x4 &matrix );
+        void run( float *xyz, size_t count, bool normals ) const;
+
+        Matrix3x4 _matrix;
+        float _vm[12];
+        float _nm[12];
+        Kernel _kernel;
+        unsigned int _num_threads;
+};
+#endif
@@ -19,12 +19,46 @@
 
 #include <osgUtil/Optimizer>
 
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
+
 #include <Eigen/Dense>
 
 #include <iostream>
 #include <sstream>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <cmath>
 
 #include "OrientationConverter.h"
+#include "TileScheduler.h"
+#include "TileIO.h"
+#include "VertexTransform.h"
+#include "BuildManifest.h"
+#include "TileIndex.h"
+#include "SphereIndex.h"
+#include "MeshSimplifier.h"
+#include "TileCache.h"
+#include "GeometryOptimizer.h"
+#include "DrawableMerger.h"
+#include "AdaptiveTree.h"
+#include "AttributeQuantizer.h"
+#include "TextureProcessor.h"
+#include "StateDeduplicator.h"
+#include "TilePack.h"
+#include "Benchmark.h"
+#include "TerrainGenerator.h"
+#include "Trace.h"
+#include "PagingSimulator.h"
+#include "GeometricError.h"
+#include "DatabaseTransformer.h"
+#include "DatabaseInspector.h"
+#include "MemoryBudget.h"
+#include "ShardQueue.h"
+#include "Utility.h"
+#include "ObjReader.h"
 
 class TraverseVisitor : public osg::NodeVisitor
 {
@@ -95,89 +129,40 @@ class TestVistor : public osg::NodeVisitor
 public:
 	TestVistor(Eigen::Matrix3d rot, Eigen::Vector3d trans, double scale):
 		osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
-		_rot(rot), _trans(trans), _scale(scale)
+		_transform(rot, trans, scale)
 	{
 	}
 
 	virtual void apply(osg::Geode &geode)
 	{
-		unsigned int    vertNum = 0;
+		Trace::Scope trace("transform_vertices", "visitor");
 		unsigned int numGeoms = geode.getNumDrawables();
 
-
 		for( unsigned int geodeIdx = 0; geodeIdx < numGeoms; geodeIdx++ ) 
 		{
 			osg::Geometry *curGeom = geode.getDrawable( geodeIdx )->asGeometry();
 
 			if ( curGeom )
 			{
+				// whole arrays at once, the axis swaps are folded into the transform
 				osg::Vec3Array * ver_array = dynamic_cast< osg::Vec3Array *>(curGeom->getVertexArray());
 				if ( ver_array ) 
 				{
-					std::cout<<"ver_array"<<std::endl;
-					std::stringstream sstr;
-					sstr << geodeIdx;
-					//std::ofstream file(sstr.str() + ".txt");
-					for ( unsigned int i = 0; i < ver_array->size(); i++ ) {
-
-						osg::Vec3 * v = &ver_array->operator [](i);
-						//std::cout<<v->_v[0]<<" "<<v->_v[1]<<" "<<v->_v[2]<<std::endl;
-
-						
-						v->_v[1] *= -1;
-						std::swap(v->_v[1], v->_v[2]);
-						//std::cout<<v->_v[0]<<" "<<v->_v[1]<<" "<<v->_v[2]<<std::endl;
-
-// 						if (file.good())
-// 						{
-// 							file << v->_v[0]<<" "<<v->_v[1]<<" "<<v->_v[2]<<std::endl;
-// 						}
-
-						Eigen::Vector3d ver(v->_v[0],v->_v[1],v->_v[2]);
-						ver = _scale * _rot * ver + _trans;
-						v->_v[0] = ver(0);
-						v->_v[1] = ver(1);
-						v->_v[2] = ver(2);
-						
-						// back
-						std::swap(v->_v[1], v->_v[2]);
-						v->_v[1] *= -1;
-					}
-				}     
+					_transform.transformVertices(*ver_array);
+					trace.arg("vertices", ver_array->size());
+				}
 
 				osg::Vec3Array * n_array = dynamic_cast< osg::Vec3Array *>(curGeom->getNormalArray());
 				if ( n_array ) 
-				{
-					std::cout<<"n_array"<<std::endl;
-					std::stringstream sstr;
-					sstr << geodeIdx;
-					//std::ofstream file(sstr.str() + ".txt");
-					for ( unsigned int i = 0; i < n_array->size(); i++ ) {
-
-						osg::Vec3 * v = &n_array->operator [](i);
-
-						v->_v[1] *= -1;
-						std::swap(v->_v[1], v->_v[2]);						
-
-						Eigen::Vector3d ver(v->_v[0],v->_v[1],v->_v[2]);
-						ver =  _rot * ver ;
-						v->_v[0] = ver(0);
-						v->_v[1] = ver(1);
-						v->_v[2] = ver(2);
-
-						// back
-						std::swap(v->_v[1], v->_v[2]);
-						v->_v[1] *= -1;
-					}
-				}  
+					_transform.transformNormals(*n_array);
+
+				curGeom->dirtyBound();
 			}
 
 		}
 	}    
 
-	Eigen::Matrix3d _rot;
-	Eigen::Vector3d _trans;
-	double _scale;
+	VertexTransform _transform;
 };
 
 class NameVistor : public osg::NodeVisitor
@@ -368,6 +353,8 @@ public:
 			{
 				osg::notify(osg::NOTICE)<<"Writing out "<<filename<<std::endl;
 				std::cout <<"Writing out "<<filename<<std::endl;
+				Trace::Scope trace("write_subgraph", filename, "visitor");
+				trace.geometryArgs(*child);
 				osgDB::writeNodeFile(*child,filename);
 			}
 		}
@@ -406,6 +393,8 @@ public:
 
 	void convert()
 	{
+		Trace::Scope trace("convert_to_pagedlod", "visitor");
+		trace.arg("lods", _lodSet.size());
 		unsigned int lodNum = 0;
 		for(LODSet::iterator itr = _lodSet.begin();
 			itr != _lodSet.end();
@@ -612,267 +601,1835 @@ inline std::string create_filename(int level, int x, int y)
 	return sstr.str();
 }
 
-inline std::string get_child_filename(std::string dir, int x, int y)
+// the directories are listed once up front, an empty cell is a set lookup
+// instead of a fileExists/fileType pair.
+inline std::string get_child_filename(const TileIndex & index, int x, int y)
 {
-	std::stringstream sstr;
-	sstr << "mesh_"<<x<<"_"<<y<<"_adj_model.obj";
-	std::string filename = dir + "\\" + sstr.str();
-	if (!osgDB::fileExists(filename) ||
-		osgDB::fileType(filename) != osgDB::REGULAR_FILE) 
-		filename = "";
-	return filename;
+	return index.getMeshFilename(x, y);
+}
+
+inline std::string get_quad_filename(const TileIndex & index, int level, int x, int y)
+{
+	return index.getQuadFilename(level, x, y);
 }
 
-inline std::string get_quad_filename(std::string dir, int level, int x, int y)
+// a simplified tile written out between tasks or processes
+inline std::string create_mesh_filename(int level, int x, int y)
 {
 	std::stringstream sstr;
-	sstr << "quad_"<<level<<"_"<<x<<"_"<<y<<".ive";
-	std::string filename = dir + "\\" + sstr.str();
-	if (!osgDB::fileExists(filename) ||
-		osgDB::fileType(filename) != osgDB::REGULAR_FILE) 
-		filename = "";
-	return filename;
+	sstr << "mesh_"<<level<<"_"<<x<<"_"<<y<<".ive";
+	return sstr.str();
 }
 
-int process_config_file2(const std::string & config_filename,
-						 const std::string & out_dir,
-						 const std::string & output_ext)
+// part of a sharded build. a shard builds the quads of the subtree below
+// its root quad, the stitch the levels above the shard level and the top
+// level once every shard is built.
+struct BuildShard
 {
-	int ret = -1;
+	BuildShard(): stitch(false) {}
+	BuildShard(bool stitch, const ShardQueue::Shard & root): stitch(stitch), root(root) {}
 
-	do 
-	{
-		std::string lod_filename = out_dir + "\\out" + output_ext;
+	bool stitch;
+	ShardQueue::Shard root;
+};
 
-		std::string top_level_filename;
-		std::vector<std::string> level_directories;
-		std::vector<std::string> pagedlod_children;
-		std::string node_file_ext = "obj";
+enum ShardRole { SHARD_BUILD, SHARD_PREBUILT, SHARD_SKIP };
 
-		float radiu_param = 5.;
+// whether quad level/x/y is built, stands in for a quad a shard built, or
+// is left to another process
+inline ShardRole get_shard_role(const BuildShard * shard, int level, int x, int y)
+{
+	if (!shard) return SHARD_BUILD;
+	if (shard->stitch)
+		return level < shard->root.level ? SHARD_BUILD : (level == shard->root.level ? SHARD_PREBUILT : SHARD_SKIP);
+	if (level < shard->root.level) return SHARD_SKIP;
+	int shift = level - shard->root.level;
+	return (x >> shift) == shard->root.x && (y >> shift) == shard->root.y ? SHARD_BUILD : SHARD_SKIP;
+}
 
+// vertices of a tile measured against the coarser tile above it
+const unsigned int error_samples_per_tile = 16384;
 
-		// ȡconfigļ
-		std::ifstream config_file(config_filename);
-		if (!config_file.good()) break;
+// z order key of a grid cell. the key of the parent cell is key >> 2 and the
+// low two bits are the slot of the cell in its parent, (y & 1) * 2 + (x & 1),
+// so the cells of a level sorted by key are in z order
+inline unsigned long long cell_key(int x, int y)
+{
+	unsigned long long key = 0;
+	for (int i_b = 0; i_b < 30; ++i_b)
+	{
+		key |= static_cast<unsigned long long>((x >> i_b) & 1) << (2 * i_b);
+		key |= static_cast<unsigned long long>((y >> i_b) & 1) << (2 * i_b + 1);
+	}
+	return key;
+}
 
-		std::string line;
-		std::getline(config_file, line);
-		if (!osgDB::fileExists(line) || osgDB::fileType(line) != osgDB::REGULAR_FILE) break;
-		top_level_filename = line;
+inline void cell_coords(unsigned long long key, int & x, int & y)
+{
+	x = 0;
+	y = 0;
+	for (int i_b = 0; i_b < 30; ++i_b)
+	{
+		x |= static_cast<int>((key >> (2 * i_b)) & 1) << i_b;
+		y |= static_cast<int>((key >> (2 * i_b + 1)) & 1) << i_b;
+	}
+}
 
-		while (config_file.good())
-		{
-			line.clear();
-			std::getline(config_file, line);
-			if (osgDB::fileExists(line) && osgDB::fileType(line) == osgDB::DIRECTORY) 
-				level_directories.push_back(line);
-		}
+// working memory of a tile against the memory budget, a multiple of its
+// file size while it is read and of its loaded size while it is simplified
+const unsigned int read_memory_factor = 2;
+const unsigned int simplify_memory_factor = 3;
 
+struct QuadBuildContext
+{
+	std::vector<std::string> level_directories;
+	std::string level_ive_dir;
+	std::string top_level_filename;
+	int num_levels;
+	float radiu_param;
+	// pixel size ranges for this screen space error, 0 for radius * radiu_param distances
+	float pixel_error;
+	TileIO * io;
+	std::vector< osg::ref_ptr<TileIndex> > level_indices;
+	osg::ref_ptr<TileIndex> quad_index;
+	MeshSimplifier * simplifier;
+	DrawableMerger * merger;
+	GeometryOptimizer * optimizer;
+	AttributeQuantizer * quantizer;
+	TextureProcessor * textures;
+	StateDeduplicator * dedup;
+	// the shape of the tree when it follows the data instead of the quad grid
+	AdaptiveTree * tree;
+	BuildManifest * manifest;
+	BuildManifest::Hash params_key;
+	MemoryBudget * budget;
+	// simplified tiles that don't fit the budget wait here for their consumers
+	std::string spill_dir;
+	// a shard writes the simplified tiles of its root here for the stitch
+	int shard_level;
+	std::string shard_mesh_dir;
+	OpenThreads::Atomic num_built;
+	OpenThreads::Atomic num_skipped;
+	OpenThreads::Atomic num_failed;
+	OpenThreads::Atomic num_spilled;
+};
 
-		// ÿײ㴦
-		int num_levels = level_directories.size();
-		std::string level_ive_dir = out_dir + "\\ive";
-		if (!osgDB::makeDirectory(level_ive_dir))
-		{
-			osg::notify(osg::NOTICE)<<"failed to create ive directory."<<std::endl;
-			goto error0;
-		}
-		while (level_directories.size() > 0)
-		{
-			int level_index = level_directories.size();
-			int num_x_quad = pow(2, level_index - 1);
-			int num_y_quad = num_x_quad;
-			std::string level_dir = level_directories.back();
+// working memory of reading the tiles of filenames
+inline unsigned long long read_memory(const QuadBuildContext & context, const std::vector<std::string> & filenames)
+{
+	unsigned long long bytes = 0;
+	for (size_t i_f = 0; i_f < filenames.size() && context.budget->limited(); ++i_f)
+		if (!filenames[i_f].empty())
+			bytes += Utility::fileSize(filenames[i_f]) * read_memory_factor;
+	return bytes;
+}
 
+// content hash of a tile file and, for an obj, of the mtl libraries and
+// textures it references. a missing reference gives a key no build had
+// before, so the tile is rebuilt until it is found
+inline BuildManifest::Hash input_key(const QuadBuildContext & context, const std::string & filename)
+{
+	BuildManifest::Hash key = context.manifest->inputHash(filename);
+	if (filename.empty() || osgDB::getLowerCaseFileExtension(filename) != "obj")
+		return key;
 
-			for (int i_yq = 0; i_yq < num_y_quad; ++i_yq)
-			{
-				for (int i_xq = 0; i_xq < num_x_quad; ++i_xq)
-				{
-					int x_start = i_xq * 2;
-					int y_start = i_yq * 2;
+	std::vector<std::string> references;
+	if (!ObjReader::references(filename, references))
+	{
+		std::cout<<filename<<" references a missing file."<<std::endl;
+		key = BuildManifest::hashCombine(key, BuildManifest::hashString(Utility::utcTime()));
+		key = BuildManifest::hashCombine(key, Utility::processId());
+	}
+	for (size_t i_r = 0; i_r < references.size(); ++i_r)
+	{
+		key = BuildManifest::hashCombine(key, BuildManifest::hashString(references[i_r]));
+		key = BuildManifest::hashCombine(key, context.manifest->inputHash(references[i_r]));
+	}
+	return key;
+}
 
-					osg::ref_ptr<osg::Group> quad_group = new osg::Group;
-					for (int iy = y_start; iy < y_start + 2; ++iy)
-					{
-						for (int ix = x_start; ix < x_start + 2; ++ix)
-						{
-							osg::ref_ptr<osg::PagedLOD> plod = new osg::PagedLOD;
+// the statistics of the passes over the tiles of one file
+struct TilePassStats
+{
+	DrawableMerger::Stats merge;
+	GeometryOptimizer::Stats optimize;
+	AttributeQuantizer::Stats quantize;
+	TextureProcessor::Stats texture;
+	StateDeduplicator::Stats dedup;
+};
 
+// the passes over a tile before it is written, null if sharing its state
+// failed. the node may be shared with the simplifier, each pass works on a
+// copy. the textures of a tile shrink with its distance from the leaves
+osg::ref_ptr<osg::Node> process_tile(const QuadBuildContext & context, osg::ref_ptr<osg::Node> node,
+									 int texture_level, TilePassStats & stats, bool process_textures = true)
+{
+	if (context.textures && process_textures)
+	{
+		Trace::Scope pass("process_textures");
+		node = context.textures->process(*node, texture_level, &stats.texture);
+	}
+	// after the atlas, the materials it joined share a stateset. the
+	// optimizer then orders the merged triangles
+	if (context.merger)
+	{
+		Trace::Scope pass("merge_drawables");
+		node = context.merger->merge(*node, &stats.merge);
+	}
+	if (context.optimizer)
+	{
+		Trace::Scope pass("optimize");
+		node = context.optimizer->optimize(*node, &stats.optimize);
+	}
+	if (context.quantizer)
+	{
+		Trace::Scope pass("quantize");
+		node = context.quantizer->quantize(*node, &stats.quantize);
+	}
+	// last, the images written to the shared files are the final ones
+	if (context.dedup)
+	{
+		Trace::Scope pass("share_state");
+		node = context.dedup->share(*node, &stats.dedup);
+	}
+	return node;
+}
 
-							std::string node_filename = get_child_filename(level_dir, ix, iy);
-							if (node_filename.empty()) continue;
+// sum up the statistics of a written file
+void add_tile_stats(const QuadBuildContext & context, const std::string & name, const TilePassStats & stats)
+{
+	if (context.merger)
+		context.merger->addStats(stats.merge);
+	if (context.optimizer)
+		context.optimizer->addReport(name, stats.optimize);
+	if (context.quantizer)
+		context.quantizer->addStats(stats.quantize);
+	if (context.textures)
+		context.textures->addStats(stats.texture);
+	if (context.dedup)
+		context.dedup->addStats(stats.dedup);
+}
 
-							osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(node_filename);
-							//tt
-							{
-								if (!node)
-									std::cout<<node_filename<<" is null!" << std::endl;
-								if (plod->containsNode(node))
-									std::cout<<node_filename<<" is already contained."<<std::endl;
-							}
-							if (!plod->addChild(node))
-							{
-								std::cout<<"insert "<<node_filename<<" failed."<<std::endl;
-								continue;
-							}
+// the ranges of the PagedLOD of a tile. child_file, relative to the file of
+// the PagedLOD, takes over at a multiple of the radius, or once the error of
+// the tile would cover more than pixel_error pixels. a tile without a
+// child_file is a leaf and always shown.
+void set_tile_ranges(const QuadBuildContext & context, osg::PagedLOD & plod, const std::string & child_file, double error)
+{
+	float radius = plod.getBound().radius();
+	float cutoff = 0.;
+	if (!child_file.empty())
+	{
+		plod.setFileName(1, child_file);
+		if (context.pixel_error > 0.f)
+		{
+			cutoff = GeometricError::pixelSizeRange(error, radius, context.pixel_error);
+			plod.setRange(1, cutoff, FLT_MAX);
+		} else {
+			cutoff = radius * context.radiu_param;
+			plod.setRange(1, 0, cutoff);
+		}
+	} else {
+		cutoff = context.pixel_error > 0.f ? FLT_MAX : 0.;
+	}
 
-							float cutoff = plod->getBound().radius() * radiu_param;
-							if (level_index != num_levels)
-							{
-								std::string quad_file = get_quad_filename(level_ive_dir, level_index + 1, ix, iy);
-								if (quad_file.empty()) continue;								
-								std::string rel_path = osgDB::getPathRelative(level_ive_dir, quad_file);	
-								plod->setFileName(1, rel_path);
-								plod->setRange(1, 0, cutoff);
-							} else {
-								cutoff = 0.;
-							}
+	plod.setCenterMode(osg::PagedLOD::USER_DEFINED_CENTER);
+	plod.setCenter(plod.getBound().center());	
+	if (context.pixel_error > 0.f)
+	{
+		// the pixel size is taken of the bound, it stays the coarse tile's
+		// when the finer file is merged
+		plod.setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
+		plod.setRadius(radius);
+		plod.setRange(0, 0, cutoff);
+	} else
+		plod.setRange(0, cutoff, FLT_MAX);
+}
 
-							plod->setRange(0, cutoff, FLT_MAX);
-							plod->setCenterMode(osg::PagedLOD::USER_DEFINED_CENTER);
-							plod->setCenter(plod->getBound().center());	
+// nodes holds the four tiles of the quad row by row, null for an empty cell.
+// errors holds their geometric error against the level below, for pixel size ranges.
+int build_quad_tile(const QuadBuildContext & context, int level_index, int i_xq, int i_yq,
+					const std::vector< osg::ref_ptr<osg::Node> > & nodes,
+					const std::vector<double> & errors)
+{
+	int x_start = i_xq * 2;
+	int y_start = i_yq * 2;
+	const std::string & level_ive_dir = context.level_ive_dir;
+	std::string quad_filename = osgDB::concatPaths(level_ive_dir, create_filename(level_index, i_xq, i_yq));
+	Trace::Scope trace("build_quad", quad_filename);
+	trace.arg("level", level_index);
+
+	osg::ref_ptr<osg::Group> quad_group = new osg::Group;
+	TilePassStats stats;
+
+	// the four tiles of a quad are written and paged in together, their
+	// textures go into one atlas for the quad rather than one per tile
+	std::vector< osg::ref_ptr<osg::Node> > tiles(nodes);
+	if (context.textures)
+	{
+		Trace::Scope pass("process_textures");
+		if (!context.textures->process(tiles, context.num_levels - level_index, &stats.texture))
+		{
+			std::cout<<"process textures of "<<quad_filename<<" failed."<<std::endl;
+			return -1;
+		}
+	}
 
-							quad_group->addChild(plod);
-						}
-					}
+	for (int iy = y_start; iy < y_start + 2; ++iy)
+	{
+		for (int ix = x_start; ix < x_start + 2; ++ix)
+		{
+			osg::ref_ptr<osg::PagedLOD> plod = new osg::PagedLOD;
 
-					if (!osgDB::writeNodeFile(*quad_group, 
-						level_ive_dir + "\\" + create_filename(level_index, i_xq, i_yq)))
-						std::cout<<lod_filename<<" write failed.."<<std::endl;
-				}
+			osg::ref_ptr<osg::Node> node = tiles[(iy - y_start) * 2 + (ix - x_start)];
+			if (!node) continue;
+
+			node = process_tile(context, node, context.num_levels - level_index, stats, false);
+			if (!node)
+			{
+				std::cout<<"share state of tile "<<ix<<"_"<<iy<<" of level "<<level_index<<" failed."<<std::endl;
+				return -1;
 			}
 
+			if (!plod->addChild(node))
+			{
+				std::cout<<"insert tile "<<ix<<"_"<<iy<<" of level "<<level_index<<" failed."<<std::endl;
+				continue;
+			}
 
-			level_directories.pop_back();
-		}
+			// only the cells with data below them have a quad, a tile without
+			// one is a leaf
+			std::string quad_file;
+			if (level_index != context.num_levels)
+				quad_file = get_quad_filename(*context.quad_index, level_index + 1, ix, iy);
+			if (!quad_file.empty())
+				quad_file = osgDB::getPathRelative(level_ive_dir, quad_file);
+			set_tile_ranges(context, *plod, quad_file, errors[(iy - y_start) * 2 + (ix - x_start)]);
 
+			quad_group->addChild(plod);
+		}
+	}
 
-		// top level pagedlode
-		osg::ref_ptr<osg::PagedLOD> lod = new osg::PagedLOD;
+	trace.geometryArgs(*quad_group);
+	osg::ref_ptr<TileIORequest> write_request = context.io->write(*quad_group, quad_filename);
+	{
+		Trace::Scope wait("write_wait", "io");
+		write_request->wait();
+	}
+	if (!write_request->success())
+	{
+		std::cout<<quad_filename<<" write failed.."<<std::endl;
+		return -1;
+	}
+	context.quad_index->addQuad(level_index, i_xq, i_yq);
+	add_tile_stats(context, create_filename(level_index, i_xq, i_yq), stats);
 
-		osg::ref_ptr<osg::Node> test_node = osgDB::readNodeFile(top_level_filename);
-		if (!test_node.valid()) break;
+	return 0;
+}
 
-		lod->addChild(/*osgDB::readNodeFile(top_level_filename)*/test_node);
-		float top_level_radius = lod->getBound().radius() * radiu_param;
-		std::string quad_file = get_quad_filename(level_ive_dir, 1,0,0);
-		if (!quad_file.empty())
-		{
-			std::string rel_path = osgDB::getPathRelative(out_dir, quad_file);	
-			lod->setFileName(1, rel_path);
-			lod->setRange(1, 0, top_level_radius);
-			lod->setRange(0, top_level_radius, FLT_MAX);
-		} else
-			lod->setRange(0, 0, FLT_MAX);
+// one mesh_<x>_<y> tile of a level when the coarse levels are generated. a
+// leaf tile is read from the leaf directory, a coarser one is simplified from
+// the four tiles of the level below.
+class MeshTileTask : public TileTask
+{
+public:
+	MeshTileTask(QuadBuildContext & context, int level_index, int x, int y):
+		_context(context), _level_index(level_index), _x(x), _y(y), _num_consumers(0), _error(0.),
+		_bytes(0), _held_bytes(0), _key(0), _needed(true)
+	{
+	}
 
-		lod->setCenterMode(osg::PagedLOD::USER_DEFINED_CENTER);
-		lod->setCenter(lod->getBound().center());	
-		if (!osgDB::writeNodeFile(*lod,lod_filename))
+	// the key covers the file a leaf is read from and the files it
+	// references, a simplified tile the keys of the tiles below it, which are
+	// computed first.
+	BuildManifest::Hash computeKey()
+	{
+		if (_children.empty())
 		{
-			std::cout<<lod_filename<<" write failed.."<<std::endl;
-			break;
+			std::string filename = getSourceFileName();
+			_key = BuildManifest::hashCombine(_context.params_key, BuildManifest::hashString(filename));
+			_key = BuildManifest::hashCombine(_key, input_key(_context, filename));
+			return _key;
 		}
+		_key = BuildManifest::hashCombine(_context.params_key, _level_index);
+		for (size_t i_c = 0; i_c < _children.size(); ++i_c)
+			_key = BuildManifest::hashCombine(_key, _children[i_c]->_key);
+		return _key;
+	}
 
+	BuildManifest::Hash getKey() const
+	{
+		return _key;
+	}
 
-		ret = 0;
-	} while (0);
-error0:
-
-	return ret;
-}
+	// no consumer of the tile is out of date, it is neither read nor simplified
+	void setNeeded(bool needed)
+	{
+		_needed = needed;
+	}
 
-int process_config_file(const std::string & config_filename,
-						const std::string & out_dir,
-						const std::string & output_ext)
-{
-	int ret = -1;
+	bool isNeeded() const
+	{
+		return _needed;
+	}
 
-	do 
+	// loaded size of the tile, known under a memory budget only
+	unsigned long long getBytes() const
 	{
-		std::string lod_filename = out_dir + "\\out" + ".ive"/*output_ext*/;
+		return _bytes;
+	}
 
-		std::string top_level_filename;
-		std::vector<std::string> level_directories;
-		std::vector<std::string> pagedlod_children;
-		std::string node_file_ext = "obj";
+	// distance of the simplified tile from the four it was simplified from
+	double getError() const
+	{
+		return _error;
+	}
 
+	void addChildMesh(MeshTileTask * child)
+	{
+		addDependency(child);
+		_children.push_back(child);
+		child->addConsumer();
+	}
 
-		// ȡconfigļ
-		std::ifstream config_file(config_filename);
-		if (!config_file.good()) break;
+	void addConsumer()
+	{
+		++_num_consumers;
+	}
 
-		std::string line;
-		std::getline(config_file, line);
-		if (!osgDB::fileExists(line) || osgDB::fileType(line) != osgDB::REGULAR_FILE) break;
-		top_level_filename = line;
+	// read the tile from filename instead of the level directory
+	void setFileName(const std::string & filename)
+	{
+		_filename = filename;
+	}
 
-		while (config_file.good())
+	// hands the tile to one of the tasks depending on it, the last one releases it.
+	osg::ref_ptr<osg::Node> takeNode()
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+		osg::ref_ptr<osg::Node> node = _node;
+		if (!node.valid() && !_spill_filename.empty())
 		{
-			line.clear();
-			std::getline(config_file, line);
-			if (osgDB::fileExists(line) && osgDB::fileType(line) == osgDB::DIRECTORY) 
-				level_directories.push_back(line);
+			// a spilled tile is read back for each consumer
+			Trace::Scope trace("unspill", _spill_filename, "memory");
+			osg::ref_ptr<TileIORequest> request = _context.io->read(_spill_filename);
+			request->wait();
+			node = request->getNode();
 		}
+		releaseConsumer();
+		return node;
+	}
 
+	// a consumer that doesn't need the tile lets go of it without loading it
+	void releaseNode()
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+		releaseConsumer();
+	}
 
-		// ÿײ㴦
-		std::vector<osg::BoundingSphere> bounding_sphere_children;
-		std::string level_ive_dir = out_dir + "\\ive";
-		if (!osgDB::makeDirectory(level_ive_dir))
+	virtual void run(TileScheduler &)
+	{
+		if (!_needed)
 		{
-			osg::notify(osg::NOTICE)<<"failed to create ive directory."<<std::endl;
-			goto error0;
+			for (size_t i_c = 0; i_c < _children.size(); ++i_c)
+				_children[i_c]->releaseNode();
+			return;
 		}
-		while (level_directories.size() > 0)
-		{
-			int level_index = level_directories.size();
-			std::stringstream sstr;
-			std::string tmp_index;
-			sstr << level_index;
-			sstr >> tmp_index;
-			// 			std::string output_level_dir = level_ive_dir + "\\" + tmp_index;
-			// 			if (!osgDB::makeDirectory(output_level_dir))
-			// 			{
-			// 				osg::notify(osg::NOTICE)<<"failed to create ive directory."<<std::endl;
-			// 				goto error0;
-			// 			}
 
+		if (_children.empty())
+		{
+			std::string filename = getSourceFileName();
+			if (filename.empty()) return;
+
+			MemoryBudget::Reservation reservation(_context.budget, read_memory(_context, std::vector<std::string>(1, filename)));
+			Trace::Scope trace("mesh_read", filename);
+			osg::ref_ptr<TileIORequest> request = _context.io->read(filename);
+			request->wait();
+			if (!request->getNode())
+				std::cout<<filename<<" is null!" << std::endl;
+			_node = request->getNode();
+			writeShardRoot();
+			hold();
+			return;
+		}
 
-			if (bounding_sphere_children.size() != pagedlod_children.size())
-				goto error0;
+		unsigned long long bytes = 0;
+		for (size_t i_c = 0; i_c < _children.size(); ++i_c)
+			bytes += _children[i_c]->getBytes() * simplify_memory_factor;
+		MemoryBudget::Reservation reservation(_context.budget, bytes);
 
+		std::vector< osg::ref_ptr<osg::Node> > nodes;
+		for (size_t i_c = 0; i_c < _children.size(); ++i_c)
+		{
+			osg::ref_ptr<osg::Node> node = _children[i_c]->takeNode();
+			if (node.valid())
+				nodes.push_back(node);
+		}
+		if (!nodes.empty())
+		{
+			Trace::Scope trace("simplify", create_filename(_level_index, _x, _y));
+			_node = _context.simplifier->simplify(nodes);
+			trace.geometryArgs(*_node);
+		}
+		if (_node.valid() && _context.pixel_error > 0.f)
+		{
+			Trace::Scope trace("geometric_error", create_filename(_level_index, _x, _y));
+			std::vector<osg::Vec3> samples;
+			for (size_t i_n = 0; i_n < nodes.size(); ++i_n)
+				GeometricError::sampleVertices(*nodes[i_n], samples, error_samples_per_tile);
+			_error = GeometricError::distance(samples, *_node);
+		}
+		writeShardRoot();
+		hold();
+	}
 
-			std::string level_dir = level_directories.back();
+	std::string getSourceFileName() const
+	{
+		return !_filename.empty() ? _filename :
+			get_child_filename(*_context.level_indices[_level_index - 1], _x, _y);
+	}
 
-			osgDB::DirectoryContents dir_contents = osgDB::getDirectoryContents(level_dir);
-			size_t num_content = dir_contents.size();
-			std::vector<std::string> current_pagedlod_filename;
-			std::vector<osg::BoundingSphere> current_bounding_spheres;
-			for (int i_c = 0; i_c < num_content; ++i_c)
-			{
-				std::string content_name = level_dir + "\\"+dir_contents[i_c];
-				if (osgDB::fileType(content_name) != osgDB::REGULAR_FILE ||
-					osgDB::getFileExtension(content_name).compare(node_file_ext))
-					continue;
+	// called with _mutex held
+	void releaseConsumer()
+	{
+		if (_num_consumers == 0 || --_num_consumers != 0) return;
+		_node = 0;
+		_context.budget->releaseHeld(_held_bytes);
+		_held_bytes = 0;
+		if (!_spill_filename.empty())
+			remove(_spill_filename.c_str());
+		_spill_filename.clear();
+	}
 
+	// the stitch simplifies the levels above a shard from its root tiles
+	void writeShardRoot()
+	{
+		if (!_node.valid() || _level_index != _context.shard_level || _context.shard_mesh_dir.empty()) return;
+		std::string filename = osgDB::concatPaths(_context.shard_mesh_dir, create_mesh_filename(_level_index, _x, _y));
+		osg::ref_ptr<TileIORequest> request = _context.io->write(*_node, filename);
+		request->wait();
+		if (!request->success())
+			std::cout<<filename<<" write failed.."<<std::endl;
+	}
 
-				std::string output_pagedlod_name = level_ive_dir + 
-					"\\" + tmp_index + "_" +
-					osgDB::getNameLessExtension(osgDB::getSimpleFileName(content_name)) + output_ext;
+	// under a memory budget the tile stays loaded for its consumers while it
+	// fits, it is written to the spill directory otherwise
+	void hold()
+	{
+		if (!_node.valid() || !_context.budget->limited()) return;
+		_bytes = PagingSimulator::residentBytes(*_node);
+		if (_context.budget->tryHold(_bytes))
+		{
+			_held_bytes = _bytes;
+			return;
+		}
 
+		std::string filename = osgDB::concatPaths(_context.spill_dir, create_mesh_filename(_level_index, _x, _y));
+		Trace::Scope trace("spill", filename, "memory");
+		osg::ref_ptr<TileIORequest> request = _context.io->write(*_node, filename, false);
+		request->wait();
+		if (!request->success())
+		{
+			std::cout<<filename<<" write failed, kept in memory.."<<std::endl;
+			return;
+		}
+		_spill_filename = filename;
+		_node = 0;
+		++_context.num_spilled;
+	}
 
-				// convert to pagedlod node
-				osg::ref_ptr<osg::PagedLOD> lod = new osg::PagedLOD;
-				lod->addChild(osgDB::readNodeFile(content_name), 0, FLT_MAX);
-				float radius = lod->getBound().radius() * 1.5;
+	QuadBuildContext & _context;
+	int _level_index;
+	int _x;
+	int _y;
+	std::vector<MeshTileTask*> _children;
+	osg::ref_ptr<osg::Node> _node;
+	unsigned int _num_consumers;
+	OpenThreads::Mutex _mutex;
+	double _error;
+	unsigned long long _bytes;
+	unsigned long long _held_bytes;
+	std::string _spill_filename;
+	std::string _filename;
+	BuildManifest::Hash _key;
+	bool _needed;
+};
 
+// one quad_<level>_<x>_<y> tile of the dependency graph.
+class QuadTileTask : public TileTask
+{
+public:
+	QuadTileTask(QuadBuildContext & context, int level_index, int i_xq, int i_yq):
+		_context(context), _level_index(level_index), _i_xq(i_xq), _i_yq(i_yq),
+		_children(4, static_cast<QuadTileTask*>(0)), _meshes(4, static_cast<MeshTileTask*>(0)), _key(0),
+		_parent_error(0.), _parent_error_valid(false), _prebuilt(false), _failed(false), _stale(true)
+	{
+	}
+
+	// the quad was built by a shard, only its key is needed
+	void setPrebuilt()
+	{
+		_prebuilt = true;
+	}
+
+	// the quad of level + 1 refining the tile of slot, (y & 1) * 2 + (x & 1).
+	// a tile without data below it has none
+	void addChildQuad(QuadTileTask * child, int slot)
+	{
+		addDependency(child);
+		_children[slot] = child;
+	}
+
+	// generated levels take their tiles from the mesh tasks
+	void addMesh(MeshTileTask * mesh, int slot)
+	{
+		addDependency(mesh);
+		_meshes[slot] = mesh;
+		mesh->addConsumer();
+	}
+
+	// the key of the quad before anything is built, to leave out the mesh
+	// tiles no stale quad consumes. the child quads are planned first.
+	bool plan()
+	{
+		computeKey();
+		std::string quad_filename = osgDB::concatPaths(_context.level_ive_dir, create_filename(_level_index, _i_xq, _i_yq));
+		_stale = !_prebuilt && !_context.manifest->isUpToDate(quad_filename, _key);
+		return _stale;
+	}
+
+	bool isStale() const
+	{
+		return _stale;
+	}
+
+	// the key covers the leaf files of this quad, the keys of its mesh tiles
+	// and the keys of the child quads, which are final since they ran first.
+	BuildManifest::Hash computeKey()
+	{
+		if (_prebuilt)
+		{
+			std::string quad_filename = osgDB::concatPaths(_context.level_ive_dir, create_filename(_level_index, _i_xq, _i_yq));
+			_key = BuildManifest::hashCombine(_context.params_key, _context.manifest->inputHash(quad_filename));
+			return _key;
+		}
+
+		const TileIndex & level_files = *_context.level_indices[_level_index - 1];
+		_key = BuildManifest::hashCombine(_context.params_key, _level_index);
+		for (int iy = _i_yq * 2; iy < _i_yq * 2 + 2; ++iy)
+		{
+			for (int ix = _i_xq * 2; ix < _i_xq * 2 + 2; ++ix)
+			{
+				std::string node_filename = get_child_filename(level_files, ix, iy);
+				_key = BuildManifest::hashCombine(_key, BuildManifest::hashString(node_filename));
+				_key = BuildManifest::hashCombine(_key, input_key(_context, node_filename));
+			}
+		}
+		// a quad built over a failed child is not the one a good child gives,
+		// the marker makes it rebuild once the child is written.
+		for (size_t i_c = 0; i_c < _children.size(); ++i_c)
+		{
+			if (!_children[i_c]) continue;
+			_key = BuildManifest::hashCombine(_key, _children[i_c]->_key);
+			if (_children[i_c]->_failed)
+				_key = BuildManifest::hashCombine(_key, BuildManifest::hashString("failed"));
+		}
+		for (size_t i_m = 0; i_m < _meshes.size(); ++i_m)
+			if (_meshes[i_m])
+				_key = BuildManifest::hashCombine(_key, _meshes[i_m]->getKey());
+		return _key;
+	}
+
+	virtual void run(TileScheduler &)
+	{
+		computeKey();
+		if (_prebuilt)
+		{
+			++_context.num_skipped;
+			return;
+		}
+
+		std::string quad_filename = osgDB::concatPaths(_context.level_ive_dir, create_filename(_level_index, _i_xq, _i_yq));
+		std::vector< osg::ref_ptr<osg::Node> > nodes(4);
+		if (_context.manifest->isUpToDate(quad_filename, _key))
+		{
+			// generated tiles can't be read again for the top level's error
+			bool top_level_error = _context.pixel_error > 0.f && _level_index == 1 && _context.simplifier;
+			for (size_t i_m = 0; i_m < _meshes.size() && top_level_error; ++i_m)
+				top_level_error = !_meshes[i_m] || _meshes[i_m]->isNeeded();
+			for (size_t i_m = 0; i_m < _meshes.size(); ++i_m)
+			{
+				if (!_meshes[i_m]) continue;
+				if (top_level_error)
+					nodes[i_m] = _meshes[i_m]->takeNode();
+				else
+					_meshes[i_m]->releaseNode();
+			}
+			if (top_level_error)
+				computeParentError(nodes);
+			++_context.num_skipped;
+			return;
+		}
+
+		// only a failed child makes a quad stale after it was planned, its
+		// mesh tiles were left out then
+		if (_context.simplifier && !_stale)
+		{
+			std::cout<<quad_filename<<" has a failed child quad.."<<std::endl;
+			for (size_t i_m = 0; i_m < _meshes.size(); ++i_m)
+				if (_meshes[i_m])
+					_meshes[i_m]->releaseNode();
+			_failed = true;
+			++_context.num_failed;
+			return;
+		}
+
+		const TileIndex & level_files = *_context.level_indices[_level_index - 1];
+		unsigned long long bytes = 0;
+		if (!_context.simplifier)
+		{
+			std::vector<std::string> node_filenames;
+			for (int iy = _i_yq * 2; iy < _i_yq * 2 + 2; ++iy)
+				for (int ix = _i_xq * 2; ix < _i_xq * 2 + 2; ++ix)
+					node_filenames.push_back(get_child_filename(level_files, ix, iy));
+			bytes = read_memory(_context, node_filenames);
+		}
+		for (size_t i_m = 0; i_m < _meshes.size(); ++i_m)
+			if (_meshes[i_m])
+				bytes += _meshes[i_m]->getBytes() * read_memory_factor;
+		MemoryBudget::Reservation reservation(_context.budget, bytes);
+
+		if (_context.simplifier)
+		{
+			for (size_t i_m = 0; i_m < _meshes.size(); ++i_m)
+				if (_meshes[i_m])
+					nodes[i_m] = _meshes[i_m]->takeNode();
+		}
+		else
+			readNodes(nodes);
+
+		// the error of each tile against the quad below it. the simplified
+		// tiles measured theirs, the child quads measure the tile they refine
+		// while they hold their own tiles.
+		std::vector<double> errors(4, 0.);
+		if (_context.pixel_error > 0.f)
+		{
+			for (size_t i_n = 0; i_n < nodes.size() && _level_index != _context.num_levels; ++i_n)
+			{
+				if (!nodes[i_n].valid()) continue;
+				if (_context.simplifier)
+					errors[i_n] = _meshes[i_n]->getError();
+				else if (_children[i_n])
+					errors[i_n] = _children[i_n]->getParentError(*nodes[i_n]);
+			}
+			if (!_context.simplifier || _level_index == 1)
+				computeParentError(nodes);
+		}
+
+		if (build_quad_tile(_context, _level_index, _i_xq, _i_yq, nodes, errors) != 0)
+		{
+			_failed = true;
+			++_context.num_failed;
+			return;
+		}
+		_context.manifest->setOutput(quad_filename, _key);
+		++_context.num_built;
+	}
+
+	// the four tiles of the quad from the level directory
+	void readNodes(std::vector< osg::ref_ptr<osg::Node> > & nodes)
+	{
+		// submit the reads of the four tiles as one batch
+		const TileIndex & level_files = *_context.level_indices[_level_index - 1];
+		std::vector<std::string> node_filenames;
+		for (int iy = _i_yq * 2; iy < _i_yq * 2 + 2; ++iy)
+			for (int ix = _i_xq * 2; ix < _i_xq * 2 + 2; ++ix)
+				node_filenames.push_back(get_child_filename(level_files, ix, iy));
+		std::vector< osg::ref_ptr<TileIORequest> > read_requests;
+		Trace::Scope trace("quad_read", create_filename(_level_index, _i_xq, _i_yq), "io");
+		_context.io->readBatch(node_filenames, read_requests);
+		nodes.assign(node_filenames.size(), 0);
+		for (size_t i_n = 0; i_n < node_filenames.size(); ++i_n)
+		{
+			if (node_filenames[i_n].empty()) continue;
+			read_requests[i_n]->wait();
+			nodes[i_n] = read_requests[i_n]->getNode();
+			if (!nodes[i_n])
+				std::cout<<node_filenames[i_n]<<" is null!" << std::endl;
+		}
+	}
+
+	// error of the tile of the level above that this quad refines, the top
+	// level for the quad of level 1
+	void computeParentError(const std::vector< osg::ref_ptr<osg::Node> > & nodes)
+	{
+		std::string parent_filename = _level_index == 1 ? _context.top_level_filename :
+			get_child_filename(*_context.level_indices[_level_index - 2], _i_xq, _i_yq);
+		osg::ref_ptr<osg::Node> parent;
+		if (!parent_filename.empty())
+		{
+			osg::ref_ptr<TileIORequest> request = _context.io->read(parent_filename);
+			request->wait();
+			parent = request->getNode();
+		}
+		_parent_error = parent.valid() ? measureError(nodes, *parent) : 0.;
+		_parent_error_valid = true;
+	}
+
+	// a quad that was up to date measured nothing, its tiles are read again
+	// when the parent is rebuilt
+	double getParentError(const osg::Node & parent)
+	{
+		if (!_parent_error_valid)
+		{
+			std::vector< osg::ref_ptr<osg::Node> > nodes;
+			readNodes(nodes);
+			_parent_error = measureError(nodes, parent);
+			_parent_error_valid = true;
+		}
+		return _parent_error;
+	}
+
+	double measureError(const std::vector< osg::ref_ptr<osg::Node> > & nodes, const osg::Node & parent)
+	{
+		Trace::Scope trace("geometric_error", create_filename(_level_index, _i_xq, _i_yq));
+		std::vector<osg::Vec3> samples;
+		for (size_t i_n = 0; i_n < nodes.size(); ++i_n)
+			if (nodes[i_n].valid())
+				GeometricError::sampleVertices(*nodes[i_n], samples, error_samples_per_tile);
+		return GeometricError::distance(samples, parent);
+	}
+
+	QuadBuildContext & _context;
+	int _level_index;
+	int _i_xq;
+	int _i_yq;
+	std::vector<QuadTileTask*> _children;
+	std::vector<MeshTileTask*> _meshes;
+	BuildManifest::Hash _key;
+	double _parent_error;
+	bool _parent_error_valid;
+	bool _prebuilt;
+	bool _failed;
+	// out of date when planned
+	bool _stale;
+};
+
+// the key of the top level, its own file and the quad of level 1 below it
+BuildManifest::Hash get_top_level_key(const QuadBuildContext & context, const QuadTileTask * quad)
+{
+	BuildManifest::Hash key = BuildManifest::hashCombine(context.params_key, input_key(context, context.top_level_filename));
+	if (quad)
+		key = BuildManifest::hashCombine(key, quad->_key);
+	return key;
+}
+
+// the passes over the top level tile. it is built once the tiles are done,
+// so its textures get every thread
+osg::ref_ptr<osg::Node> process_top_level(const QuadBuildContext & context, osg::ref_ptr<osg::Node> node,
+										  unsigned int num_threads, int texture_level)
+{
+	if (context.textures)
+	{
+		context.textures->setNumThreads(num_threads);
+		node = context.textures->process(*node, texture_level);
+	}
+	if (context.merger)
+		node = context.merger->merge(*node);
+	if (context.optimizer)
+		node = context.optimizer->optimize(*node);
+	if (context.quantizer)
+		node = context.quantizer->quantize(*node);
+	return node;
+}
+
+// writes the top level, into the pack as its master file when there is one
+bool write_top_level(const QuadBuildContext & context, TilePack * pack, osg::Node & lod, const std::string & lod_filename)
+{
+	if (pack)
+	{
+		// reading out.tpk opens the master file
+		osg::ref_ptr<TileIORequest> write_request = context.io->write(lod, lod_filename);
+		write_request->wait();
+		context.io->flush();
+		pack->setMasterFileName(lod_filename);
+		if (!write_request->success() || !pack->close())
+		{
+			// no index over a pack without its top level
+			pack->abort();
+			std::cout<<pack->getFileName()<<" write failed.."<<std::endl;
+			return false;
+		}
+		std::cout<<"packed "<<pack->getNumEntries()<<" files, "<<pack->getNumBytes()
+			<<" bytes into "<<pack->getFileName()<<std::endl;
+	}
+	else if (!osgDB::writeNodeFile(lod, lod_filename))
+	{
+		std::cout<<lod_filename<<" write failed.."<<std::endl;
+		return false;
+	}
+	return true;
+}
+
+// the totals of the passes over the written tiles
+void report_passes(const QuadBuildContext & context, const std::string & optimize_report_filename)
+{
+	if (context.num_built == 0) return;
+	if (context.merger)
+	{
+		DrawableMerger::Stats total = context.merger->getTotal();
+		std::cout<<"draw calls: "<<total.draw_calls_before<<" -> "<<total.draw_calls_after<<", "
+			<<total.drawables_before<<" -> "<<total.drawables_after<<" drawables in "<<total.num_tiles<<" tiles."<<std::endl;
+	}
+	if (context.optimizer)
+	{
+		GeometryOptimizer::Stats total = context.optimizer->getTotal();
+		std::cout<<"vertex cache: acmr "<<total.acmrBefore()<<" -> "<<total.acmrAfter()<<", "
+			<<total.vertices_before<<" -> "<<total.vertices_after<<" vertices."<<std::endl;
+		std::ofstream report(optimize_report_filename.c_str());
+		context.optimizer->writeReport(report);
+	}
+	if (context.quantizer)
+	{
+		AttributeQuantizer::Stats total = context.quantizer->getTotal();
+		std::cout<<"quantized "<<total.num_tiles - total.num_kept<<" of "<<total.num_tiles<<" tiles, "
+			<<total.bytes_before<<" -> "<<total.bytes_after<<" attribute bytes, position error up to "
+			<<total.max_position_error<<"."<<std::endl;
+	}
+	if (context.textures)
+	{
+		TextureProcessor::Stats total = context.textures->getTotal();
+		std::cout<<"processed "<<total.num_images<<" textures into "<<total.num_atlases<<" atlases, "
+			<<total.bytes_before<<" -> "<<total.bytes_after<<" image bytes."<<std::endl;
+	}
+	if (context.dedup)
+	{
+		StateDeduplicator::Stats total = context.dedup->getTotal();
+		std::cout<<"shared "<<total.num_images<<" images written, "<<total.num_shared_images<<" references to them ("
+			<<total.bytes_shared<<" image bytes not duplicated), "<<total.num_statesets<<" statesets, "
+			<<total.num_shared_statesets<<" merged."<<std::endl;
+	}
+}
+
+// a subtree of the adaptive tree as its parent sees it. a leaf is its full
+// tile, an inner node its simplified tile and the tree_<path> file of its
+// children.
+struct TreeTile
+{
+	TreeTile(): triangles(0), error(0.), height(0) {}
+
+	osg::ref_ptr<osg::Node> node;
+	// triangles of the full resolution data below
+	unsigned long long triangles;
+	// distance of the simplified tile from the tiles of its children
+	double error;
+	// inner nodes below, 0 for a leaf
+	int height;
+	std::string filename;
+};
+
+// the tree_<path> file of an inner node, a PagedLOD per child
+int write_tree_node(const QuadBuildContext & context, const std::string & filename, const std::vector<TreeTile> & children)
+{
+	Trace::Scope trace("build_tree_node", filename);
+	osg::ref_ptr<osg::Group> group = new osg::Group;
+	TilePassStats stats;
+	for (size_t i_c = 0; i_c < children.size(); ++i_c)
+	{
+		osg::ref_ptr<osg::Node> node = process_tile(context, children[i_c].node, children[i_c].height, stats);
+		if (!node)
+		{
+			std::cout<<"share state of child "<<i_c<<" of "<<filename<<" failed."<<std::endl;
+			return -1;
+		}
+
+		osg::ref_ptr<osg::PagedLOD> plod = new osg::PagedLOD;
+		plod->addChild(node);
+		std::string child_file = children[i_c].filename;
+		if (!child_file.empty())
+			child_file = osgDB::getPathRelative(context.level_ive_dir, child_file);
+		set_tile_ranges(context, *plod, child_file, children[i_c].error);
+		group->addChild(plod);
+	}
+
+	trace.geometryArgs(*group);
+	osg::ref_ptr<TileIORequest> write_request = context.io->write(*group, filename);
+	{
+		Trace::Scope wait("write_wait", "io");
+		write_request->wait();
+	}
+	if (!write_request->success())
+	{
+		std::cout<<filename<<" write failed.."<<std::endl;
+		return -1;
+	}
+	add_tile_stats(context, osgDB::getSimpleFileName(filename), stats);
+	return 0;
+}
+
+// the node at path from the subtrees of its children. a single child stands
+// for the node, leaves holding few triangles together are joined into one
+// leaf, otherwise the tiles of the children are simplified into the tile of
+// the node and the children are written to its file. 0 with the tile, 1 if
+// the children hold nothing, -1 if the node could not be built.
+int build_tree_node(QuadBuildContext & context, const std::string & path, const std::vector<TreeTile> & subtrees,
+					AdaptiveTree::Stats & stats, TreeTile & tile)
+{
+	std::vector<TreeTile> children;
+	for (size_t i_c = 0; i_c < subtrees.size(); ++i_c)
+		if (subtrees[i_c].node.valid())
+			children.push_back(subtrees[i_c]);
+	if (children.empty()) return 1;
+	if (children.size() == 1)
+	{
+		tile = children[0];
+		return 0;
+	}
+
+	unsigned long long triangles = 0;
+	int height = 0;
+	bool leaves = true;
+	for (size_t i_c = 0; i_c < children.size(); ++i_c)
+	{
+		triangles += children[i_c].triangles;
+		height = std::max(height, children[i_c].height + 1);
+		leaves = leaves && children[i_c].filename.empty();
+	}
+	if (leaves && context.tree->collapses(triangles))
+	{
+		osg::ref_ptr<osg::Group> group = new osg::Group;
+		for (size_t i_c = 0; i_c < children.size(); ++i_c)
+			group->addChild(children[i_c].node.get());
+		tile = TreeTile();
+		tile.node = group;
+		tile.triangles = triangles;
+		++stats.num_collapsed;
+		return 0;
+	}
+
+	// a node keeps at most the simplify ratio of its children, and not much
+	// more than a tile holds
+	std::string filename = osgDB::concatPaths(context.level_ive_dir, AdaptiveTree::nodeName(path));
+	std::vector< osg::ref_ptr<osg::Node> > nodes;
+	unsigned long long child_triangles = 0;
+	for (size_t i_c = 0; i_c < children.size(); ++i_c)
+	{
+		nodes.push_back(children[i_c].node);
+		child_triangles += AdaptiveTree::countTriangles(*children[i_c].node);
+	}
+	float ratio = context.simplifier->getRatio();
+	if (child_triangles > 0)
+		ratio = std::min(ratio, static_cast<float>(double(context.tree->getMaxTriangles()) / child_triangles));
+	MeshSimplifier simplifier(ratio);
+	{
+		Trace::Scope trace("simplify", filename);
+		tile.node = simplifier.simplify(nodes);
+		if (!tile.node.valid())
+		{
+			std::cout<<filename<<" simplify failed."<<std::endl;
+			return -1;
+		}
+		trace.geometryArgs(*tile.node);
+	}
+	tile.error = 0.;
+	if (context.pixel_error > 0.f)
+	{
+		Trace::Scope trace("geometric_error", filename);
+		std::vector<osg::Vec3> samples;
+		for (size_t i_n = 0; i_n < nodes.size(); ++i_n)
+			GeometricError::sampleVertices(*nodes[i_n], samples, error_samples_per_tile);
+		tile.error = GeometricError::distance(samples, *tile.node);
+	}
+	if (write_tree_node(context, filename, children) != 0) return -1;
+
+	tile.triangles = triangles;
+	tile.height = height;
+	tile.filename = filename;
+	++stats.num_nodes;
+	++context.num_built;
+	return 0;
+}
+
+// the subtree of a tile of the leaf grid, split while it holds too many
+// triangles. depth counts the splits above it. returns as build_tree_node
+int build_tree_leaf(QuadBuildContext & context, const std::string & path, const osg::ref_ptr<osg::Node> & node,
+					unsigned int depth, AdaptiveTree::Stats & stats, TreeTile & tile)
+{
+	unsigned long long triangles = AdaptiveTree::countTriangles(*node);
+	std::vector< osg::ref_ptr<osg::Node> > parts;
+	if (context.tree->splits(triangles, depth))
+	{
+		Trace::Scope trace("split", AdaptiveTree::nodeName(path));
+		context.tree->split(*node, parts);
+	}
+
+	// a part that took everything would be split the same way again
+	size_t num_parts = 0;
+	for (size_t i_p = 0; i_p < parts.size(); ++i_p)
+		if (parts[i_p].valid())
+			++num_parts;
+	if (num_parts < 2)
+	{
+		tile = TreeTile();
+		tile.node = node;
+		tile.triangles = triangles;
+		++stats.num_leaves;
+		return 0;
+	}
+
+	++stats.num_split;
+	std::vector<TreeTile> children(parts.size());
+	for (size_t i_p = 0; i_p < parts.size(); ++i_p)
+		if (parts[i_p].valid() && build_tree_leaf(context, path + char('0' + i_p), parts[i_p], depth + 1, stats, children[i_p]) < 0)
+			return -1;
+	return build_tree_node(context, path, children, stats, tile);
+}
+
+// one cell of the grid of the adaptive tree. the cell of a leaf file reads
+// its tile and splits it while it is too dense, a coarser cell builds its
+// node from the cells below it.
+class TreeNodeTask : public TileTask
+{
+public:
+	TreeNodeTask(QuadBuildContext & context, int level_index, int x, int y):
+		_context(context), _level_index(level_index), _x(x), _y(y), _failed(false)
+	{
+	}
+
+	bool isFailed() const { return _failed; }
+
+	void addChild(TreeNodeTask * child)
+	{
+		addDependency(child);
+		_children.push_back(child);
+	}
+
+	// hands the subtree to the parent, which is its only consumer
+	TreeTile takeTile()
+	{
+		TreeTile tile = _tile;
+		_tile = TreeTile();
+		return tile;
+	}
+
+	// a digit per level for the slot of the cell in its parent
+	std::string getPath() const
+	{
+		std::string path;
+		for (int i_l = _level_index - 1; i_l >= 0; --i_l)
+			path += char('0' + ((_y >> i_l) & 1) * 2 + ((_x >> i_l) & 1));
+		return path;
+	}
+
+	virtual void run(TileScheduler &)
+	{
+		AdaptiveTree::Stats stats;
+		int ret = 0;
+		if (_children.empty())
+		{
+			std::string filename = get_child_filename(*_context.level_indices.back(), _x, _y);
+			MemoryBudget::Reservation reservation(_context.budget, read_memory(_context, std::vector<std::string>(1, filename)));
+			osg::ref_ptr<osg::Node> node;
+			{
+				Trace::Scope trace("mesh_read", filename);
+				osg::ref_ptr<TileIORequest> request = _context.io->read(filename);
+				request->wait();
+				node = request->getNode();
+			}
+			if (!node)
+			{
+				std::cout<<filename<<" is null!" << std::endl;
+				ret = -1;
+			}
+			else
+				ret = build_tree_leaf(_context, getPath(), node, 0, stats, _tile);
+		}
+		else
+		{
+			// the node of a failed subtree would leave it out
+			std::vector<TreeTile> children;
+			for (size_t i_c = 0; i_c < _children.size() && ret == 0; ++i_c)
+			{
+				if (_children[i_c]->isFailed())
+					ret = -1;
+				children.push_back(_children[i_c]->takeTile());
+			}
+			if (ret == 0)
+				ret = build_tree_node(_context, getPath(), children, stats, _tile);
+		}
+		_context.tree->addStats(stats);
+		if (ret < 0)
+		{
+			_tile = TreeTile();
+			_failed = true;
+			++_context.num_failed;
+		}
+	}
+
+	QuadBuildContext & _context;
+	int _level_index;
+	int _x;
+	int _y;
+	std::vector<TreeNodeTask*> _children;
+	TreeTile _tile;
+	bool _failed;
+};
+
+// the adaptive tree of the leaf files. one task per grid cell that holds
+// data, from the cells of the leaf files up to the root cell, so the work
+// follows the data rather than the bounding grid. the grid is as deep as
+// the largest cell index needs.
+int build_adaptive_tree(QuadBuildContext & context, unsigned int num_threads, const std::string & lod_filename, TilePack * pack)
+{
+	Trace::Scope trace("build_adaptive_tree", lod_filename);
+	std::vector< std::pair<int, int> > leaves;
+	context.level_indices.back()->getMeshes(leaves);
+	if (leaves.empty())
+	{
+		std::cout<<"no tiles in "<<context.level_indices.back()->getDirectory()<<std::endl;
+		return -1;
+	}
+	int grid_levels = 0;
+	for (size_t i_l = 0; i_l < leaves.size(); ++i_l)
+		while ((leaves[i_l].first >> grid_levels) > 0 || (leaves[i_l].second >> grid_levels) > 0)
+			++grid_levels;
+
+	typedef std::map< unsigned long long, osg::ref_ptr<TreeNodeTask> > TreeTasks;
+	std::vector<TreeTasks> tasks(grid_levels + 1);
+	for (size_t i_l = 0; i_l < leaves.size(); ++i_l)
+		tasks[grid_levels][cell_key(leaves[i_l].first, leaves[i_l].second)] =
+			new TreeNodeTask(context, grid_levels, leaves[i_l].first, leaves[i_l].second);
+	for (int level_index = grid_levels - 1; level_index >= 0; --level_index)
+	{
+		for (TreeTasks::const_iterator itr = tasks[level_index + 1].begin(); itr != tasks[level_index + 1].end(); ++itr)
+		{
+			osg::ref_ptr<TreeNodeTask> & parent = tasks[level_index][itr->first >> 2];
+			if (!parent.valid())
+			{
+				int x = 0, y = 0;
+				cell_coords(itr->first >> 2, x, y);
+				parent = new TreeNodeTask(context, level_index, x, y);
+			}
+			parent->addChild(itr->second.get());
+		}
+	}
+
+	// in z order, the cells of a block finish close together
+	TileScheduler scheduler(num_threads);
+	for (int level_index = grid_levels; level_index >= 0; --level_index)
+		for (TreeTasks::const_iterator itr = tasks[level_index].begin(); itr != tasks[level_index].end(); ++itr)
+			scheduler.add(itr->second.get());
+
+	std::cout<<"building the tree of "<<leaves.size()<<" tiles with "<<scheduler.getNumThreads()<<" threads."<<std::endl;
+	{
+		Trace::Scope trace_tree("build_tree");
+		scheduler.run();
+		trace_tree.arg("built", context.num_built);
+	}
+	TreeTile root = tasks[0].begin()->second->takeTile();
+	AdaptiveTree::Stats total = context.tree->getTotal();
+	std::cout<<total.num_nodes<<" tree nodes built over "<<total.num_leaves<<" leaf tiles, "<<total.num_split
+		<<" tiles split, "<<total.num_collapsed<<" cells collapsed, "<<root.height<<" levels, "
+		<<context.num_failed<<" failed."<<std::endl;
+	if (context.num_failed > 0 || !root.node.valid()) return -1;
+
+	// the root tile on top, refined by the root node
+	Trace::Scope trace_top("build_top_level", lod_filename);
+	osg::ref_ptr<osg::PagedLOD> lod = new osg::PagedLOD;
+	lod->addChild(process_top_level(context, root.node, num_threads, root.height));
+	std::string root_file = root.filename;
+	if (!root_file.empty())
+		root_file = osgDB::getPathRelative(osgDB::getFilePath(lod_filename), root_file);
+	set_tile_ranges(context, *lod, root_file, root.error);
+	trace_top.geometryArgs(*lod);
+	return write_top_level(context, pack, *lod, lod_filename) ? 0 : -1;
+}
+
+int process_config_file2(const std::string & config_filename,
+						 const std::string & out_dir,
+						 const std::string & output_ext,
+						 unsigned int num_threads = 0,
+						 unsigned int io_queue_depth = 32,
+						 bool full_rebuild = false,
+						 unsigned int generate_levels = 0,
+						 float simplify_ratio = 0.25f,
+						 bool optimize_geometry = true,
+						 bool merge_drawables = true,
+						 AttributeQuantizer * quantizer = 0,
+						 TextureProcessor * textures = 0,
+						 bool share_state = false,
+						 bool pack = false,
+						 AdaptiveTree * tree = 0,
+						 float pixel_error = 2.f,
+						 MemoryBudget * budget = 0,
+						 const BuildShard * shard = 0)
+{
+	Trace::Scope trace("process_config_file2", config_filename);
+	int ret = -1;
+	// outlives the tile io, a failed build aborts it once every write is through
+	osg::ref_ptr<TilePack> tile_pack;
+
+	do 
+	{
+		std::string lod_filename = osgDB::concatPaths(out_dir, "out" + output_ext);
+
+		std::string top_level_filename;
+		std::vector<std::string> level_directories;
+		std::vector<std::string> pagedlod_children;
+		std::string node_file_ext = "obj";
+
+		float radiu_param = 5.;
+
+
+		// ȡconfigļ
+		std::ifstream config_file(config_filename);
+		if (!config_file.good()) break;
+
+		std::string line;
+		std::getline(config_file, line);
+		if (!osgDB::fileExists(line) || osgDB::fileType(line) != osgDB::REGULAR_FILE) break;
+		top_level_filename = line;
+
+		while (config_file.good())
+		{
+			line.clear();
+			std::getline(config_file, line);
+			if (osgDB::fileExists(line) && osgDB::fileType(line) == osgDB::DIRECTORY) 
+				level_directories.push_back(line);
+		}
+
+		// only the leaf level is read from disk, the coarser levels are simplified from it
+		if (generate_levels > 0 || tree)
+		{
+			if (level_directories.empty()) break;
+			std::string leaf_dir = level_directories.back();
+			level_directories.assign(std::max(generate_levels, 1u), std::string());
+			level_directories.back() = leaf_dir;
+		}
+		// the shape of the tree follows all of the data
+		if (tree && shard)
+		{
+			std::cout<<"a sharded build can't build an adaptive tree."<<std::endl;
+			break;
+		}
+
+
+		// ÿײ㴦
+		int num_levels = level_directories.size();
+		std::string level_ive_dir = osgDB::concatPaths(out_dir, "ive");
+		if (!osgDB::makeDirectory(level_ive_dir))
+		{
+			osg::notify(osg::NOTICE)<<"failed to create ive directory."<<std::endl;
+			goto error0;
+		}
+
+		QuadBuildContext context;
+		context.level_directories = level_directories;
+		context.level_ive_dir = level_ive_dir;
+		context.num_levels = num_levels;
+		context.radiu_param = radiu_param;
+		context.pixel_error = pixel_error;
+		context.top_level_filename = top_level_filename;
+
+		MemoryBudget unlimited;
+		context.budget = budget ? budget : &unlimited;
+		if (context.budget->limited())
+		{
+			context.spill_dir = osgDB::concatPaths(out_dir, "spill");
+			if (!osgDB::makeDirectory(context.spill_dir))
+			{
+				osg::notify(osg::NOTICE)<<"failed to create spill directory."<<std::endl;
+				goto error0;
+			}
+		}
+
+		context.shard_level = shard ? shard->root.level : 0;
+		if (shard)
+			context.shard_mesh_dir = osgDB::concatPaths(out_dir, "shards");
+
+		// one listing per directory instead of a stat per grid cell
+		size_t num_tiles = 0;
+		for (int i_l = 0; i_l < num_levels; ++i_l)
+		{
+			osg::ref_ptr<TileIndex> index = new TileIndex(level_directories[i_l]);
+			if (!level_directories[i_l].empty() && !index->scan())
+				std::cout<<"failed to list "<<level_directories[i_l]<<std::endl;
+			num_tiles += index->getNumMeshes();
+			context.level_indices.push_back(index);
+		}
+		// every tile goes into out.tpk instead of a file of its own, the pack
+		// is built from scratch
+		if (pack)
+		{
+			if (shard)
+			{
+				std::cout<<"a sharded build can't write a pack."<<std::endl;
+				break;
+			}
+			tile_pack = new TilePack(osgDB::concatPaths(out_dir, "out.tpk"));
+			if (!tile_pack->create())
+			{
+				std::cout<<"failed to create "<<tile_pack->getFileName()<<std::endl;
+				break;
+			}
+			full_rebuild = true;
+		}
+
+		context.quad_index = new TileIndex(level_ive_dir);
+		if (!tile_pack.valid())
+			context.quad_index->scan();
+		std::cout<<num_tiles<<" tiles in "<<num_levels<<" levels."<<std::endl;
+
+		TileIO io(io_queue_depth);
+		io.setPack(tile_pack.get());
+		context.io = &io;
+
+		MeshSimplifier simplifier(simplify_ratio);
+		context.simplifier = generate_levels > 0 || tree ? &simplifier : 0;
+		context.tree = tree;
+
+		DrawableMerger merger;
+		context.merger = merge_drawables ? &merger : 0;
+		GeometryOptimizer optimizer;
+		context.optimizer = optimize_geometry ? &optimizer : 0;
+		context.quantizer = quantizer;
+		context.textures = textures;
+
+		StateDeduplicator dedup(level_ive_dir);
+		dedup.setPack(tile_pack.get());
+		context.dedup = share_state ? &dedup : 0;
+
+		// tiles whose inputs and build parameters match the previous build are skipped
+		// every shard keeps its own manifest, the processes don't share one file
+		std::string manifest_filename = shard && !shard->stitch ?
+			"build_manifest_" + ShardQueue::shardName(shard->root) + ".txt" : "build_manifest.txt";
+		BuildManifest manifest(osgDB::concatPaths(out_dir, manifest_filename));
+		if (!full_rebuild)
+			manifest.load();
+		context.manifest = &manifest;
+		{
+			std::stringstream params;
+			params << "process_config_file2 " << radiu_param << " " << output_ext << " " << num_levels;
+			if (pixel_error > 0.f)
+				params << " pixel_error " << pixel_error;
+			if (context.simplifier)
+				params << " generated " << simplify_ratio;
+			if (context.merger)
+				params << " merged " << merger.getMaxVertices();
+			if (context.optimizer)
+				params << " optimized";
+			if (context.quantizer)
+				params << " quantized " << quantizer->getPositionError() << " " << quantizer->getNormalBits()
+					<< " " << quantizer->getTexCoordBits();
+			if (context.textures)
+				params << " textures " << textures->getMaxSize() << " " << textures->getMinSize()
+					<< " " << textures->getCompress() << " " << textures->getAtlas();
+			if (context.dedup)
+				params << " shared " << dedup.getImageDirectory();
+			if (tile_pack.valid())
+				params << " packed";
+			for (int i_l = 0; i_l < num_levels; ++i_l)
+				params << " " << level_directories[i_l];
+			context.params_key = BuildManifest::hashString(params.str());
+		}
+
+		if (context.tree)
+		{
+			ret = build_adaptive_tree(context, num_threads, lod_filename, tile_pack.get());
+			report_passes(context, osgDB::concatPaths(out_dir, "optimize_report.txt"));
+			break;
+		}
+
+		TileScheduler scheduler(num_threads);
+
+		// only the cells that hold data get a task. the tiles of a level are
+		// the cells of its directory, the ones of a generated level the parents
+		// of the tiles of the level below
+		std::vector< std::set<unsigned long long> > level_cells(num_levels + 2);
+		for (int level_index = num_levels; level_index >= 1; --level_index)
+		{
+			std::set<unsigned long long> & cells = level_cells[level_index];
+			if (context.simplifier && level_index != num_levels)
+			{
+				const std::set<unsigned long long> & child_cells = level_cells[level_index + 1];
+				for (std::set<unsigned long long>::const_iterator itr = child_cells.begin(); itr != child_cells.end(); ++itr)
+					cells.insert(*itr >> 2);
+				continue;
+			}
+			std::vector< std::pair<int, int> > meshes;
+			context.level_indices[level_index - 1]->getMeshes(meshes);
+			int num_x_tile = pow(2, level_index);
+			for (size_t i_m = 0; i_m < meshes.size(); ++i_m)
+				if (meshes[i_m].first < num_x_tile && meshes[i_m].second < num_x_tile)
+					cells.insert(cell_key(meshes[i_m].first, meshes[i_m].second));
+		}
+
+		// for generated levels one task per mesh tile, a tile waits for the tiles below it
+		typedef std::map< unsigned long long, osg::ref_ptr<MeshTileTask> > MeshTasks;
+		std::vector<MeshTasks> mesh_tasks(num_levels + 2);
+		if (context.simplifier)
+		{
+			for (int level_index = num_levels; level_index >= 1; --level_index)
+			{
+				const std::set<unsigned long long> & cells = level_cells[level_index];
+				const MeshTasks & child_tasks = mesh_tasks[level_index + 1];
+				for (std::set<unsigned long long>::const_iterator itr = cells.begin(); itr != cells.end(); ++itr)
+				{
+					int ix = 0, iy = 0;
+					cell_coords(*itr, ix, iy);
+					ShardRole role = get_shard_role(shard, level_index, ix / 2, iy / 2);
+					if (role == SHARD_SKIP) continue;
+					osg::ref_ptr<MeshTileTask> task = new MeshTileTask(context, level_index, ix, iy);
+					if (role == SHARD_PREBUILT)
+					{
+						std::string filename = osgDB::concatPaths(context.shard_mesh_dir, create_mesh_filename(level_index, ix, iy));
+						if (osgDB::fileExists(filename))
+							task->setFileName(filename);
+					}
+					else if (level_index != num_levels)
+					{
+						for (int slot = 0; slot < 4; ++slot)
+						{
+							MeshTasks::const_iterator child = child_tasks.find(*itr << 2 | slot);
+							if (child != child_tasks.end())
+								task->addChildMesh(child->second.get());
+						}
+					}
+					mesh_tasks[level_index][*itr] = task;
+				}
+			}
+		}
+
+		// one task per quad with a tile in it, a quad waits for the quads of
+		// level + 1 refining its tiles
+		typedef std::map< unsigned long long, osg::ref_ptr<QuadTileTask> > QuadTasks;
+		std::vector<QuadTasks> level_tasks(num_levels + 2);
+		for (int level_index = num_levels; level_index >= 1; --level_index)
+		{
+			std::set<unsigned long long> quads;
+			const std::set<unsigned long long> & cells = level_cells[level_index];
+			for (std::set<unsigned long long>::const_iterator itr = cells.begin(); itr != cells.end(); ++itr)
+				quads.insert(*itr >> 2);
+
+			const QuadTasks & child_tasks = level_tasks[level_index + 1];
+			const MeshTasks & meshes = mesh_tasks[level_index];
+			for (std::set<unsigned long long>::const_iterator itr = quads.begin(); itr != quads.end(); ++itr)
+			{
+				int i_xq = 0, i_yq = 0;
+				cell_coords(*itr, i_xq, i_yq);
+				ShardRole role = get_shard_role(shard, level_index, i_xq, i_yq);
+				if (role == SHARD_SKIP) continue;
+				osg::ref_ptr<QuadTileTask> task = new QuadTileTask(context, level_index, i_xq, i_yq);
+				if (role == SHARD_PREBUILT)
+				{
+					task->setPrebuilt();
+					level_tasks[level_index][*itr] = task;
+					continue;
+				}
+				for (int slot = 0; slot < 4; ++slot)
+				{
+					unsigned long long cell = *itr << 2 | slot;
+					QuadTasks::const_iterator child = child_tasks.find(cell);
+					if (child != child_tasks.end())
+						task->addChildQuad(child->second.get(), slot);
+					MeshTasks::const_iterator mesh = meshes.find(cell);
+					if (mesh != meshes.end())
+						task->addMesh(mesh->second.get(), slot);
+				}
+				level_tasks[level_index][*itr] = task;
+			}
+		}
+
+		// the keys are planned bottom up before anything runs. a mesh tile is
+		// read or simplified only for a stale quad, a stale top level or a
+		// tile simplified from it, so an up to date build reads no tile at all
+		if (context.simplifier)
+		{
+			for (int level_index = num_levels; level_index >= 1; --level_index)
+			{
+				for (MeshTasks::const_iterator itr = mesh_tasks[level_index].begin(); itr != mesh_tasks[level_index].end(); ++itr)
+					itr->second->computeKey();
+				for (QuadTasks::const_iterator itr = level_tasks[level_index].begin(); itr != level_tasks[level_index].end(); ++itr)
+					itr->second->plan();
+			}
+			bool top_level_stale = pixel_error > 0.f && (!shard || shard->stitch) && !level_tasks[1].empty() &&
+				!manifest.isUpToDate(lod_filename, get_top_level_key(context, level_tasks[1].begin()->second.get()));
+			for (int level_index = 1; level_index <= num_levels; ++level_index)
+			{
+				for (MeshTasks::const_iterator itr = mesh_tasks[level_index].begin(); itr != mesh_tasks[level_index].end(); ++itr)
+				{
+					QuadTasks::const_iterator quad = level_tasks[level_index].find(itr->first >> 2);
+					bool needed = quad != level_tasks[level_index].end() && quad->second->isStale();
+					if (level_index == 1)
+						needed = needed || top_level_stale;
+					else
+					{
+						MeshTasks::const_iterator parent = mesh_tasks[level_index - 1].find(itr->first >> 2);
+						needed = needed || (parent != mesh_tasks[level_index - 1].end() && parent->second->isNeeded());
+					}
+					// the root tiles of a shard are the stitch's input
+					if (shard && !shard->stitch && level_index == context.shard_level)
+					{
+						int ix = 0, iy = 0;
+						cell_coords(itr->first, ix, iy);
+						needed = needed || !osgDB::fileExists(osgDB::concatPaths(context.shard_mesh_dir, create_mesh_filename(level_index, ix, iy)));
+					}
+					itr->second->setNeeded(needed);
+				}
+			}
+		}
+
+		// the tasks of a level go in z order, so the four tiles of a block finish
+		// close together and a block is simplified and released before the next one is read
+		for (int level_index = num_levels; level_index >= 1; --level_index)
+			for (MeshTasks::const_iterator itr = mesh_tasks[level_index].begin(); itr != mesh_tasks[level_index].end(); ++itr)
+				scheduler.add(itr->second.get());
+		for (int level_index = num_levels; level_index >= 1; --level_index)
+			for (QuadTasks::const_iterator itr = level_tasks[level_index].begin(); itr != level_tasks[level_index].end(); ++itr)
+				scheduler.add(itr->second.get());
+
+		std::cout<<"building quads with "<<scheduler.getNumThreads()<<" threads."<<std::endl;
+		{
+			Trace::Scope trace_quads("build_quads");
+			scheduler.run();
+			trace_quads.arg("built", context.num_built);
+			trace_quads.arg("skipped", context.num_skipped);
+		}
+		std::cout<<context.num_built<<" quads built, "<<context.num_skipped<<" up to date, "<<context.num_failed<<" failed."<<std::endl;
+		if (context.budget->limited())
+			std::cout<<"memory peak "<<context.budget->getPeak() / (1024 * 1024)<<" of "
+				<<context.budget->getBudget() / (1024 * 1024)<<" MB, "<<context.num_spilled<<" tiles spilled, "
+				<<context.budget->getNumWaits()<<" waits."<<std::endl;
+		std::string report_filename = shard && !shard->stitch ?
+			"optimize_report_" + ShardQueue::shardName(shard->root) + ".txt" : "optimize_report.txt";
+		report_passes(context, osgDB::concatPaths(out_dir, report_filename));
+		if (!manifest.save())
+			std::cout<<"failed to write the build manifest."<<std::endl;
+		// the quads that were written are kept in the manifest, the build fails
+		if (context.num_failed > 0)
+			break;
+
+		// the top level is the stitch's
+		if (shard && !shard->stitch)
+		{
+			ret = 0;
+			break;
+		}
+
+		BuildManifest::Hash top_level_key = get_top_level_key(context,
+			level_tasks[1].empty() ? 0 : level_tasks[1].begin()->second.get());
+		if (manifest.isUpToDate(lod_filename, top_level_key))
+		{
+			ret = 0;
+			break;
+		}
+
+		// top level pagedlode
+		Trace::Scope trace_top("build_top_level", lod_filename);
+		osg::ref_ptr<osg::PagedLOD> lod = new osg::PagedLOD;
+
+		// read only once the quads say the top level is out of date
+		osg::ref_ptr<TileIORequest> top_level_request = io.read(top_level_filename);
+		top_level_request->wait();
+		osg::ref_ptr<osg::Node> test_node = top_level_request->getNode();
+		top_level_request = 0;
+		if (!test_node.valid()) break;
+
+		// the error is measured on the tile as read, a quantized one has no
+		// float vertices to sample
+		osg::ref_ptr<osg::Node> top_level_source = test_node;
+		test_node = process_top_level(context, test_node, num_threads, num_levels);
+		lod->addChild(/*osgDB::readNodeFile(top_level_filename)*/test_node);
+		float top_level_radius = lod->getBound().radius() * radiu_param;
+		std::string quad_file = get_quad_filename(*context.quad_index, 1,0,0);
+		if (!quad_file.empty() && pixel_error > 0.f)
+		{
+			// the quad of level 1 measured the top level against its tiles
+			float radius = lod->getBound().radius();
+			float cutoff = level_tasks[1].empty() ? FLT_MAX :
+				GeometricError::pixelSizeRange(level_tasks[1].begin()->second->getParentError(*top_level_source), radius, pixel_error);
+			trace_top.arg("pixel_range", cutoff);
+			std::string rel_path = osgDB::getPathRelative(out_dir, quad_file);	
+			lod->setFileName(1, rel_path);
+			lod->setRange(1, cutoff, FLT_MAX);
+			lod->setRange(0, 0, cutoff);
+			lod->setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
+			lod->setRadius(radius);
+		}
+		else if (!quad_file.empty())
+		{
+			std::string rel_path = osgDB::getPathRelative(out_dir, quad_file);	
+			lod->setFileName(1, rel_path);
+			lod->setRange(1, 0, top_level_radius);
+			lod->setRange(0, top_level_radius, FLT_MAX);
+		} else
+			lod->setRange(0, 0, FLT_MAX);
+
+		lod->setCenterMode(osg::PagedLOD::USER_DEFINED_CENTER);
+		lod->setCenter(lod->getBound().center());	
+		trace_top.geometryArgs(*lod);
+		if (!write_top_level(context, tile_pack.get(), *lod, lod_filename))
+			break;
+		manifest.setOutput(lod_filename, top_level_key);
+		manifest.save();
+
+
+		ret = 0;
+	} while (0);
+error0:
+	// the tiles written so far are no database
+	if (ret && tile_pack.valid())
+		tile_pack->abort();
+
+	return ret;
+}
+
+int process_config_file(const std::string & config_filename,
+						const std::string & out_dir,
+						const std::string & output_ext,
+						unsigned int io_queue_depth = 32,
+						float pixel_error = 2.f,
+						MemoryBudget * budget = 0)
+{
+	Trace::Scope trace("process_config_file", config_filename);
+	int ret = -1;
+
+	do 
+	{
+		std::string lod_filename = osgDB::concatPaths(out_dir, "out.ive");
+
+		std::string top_level_filename;
+		std::vector<std::string> level_directories;
+		std::vector<std::string> pagedlod_children;
+		std::string node_file_ext = "obj";
+
+
+		// ȡconfigļ
+		std::ifstream config_file(config_filename);
+		if (!config_file.good()) break;
+
+		std::string line;
+		std::getline(config_file, line);
+		if (!osgDB::fileExists(line) || osgDB::fileType(line) != osgDB::REGULAR_FILE) break;
+		top_level_filename = line;
+
+		while (config_file.good())
+		{
+			line.clear();
+			std::getline(config_file, line);
+			if (osgDB::fileExists(line) && osgDB::fileType(line) == osgDB::DIRECTORY) 
+				level_directories.push_back(line);
+		}
+
+
+		// ÿײ㴦
+		std::vector<osg::BoundingSphere> bounding_sphere_children;
+		// vertices of the children, measured against the tile that contains them
+		std::vector< std::vector<osg::Vec3> > samples_children;
+		TileIO io(io_queue_depth);
+		std::string level_ive_dir = osgDB::concatPaths(out_dir, "ive");
+		if (!osgDB::makeDirectory(level_ive_dir))
+		{
+			osg::notify(osg::NOTICE)<<"failed to create ive directory."<<std::endl;
+			goto error0;
+		}
+		while (level_directories.size() > 0)
+		{
+			int level_index = level_directories.size();
+			std::stringstream sstr;
+			std::string tmp_index;
+			sstr << level_index;
+			sstr >> tmp_index;
+			// 			std::string output_level_dir = level_ive_dir + "\\" + tmp_index;
+			// 			if (!osgDB::makeDirectory(output_level_dir))
+			// 			{
+			// 				osg::notify(osg::NOTICE)<<"failed to create ive directory."<<std::endl;
+			// 				goto error0;
+			// 			}
+
+
+			if (bounding_sphere_children.size() != pagedlod_children.size())
+				goto error0;
+
+
+			std::string level_dir = level_directories.back();
+			Trace::Scope trace_level("process_level", level_dir);
+
+			osgDB::DirectoryContents dir_contents = osgDB::getDirectoryContents(level_dir);
+			size_t num_content = dir_contents.size();
+			std::vector<std::string> content_names;
+			for (size_t i_c = 0; i_c < num_content; ++i_c)
+			{
+				std::string content_name = osgDB::concatPaths(level_dir, dir_contents[i_c]);
+				if (osgDB::fileType(content_name) != osgDB::REGULAR_FILE ||
+					osgDB::getFileExtension(content_name).compare(node_file_ext))
+					continue;
+				content_names.push_back(content_name);
+			}
+
+			// keep reads in flight ahead of the tile being linked, writes drain in the background
+			std::deque< osg::ref_ptr<TileIORequest> > read_requests;
+			std::deque<unsigned long long> read_bytes;
+			std::vector< osg::ref_ptr<TileIORequest> > write_requests;
+			size_t num_submitted = 0;
+			std::vector<std::string> current_pagedlod_filename;
+			std::vector<osg::BoundingSphere> current_bounding_spheres;
+			std::vector< std::vector<osg::Vec3> > current_samples;
+			SphereIndex children_index(bounding_sphere_children);
+			std::vector<unsigned int> candidate_children;
+			for (size_t i_c = 0; i_c < content_names.size(); ++i_c)
+			{
+				while (num_submitted < content_names.size() &&
+					read_requests.size() <= io.getQueueDepth() / 2)
+				{
+					// under a memory budget the reads ahead stop at the budget,
+					// the tile being linked is read however large it is
+					unsigned long long bytes = budget && budget->limited() ?
+						Utility::fileSize(content_names[num_submitted]) * read_memory_factor : 0;
+					if (bytes > 0 && !budget->tryHold(bytes))
+					{
+						if (!read_requests.empty()) break;
+						bytes = 0;
+					}
+					read_bytes.push_back(bytes);
+					read_requests.push_back(io.read(content_names[num_submitted++]));
+				}
+
+				std::string content_name = content_names[i_c];
+				Trace::Scope trace_tile("link_tile", content_name);
+				osg::ref_ptr<TileIORequest> read_request = read_requests.front();
+				read_requests.pop_front();
+				{
+					Trace::Scope wait("read_wait", "io");
+					read_request->wait();
+				}
+
+
+				std::string output_pagedlod_name = osgDB::concatPaths(level_ive_dir,
+					tmp_index + "_" + osgDB::getNameLessExtension(osgDB::getSimpleFileName(content_name)) + output_ext);
+
+
+				// convert to pagedlod node
+				osg::ref_ptr<osg::PagedLOD> lod = new osg::PagedLOD;
+				lod->addChild(read_request->getNode(), 0, FLT_MAX);
+				read_request = 0;
+				float radius = lod->getBound().radius() * 1.5;
+
+
+				if (pixel_error > 0.f)
+				{
+					current_samples.push_back(std::vector<osg::Vec3>());
+					GeometricError::sampleVertices(*lod, current_samples.back());
+				}
 
 				// add children if exists
 				int num_added_children = 0;
-				for (int i_ch = 0; i_ch < pagedlod_children.size(); ++i_ch)
+				std::vector<osg::Vec3> samples;
+				children_index.query(lod->getBound(), candidate_children);
+				for (size_t i_cc = 0; i_cc < candidate_children.size(); ++i_cc)
 				{	
+					unsigned int i_ch = candidate_children[i_cc];
+
 					// if contained
 					if (!sphere_contained_most(lod->getBound(), bounding_sphere_children[i_ch]))
 						continue;
@@ -881,17 +2438,35 @@ int process_config_file(const std::string & config_filename,
 					//std::string rel_path = osgDB::getPathRelative(level_dir, pagedlod_children[i_ch]);	
 					lod->setFileName(num_added_children + 1, /*rel_path*/osgDB::getSimpleFileName(pagedlod_children[i_ch]));
 					lod->setRange(num_added_children + 1, 0, radius);
+					if (pixel_error > 0.f)
+						samples.insert(samples.end(), samples_children[i_ch].begin(), samples_children[i_ch].end());
 
 					++num_added_children;
 				}				
 
 
 				// save file
-				radius = num_added_children > 0 ? radius : 0;
-				lod->setRange(0, radius, FLT_MAX);
+				if (pixel_error > 0.f)
+				{
+					// the children take over once the error of this tile covers pixel_error pixels
+					float cutoff = num_added_children > 0 ? GeometricError::pixelSizeRange(
+						GeometricError::distance(samples, *lod->getChild(0)), lod->getBound().radius(), pixel_error) : FLT_MAX;
+					for (int i_ch = 0; i_ch < num_added_children; ++i_ch)
+						lod->setRange(i_ch + 1, cutoff, FLT_MAX);
+					lod->setRange(0, 0, cutoff);
+					lod->setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
+					lod->setRadius(lod->getBound().radius());
+				} else {
+					radius = num_added_children > 0 ? radius : 0;
+					lod->setRange(0, radius, FLT_MAX);
+				}
 				lod->setCenter(lod->getBound().center());	
-				if (!osgDB::writeNodeFile(*lod,output_pagedlod_name))
-					std::cout<<output_pagedlod_name<<" write failed.."<<std::endl;
+				trace_tile.arg("children", num_added_children);
+				trace_tile.geometryArgs(*lod);
+				write_requests.push_back(io.write(*lod, output_pagedlod_name));
+				if (budget)
+					budget->releaseHeld(read_bytes.front());
+				read_bytes.pop_front();
 
 
 				// insert to children (filename and bounding sphere)
@@ -899,9 +2474,20 @@ int process_config_file(const std::string & config_filename,
 				current_bounding_spheres.push_back(lod->getBound());
 			}			
 
+			{
+				Trace::Scope wait("write_flush", "io");
+				io.flush();
+			}
+			for (size_t i_w = 0; i_w < write_requests.size(); ++i_w)
+			{
+				if (!write_requests[i_w]->success())
+					std::cout<<write_requests[i_w]->getFileName()<<" write failed.."<<std::endl;
+			}
+
 
 			pagedlod_children.swap(current_pagedlod_filename);
 			bounding_sphere_children.swap(current_bounding_spheres);
+			samples_children.swap(current_samples);
 
 			level_directories.pop_back();
 		}
@@ -911,13 +2497,26 @@ int process_config_file(const std::string & config_filename,
 		osg::ref_ptr<osg::PagedLOD> lod = new osg::PagedLOD;
 		lod->addChild(osgDB::readNodeFile(top_level_filename), 0, FLT_MAX);
 		float top_level_radius = lod->getBound().radius() * 1.5;
-		for (int i_ch = 0; i_ch < pagedlod_children.size(); ++i_ch)
+		for (size_t i_ch = 0; i_ch < pagedlod_children.size(); ++i_ch)
 		{			
 			std::string rel_path = osgDB::getPathRelative(out_dir, pagedlod_children[i_ch]);	
 			lod->setFileName(i_ch + 1, rel_path);
 			lod->setRange(i_ch + 1, 0, top_level_radius);
 		}
 		lod->setRange(0, top_level_radius, FLT_MAX);
+		if (pixel_error > 0.f && lod->getNumChildren() > 0 && lod->getChild(0))
+		{
+			std::vector<osg::Vec3> samples;
+			for (size_t i_ch = 0; i_ch < samples_children.size(); ++i_ch)
+				samples.insert(samples.end(), samples_children[i_ch].begin(), samples_children[i_ch].end());
+			float cutoff = pagedlod_children.empty() ? FLT_MAX : GeometricError::pixelSizeRange(
+				GeometricError::distance(samples, *lod->getChild(0)), lod->getBound().radius(), pixel_error);
+			for (size_t i_ch = 0; i_ch < pagedlod_children.size(); ++i_ch)
+				lod->setRange(i_ch + 1, cutoff, FLT_MAX);
+			lod->setRange(0, 0, cutoff);
+			lod->setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
+			lod->setRadius(lod->getBound().radius());
+		}
 		lod->setCenter(lod->getBound().center());	
 		if (!osgDB::writeNodeFile(*lod,lod_filename))
 			std::cout<<lod_filename<<" write failed.."<<std::endl;
@@ -930,19 +2529,215 @@ error0:
 	return ret;
 }
 
+// a local worker of a sharded build, runs one process per shard it claims
+// until the queue is empty.
+class ShardProcessThread : public OpenThreads::Thread
+{
+public:
+	ShardProcessThread(ShardQueue & queue, const std::vector<std::string> & worker_args):
+		_queue(queue), _worker_args(worker_args)
+	{
+	}
+
+	virtual void run()
+	{
+		ShardQueue::Shard shard;
+		while (_queue.claim(shard))
+		{
+			std::vector<std::string> args(_worker_args);
+			args.push_back("--build-shard");
+			std::stringstream sstr;
+			sstr << shard.level << " " << shard.x << " " << shard.y;
+			std::string value;
+			while (sstr >> value)
+				args.push_back(value);
+
+			int code = 0;
+			{
+				ShardQueue::Lease lease(_queue, shard);
+				code = ShardQueue::runProcess(args);
+			}
+			// a shard taken back meanwhile is built again by its new owner
+			if (code == 0)
+			{
+				if (!_queue.finish(shard, true))
+					std::cout<<ShardQueue::shardName(shard)<<" was taken back, its result is dropped."<<std::endl;
+				continue;
+			}
+			// back to the queue until it failed its attempts
+			std::cout<<ShardQueue::shardName(shard)<<" failed ("<<code<<")."<<std::endl;
+			if (!_queue.fail(shard))
+				std::cout<<ShardQueue::shardName(shard)<<" was taken back already."<<std::endl;
+		}
+	}
+
+private:
+	ShardQueue & _queue;
+	std::vector<std::string> _worker_args;
+};
+
+// the coordinator of a sharded build. the quads from the shard level down
+// are split into one shard per quad of that level, built by num_processes
+// local workers and any --shard-worker sharing the output directory.
+// returns the shard level to stitch, 0 if there are too few levels to
+// shard, -1 if a shard failed or none finished for timeout seconds.
+int run_shards(ShardQueue & queue, const std::string & config_filename, unsigned int generate_levels,
+			   unsigned int num_processes, int shard_level, const std::vector<std::string> & worker_args,
+			   unsigned int timeout)
+{
+	Trace::Scope trace("run_shards", config_filename);
+
+	// the levels process_config_file2 builds
+	int num_levels = generate_levels;
+	if (num_levels == 0)
+	{
+		std::ifstream config_file(config_filename.c_str());
+		std::string line;
+		std::getline(config_file, line);
+		while (config_file.good())
+		{
+			line.clear();
+			std::getline(config_file, line);
+			if (osgDB::fileExists(line) && osgDB::fileType(line) == osgDB::DIRECTORY)
+				++num_levels;
+		}
+	}
+	if (num_levels < 2) return 0;
+
+	// a few shards per process so they even out
+	if (shard_level <= 0)
+	{
+		unsigned int num_shards = 4 * (num_processes > 0 ? num_processes : 1);
+		shard_level = 2;
+		while (shard_level < num_levels && (1u << (2 * (shard_level - 1))) < num_shards)
+			++shard_level;
+	}
+	if (shard_level < 2) shard_level = 2;
+	if (shard_level > num_levels) shard_level = num_levels;
+
+	if (!queue.create(shard_level))
+	{
+		std::cout<<"failed to create the shard queue in "<<queue.getDirectory()<<std::endl;
+		return -1;
+	}
+	std::cout<<queue.getNumShards()<<" shards of level "<<shard_level<<", "<<num_processes<<" local workers."<<std::endl;
+	trace.arg("shards", queue.getNumShards());
+
+	std::vector<ShardProcessThread*> threads;
+	for (unsigned int i = 0; i < num_processes; ++i)
+	{
+		threads.push_back(new ShardProcessThread(queue, worker_args));
+		threads.back()->start();
+	}
+
+	// the claims of crashed or stalled workers go back to the queue, the
+	// local workers that ran out of shards are restarted for them
+	unsigned int num_finished = 0;
+	unsigned int idle_seconds = 0;
+	while (!queue.complete())
+	{
+		unsigned int num_reclaimed = queue.reclaimStale();
+		if (num_reclaimed > 0)
+			std::cout<<num_reclaimed<<" stale shard claims taken back."<<std::endl;
+		if (queue.claimable())
+		{
+			if (threads.empty())
+				threads.push_back(0);
+			for (size_t i = 0; i < threads.size(); ++i)
+			{
+				if (threads[i] && threads[i]->isRunning()) continue;
+				if (threads[i])
+				{
+					threads[i]->join();
+					delete threads[i];
+				}
+				threads[i] = new ShardProcessThread(queue, worker_args);
+				threads[i]->start();
+			}
+		}
+
+		unsigned int num = queue.getNumDone() + queue.getNumFailed();
+		if (num != num_finished)
+		{
+			std::cout<<num<<" of "<<queue.getNumShards()<<" shards built."<<std::endl;
+			num_finished = num;
+			idle_seconds = 0;
+		}
+		else if (timeout > 0 && ++idle_seconds > timeout)
+		{
+			// the workers still running are left to the exit of the process
+			std::cout<<"no shard finished in "<<timeout<<" seconds, giving up."<<std::endl;
+			return -1;
+		}
+		OpenThreads::Thread::microSleep(1000000);
+	}
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i]->join();
+		delete threads[i];
+	}
+
+	if (queue.getNumFailed() > 0)
+	{
+		std::cout<<queue.getNumFailed()<<" of "<<queue.getNumShards()<<" shards failed."<<std::endl;
+		return -1;
+	}
+	return shard_level;
+}
+
 int proxy_main_custom_test(int argc, char ** argv)
 {
+	// the workers of a sharded build get the same options
+	std::vector<std::string> command_line(argv, argv + argc);
+
 	// use an ArgumentParser object to manage the program arguments.
 	osg::ArgumentParser arguments(&argc,argv);
 
 	// set up the usage document, in case we need to print out how to use this program.
 	arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
 	arguments.getApplicationUsage()->setDescription(arguments.getApplicationName()+" blablablabla.");
-	arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" [options] -dir directory ...");
+	arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" --build [options] -config file -o directory ...");
 	arguments.getApplicationUsage()->addCommandLineOption("-h or --help","Display this information");
+	arguments.getApplicationUsage()->addCommandLineOption("--build","build the paged database of a config file, must come first.");
 	arguments.getApplicationUsage()->addCommandLineOption("-o","set the output directory");
 	arguments.getApplicationUsage()->addCommandLineOption("-dir","set the input directory");
 	arguments.getApplicationUsage()->addCommandLineOption("-config","set the config file.");
+	arguments.getApplicationUsage()->addCommandLineOption("--threads <N>","set the number of tile building threads (defaults to the number of processors).");
+	arguments.getApplicationUsage()->addCommandLineOption("--io-queue-depth <N>","set the number of tile reads and writes in flight (defaults to 32).");
+	arguments.getApplicationUsage()->addCommandLineOption("--full-rebuild","ignore the build manifest and rebuild every tile.");
+	arguments.getApplicationUsage()->addCommandLineOption("--generate-levels <N>","build N levels from the last directory of the config file, simplifying the coarser levels from it.");
+	arguments.getApplicationUsage()->addCommandLineOption("--simplify-ratio <r>","fraction of the triangles of four tiles kept in their parent tile (defaults to 0.25).");
+	arguments.getApplicationUsage()->addCommandLineOption("--no-tile-cache","parse every obj tile from text, neither reading nor writing the .tilecache files next to them.");
+	arguments.getApplicationUsage()->addCommandLineOption("--no-merge","write the geometries of a tile as they are instead of one per stateset.");
+	arguments.getApplicationUsage()->addCommandLineOption("--no-optimize","write the tiles without the vertex cache and index width optimization.");
+	arguments.getApplicationUsage()->addCommandLineOption("--quantize","write 16 bit positions and texcoords and octahedral normals.");
+	arguments.getApplicationUsage()->addCommandLineOption("--quantize-position-error <e>","largest position error of a quantized tile, in model units (defaults to 16 bits per axis).");
+	arguments.getApplicationUsage()->addCommandLineOption("--quantize-normal-bits <N>","bits per octahedral normal component (defaults to 8).");
+	arguments.getApplicationUsage()->addCommandLineOption("--quantize-texcoord-bits <N>","bits per texcoord component (defaults to 16).");
+	arguments.getApplicationUsage()->addCommandLineOption("--process-textures","scale the textures of each level to its distance, atlas, mipmap and compress them to bc1/bc3.");
+	arguments.getApplicationUsage()->addCommandLineOption("--texture-max-size <N>","largest texture of the leaf level, halved for each level above (defaults to 4096).");
+	arguments.getApplicationUsage()->addCommandLineOption("--texture-min-size <N>","size the textures of the coarse levels don't go below (defaults to 64).");
+	arguments.getApplicationUsage()->addCommandLineOption("--no-texture-compression","keep the processed textures as uncompressed rgb/rgba.");
+	arguments.getApplicationUsage()->addCommandLineOption("--no-texture-atlas","keep the textures of a tile separate.");
+	arguments.getApplicationUsage()->addCommandLineOption("--pack","append the tiles to out.tpk and its out.<n>.tpd data files instead of one file per tile, open out.tpk to view them. implies --full-rebuild.");
+	arguments.getApplicationUsage()->addCommandLineOption("--adaptive","build a tree that follows the density of the last directory of the config file instead of the full quad grid: dense tiles are split, sparse cells are joined into one tile.");
+	arguments.getApplicationUsage()->addCommandLineOption("--max-triangles <N>","triangles a tile of the adaptive tree holds before it is split (defaults to 65536), implies --adaptive.");
+	arguments.getApplicationUsage()->addCommandLineOption("--octree","split the tall tiles of the adaptive tree into octants instead of quadrants, implies --adaptive.");
+	arguments.getApplicationUsage()->addCommandLineOption("--share-state","write every distinct image once to ive/textures and reference it from the tiles, merge the equal statesets of a tile. viewers share them across tiles with osgDB::Options::CACHE_IMAGES and the registry's SharedStateManager.");
+	arguments.getApplicationUsage()->addCommandLineOption("--trace <file>","write the timings of every tile and stage as chrome trace json (chrome://tracing, perfetto).");
+	arguments.getApplicationUsage()->addCommandLineOption("--pixel-error <px>","refine a tile once its geometric error covers more than px pixels on screen (defaults to 2).");
+	arguments.getApplicationUsage()->addCommandLineOption("--distance-ranges","switch levels at a multiple of the tile radius from the eye instead of by screen space error.");
+	arguments.getApplicationUsage()->addCommandLineOption("--shard-processes <N>","build the quads in shards on N local worker processes, then stitch the levels above them.");
+	arguments.getApplicationUsage()->addCommandLineOption("--shard-level <L>","level of the quads the shards start at (defaults to a few shards per process).");
+	arguments.getApplicationUsage()->addCommandLineOption("--shard-worker","build shards of the sharded build writing to the same output directory, e.g. from another machine.");
+	arguments.getApplicationUsage()->addCommandLineOption("--build-shard <L> <x> <y>","build only the quads below quad L x y, used by the workers.");
+	arguments.getApplicationUsage()->addCommandLineOption("--shard-lease <s>","seconds a shard claim lives without being renewed before the coordinator gives it to another worker (defaults to 300).");
+	arguments.getApplicationUsage()->addCommandLineOption("--shard-timeout <s>","seconds the coordinator waits for the next shard to finish before it fails the build, 0 waits forever (defaults to 86400).");
+	arguments.getApplicationUsage()->addCommandLineOption("--memory-budget <size>","hold at most size bytes of tiles (512M, 4G, a plain number is megabytes), spilling simplified tiles to disk and running fewer tiles at once.");
+	arguments.getApplicationUsage()->addCommandLineOption("--link-by-bounds","for tiles that are not named mesh_<x>_<y>: link each tile to the tiles of the level below whose bounding spheres it contains instead of building the quad grid.");
+
+	// the mode switch, kept in command_line for the shard workers
+	while (arguments.read("--build")) {}
 
 	if (arguments.read("-h") || arguments.read("--help") || argc < 3)
 	{
@@ -971,6 +2766,91 @@ int proxy_main_custom_test(int argc, char ** argv)
 
 	while (arguments.read("-config",config_file)) {}
 
+	unsigned int num_threads = 0;
+	while (arguments.read("--threads",num_threads)) {}
+
+	unsigned int io_queue_depth = 32;
+	while (arguments.read("--io-queue-depth",io_queue_depth)) {}
+
+	bool full_rebuild = false;
+	while (arguments.read("--full-rebuild")) { full_rebuild = true; }
+
+	unsigned int generate_levels = 0;
+	while (arguments.read("--generate-levels",generate_levels)) {}
+
+	float simplify_ratio = 0.25f;
+	while (arguments.read("--simplify-ratio",simplify_ratio)) {}
+
+	while (arguments.read("--no-tile-cache")) { TileCache::setEnabled(false); }
+
+	bool optimize_geometry = true;
+	while (arguments.read("--no-optimize")) { optimize_geometry = false; }
+	bool merge_drawables = true;
+	while (arguments.read("--no-merge")) { merge_drawables = false; }
+
+	bool quantize = false;
+	while (arguments.read("--quantize")) { quantize = true; }
+	double quantize_position_error = 0.;
+	while (arguments.read("--quantize-position-error",quantize_position_error)) { quantize = true; }
+	unsigned int quantize_normal_bits = 8;
+	while (arguments.read("--quantize-normal-bits",quantize_normal_bits)) { quantize = true; }
+	unsigned int quantize_texcoord_bits = 16;
+	while (arguments.read("--quantize-texcoord-bits",quantize_texcoord_bits)) { quantize = true; }
+	AttributeQuantizer quantizer(quantize_position_error, quantize_normal_bits, quantize_texcoord_bits);
+
+	bool process_textures = false;
+	while (arguments.read("--process-textures")) { process_textures = true; }
+	unsigned int texture_max_size = 4096;
+	while (arguments.read("--texture-max-size",texture_max_size)) { process_textures = true; }
+	unsigned int texture_min_size = 64;
+	while (arguments.read("--texture-min-size",texture_min_size)) { process_textures = true; }
+	bool texture_compression = true;
+	while (arguments.read("--no-texture-compression")) { texture_compression = false; process_textures = true; }
+	bool texture_atlas = true;
+	while (arguments.read("--no-texture-atlas")) { texture_atlas = false; process_textures = true; }
+	bool share_state = false;
+	while (arguments.read("--share-state")) { share_state = true; }
+	bool pack = false;
+	while (arguments.read("--pack")) { pack = true; }
+	bool adaptive = false;
+	while (arguments.read("--adaptive")) { adaptive = true; }
+	unsigned int max_triangles = 65536;
+	while (arguments.read("--max-triangles",max_triangles)) { adaptive = true; }
+	bool octree = false;
+	while (arguments.read("--octree")) { octree = true; adaptive = true; }
+	AdaptiveTree tree(max_triangles, octree);
+	TextureProcessor textures(texture_max_size, texture_min_size);
+	textures.setCompress(texture_compression);
+	textures.setAtlas(texture_atlas);
+
+	float pixel_error = 2.f;
+	while (arguments.read("--pixel-error",pixel_error)) {}
+	while (arguments.read("--distance-ranges")) { pixel_error = 0.f; }
+
+	std::string memory_budget;
+	while (arguments.read("--memory-budget",memory_budget)) {}
+	MemoryBudget budget(MemoryBudget::parseSize(memory_budget));
+	if (!memory_budget.empty() && !budget.limited())
+	{
+		std::cout<<"invalid memory budget "<<memory_budget<<std::endl;
+		return 1;
+	}
+
+	unsigned int shard_processes = 0;
+	while (arguments.read("--shard-processes",shard_processes)) {}
+	int shard_level = 0;
+	while (arguments.read("--shard-level",shard_level)) {}
+	bool shard_worker = false;
+	while (arguments.read("--shard-worker")) { shard_worker = true; }
+	ShardQueue::Shard build_shard;
+	while (arguments.read("--build-shard",build_shard.level,build_shard.x,build_shard.y)) {}
+	unsigned int shard_lease = 300;
+	while (arguments.read("--shard-lease",shard_lease)) {}
+	unsigned int shard_timeout = 86400;
+	while (arguments.read("--shard-timeout",shard_timeout)) {}
+	bool link_by_bounds = false;
+	while (arguments.read("--link-by-bounds")) { link_by_bounds = true; }
+
 	// any option left unread are converted into errors to write out later.
 	arguments.reportRemainingOptionsAsUnrecognized();
 
@@ -981,13 +2861,92 @@ int proxy_main_custom_test(int argc, char ** argv)
 		return 1;
 	}
 
-	if (!config_file.empty())
+	if (adaptive && (shard_processes > 0 || shard_level > 0 || shard_worker || build_shard.level > 0))
+	{
+		std::cout<<"the adaptive tree is built by one process."<<std::endl;
+		return 1;
+	}
+
+	if (link_by_bounds && (adaptive || pack || generate_levels > 0 || shard_processes > 0 || shard_level > 0 ||
+		shard_worker || build_shard.level > 0))
 	{
-		if (process_config_file2(config_file, out_dir, output_ext))
+		std::cout<<"--link-by-bounds links the tiles as they are, without the quad grid options."<<std::endl;
+		return 1;
+	}
+
+	if (!config_file.empty() && link_by_bounds)
+	{
+		if (process_config_file(config_file, out_dir, output_ext, io_queue_depth, pixel_error, &budget))
+		{
+			std::cout<<"process config file failed."<<std::endl;
+			return 1;
+		}
+	}
+	else if (!config_file.empty())
+	{
+		// a worker builds the shards it gets, the coordinator stitches the
+		// levels above them once the workers are through
+		ShardQueue queue(osgDB::concatPaths(out_dir, "shards"), shard_lease);
+		BuildShard shard;
+		bool sharded = false;
+		if (build_shard.level > 0)
+		{
+			shard = BuildShard(false, build_shard);
+			sharded = true;
+		}
+		else if (shard_worker)
+		{
+			if (!queue.load())
+			{
+				std::cout<<"no sharded build in "<<out_dir<<std::endl;
+				return 1;
+			}
+		}
+		else if (shard_processes > 0 || shard_level > 0)
 		{
-			std::cout<<"process config file failed."<<std::endl;
-			return 1;
+			std::vector<std::string> worker_args;
+			for (size_t i = 0; i < command_line.size(); ++i)
+			{
+				if (command_line[i] == "--shard-processes" || command_line[i] == "--shard-level") { ++i; continue; }
+				worker_args.push_back(command_line[i]);
+			}
+			int stitch_level = run_shards(queue, config_file, generate_levels, shard_processes, shard_level, worker_args,
+				shard_timeout);
+			if (stitch_level < 0) return 1;
+			if (stitch_level > 0)
+			{
+				shard = BuildShard(true, ShardQueue::Shard(stitch_level, 0, 0));
+				sharded = true;
+			}
 		}
+
+		do
+		{
+			if (shard_worker)
+			{
+				if (!queue.claim(shard.root)) break;
+				sharded = true;
+			}
+			// the claim is renewed while the shard builds
+			ShardQueue::Lease * lease = shard_worker ? new ShardQueue::Lease(queue, shard.root) : 0;
+			int ret = process_config_file2(config_file, out_dir, output_ext, num_threads, io_queue_depth, full_rebuild,
+				generate_levels, simplify_ratio, optimize_geometry, merge_drawables, quantize ? &quantizer : 0,
+				process_textures ? &textures : 0, share_state, pack, adaptive ? &tree : 0, pixel_error, &budget,
+				sharded ? &shard : 0);
+			delete lease;
+			if (shard_worker)
+			{
+				bool held = ret == 0 ? queue.finish(shard.root, true) : queue.fail(shard.root);
+				if (!held)
+					std::cout<<ShardQueue::shardName(shard.root)<<" was taken back meanwhile."<<std::endl;
+				continue;
+			}
+			if (ret)
+			{
+				std::cout<<"process config file failed."<<std::endl;
+				return 1;
+			}
+		} while (shard_worker);
 	} else {
 
 		if (dir_name.empty())
@@ -1056,6 +3015,9 @@ int transformation_main_proxy_test(int argc, char **argv)
 		arguments.getApplicationUsage()->addCommandLineOption("-o","set the output directory");
 		arguments.getApplicationUsage()->addCommandLineOption("-dir","set the input directory");
 		arguments.getApplicationUsage()->addCommandLineOption("-config","set the config file.");
+		arguments.getApplicationUsage()->addCommandLineOption("--threads <N>","set the number of tiles transformed at once (defaults to the number of processors).");
+		arguments.getApplicationUsage()->addCommandLineOption("--io-queue-depth <N>","set the number of tile reads and writes in flight (defaults to 32).");
+		arguments.getApplicationUsage()->addCommandLineOption("--no-bake","write only the root below one transform, the tiles are referenced where they are.");
 
 		if (arguments.read("-h") || arguments.read("--help") || argc < 3)
 		{
@@ -1071,6 +3033,15 @@ int transformation_main_proxy_test(int argc, char **argv)
 		while (arguments.read("-o",out_dir)) {}
 		while (arguments.read("-config",config_file)) {}
 
+		unsigned int num_threads = 0;
+		while (arguments.read("--threads",num_threads)) {}
+
+		unsigned int io_queue_depth = 32;
+		while (arguments.read("--io-queue-depth",io_queue_depth)) {}
+
+		bool bake = true;
+		while (arguments.read("--no-bake")) { bake = false; }
+
 		// any option left unread are converted into errors to write out later.
 		arguments.reportRemainingOptionsAsUnrecognized();
 
@@ -1168,53 +3139,658 @@ int transformation_main_proxy_test(int argc, char **argv)
 		oc.setScale(osg_scale);
 		//oc.useWorldFrame(true);
 
-		// tt
-		osg::ref_ptr<osg::Node> root = osgDB::readNodeFile(model_file);
-		if (!root.valid()) break;
+		// the model file and every tile its PagedLODs reference, the output
+		// mirrors the input tree
+		if (!osgDB::makeDirectory(out_dir))
+		{
+			osg::notify(osg::NOTICE)<<"failed to create output directory."<<std::endl;
+			break;
+		}
+		DatabaseTransformer transformer(oc, num_threads, io_queue_depth);
+		transformer.setBake(bake);
+		std::string out_filename = transformer.transform(model_file, out_dir);
+		std::cout<<transformer.getNumFiles()<<" files transformed, "<<transformer.getNumFailed()<<" failed."<<std::endl;
+		if (out_filename.empty())
+		{
+			std::cout<<model_file<<" transform failed.."<<std::endl;
+			break;
+		}
+
+		ret = transformer.getNumFailed() == 0 ? 0 : -1;
+	} while (0);
+error0:
+
+	return ret;
+}
+
+class DirtyBoundVisitor : public osg::NodeVisitor
+{
+public:
+	DirtyBoundVisitor():
+		osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+	{
+	}
+
+	virtual void apply(osg::Node &node)
+	{
+		node.dirtyBound();
+		traverse(node);
+	}
+
+	virtual void apply(osg::Geode &geode)
+	{
+		for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+			geode.getDrawable(i)->dirtyBound();
+		geode.dirtyBound();
+	}
+};
+
+// times the stages of the tile builder on a generated terrain, every stage
+// is run --repeat times and the times are written as json.
+int proxy_main_benchmark(int argc, char **argv)
+{
+	osg::ArgumentParser arguments(&argc,argv);
+
+	arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+	arguments.getApplicationUsage()->setDescription(arguments.getApplicationName()+" benchmark of the tile builder on a synthetic terrain.");
+	arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" --benchmark [options]");
+	arguments.getApplicationUsage()->addCommandLineOption("-h or --help","Display this information");
+	arguments.getApplicationUsage()->addCommandLineOption("-o","set the output directory of the dataset and the built tiles (defaults to benchmark).");
+	arguments.getApplicationUsage()->addCommandLineOption("--benchmark-out <file>","json report (defaults to benchmark.json in the output directory).");
+	arguments.getApplicationUsage()->addCommandLineOption("--levels <N>","levels of the generated terrain (defaults to 3).");
+	arguments.getApplicationUsage()->addCommandLineOption("--tile-resolution <N>","quads along a tile side (defaults to 64).");
+	arguments.getApplicationUsage()->addCommandLineOption("--texture-size <N>","texture size of a tile, 0 for none (defaults to 256).");
+	arguments.getApplicationUsage()->addCommandLineOption("--seed <N>","seed of the terrain (defaults to 1).");
+	arguments.getApplicationUsage()->addCommandLineOption("--repeat <N>","runs of every stage (defaults to 3).");
+	arguments.getApplicationUsage()->addCommandLineOption("--threads <N>","threads of the full build (defaults to the number of processors).");
+	arguments.getApplicationUsage()->addCommandLineOption("--trace <file>","write the timings of the runs as chrome trace json (chrome://tracing, perfetto).");
+
+	while (arguments.read("--benchmark")) {}
+	if (arguments.read("-h") || arguments.read("--help"))
+	{
+		arguments.getApplicationUsage()->write(std::cout);
+		return 1;
+	}
+
+	std::string out_dir("benchmark");
+	while (arguments.read("-o",out_dir)) {}
+	std::string json_filename;
+	while (arguments.read("--benchmark-out",json_filename)) {}
+	unsigned int num_levels = 3;
+	while (arguments.read("--levels",num_levels)) {}
+	unsigned int tile_resolution = 64;
+	while (arguments.read("--tile-resolution",tile_resolution)) {}
+	unsigned int texture_size = 256;
+	while (arguments.read("--texture-size",texture_size)) {}
+	unsigned int seed = 1;
+	while (arguments.read("--seed",seed)) {}
+	unsigned int repeat = 3;
+	while (arguments.read("--repeat",repeat)) {}
+	if (repeat < 1) repeat = 1;
+	unsigned int num_threads = 0;
+	while (arguments.read("--threads",num_threads)) {}
+
+	arguments.reportRemainingOptionsAsUnrecognized();
+	if (arguments.errors())
+	{
+		arguments.writeErrorMessages(std::cout);
+		return 1;
+	}
+
+	if (!osgDB::makeDirectory(out_dir))
+	{
+		osg::notify(osg::NOTICE)<<"failed to create output directory."<<std::endl;
+		return 1;
+	}
+	if (json_filename.empty())
+		json_filename = osgDB::concatPaths(out_dir, "benchmark.json");
+
+	TerrainGenerator generator(num_levels, tile_resolution, texture_size);
+	generator.setSeed(seed);
+
+	Benchmark benchmark("osg_lod_test");
+	benchmark.setParameter("levels", generator.getNumLevels());
+	benchmark.setParameter("tile_resolution", generator.getTileResolution());
+	benchmark.setParameter("texture_size", generator.getTextureSize());
+	benchmark.setParameter("seed", seed);
+	benchmark.setParameter("repeat", repeat);
+	benchmark.setParameter("threads", num_threads ? num_threads : TileScheduler::defaultNumThreads());
+
+	// the dataset, every level and the top level tile
+	Benchmark::Timer timer;
+	TerrainGenerator::Stats generated;
+	std::string dataset_dir = osgDB::concatPaths(out_dir, "dataset");
+	std::string config_filename = generator.generate(dataset_dir, &generated);
+	benchmark.addRun("generate", timer.seconds(), generated.num_tiles, generated.num_bytes);
+	if (config_filename.empty())
+	{
+		std::cout<<"failed to generate the dataset."<<std::endl;
+		return 1;
+	}
+	std::cout<<generated.num_tiles<<" tiles, "<<generated.num_triangles<<" triangles generated."<<std::endl;
+
+	// the leaf tiles row by row
+	num_levels = generator.getNumLevels();
+	const int num_x_tile = 1 << num_levels;
+	osg::ref_ptr<TileIndex> leaf_index = new TileIndex(TerrainGenerator::levelDirectory(dataset_dir, num_levels));
+	leaf_index->scan();
+	std::vector<std::string> leaf_files;
+	unsigned long long leaf_bytes = 0;
+	for (int iy = 0; iy < num_x_tile; ++iy)
+	{
+		for (int ix = 0; ix < num_x_tile; ++ix)
+		{
+			leaf_files.push_back(leaf_index->getMeshFilename(ix, iy));
+			leaf_bytes += Utility::fileSize(leaf_files.back());
+		}
+	}
+
+	// obj text parsing, then the same tiles from their .tilecache files
+	std::vector< osg::ref_ptr<osg::Node> > tiles(leaf_files.size());
+	bool tile_cache = TileCache::getEnabled();
+	TileCache::setEnabled(false);
+	for (unsigned int i_r = 0; i_r < repeat; ++i_r)
+	{
+		timer.restart();
+		for (size_t i_t = 0; i_t < leaf_files.size(); ++i_t)
+			tiles[i_t] = osgDB::readNodeFile(leaf_files[i_t]);
+		benchmark.addRun("obj_load", timer.seconds(), leaf_files.size(), leaf_bytes);
+	}
+
+	TileCache::setEnabled(true);
+	unsigned long long cache_bytes = 0;
+	for (size_t i_t = 0; i_t < leaf_files.size(); ++i_t)
+	{
+		osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(leaf_files[i_t]);
+		cache_bytes += Utility::fileSize(TileCache::cacheFileName(leaf_files[i_t]));
+	}
+	for (unsigned int i_r = 0; i_r < repeat && cache_bytes > 0; ++i_r)
+	{
+		timer.restart();
+		for (size_t i_t = 0; i_t < leaf_files.size(); ++i_t)
+			osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(leaf_files[i_t]);
+		benchmark.addRun("obj_load_tile_cache", timer.seconds(), leaf_files.size(), cache_bytes);
+	}
+	TileCache::setEnabled(tile_cache);
 
-// 		TestVistor tester(rot, trans, scale);
-// 		root->accept(tester);
+	for (size_t i_t = 0; i_t < tiles.size(); ++i_t)
+	{
+		if (!tiles[i_t].valid())
+		{
+			std::cout<<leaf_files[i_t]<<" read failed."<<std::endl;
+			return 1;
+		}
+	}
 
-// 		CheckVisitor check;
-// 		root->accept(check);
+	// bounds from scratch
+	for (unsigned int i_r = 0; i_r < repeat; ++i_r)
+	{
+		DirtyBoundVisitor dirty;
+		for (size_t i_t = 0; i_t < tiles.size(); ++i_t)
+			tiles[i_t]->accept(dirty);
+
+		timer.restart();
+		for (size_t i_t = 0; i_t < tiles.size(); ++i_t)
+			tiles[i_t]->getBound();
+		benchmark.addRun("bound", timer.seconds(), tiles.size());
+	}
 
-		TraverseVisitor visitor;
-		root->accept(visitor);
+	// TestVistor on copies of the tiles, the copies are not timed
+	Eigen::Matrix3d rot = Eigen::AngleAxisd(0.3, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+	Eigen::Vector3d trans(10., 20., 5.);
+	for (unsigned int i_r = 0; i_r < repeat; ++i_r)
+	{
+		std::vector< osg::ref_ptr<osg::Node> > copies(tiles.size());
+		for (size_t i_t = 0; i_t < tiles.size(); ++i_t)
+			copies[i_t] = dynamic_cast<osg::Node*>(tiles[i_t]->clone(
+				osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES | osg::CopyOp::DEEP_COPY_ARRAYS));
+
+		TestVistor tester(rot, trans, 1.01);
+		timer.restart();
+		for (size_t i_t = 0; i_t < copies.size(); ++i_t)
+			copies[i_t]->accept(tester);
+		benchmark.addRun("transform", timer.seconds(), copies.size());
+	}
 
-		std::cout<<"ref_filenames:"<<std::endl;
-		for (int i = 0; i < visitor._ref_filenames.size(); ++i)
+	// the leaf level PagedLODs four to a group, as build_quad_tile puts them
+	std::vector< osg::ref_ptr<osg::Group> > quads;
+	for (unsigned int i_r = 0; i_r < repeat; ++i_r)
+	{
+		quads.clear();
+		timer.restart();
+		for (int i_yq = 0; i_yq < num_x_tile / 2; ++i_yq)
 		{
-			std::cout<<visitor._ref_filenames[i]<<std::endl;
+			for (int i_xq = 0; i_xq < num_x_tile / 2; ++i_xq)
+			{
+				osg::ref_ptr<osg::Group> quad_group = new osg::Group;
+				for (int iy = i_yq * 2; iy < i_yq * 2 + 2; ++iy)
+				{
+					for (int ix = i_xq * 2; ix < i_xq * 2 + 2; ++ix)
+					{
+						osg::ref_ptr<osg::PagedLOD> plod = new osg::PagedLOD;
+						plod->addChild(tiles[iy * num_x_tile + ix].get());
+						plod->setRange(0, 0., FLT_MAX);
+						plod->setCenterMode(osg::PagedLOD::USER_DEFINED_CENTER);
+						plod->setCenter(plod->getBound().center());
+						quad_group->addChild(plod);
+					}
+				}
+				quads.push_back(quad_group);
+			}
 		}
+		benchmark.addRun("quad_assembly", timer.seconds(), quads.size());
+	}
 
-		//root = oc.convert( root.get() );
+	const char * write_exts[] = { ".ive", ".osgb" };
+	for (int i_e = 0; i_e < 2; ++i_e)
+	{
+		std::string write_dir = osgDB::concatPaths(out_dir, std::string("write") + write_exts[i_e]);
+		if (!osgDB::makeDirectory(write_dir))
+		{
+			osg::notify(osg::NOTICE)<<"failed to create "<<write_dir<<std::endl;
+			return 1;
+		}
+		for (unsigned int i_r = 0; i_r < repeat; ++i_r)
+		{
+			std::vector<std::string> quad_files;
+			timer.restart();
+			for (size_t i_q = 0; i_q < quads.size(); ++i_q)
+			{
+				int i_xq = static_cast<int>(i_q) % (num_x_tile / 2), i_yq = static_cast<int>(i_q) / (num_x_tile / 2);
+				quad_files.push_back(osgDB::concatPaths(write_dir,
+					osgDB::getNameLessExtension(create_filename(num_levels, i_xq, i_yq)) + write_exts[i_e]));
+				if (!osgDB::writeNodeFile(*quads[i_q], quad_files.back()))
+					std::cout<<quad_files.back()<<" write failed.."<<std::endl;
+			}
+			double seconds = timer.seconds();
 
-		if (!osgDB::writeNodeFile(*root,out_dir + "\\transform.osgb"))
-			std::cout<<out_dir<<" write failed.."<<std::endl;
+			unsigned long long bytes = 0;
+			for (size_t i_q = 0; i_q < quad_files.size(); ++i_q)
+				bytes += Utility::fileSize(quad_files[i_q]);
+			benchmark.addRun(std::string("write_") + (write_exts[i_e] + 1), seconds, quad_files.size(), bytes);
+		}
+	}
+	quads.clear();
+	tiles.clear();
 
-		ret = 0;
-	} while (0);
-error0:
+	// the whole database, built from scratch every run
+	for (unsigned int i_r = 0; i_r < repeat; ++i_r)
+	{
+		timer.restart();
+		if (process_config_file2(config_filename, osgDB::concatPaths(out_dir, "build"), ".ive", num_threads, 32, true))
+		{
+			std::cout<<"process config file failed."<<std::endl;
+			return 1;
+		}
+		benchmark.addRun("process_config_file2", timer.seconds(), generated.num_tiles - 1, generated.num_bytes);
+	}
 
-	return ret;
+	benchmark.writeSummary(std::cout);
+	if (!benchmark.writeJson(json_filename))
+	{
+		std::cout<<json_filename<<" write failed.."<<std::endl;
+		return 1;
+	}
+	std::cout<<"benchmark written to "<<json_filename<<std::endl;
+	return 0;
+}
+
+// replays a camera path over a built database the way a viewer would page
+// it, without a window, to compare the ranges of the builders.
+int proxy_main_paging_simulation(int argc, char **argv)
+{
+	osg::ArgumentParser arguments(&argc,argv);
+
+	arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+	arguments.getApplicationUsage()->setDescription(arguments.getApplicationName()+" headless paging of a built database along a camera path.");
+	arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" --simulate-paging out.ive [options]");
+	arguments.getApplicationUsage()->addCommandLineOption("-h or --help","Display this information");
+	arguments.getApplicationUsage()->addCommandLineOption("--camera-path <file>","lines of \"time eye_x eye_y eye_z center_x center_y center_z\" (defaults to a flyover of the database).");
+	arguments.getApplicationUsage()->addCommandLineOption("--duration <s>","length of the default flyover (defaults to 20).");
+	arguments.getApplicationUsage()->addCommandLineOption("--fps <N>","frames per second of the replay (defaults to 60).");
+	arguments.getApplicationUsage()->addCommandLineOption("--viewport <w> <h>","viewport in pixels (defaults to 1920 1080).");
+	arguments.getApplicationUsage()->addCommandLineOption("--fov <degrees>","vertical field of view (defaults to 30).");
+	arguments.getApplicationUsage()->addCommandLineOption("--lod-scale <s>","scale of the lod ranges, like osg::Camera::setLODScale (defaults to 1).");
+	arguments.getApplicationUsage()->addCommandLineOption("--target-pagedlods <N>","PagedLODs the pager keeps before it expires children (defaults to 300).");
+	arguments.getApplicationUsage()->addCommandLineOption("--expiry-delay <s>","seconds a child is kept after it was last drawn (defaults to 0.1).");
+	arguments.getApplicationUsage()->addCommandLineOption("--expiry-frames <N>","frames a child is kept after it was last drawn (defaults to 1).");
+	arguments.getApplicationUsage()->addCommandLineOption("--loads-per-frame <N>","tiles the pager loads per frame, 0 for every request (defaults to 0).");
+	arguments.getApplicationUsage()->addCommandLineOption("--paging-report <file>","per frame counts as csv.");
+	arguments.getApplicationUsage()->addCommandLineOption("--share-state","cache the images and share the statesets of the loaded tiles, for databases built with --share-state.");
+
+	std::string db_filename;
+	while (arguments.read("--simulate-paging",db_filename)) {}
+	if (arguments.read("-h") || arguments.read("--help") || db_filename.empty())
+	{
+		arguments.getApplicationUsage()->write(std::cout);
+		return 1;
+	}
+
+	std::string path_filename;
+	while (arguments.read("--camera-path",path_filename)) {}
+	double duration = 20.;
+	while (arguments.read("--duration",duration)) {}
+	double fps = 60.;
+	while (arguments.read("--fps",fps)) {}
+	unsigned int width = 1920, height = 1080;
+	while (arguments.read("--viewport",width,height)) {}
+	double fovy = 30.;
+	while (arguments.read("--fov",fovy)) {}
+	float lod_scale = 1.f;
+	while (arguments.read("--lod-scale",lod_scale)) {}
+	unsigned int target_pagedlods = 300;
+	while (arguments.read("--target-pagedlods",target_pagedlods)) {}
+	double expiry_delay = 0.1;
+	while (arguments.read("--expiry-delay",expiry_delay)) {}
+	unsigned int expiry_frames = 1;
+	while (arguments.read("--expiry-frames",expiry_frames)) {}
+	unsigned int loads_per_frame = 0;
+	while (arguments.read("--loads-per-frame",loads_per_frame)) {}
+	std::string report_filename;
+	while (arguments.read("--paging-report",report_filename)) {}
+	bool share_state = false;
+	while (arguments.read("--share-state")) { share_state = true; }
+
+	arguments.reportRemainingOptionsAsUnrecognized();
+	if (arguments.errors())
+	{
+		arguments.writeErrorMessages(std::cout);
+		return 1;
+	}
+
+	osg::ref_ptr<osg::Node> root = osgDB::readNodeFile(db_filename);
+	if (!root.valid())
+	{
+		std::cout<<db_filename<<" could not be read."<<std::endl;
+		return 1;
+	}
+
+	PagingSimulator::CameraPath path;
+	if (!path_filename.empty())
+	{
+		if (!PagingSimulator::readCameraPath(path_filename, path))
+		{
+			std::cout<<path_filename<<" is not a camera path."<<std::endl;
+			return 1;
+		}
+	}
+	else
+		path = PagingSimulator::flyover(root->getBound(), duration);
+
+	PagingSimulator simulator;
+	simulator.setViewport(width, height);
+	simulator.setFieldOfView(fovy);
+	simulator.setLODScale(lod_scale);
+	simulator.setFrameRate(fps);
+	simulator.setTargetMaximumNumberOfPageLOD(target_pagedlods);
+	simulator.setExpiryDelay(expiry_delay);
+	simulator.setExpiryFrames(expiry_frames);
+	simulator.setMaxLoadsPerFrame(loads_per_frame);
+	simulator.setShareState(share_state);
+	{
+		Trace::Scope trace("simulate_paging", db_filename);
+		if (!simulator.run(*root, path))
+			return 1;
+		trace.arg("frames", simulator.getSummary().num_frames);
+		trace.arg("loaded", simulator.getSummary().num_loaded);
+		trace.arg("bytes", simulator.getSummary().bytes_read);
+	}
+
+	simulator.writeSummary(std::cout);
+	if (!report_filename.empty() && !simulator.writeCsv(report_filename))
+	{
+		std::cout<<report_filename<<" write failed.."<<std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// follows every file reference of a built database and writes the counts
+// per level, the broken references and the failed range checks as json.
+int proxy_main_inspection(int argc, char **argv)
+{
+	osg::ArgumentParser arguments(&argc,argv);
+
+	arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+	arguments.getApplicationUsage()->setDescription(arguments.getApplicationName()+" statistics and checks of a whole paged database on disk.");
+	arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" --inspect out.ive [options]");
+	arguments.getApplicationUsage()->addCommandLineOption("-h or --help","Display this information");
+	arguments.getApplicationUsage()->addCommandLineOption("--inspect-out <file>","json report (defaults to inspection.json next to the database).");
+	arguments.getApplicationUsage()->addCommandLineOption("--threads <N>","set the number of tiles inspected at once (defaults to the number of processors).");
+	arguments.getApplicationUsage()->addCommandLineOption("--io-queue-depth <N>","set the number of tile reads in flight (defaults to 32).");
+
+	std::string db_filename;
+	while (arguments.read("--inspect",db_filename)) {}
+	if (arguments.read("-h") || arguments.read("--help") || db_filename.empty())
+	{
+		arguments.getApplicationUsage()->write(std::cout);
+		return 1;
+	}
+
+	std::string json_filename;
+	while (arguments.read("--inspect-out",json_filename)) {}
+	if (json_filename.empty())
+		json_filename = osgDB::concatPaths(osgDB::getFilePath(db_filename), "inspection.json");
+	unsigned int num_threads = 0;
+	while (arguments.read("--threads",num_threads)) {}
+	unsigned int io_queue_depth = 32;
+	while (arguments.read("--io-queue-depth",io_queue_depth)) {}
+
+	arguments.reportRemainingOptionsAsUnrecognized();
+	if (arguments.errors())
+	{
+		arguments.writeErrorMessages(std::cout);
+		return 1;
+	}
+
+	DatabaseInspector inspector(num_threads, io_queue_depth);
+	bool inspected = inspector.inspect(db_filename);
+	inspector.writeSummary(std::cout);
+	if (!inspector.writeJson(json_filename))
+	{
+		std::cout<<json_filename<<" write failed.."<<std::endl;
+		return 1;
+	}
+	std::cout<<"inspection written to "<<json_filename<<std::endl;
+	if (!inspected)
+	{
+		std::cout<<db_filename<<" could not be read."<<std::endl;
+		return 1;
+	}
+	return 0;
 }
 
+// the files with extension ext below dir, relative to it, without the
+// files of skip_dir
+void list_files(const std::string & dir, const std::string & rel_dir, const std::string & ext,
+				const std::string & skip_dir, std::vector<std::string> & files)
+{
+	osgDB::DirectoryContents contents = osgDB::getDirectoryContents(osgDB::concatPaths(dir, rel_dir));
+	std::sort(contents.begin(), contents.end());
+	for (size_t i = 0; i < contents.size(); ++i)
+	{
+		if (contents[i] == "." || contents[i] == "..") continue;
+		std::string rel_name = rel_dir.empty() ? contents[i] : osgDB::concatPaths(rel_dir, contents[i]);
+		osgDB::FileType type = osgDB::fileType(osgDB::concatPaths(dir, rel_name));
+		if (type == osgDB::DIRECTORY && rel_name != skip_dir)
+			list_files(dir, rel_name, ext, skip_dir, files);
+		else if (type == osgDB::REGULAR_FILE && osgDB::getLowerCaseFileExtension(rel_name) == ext)
+			files.push_back(rel_name);
+	}
+}
+
+// builds a small synthetic terrain once in one process and once sharded,
+// the two databases have to hold the same tiles.
+int proxy_main_shard_test(int argc, char **argv)
+{
+	osg::ArgumentParser arguments(&argc,argv);
+
+	arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+	arguments.getApplicationUsage()->setDescription(arguments.getApplicationName()+" compares a sharded build of a synthetic terrain with a build in one process.");
+	arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" --shard-test [options]");
+	arguments.getApplicationUsage()->addCommandLineOption("-h or --help","Display this information");
+	arguments.getApplicationUsage()->addCommandLineOption("-o","set the output directory of the dataset and both builds (defaults to shard_test).");
+	arguments.getApplicationUsage()->addCommandLineOption("--levels <N>","levels of the generated terrain (defaults to 3).");
+	arguments.getApplicationUsage()->addCommandLineOption("--shard-processes <N>","local workers of the sharded build (defaults to 2).");
+
+	std::string executable(argv[0]);
+	while (arguments.read("--shard-test")) {}
+	if (arguments.read("-h") || arguments.read("--help"))
+	{
+		arguments.getApplicationUsage()->write(std::cout);
+		return 1;
+	}
+
+	std::string out_dir("shard_test");
+	while (arguments.read("-o",out_dir)) {}
+	unsigned int num_levels = 3;
+	while (arguments.read("--levels",num_levels)) {}
+	unsigned int shard_processes = 2;
+	while (arguments.read("--shard-processes",shard_processes)) {}
+	if (shard_processes < 1) shard_processes = 1;
+
+	arguments.reportRemainingOptionsAsUnrecognized();
+	if (arguments.errors())
+	{
+		arguments.writeErrorMessages(std::cout);
+		return 1;
+	}
+
+	if (!osgDB::makeDirectory(out_dir))
+	{
+		osg::notify(osg::NOTICE)<<"failed to create output directory."<<std::endl;
+		return 1;
+	}
+
+	// small untextured tiles, the test is about the shards
+	TerrainGenerator generator(num_levels < 2 ? 2 : num_levels, 16, 0);
+	std::string config_filename = generator.generate(osgDB::concatPaths(out_dir, "dataset"));
+	if (config_filename.empty())
+	{
+		std::cout<<"failed to generate the dataset."<<std::endl;
+		return 1;
+	}
+
+	// both builds in their own processes, the way a user runs them
+	std::string single_dir = osgDB::concatPaths(out_dir, "single");
+	std::string sharded_dir = osgDB::concatPaths(out_dir, "sharded");
+	std::vector<std::string> args;
+	args.push_back(executable);
+	args.push_back("--build");
+	args.push_back("-config");
+	args.push_back(config_filename);
+	args.push_back("--full-rebuild");
+	args.push_back("-o");
+	args.push_back(single_dir);
+	if (ShardQueue::runProcess(args) != 0)
+	{
+		std::cout<<"the build in one process failed."<<std::endl;
+		return 1;
+	}
+	args.back() = sharded_dir;
+	std::stringstream sstr;
+	sstr << shard_processes;
+	args.push_back("--shard-processes");
+	args.push_back(sstr.str());
+	args.push_back("--shard-level");
+	args.push_back("2");
+	if (ShardQueue::runProcess(args) != 0)
+	{
+		std::cout<<"the sharded build failed."<<std::endl;
+		return 1;
+	}
+
+	// the same tiles with the same triangles and bounds, the shard
+	// directory holds the stitch's input only
+	std::vector<std::string> single_files, sharded_files;
+	list_files(single_dir, "", "ive", "shards", single_files);
+	list_files(sharded_dir, "", "ive", "shards", sharded_files);
+	if (single_files.empty() || single_files != sharded_files)
+	{
+		std::cout<<single_files.size()<<" tiles built in one process, "<<sharded_files.size()<<" sharded."<<std::endl;
+		return 1;
+	}
+
+	unsigned int num_different = 0;
+	for (size_t i_f = 0; i_f < single_files.size(); ++i_f)
+	{
+		osg::ref_ptr<osg::Node> single = osgDB::readNodeFile(osgDB::concatPaths(single_dir, single_files[i_f]));
+		osg::ref_ptr<osg::Node> sharded = osgDB::readNodeFile(osgDB::concatPaths(sharded_dir, single_files[i_f]));
+		bool same = single.valid() && sharded.valid() &&
+			AdaptiveTree::countTriangles(*single) == AdaptiveTree::countTriangles(*sharded);
+		if (same)
+		{
+			const osg::BoundingSphere & a = single->getBound();
+			const osg::BoundingSphere & b = sharded->getBound();
+			double tolerance = 1e-5 * (a.radius() > 1.f ? a.radius() : 1.f);
+			same = (a.center() - b.center()).length() <= tolerance && fabs(a.radius() - b.radius()) <= tolerance;
+		}
+		if (!same)
+		{
+			std::cout<<single_files[i_f]<<" differs."<<std::endl;
+			++num_different;
+		}
+	}
+	std::cout<<single_files.size()<<" tiles compared, "<<num_different<<" differ."<<std::endl;
+	return num_different > 0 ? 1 : 0;
+}
+
+#ifdef _MSC_VER
 inline void EnableMemLeakCheck(void)
 {
 	_CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
 	//_CrtSetBreakAlloc(6330);
 }
+#endif
 
-void main(int argc, char **argv)
+int main(int argc, char **argv)
 {
+#ifdef _MSC_VER
 	EnableMemLeakCheck();
+#endif
 
 	int ret = -1;
 
+	// --trace <file> works with every mode, it is taken out before they parse
+	std::string trace_filename;
+	{
+		osg::ArgumentParser arguments(&argc,argv);
+		while (arguments.read("--trace",trace_filename)) {}
+	}
+	if (!trace_filename.empty())
+	{
+		Trace::start();
+		Trace::setThreadName("main");
+	}
+
 	//ret proxy_main_pagedlod_test(argc, argv);
 
-	ret = transformation_main_proxy_test(argc, argv);
-	//ret = proxy_main_custom_test(argc, argv);
+	// osg_lod_test --benchmark [options] runs the benchmark suite
+	if (argc > 1 && std::string(argv[1]) == "--benchmark")
+		ret = proxy_main_benchmark(argc, argv);
+	// osg_lod_test --simulate-paging out.ive [options] replays a camera path over a database
+	else if (argc > 1 && std::string(argv[1]) == "--simulate-paging")
+		ret = proxy_main_paging_simulation(argc, argv);
+	// osg_lod_test --inspect out.ive [options] writes the statistics of a database
+	else if (argc > 1 && std::string(argv[1]) == "--inspect")
+		ret = proxy_main_inspection(argc, argv);
+	// osg_lod_test --build -config <file> -o <dir> [options] builds the paged database
+	else if (argc > 1 && std::string(argv[1]) == "--build")
+		ret = proxy_main_custom_test(argc, argv);
+	// osg_lod_test --shard-test [options] compares a sharded build with a single one
+	else if (argc > 1 && std::string(argv[1]) == "--shard-test")
+		ret = proxy_main_shard_test(argc, argv);
+	else
+		ret = transformation_main_proxy_test(argc, argv);
+
+	if (!trace_filename.empty())
+	{
+		Trace::stop();
+		if (Trace::write(trace_filename))
+			std::cout<<"trace written to "<<trace_filename<<std::endl;
+		else
+			std::cout<<trace_filename<<" write failed.."<<std::endl;
+	}
 
 	if (ret)
 		std::cout<<"failed.."<<std::endl;
@@ -1222,4 +3798,5 @@ void main(int argc, char **argv)
 		std::cout<<"done."<<std::endl;
 
 	std::cout<<"osg_lod_test."<<std::endl;
+	return ret ? 1 : 0;
 }
\ No newline at end of file